@@ -12,6 +12,8 @@ from .ops.attention import *
 from .ops.moe_op import *
 from .ops.moe_sorting import *
 from .ops.cache import *
+from .ops.block_manager import *
+from .ops.kv_swapper import *
 
 
 def getLogger():
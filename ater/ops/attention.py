@@ -11,7 +11,7 @@
 
 import os
 import torch
-from typing import List, Optional
+from typing import List, Optional, Tuple
 from ..jit.core import compile_ops, CK_DIR, ATER_CSRC_DIR, ATER_ROOT_DIR
 MD_NAME = 'module_attention'
 
@@ -92,4 +92,336 @@ def paged_attention_rocm(
     v_scale: float,
     fp8_out_scale: Optional[torch.Tensor],
     partition_size: int,
+    # [num_kv_heads], float32: per kv head k_scale / v_scale
+    k_head_scales: Optional[torch.Tensor] = None,
+    v_head_scales: Optional[torch.Tensor] = None,
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention.cu",
+    ],
+    flags_extra_hip=['-DENABLE_FP8'],
+    md_name=MD_NAME,
+)
+def paged_attention_rocm_supported(
+    query: torch.Tensor,
+    kv_cache_dtype: str,
+    block_size: int,
+) -> bool: ...
+
+
+MD_NAME = "module_pa_cpu"
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_cpu(
+    out: torch.Tensor,
+    exp_sums: torch.Tensor,
+    max_logits: torch.Tensor,
+    tmp_out: torch.Tensor,
+    query: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    num_kv_heads: int,
+    scale: float,
+    block_tables: torch.Tensor,
+    context_lens: torch.Tensor,
+    block_size: int,
+    max_context_len: int,
+    alibi_slopes: Optional[torch.Tensor],
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    fp8_out_scale: Optional[torch.Tensor],
+    partition_size: int,
+    work_list: Optional[torch.Tensor],
+    partition_offsets: Optional[torch.Tensor],
+    window_size: int,
+    num_sink_tokens: int,
+    # [num_kv_heads, max_kv_tokens], per-token quantized (int8 / fp8) cache
+    k_dequant_scales: Optional[torch.Tensor],
+    v_dequant_scales: Optional[torch.Tensor],
+    # [num_seqs, num_kv_heads, max_num_blocks_per_seq, block_size], float32,
+    # accumulated heavy-hitter mass (h2o_compact_cpu)
+    attn_mass: Optional[torch.Tensor],
+    # [num_kv_heads], float32: per kv head k_scale / v_scale
+    k_head_scales: Optional[torch.Tensor],
+    v_head_scales: Optional[torch.Tensor],
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_cpu_partition_size(
+    context_lens: torch.Tensor,
+    num_kv_heads: int,
+    block_size: int,
+) -> int: ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_cpu_plan(
+    context_lens: torch.Tensor,
+    num_kv_heads: int,
+    block_size: int,
+    partition_size: int,
+) -> Tuple[torch.Tensor, int]: ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_cpu_workspace(
+    context_lens: torch.Tensor,
+    partition_size: int,
+) -> torch.Tensor: ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_multi_token_cpu(
+    out: torch.Tensor,
+    # [num_seqs, q_len, num_heads, head_size]
+    query: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    num_kv_heads: int,
+    scale: float,
+    block_tables: torch.Tensor,
+    # [num_seqs], including the q_len draft tokens
+    context_lens: torch.Tensor,
+    block_size: int,
+    max_context_len: int,
+    alibi_slopes: Optional[torch.Tensor],
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    window_size: int,
+    num_sink_tokens: int,
+    k_head_scales: Optional[torch.Tensor],
+    v_head_scales: Optional[torch.Tensor],
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_append_cpu(
+    # [num_seqs, num_heads, head_size_v]
+    out: torch.Tensor,
+    # [num_seqs, num_heads, head_size]
+    query: torch.Tensor,
+    # [num_seqs, num_kv_heads, head_size]
+    key: torch.Tensor,
+    # [num_seqs, num_kv_heads, head_size_v]
+    value: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    # [num_seqs], int64; negative slots append nothing
+    slot_mapping: torch.Tensor,
+    num_kv_heads: int,
+    scale: float,
+    block_tables: torch.Tensor,
+    # [num_seqs], including the new token
+    context_lens: torch.Tensor,
+    block_size: int,
+    alibi_slopes: Optional[torch.Tensor],
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    k_head_scales: Optional[torch.Tensor],
+    v_head_scales: Optional[torch.Tensor],
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_varlen_cpu(
+    out: torch.Tensor,
+    # [total_q, num_heads, head_size]
+    query: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    num_kv_heads: int,
+    scale: float,
+    block_tables: torch.Tensor,
+    # [num_seqs + 1]
+    cu_seqlens_q: torch.Tensor,
+    # [num_seqs], including the query tokens
+    context_lens: torch.Tensor,
+    block_size: int,
+    max_context_len: int,
+    alibi_slopes: Optional[torch.Tensor],
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    window_size: int,
+    num_sink_tokens: int,
+    k_head_scales: Optional[torch.Tensor],
+    v_head_scales: Optional[torch.Tensor],
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def merge_attn_states_cpu(
+    # [..., head_size]
+    out: torch.Tensor,
+    # [...]
+    out_lse: Optional[torch.Tensor],
+    # [num_partials, ..., head_size]
+    partial_out: torch.Tensor,
+    # [num_partials, ...], log-sum-exp when exp_sums is None
+    max_logits: torch.Tensor,
+    exp_sums: Optional[torch.Tensor],
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def mla_decode_cpu(
+    # [num_seqs, num_heads, kv_lora_rank]
+    out: torch.Tensor,
+    # [num_seqs, num_heads, kv_lora_rank + rope_dim], W_UK absorbed
+    query: torch.Tensor,
+    # [num_blocks, block_size, kv_lora_rank + rope_dim]
+    kv_cache: torch.Tensor,
+    block_tables: torch.Tensor,
+    context_lens: torch.Tensor,
+    kv_lora_rank: int,
+    scale: float,
+    kv_cache_dtype: str,
+    k_scale: float,
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def paged_attention_block_sparse_cpu(
+    # [num_seqs, num_heads, head_size]
+    out: torch.Tensor,
+    query: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    # [num_blocks, num_kv_heads, 2, head_size], float32
+    key_summaries: torch.Tensor,
+    num_kv_heads: int,
+    scale: float,
+    block_tables: torch.Tensor,
+    context_lens: torch.Tensor,
+    block_size: int,
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    top_blocks: int,
+    k_head_scales: Optional[torch.Tensor],
+    v_head_scales: Optional[torch.Tensor],
+): ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def h2o_compact_cpu(
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    # [num_seqs, num_kv_heads, max_num_blocks_per_seq, block_size], float32
+    attn_mass: torch.Tensor,
+    block_tables: torch.Tensor,
+    context_lens: torch.Tensor,
+    block_size: int,
+    heavy_blocks: int,
+    recent_tokens: int,
+) -> torch.Tensor: ...
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/attention_cpu_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/attention_cpu.cpp",
+    ],
+    flags_extra_hip=['-Xarch_host', '-march=native'],
+    md_name=MD_NAME,
+)
+def varlen_attention_cpu(
+    # [total_tokens, num_heads, head_size_v]
+    out: torch.Tensor,
+    # [total_tokens, num_heads, head_size]
+    query: torch.Tensor,
+    # [total_tokens, num_kv_heads, head_size]
+    key: torch.Tensor,
+    # [total_tokens, num_kv_heads, head_size_v]
+    value: torch.Tensor,
+    # [num_seqs + 1], int32
+    cu_seqlens: torch.Tensor,
+    scale: float,
+    causal: bool,
 ): ...
@@ -0,0 +1,28 @@
+from torch import Tensor
+from ..jit.core import compile_ops, ATER_CSRC_DIR
+
+MD_NAME = "module_block_manager"
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/block_manager_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/block_manager.cpp",
+    ],
+    md_name=MD_NAME,
+    fc_name="BlockManager",
+)
+def block_manager(num_blocks: int, block_size: int,
+                  enable_prefix_caching: bool = False):
+    # Returns a BlockManager over num_blocks KV blocks of block_size tokens:
+    #   allocate() / free(block) / ref_count(block)    raw blocks, O(1)
+    #   add_sequence(seq_id, num_tokens) -> slot_mapping of the prompt
+    #   add_sequence_with_prefix(seq_id, token_ids) -> (slot_mapping of the
+    #       uncached suffix, num_cached_tokens), reusing cached full blocks
+    #   fork(parent_id, child_id), free_sequence(seq_id)
+    #   append_slots(seq_ids, token_ids=None) -> slot_mapping of one new token
+    #       per sequence, copying shared partial blocks on write; token_ids
+    #       keep the prefix cache indexing the blocks they fill
+    #   take_copy_mapping() -> [num_pairs, 2] int64 mapping for copy_blocks
+    #   block_tables(seq_ids, max_num_blocks=0), context_lens(seq_ids)
+    ...
@@ -9,7 +9,9 @@ compile_ops_ = {
     "srcs": [
         f"{ATER_CSRC_DIR}/pybind/cache_pybind.cu",
         f"{ATER_CSRC_DIR}/kernels/cache_kernels.cu",
+        f"{ATER_CSRC_DIR}/kernels/cache_cpu.cpp",
     ],
+    "flags_extra_hip": ['-Xarch_host', '-march=native'],
     "md_name": MD_NAME,
 }
 
@@ -32,7 +34,12 @@ def reshape_and_cache(
     kv_cache_dtype: str,
     k_scale: float,
     v_scale: float,
-    asm_layout: bool
+    asm_layout: bool,
+    # [num_blocks, num_heads, 2, head_size], float32
+    key_summaries: Optional[Tensor] = None,
+    # [num_heads], float32: per kv head k_scale / v_scale of an fp8 cache
+    k_head_scales: Optional[Tensor] = None,
+    v_head_scales: Optional[Tensor] = None,
 ): ...
 
 
@@ -46,6 +53,24 @@ def reshape_and_cache_flash(
     kv_cache_dtype: str,
     k_scale: float,
     v_scale: float,
+    # [num_blocks, num_heads, 2, head_size], float32
+    key_summaries: Optional[Tensor] = None,
+    # [num_heads], float32: per kv head k_scale / v_scale of an fp8 cache
+    k_head_scales: Optional[Tensor] = None,
+    v_head_scales: Optional[Tensor] = None,
+): ...
+
+@compile_ops(**compile_ops_)
+def concat_and_cache_mla(
+    # [num_tokens, kv_lora_rank]
+    kv_c: Tensor,
+    # [num_tokens, pe_dim]
+    k_pe: Tensor,
+    # [num_blocks, block_size, kv_lora_rank + pe_dim]
+    kv_cache: Tensor,
+    slot_mapping: Tensor,
+    kv_cache_dtype: str,
+    scale: float,
 ): ...
 
 @compile_ops(**compile_ops_)
@@ -57,10 +82,55 @@ def reshape_and_cache_with_pertoken_quant(
     k_dequant_scales: Tensor,
     v_dequant_scales: Tensor,
     slot_mapping: Tensor,
-    asm_layout: bool
+    asm_layout: bool,
+    # [num_blocks, num_heads, 2, head_size], float32
+    key_summaries: Optional[Tensor] = None,
 ): ...
 
 @compile_ops(**compile_ops_)
 def convert_fp8(
     dst_cache: Tensor, src_cache: Tensor, scale: float, kv_cache_dtype: str
 ): ...
+
+
+@compile_ops(**compile_ops_)
+def reshape_and_cache_cpu(
+    # [num_tokens, num_kv_heads, head_size]
+    key: Tensor,
+    value: Tensor,
+    key_cache: Tensor,
+    value_cache: Tensor,
+    # [num_tokens], int64
+    slot_mapping: Tensor,
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    # [num_blocks, num_kv_heads, 2, head_size], float32
+    key_summaries: Optional[Tensor],
+    k_head_scales: Optional[Tensor],
+    v_head_scales: Optional[Tensor],
+): ...
+
+
+@compile_ops(**compile_ops_)
+def concat_and_cache_mla_cpu(
+    # [num_tokens, kv_lora_rank]
+    kv_c: Tensor,
+    # [num_tokens, rope_dim]
+    k_pe: Tensor,
+    # [num_blocks, block_size, kv_lora_rank + rope_dim]
+    kv_cache: Tensor,
+    # [num_tokens], int64
+    slot_mapping: Tensor,
+    kv_cache_dtype: str,
+    scale: float,
+): ...
+
+
+@compile_ops(**compile_ops_)
+def copy_blocks_cpu(
+    key_caches: List[Tensor],
+    value_caches: List[Tensor],
+    # [num_pairs, 2], int64
+    block_mapping: Tensor,
+): ...
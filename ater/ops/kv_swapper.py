@@ -0,0 +1,21 @@
+from torch import Tensor
+from ..jit.core import compile_ops, ATER_CSRC_DIR
+
+MD_NAME = "module_kv_swapper"
+
+
+@compile_ops(
+    srcs=[
+        f"{ATER_CSRC_DIR}/pybind/kv_swapper_pybind.cu",
+        f"{ATER_CSRC_DIR}/kernels/kv_swapper.cu",
+    ],
+    md_name=MD_NAME,
+    fc_name="KVSwapper",
+)
+def kv_swapper(device: int, staging_bytes: int = 64 << 20):
+    # Returns a KVSwapper moving KV blocks between GPU `device` and host
+    # tiers off the caller's thread and stream, pageable host memory staged
+    # through two pinned buffers of staging_bytes:
+    #   swap_async(src_caches, dst_caches, block_mapping) -> handle
+    #   poll(handle) -> bool, wait(handle), wait_all(), num_pending
+    ...
@@ -12,9 +12,13 @@ def is_hip():
 # Should be the same as PARTITION_SIZE in `paged_attention_v2_launcher`.
 _PARTITION_SIZE = 512 if not is_hip() else 1024
 _PARTITION_SIZE_ROCM = 256
-_DEVICE_PROPERTIES = torch.cuda.get_device_properties("cuda")
+# the ll4mi reduce covers 8 * WARP_SIZE partitions in one pass (128K tokens)
+# and folds WARP_SIZE partitions at a time first beyond that (8M tokens)
+_MAX_SEQ_LEN_ROCM = 8 * 64 * 64 * _PARTITION_SIZE_ROCM
+_DEVICE_PROPERTIES = torch.cuda.get_device_properties("cuda") \
+    if torch.cuda.is_available() else None
 _ON_NAVI = hasattr(_DEVICE_PROPERTIES, "gcnArchName") and \
-            "gfx1" in torch.cuda.get_device_properties("cuda").gcnArchName
+            "gfx1" in _DEVICE_PROPERTIES.gcnArchName
 
 
 # page attention ops
@@ -96,14 +100,17 @@ class PagedAttentionMetadata:
     block_tables: Optional[torch.Tensor]
 
 
-def _use_rocm_custom_paged_attention(qtype: torch.dtype, head_size: int,
+def _use_rocm_custom_paged_attention(query: torch.Tensor, kv_cache_dtype: str,
                                     block_size: int, gqa_ratio: int,
                                     max_seq_len: int) -> bool:
-    # rocm custom page attention not support on navi (gfx1*)
-    return (not _ON_NAVI and (qtype == torch.half or qtype == torch.bfloat16)
-            and (head_size == 64 or head_size == 128)
-            and (block_size == 16 or block_size == 32)
-            and (gqa_ratio >= 1 and gqa_ratio <= 16) and max_seq_len <= 65536)
+    # rocm custom page attention not support on navi (gfx1*); the
+    # (dtype, kv cache dtype, head size, block size) shapes it supports are
+    # those in its kernel registry, anything else falls back to
+    # paged_attention_v1/v2
+    return (not _ON_NAVI and (gqa_ratio >= 1 and gqa_ratio <= 16)
+            and max_seq_len <= _MAX_SEQ_LEN_ROCM
+            and ops.paged_attention_rocm_supported(query, kv_cache_dtype,
+                                                   block_size))
 
 class PagedAttention:
     @staticmethod
@@ -119,6 +126,25 @@ class PagedAttention:
     ) -> Tuple[int, ...]:
         return (2, num_blocks, block_size * num_kv_heads * head_size)
 
+    @staticmethod
+    def get_key_summaries_shape(
+        num_blocks: int,
+        num_kv_heads: int,
+        head_size: int,
+    ) -> Tuple[int, ...]:
+        # channel-wise key min / max per block, float32
+        return (num_blocks, num_kv_heads, 2, head_size)
+
+    @staticmethod
+    def get_attn_mass_shape(
+        num_seqs: int,
+        num_kv_heads: int,
+        max_num_blocks_per_seq: int,
+        block_size: int,
+    ) -> Tuple[int, ...]:
+        # accumulated attention per cached token, float32, zero initialized
+        return (num_seqs, num_kv_heads, max_num_blocks_per_seq, block_size)
+
     @staticmethod
     def split_kv_cache(
         kv_cache: torch.Tensor,
@@ -145,8 +171,29 @@ class PagedAttention:
         kv_cache_dtype: str,
         k_scale: float,
         v_scale: float,
-        asm_layout=False
+        asm_layout=False,
+        key_summaries: Optional[torch.Tensor] = None,
+        k_head_scales: Optional[torch.Tensor] = None,
+        v_head_scales: Optional[torch.Tensor] = None,
     ) -> None:
+        # k_head_scales / v_head_scales ([num_kv_heads] float32) give every
+        # kv head of an fp8 cache its own scale in place of k_scale / v_scale
+        if key_cache.device.type == "cpu":
+            # the layout follows from the cache shapes
+            ops.reshape_and_cache_cpu(
+                key,
+                value,
+                key_cache,
+                value_cache,
+                slot_mapping.flatten().long(),
+                kv_cache_dtype,
+                k_scale,
+                v_scale,
+                key_summaries,
+                k_head_scales,
+                v_head_scales,
+            )
+            return
         ops.reshape_and_cache(
             key,
             value,
@@ -156,7 +203,10 @@ class PagedAttention:
             kv_cache_dtype,
             k_scale,
             v_scale,
-            asm_layout
+            asm_layout,
+            key_summaries,
+            k_head_scales,
+            v_head_scales,
         )
 
     @staticmethod
@@ -178,24 +228,125 @@ class PagedAttention:
         blocksparse_vert_stride: int = 0,
         blocksparse_block_size: int = 64,
         blocksparse_head_sliding_step: int = 0,
-        fp8_out_scale=None
+        fp8_out_scale=None,
+        window_size: int = 0,
+        num_sink_tokens: int = 0,
+        k_dequant_scales: Optional[torch.Tensor] = None,
+        v_dequant_scales: Optional[torch.Tensor] = None,
+        key_summaries: Optional[torch.Tensor] = None,
+        top_blocks: int = 0,
+        attn_mass: Optional[torch.Tensor] = None,
+        k_head_scales: Optional[torch.Tensor] = None,
+        v_head_scales: Optional[torch.Tensor] = None,
     ) -> torch.Tensor:
         # Whether to use rocm custom paged attention or not
         num_seqs, num_heads, head_size = query.shape
-        block_size = value_cache.shape[3]
+        # flash layout caches are [num_blocks, block_size, num_kv_heads,
+        # head_size]; vLLM and asm layout keys have block_size in dim 3
+        block_size = (key_cache.shape[1] if key_cache.dim() == 4 else
+                      key_cache.shape[3])
+        # values may have their own head size (hdim_qk != hdim_v, e.g.
+        # 192 / 128), which is then the head size of the output
+        head_size_v = (value_cache.shape[2] if value_cache.dim() == 4
+                       and key_cache.dim() == 5 else value_cache.shape[3])
+        out_shape = (num_seqs, num_heads, head_size_v)
+        assert head_size_v == head_size or query.device.type == "cpu", \
+            "distinct q/k and v head sizes are only supported by the CPU engine"
+        if top_blocks > 0:
+            # long-context decode over the top_blocks most relevant blocks
+            # (plus the last) by the key summaries the writers maintain
+            assert query.device.type == "cpu", \
+                "block-sparse decode is only supported by the CPU engine"
+            assert alibi_slopes is None and window_size <= 0
+            output = query.new_empty(out_shape)
+            ops.paged_attention_block_sparse_cpu(
+                output, query, key_cache, value_cache, key_summaries,
+                num_kv_heads, scale, block_tables, seq_lens, block_size,
+                kv_cache_dtype, k_scale, v_scale, top_blocks, k_head_scales,
+                v_head_scales)
+            return output
         gqa_ratio = num_heads // num_kv_heads
-        use_custom = _use_rocm_custom_paged_attention(
-            query.dtype, head_size, block_size, gqa_ratio,
-            max_seq_len)
-        output = torch.empty_like(query)
-        if use_custom:
+        use_custom = (query.device.type != "cpu"
+                      and _use_rocm_custom_paged_attention(
+                          query, kv_cache_dtype, block_size, gqa_ratio,
+                          max_seq_len))
+        # fused output quantization: the CPU engine and the custom rocm
+        # kernels store out / fp8_out_scale as e4m3fnuz straight from the
+        # reduce, returned as [num_seqs, num_heads * head_size] for o_proj
+        fp8_out = fp8_out_scale is not None and (query.device.type == "cpu"
+                                                 or use_custom)
+        output = query.new_empty(
+            out_shape,
+            dtype=torch.float8_e4m3fnuz if fp8_out else query.dtype)
+        assert window_size <= 0 or query.device.type == "cpu", \
+            "sliding window decode is only supported by the CPU engine"
+        assert k_dequant_scales is None or query.device.type == "cpu", \
+            "per-token quantized kv decode is only supported by the CPU engine"
+        assert attn_mass is None or query.device.type == "cpu", \
+            "attention mass accumulation is only supported by the CPU engine"
+        assert k_head_scales is None or query.device.type == "cpu" \
+            or use_custom, \
+            "per-head kv scales need the CPU engine or paged_attention_rocm"
+        if query.device.type == "cpu":
+            # kv cache offloaded to host memory: same split-K contract as
+            # paged_attention_rocm, computed by the host decode engine with
+            # a partition size planned from this batch's seq_lens. The work
+            # list is left to the op, which also cascades shared prefixes
+            # of block_tables.
+            partition_size = ops.paged_attention_cpu_partition_size(
+                seq_lens, num_kv_heads, block_size)
+            # ragged workspace: sized by the total partition count of the
+            # batch rather than num_seqs * max_num_partitions
+            partition_offsets = ops.paged_attention_cpu_workspace(
+                seq_lens, partition_size)
+            total_partitions = int(partition_offsets[-1])
+            tmp_output = torch.empty(
+                size=(total_partitions * num_heads, head_size_v),
+                dtype=query.dtype,
+            )
+            exp_sums = torch.empty(
+                size=(total_partitions * num_heads,),
+                dtype=torch.float32,
+            )
+            max_logits = torch.empty_like(exp_sums)
+            ops.paged_attention_cpu(
+                output,
+                exp_sums,
+                max_logits,
+                tmp_output,
+                query,
+                key_cache,
+                value_cache,
+                num_kv_heads,
+                scale,
+                block_tables,
+                seq_lens,
+                block_size,
+                max_seq_len,
+                alibi_slopes,
+                kv_cache_dtype,
+                k_scale,
+                v_scale,
+                fp8_out_scale,
+                partition_size,
+                None,
+                partition_offsets,
+                window_size,
+                num_sink_tokens,
+                k_dequant_scales,
+                v_dequant_scales,
+                attn_mass,
+                k_head_scales,
+                v_head_scales,
+            )
+        elif use_custom:
             max_num_partitions = (
                 (max_seq_len + _PARTITION_SIZE_ROCM - 1) //
                 _PARTITION_SIZE_ROCM)
             assert _PARTITION_SIZE_ROCM % block_size == 0
             tmp_output = torch.empty(
                 size=(num_seqs, num_heads, max_num_partitions, head_size),
-                dtype=output.dtype,
+                dtype=query.dtype,
                 device=output.device,
             )
             exp_sums = torch.empty(
@@ -204,11 +355,6 @@ class PagedAttention:
                 device=output.device,
             )
             max_logits = torch.empty_like(exp_sums)
-            cpa_fp8_out = False
-            if fp8_out_scale is not None:
-                output = torch.empty_like(output,
-                                        dtype=torch.float8_e4m3fnuz)
-                cpa_fp8_out = True
             ops.paged_attention_rocm(
                 output,
                 exp_sums,
@@ -227,11 +373,11 @@ class PagedAttention:
                 kv_cache_dtype,
                 k_scale,
                 v_scale,
-                fp8_out_scale if cpa_fp8_out else None,
+                fp8_out_scale,
                 _PARTITION_SIZE_ROCM,
+                k_head_scales,
+                v_head_scales,
             )
-            if cpa_fp8_out:
-                return output.view(num_seqs, num_heads * head_size)
         else:
             max_num_partitions = ((max_seq_len + _PARTITION_SIZE - 1) //
                                 _PARTITION_SIZE)
@@ -314,8 +460,123 @@ class PagedAttention:
                     blocksparse_block_size,
                     blocksparse_head_sliding_step,
                 )
+        if fp8_out:
+            return output.view(num_seqs, num_heads * head_size_v)
+        return output
+
+    @staticmethod
+    def forward_decode_append(
+        query: torch.Tensor,
+        key: torch.Tensor,
+        value: torch.Tensor,
+        key_cache: torch.Tensor,
+        value_cache: torch.Tensor,
+        slot_mapping: torch.Tensor,
+        block_tables: torch.Tensor,
+        seq_lens: torch.Tensor,
+        max_seq_len: int,
+        kv_cache_dtype: str,
+        num_kv_heads: int,
+        scale: float,
+        alibi_slopes: Optional[torch.Tensor],
+        k_scale: float,
+        v_scale: float,
+        k_head_scales: Optional[torch.Tensor] = None,
+        v_head_scales: Optional[torch.Tensor] = None,
+    ) -> torch.Tensor:
+        # write_to_paged_cache + forward_decode for one new token per
+        # sequence; seq_lens include it. The CPU engine does both in one
+        # pass and attends to the new token from key / value directly.
+        if query.device.type != "cpu":
+            PagedAttention.write_to_paged_cache(key, value, key_cache,
+                                                value_cache, slot_mapping,
+                                                kv_cache_dtype, k_scale,
+                                                v_scale,
+                                                value_cache.dim() == 5,
+                                                k_head_scales=k_head_scales,
+                                                v_head_scales=v_head_scales)
+            return PagedAttention.forward_decode(
+                query, key_cache, value_cache, block_tables, seq_lens,
+                max_seq_len, kv_cache_dtype, num_kv_heads, scale,
+                alibi_slopes, k_scale, v_scale, k_head_scales=k_head_scales,
+                v_head_scales=v_head_scales)
+        block_size = (key_cache.shape[1] if key_cache.dim() == 4 else
+                      key_cache.shape[3])
+        output = query.new_empty(query.shape[:2] + value.shape[2:])
+        ops.paged_attention_append_cpu(output, query, key, value, key_cache,
+                                       value_cache,
+                                       slot_mapping.flatten().long(),
+                                       num_kv_heads, scale, block_tables,
+                                       seq_lens, block_size, alibi_slopes,
+                                       kv_cache_dtype, k_scale, v_scale,
+                                       k_head_scales, v_head_scales)
         return output
 
+    @staticmethod
+    def write_to_paged_cache_mla(
+        kv_c: torch.Tensor,
+        k_pe: torch.Tensor,
+        kv_cache: torch.Tensor,
+        slot_mapping: torch.Tensor,
+        kv_cache_dtype: str,
+        scale: float,
+    ) -> None:
+        if kv_cache.device.type == "cpu":
+            ops.concat_and_cache_mla_cpu(kv_c, k_pe, kv_cache,
+                                         slot_mapping.flatten().long(),
+                                         kv_cache_dtype, scale)
+        else:
+            ops.concat_and_cache_mla(kv_c, k_pe, kv_cache,
+                                     slot_mapping.flatten(), kv_cache_dtype,
+                                     scale)
+
+    @staticmethod
+    def forward_decode_mla(
+        q_nope: torch.Tensor,
+        q_pe: torch.Tensor,
+        kv_cache: torch.Tensor,
+        block_tables: torch.Tensor,
+        seq_lens: torch.Tensor,
+        kv_cache_dtype: str,
+        scale: float,
+        k_scale: float,
+        w_uk: torch.Tensor,
+        w_uv: torch.Tensor,
+    ) -> torch.Tensor:
+        # q_nope [num_seqs, num_heads, qk_nope_head_dim], q_pe [num_seqs,
+        # num_heads, rope_dim], w_uk [num_heads, qk_nope_head_dim,
+        # kv_lora_rank], w_uv [num_heads, kv_lora_rank, v_head_dim]. W_UK is
+        # absorbed into the query so attention runs on the latent cache.
+        assert kv_cache.device.type == "cpu", "MLA decode is CPU only"
+        kv_lora_rank = w_uk.shape[-1]
+        q_c = torch.einsum("shd,hdc->shc", q_nope, w_uk)
+        query = torch.cat([q_c, q_pe], dim=-1).contiguous()
+        output = torch.empty(query.shape[0], query.shape[1], kv_lora_rank,
+                             dtype=query.dtype, device=query.device)
+        ops.mla_decode_cpu(output, query, kv_cache, block_tables, seq_lens,
+                           kv_lora_rank, scale, kv_cache_dtype, k_scale)
+        return torch.einsum("shc,hcv->shv", output, w_uv)
+
+    @staticmethod
+    def compact_h2o(
+        key_cache: torch.Tensor,
+        value_cache: torch.Tensor,
+        attn_mass: torch.Tensor,
+        block_tables: torch.Tensor,
+        seq_lens: torch.Tensor,
+        heavy_blocks: int,
+        recent_tokens: int,
+    ) -> torch.Tensor:
+        # Keeps heavy_blocks blocks' worth of heavy hitters (by the attn_mass
+        # forward_decode accumulated) before the recent window of every
+        # sequence; block_tables and seq_lens are updated in place and the
+        # freed physical blocks are returned to the caller's allocator.
+        assert key_cache.device.type == "cpu", "H2O compaction is CPU only"
+        block_size = attn_mass.shape[3]
+        return ops.h2o_compact_cpu(key_cache, value_cache, attn_mass,
+                                   block_tables, seq_lens, block_size,
+                                   heavy_blocks, recent_tokens)
+
     # @staticmethod
     # def forward_prefix(
     #     query: torch.Tensor,
@@ -370,6 +631,19 @@ class PagedAttention:
         dst_value_cache = dst_kv_cache[1]
         ops.swap_blocks(src_value_cache, dst_value_cache, src_to_dst)
 
+    @staticmethod
+    def swap_blocks_async(
+        swapper,
+        src_kv_caches: List[torch.Tensor],
+        dst_kv_caches: List[torch.Tensor],
+        src_to_dst: torch.Tensor,
+    ) -> int:
+        # one request for the keys and values of every layer; the caches must
+        # be left alone until swapper.poll / swapper.wait reports the handle
+        src = [c[i] for c in src_kv_caches for i in range(2)]
+        dst = [c[i] for c in dst_kv_caches for i in range(2)]
+        return swapper.swap_async(src, dst, src_to_dst)
+
     @staticmethod
     def copy_blocks(
         kv_caches: List[torch.Tensor],
@@ -377,4 +651,7 @@ class PagedAttention:
     ) -> None:
         key_caches = [kv_cache[0] for kv_cache in kv_caches]
         value_caches = [kv_cache[1] for kv_cache in kv_caches]
-        ops.copy_blocks(key_caches, value_caches, src_to_dists)
+        if key_caches and key_caches[0].device.type == "cpu":
+            ops.copy_blocks_cpu(key_caches, value_caches, src_to_dists)
+        else:
+            ops.copy_blocks(key_caches, value_caches, src_to_dists)
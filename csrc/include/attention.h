@@ -1,6 +1,8 @@
 #pragma once
 #include <torch/extension.h>
 
+// k_head_scales / v_head_scales ([num_kv_heads] float32 on the query device)
+// replace k_scale / v_scale of an fp8 cache with one scale per kv head.
 void paged_attention(
     torch::Tensor &out, torch::Tensor &exp_sums, torch::Tensor &max_logits,
     torch::Tensor &tmp_out, torch::Tensor &query, torch::Tensor &key_cache,
@@ -9,4 +11,12 @@ void paged_attention(
     int64_t block_size, int64_t max_context_len,
     const c10::optional<torch::Tensor> &alibi_slopes,
     const std::string &kv_cache_dtype, double k_scale, double v_scale,
-    const c10::optional<torch::Tensor> &fp8_out_scale, int64_t partition_size);
\ No newline at end of file
+    const c10::optional<torch::Tensor> &fp8_out_scale, int64_t partition_size,
+    const c10::optional<torch::Tensor> &k_head_scales,
+    const c10::optional<torch::Tensor> &v_head_scales);
+
+// Whether paged_attention has a kernel for this query dtype / head size,
+// kv_cache_dtype and block_size.
+bool paged_attention_rocm_supported(torch::Tensor &query,
+                                    const std::string &kv_cache_dtype,
+                                    int64_t block_size);
\ No newline at end of file
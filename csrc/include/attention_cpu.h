@@ -0,0 +1,162 @@
+#pragma once
+#include <torch/extension.h>
+
+// The CPU ops read key_cache / value_cache in whichever layout the cache
+// writers produced: reshape_and_cache (vLLM), reshape_and_cache with
+// asm_layout (5-D value_cache) or reshape_and_cache_flash (4-D
+// [num_blocks, block_size, num_kv_heads, head_size] caches).
+// Optional k_head_scales / v_head_scales ([num_kv_heads] float32) replace the
+// scalar k_scale / v_scale of an fp8 (or int8) cache with one scale per kv
+// head, in the writer and the readers alike.
+// value_cache may hold a head size of its own (hdim_qk != hdim_v, e.g.
+// DeepSeek 192 / 128); out and tmp_out then end in that head size.
+
+// Without a work_list the op plans itself and computes partitions shared by
+// sequences with identical leading block_tables entries once (cascade).
+// window_size > 0 restricts each query to its last window_size tokens plus
+// the first num_sink_tokens; blocks outside both are not read.
+// kv_cache_dtype "int8" (or "fp8") with k/v_dequant_scales reads a cache
+// written by reshape_and_cache_with_pertoken_quant; for int8, QK^T runs on
+// int8 dot products (VNNI where available) against a quantized query.
+// With fp8_out_scale (one-element float32) out is float8_e4m3fnuz and the
+// reduce stores out / fp8_out_scale, saturated to +-240.
+// With attn_mass (float32 [num_seqs, num_kv_heads, max_num_blocks_per_seq,
+// block_size], logical token order) every token's attention probability,
+// summed over the query heads of its kv head, is added to its mass for
+// h2o_compact_cpu.
+void paged_attention_cpu(
+    torch::Tensor &out, torch::Tensor &exp_sums, torch::Tensor &max_logits,
+    torch::Tensor &tmp_out, torch::Tensor &query, torch::Tensor &key_cache,
+    torch::Tensor &value_cache, int64_t num_kv_heads, double scale,
+    torch::Tensor &block_tables, torch::Tensor &context_lens,
+    int64_t block_size, int64_t max_context_len,
+    const c10::optional<torch::Tensor> &alibi_slopes,
+    const std::string &kv_cache_dtype, double k_scale, double v_scale,
+    const c10::optional<torch::Tensor> &fp8_out_scale, int64_t partition_size,
+    const c10::optional<torch::Tensor> &work_list,
+    const c10::optional<torch::Tensor> &partition_offsets,
+    int64_t window_size, int64_t num_sink_tokens,
+    const c10::optional<torch::Tensor> &k_dequant_scales,
+    const c10::optional<torch::Tensor> &v_dequant_scales,
+    const c10::optional<torch::Tensor> &attn_mass,
+    const c10::optional<torch::Tensor> &k_head_scales,
+    const c10::optional<torch::Tensor> &v_head_scales);
+
+// The partition size the decode planner picks for this batch (by context_lens
+// and the thread count), without building the work list.
+int64_t paged_attention_cpu_partition_size(torch::Tensor &context_lens,
+                                           int64_t num_kv_heads,
+                                           int64_t block_size);
+
+// Decode planner: picks the partition size for this batch (partition_size <= 0)
+// and returns the (seq, kv_head, partition) work list, longest items first.
+std::tuple<torch::Tensor, int64_t> paged_attention_cpu_plan(
+    torch::Tensor &context_lens, int64_t num_kv_heads, int64_t block_size,
+    int64_t partition_size);
+
+// Ragged workspace sizing: returns the prefix sum of per-sequence partition
+// counts [num_seqs + 1]. With total = offsets[-1], allocate exp_sums and
+// max_logits as [total * num_heads] and tmp_out as [total * num_heads,
+// head_size], then pass offsets as partition_offsets.
+torch::Tensor paged_attention_cpu_workspace(torch::Tensor &context_lens,
+                                            int64_t partition_size);
+
+// Speculative decode verification: q_len draft tokens per sequence, already
+// appended to the cache, attend causally over one pass of the paged KV.
+void paged_attention_multi_token_cpu(
+    torch::Tensor &out, torch::Tensor &query, torch::Tensor &key_cache,
+    torch::Tensor &value_cache, int64_t num_kv_heads, double scale,
+    torch::Tensor &block_tables, torch::Tensor &context_lens,
+    int64_t block_size, int64_t max_context_len,
+    const c10::optional<torch::Tensor> &alibi_slopes,
+    const std::string &kv_cache_dtype, double k_scale, double v_scale,
+    int64_t window_size, int64_t num_sink_tokens,
+    const c10::optional<torch::Tensor> &k_head_scales,
+    const c10::optional<torch::Tensor> &v_head_scales);
+
+// Fused decode step: writes key / value [num_seqs, num_kv_heads, head_size
+// (head_size_v)] to slot_mapping as reshape_and_cache_cpu does and attends
+// with query [num_seqs, num_heads, head_size] over context_lens tokens, the
+// new one included, in one pass. The new token is taken from key / value
+// rather than read back from the cache; a negative slot appends nothing.
+// No sliding window or per-token quantized cache.
+void paged_attention_append_cpu(
+    torch::Tensor &out, torch::Tensor &query, torch::Tensor &key,
+    torch::Tensor &value, torch::Tensor &key_cache, torch::Tensor &value_cache,
+    torch::Tensor &slot_mapping, int64_t num_kv_heads, double scale,
+    torch::Tensor &block_tables, torch::Tensor &context_lens,
+    int64_t block_size, const c10::optional<torch::Tensor> &alibi_slopes,
+    const std::string &kv_cache_dtype, double k_scale, double v_scale,
+    const c10::optional<torch::Tensor> &k_head_scales,
+    const c10::optional<torch::Tensor> &v_head_scales);
+
+// Mixed chunked-prefill + decode batch in one call. Query rows of sequence s
+// are [cu_seqlens_q[s], cu_seqlens_q[s + 1]) and are the last tokens of its
+// context_lens[s] cached tokens. Short queries take the split-KV decode path,
+// long ones are tiled with an online softmax.
+void paged_attention_varlen_cpu(
+    torch::Tensor &out, torch::Tensor &query, torch::Tensor &key_cache,
+    torch::Tensor &value_cache, int64_t num_kv_heads, double scale,
+    torch::Tensor &block_tables, torch::Tensor &cu_seqlens_q,
+    torch::Tensor &context_lens, int64_t block_size, int64_t max_context_len,
+    const c10::optional<torch::Tensor> &alibi_slopes,
+    const std::string &kv_cache_dtype, double k_scale, double v_scale,
+    int64_t window_size, int64_t num_sink_tokens,
+    const c10::optional<torch::Tensor> &k_head_scales,
+    const c10::optional<torch::Tensor> &v_head_scales);
+
+// Merges partial attention results [num_partials, ..., head_size] (each
+// normalized by its own exp sum) with the math of the ll4mi reduce. The
+// per-row softmax states are max_logits + exp_sums, or log-sum-exp values in
+// max_logits when exp_sums is None; out_lse optionally receives the merged LSE.
+void merge_attn_states_cpu(torch::Tensor &out,
+                           const c10::optional<torch::Tensor> &out_lse,
+                           torch::Tensor &partial_out,
+                           torch::Tensor &max_logits,
+                           const c10::optional<torch::Tensor> &exp_sums);
+
+// MLA decode over a latent cache [num_blocks, block_size, kv_lora_rank +
+// rope_dim] shared by all heads. query holds q_nope . W_UK (kv_lora_rank)
+// followed by q_pe; out is in the latent space, the caller applies W_UV.
+void mla_decode_cpu(torch::Tensor &out, torch::Tensor &query,
+                    torch::Tensor &kv_cache, torch::Tensor &block_tables,
+                    torch::Tensor &context_lens, int64_t kv_lora_rank,
+                    double scale, const std::string &kv_cache_dtype,
+                    double k_scale);
+
+// Query-aware block-sparse decode (Quest): every kv head attends only to the
+// top_blocks blocks whose key_summaries bound the largest logit, plus the
+// last block of the sequence. No alibi or sliding window.
+void paged_attention_block_sparse_cpu(
+    torch::Tensor &out, torch::Tensor &query, torch::Tensor &key_cache,
+    torch::Tensor &value_cache, torch::Tensor &key_summaries,
+    int64_t num_kv_heads, double scale, torch::Tensor &block_tables,
+    torch::Tensor &context_lens, int64_t block_size,
+    const std::string &kv_cache_dtype, double k_scale, double v_scale,
+    int64_t top_blocks, const c10::optional<torch::Tensor> &k_head_scales,
+    const c10::optional<torch::Tensor> &v_head_scales);
+
+// Heavy-hitter (H2O) eviction. For every sequence whose full blocks before
+// its last recent_tokens tokens number more than heavy_blocks, keeps per kv
+// head the heavy_blocks * block_size tokens of those blocks with the largest
+// attn_mass, packs them in order into the first heavy_blocks blocks, drops
+// the other blocks from block_tables and shrinks context_lens. Returns the
+// freed physical blocks (int32). Compacted blocks must not be shared with
+// other sequences (copy_blocks them first); per-token dequant scales are not
+// moved.
+torch::Tensor h2o_compact_cpu(torch::Tensor &key_cache,
+                              torch::Tensor &value_cache,
+                              torch::Tensor &attn_mass,
+                              torch::Tensor &block_tables,
+                              torch::Tensor &context_lens, int64_t block_size,
+                              int64_t heavy_blocks, int64_t recent_tokens);
+
+// Attention within each sequence of a packed variable-length batch, no KV
+// cache (encoder / embedding / reranker models): query [total_tokens,
+// num_heads, head_size], key / value [total_tokens, num_kv_heads, head_size
+// (head_size_v)], int32 cu_seqlens [num_seqs + 1]. Bidirectional unless
+// causal; out is [total_tokens, num_heads, head_size_v].
+void varlen_attention_cpu(torch::Tensor &out, torch::Tensor &query,
+                          torch::Tensor &key, torch::Tensor &value,
+                          torch::Tensor &cu_seqlens, double scale,
+                          bool causal);
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <torch/extension.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Host bookkeeping of a paged KV pool, so schedulers need no Python free
+// lists: O(1) allocate / free off a free-block stack, per-block reference
+// counts, sequences that share blocks after fork and copy them on write, and
+// the slot_mapping / block_tables / copy_blocks mapping tensors of a whole
+// scheduler step in one call each.
+//
+// With enable_prefix_caching, the full blocks of sequences whose tokens are
+// known are also indexed by a chained hash (of the parent block's hash and
+// the block's tokens): a radix tree with one block per edge. New sequences
+// map the longest indexed prefix of their prompt into their block table, and
+// blocks nobody references stay cached until the free list runs dry; then
+// the least recently released leaves are evicted first.
+class BlockManager {
+ public:
+  BlockManager(int64_t num_blocks, int64_t block_size,
+               bool enable_prefix_caching = false);
+
+  int64_t num_blocks() const { return int64_t(ref_counts_.size()); }
+  int64_t block_size() const { return block_size_; }
+  // Evictable cached blocks count as free.
+  int64_t num_free_blocks() const {
+    return int64_t(free_blocks_.size()) + num_evictable_;
+  }
+  int64_t num_cached_blocks() const { return int64_t(index_.size()); }
+  int64_t num_sequences() const { return int64_t(seqs_.size()); }
+  int64_t ref_count(int64_t block) const;
+
+  // Raw blocks: allocate takes one reference of a free block, free drops one
+  // reference and returns the block to the pool when none is left.
+  int64_t allocate();
+  void free(int64_t block);
+
+  // Whether num_tokens more tokens fit into free blocks (new sequences).
+  bool can_allocate(int64_t num_tokens) const;
+  // Registers seq_id with num_tokens tokens in fresh blocks and returns
+  // their slot_mapping [num_tokens] (int64).
+  torch::Tensor add_sequence(int64_t seq_id, int64_t num_tokens);
+  // Prefix caching: registers seq_id with its prompt token_ids (int32 or
+  // int64 [n]), mapping the longest cached run of full leading blocks and
+  // fresh blocks for the rest. At least the last token is always computed.
+  // Returns the slot_mapping of the tokens to compute (int64
+  // [n - num_cached]) and num_cached. The fresh full blocks are indexed at
+  // once: later steps only read them after this step's cache writes.
+  std::tuple<torch::Tensor, int64_t> add_sequence_with_prefix(
+      int64_t seq_id, const torch::Tensor &token_ids);
+  // child_id shares every block of parent_id (beam search, parallel
+  // sampling); the first append to a shared partial block copies it.
+  void fork(int64_t parent_id, int64_t child_id);
+  // Drops the sequence's references; unshared blocks go back to the pool,
+  // or stay cached until evicted.
+  void free_sequence(int64_t seq_id);
+
+  // Blocks the next append of seq_ids (int64 [n], distinct) needs: new
+  // blocks plus copies of shared last blocks.
+  int64_t blocks_needed_to_append(const torch::Tensor &seq_ids) const;
+  // Appends one token to each of seq_ids and returns its slot_mapping [n]
+  // (int64). Shared last blocks are replaced by copies first; the
+  // (src, dst) pairs queue up for take_copy_mapping. Nothing changes when
+  // the pool cannot cover the whole batch. With prefix caching, token_ids
+  // (int32 or int64 [n]) are the appended tokens and the blocks they fill
+  // get indexed; without them the sequences stop being indexed.
+  torch::Tensor append_slots(const torch::Tensor &seq_ids,
+                             const c10::optional<torch::Tensor> &token_ids);
+  // The queued copy-on-write pairs as an int64 [num_pairs, 2] tensor for
+  // copy_blocks, which must run before this step's cache writes (a source
+  // freed meanwhile may already be handed out again); the queue is cleared.
+  torch::Tensor take_copy_mapping();
+
+  // int32 [n, max_num_blocks] block tables of seq_ids, zero padded;
+  // max_num_blocks <= 0 sizes them for the longest sequence.
+  torch::Tensor block_tables(const torch::Tensor &seq_ids,
+                             int64_t max_num_blocks) const;
+  // int32 [n] token counts of seq_ids.
+  torch::Tensor context_lens(const torch::Tensor &seq_ids) const;
+
+ private:
+  struct Sequence {
+    std::vector<int> blocks;
+    int64_t num_tokens = 0;
+    int64_t append_step = -1;  // last append_slots call that saw it
+    // prefix caching: whether every full block so far is indexed, the hash
+    // of the last one, and the tokens of the partial block
+    bool indexed = false;
+    uint64_t hash = 0;
+    std::vector<int32_t> tail;
+  };
+
+  int take_free_block();
+  void release(int block);
+  Sequence &sequence(int64_t seq_id);
+  const Sequence &sequence(int64_t seq_id) const;
+  bool needs_copy(const Sequence &seq) const;
+  int64_t blocks_needed(const Sequence *const *batch, int64_t n) const;
+
+  int match_block(uint64_t hash, int parent, const int32_t *tokens) const;
+  void index_block(Sequence &seq, size_t k, const int32_t *tokens);
+  void lru_push(int block);
+  void lru_remove(int block);
+  int evict_block();
+
+  int64_t block_size_;
+  std::vector<int> free_blocks_;  // stack, so freed blocks are reused hot
+  std::vector<int> ref_counts_;
+  std::unordered_map<int64_t, Sequence> seqs_;
+  std::vector<int64_t> copies_;  // pending (src, dst) pairs
+  int64_t step_ = 0;
+
+  // prefix cache, per block: parent (-1 under the root), indexed children,
+  // tokens (to rule out hash collisions), and the links of the list of
+  // unreferenced cached leaves, oldest first, closed at num_blocks; the
+  // evictable count also covers unreferenced blocks with cached children
+  bool prefix_caching_;
+  std::unordered_map<uint64_t, int> index_;
+  std::vector<char> cached_;
+  std::vector<int> parent_;
+  std::vector<int> num_children_;
+  std::vector<int32_t> block_tokens_;
+  std::vector<uint64_t> block_hash_;
+  std::vector<int> lru_prev_, lru_next_;
+  int64_t num_evictable_ = 0;
+};
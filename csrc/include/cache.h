@@ -15,25 +15,76 @@ void copy_blocks(std::vector<torch::Tensor> const &key_caches,
                  std::vector<torch::Tensor> const &value_caches,
                  const torch::Tensor &block_mapping);
 
+// The writers optionally keep key_summaries [num_blocks, num_heads, 2,
+// head_size] float32, the channel-wise min / max of the keys of every block
+// for block-sparse decode (paged_attention_block_sparse_cpu). A block's
+// summary is reset when its first slot is written.
+// k_head_scales / v_head_scales ([num_heads] float32 on the cache device)
+// quantize every kv head of an fp8 cache with its own scale instead of
+// k_scale / v_scale.
 void reshape_and_cache(torch::Tensor &key, torch::Tensor &value,
                        torch::Tensor &key_cache, torch::Tensor &value_cache,
                        torch::Tensor &slot_mapping,
                        const std::string &kv_cache_dtype, const double k_scale,
-                       const double v_scale, const bool asm_layout);
+                       const double v_scale, const bool asm_layout,
+                       const c10::optional<torch::Tensor> &key_summaries,
+                       const c10::optional<torch::Tensor> &k_head_scales,
+                       const c10::optional<torch::Tensor> &v_head_scales);
 
 void reshape_and_cache_flash(torch::Tensor &key, torch::Tensor &value,
                              torch::Tensor &key_cache,
                              torch::Tensor &value_cache,
                              torch::Tensor &slot_mapping,
                              const std::string &kv_cache_dtype,
-                             const double k_scale, const double v_scale);
+                             const double k_scale, const double v_scale,
+                             const c10::optional<torch::Tensor> &key_summaries,
+                             const c10::optional<torch::Tensor> &k_head_scales,
+                             const c10::optional<torch::Tensor> &v_head_scales);
+
+// MLA latent cache: kv_cache[block, offset] = concat(kv_c, k_pe) of the
+// token in that slot.
+void concat_and_cache_mla(torch::Tensor &kv_c, torch::Tensor &k_pe,
+                          torch::Tensor &kv_cache, torch::Tensor &slot_mapping,
+                          const std::string &kv_cache_dtype,
+                          const double scale);
 
 void reshape_and_cache_with_pertoken_quant(torch::Tensor &key, torch::Tensor &value,
                        torch::Tensor &key_cache, torch::Tensor &value_cache,
                        torch::Tensor &k_dequant_scales, torch::Tensor &v_dequant_scales,
                        torch::Tensor &slot_mapping,
-                       const bool asm_layout);
+                       const bool asm_layout,
+                       const c10::optional<torch::Tensor> &key_summaries);
 
 // Just for unittest
 void convert_fp8(torch::Tensor &dst_cache, torch::Tensor &src_cache,
-                 const double scale, const std::string &kv_cache_dtype);
\ No newline at end of file
+                 const double scale, const std::string &kv_cache_dtype);
+
+// Host counterpart of concat_and_cache_mla: writes [kv_c, k_pe] of every
+// token to its slot of the latent cache (int64 slot_mapping, -1 skips).
+void concat_and_cache_mla_cpu(torch::Tensor &kv_c, torch::Tensor &k_pe,
+                              torch::Tensor &kv_cache,
+                              torch::Tensor &slot_mapping,
+                              const std::string &kv_cache_dtype, double scale);
+
+// Host counterpart of reshape_and_cache / reshape_and_cache_flash for any
+// layout the CPU attention ops read (see attention_cpu.h; int64
+// slot_mapping, -1 skips). With key_summaries
+// [num_blocks, num_kv_heads, 2, head_size] float32 it also keeps the
+// channel-wise key min / max of every block: a block's summary is reset when
+// its first slot is written.
+void reshape_and_cache_cpu(torch::Tensor &key, torch::Tensor &value,
+                           torch::Tensor &key_cache, torch::Tensor &value_cache,
+                           torch::Tensor &slot_mapping,
+                           const std::string &kv_cache_dtype, double k_scale,
+                           double v_scale,
+                           const c10::optional<torch::Tensor> &key_summaries,
+                           const c10::optional<torch::Tensor> &k_head_scales,
+                           const c10::optional<torch::Tensor> &v_head_scales);
+
+// Host counterpart of copy_blocks: for every (src, dst) pair of
+// block_mapping (int64 [num_pairs, 2]), block src of each layer's key and
+// value cache is copied to block dst, e.g. the copy-on-write mapping of a
+// beam-search fork across all layers.
+void copy_blocks_cpu(std::vector<torch::Tensor> const &key_caches,
+                     std::vector<torch::Tensor> const &value_caches,
+                     const torch::Tensor &block_mapping);
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_block_copy.h
+ * @Description: Whole-block copies between paged caches (swap_blocks,
+ *               copy_blocks). A (src, dst) block mapping is sorted and
+ *               merged into runs that are contiguous on both sides, so
+ *               swapping many blocks costs one copy per run instead of one
+ *               per block; host to host copies are split over the thread
+ *               pool and written with streaming stores.
+ */
+
+#pragma once
+
+#include "cpu_parallel.h"
+#include "cpu_vec.h"
+
+namespace ater {
+namespace cpu {
+
+// memcpy with non-temporal stores where the ISA has them: copied blocks are
+// not read back by the copying thread, so they need not displace its cache.
+inline void stream_copy(char* dst, const char* src, int64_t bytes) {
+#if defined(ATER_CPU_AVX512) || defined(ATER_CPU_AVX2)
+#if defined(ATER_CPU_AVX512)
+  constexpr int64_t kWidth = 64;
+#else
+  constexpr int64_t kWidth = 32;
+#endif
+  // aligned stores from the first dst line boundary on
+  const int64_t head =
+      std::min<int64_t>(bytes, -reinterpret_cast<uintptr_t>(dst) & (kWidth - 1));
+  std::memcpy(dst, src, head);
+  int64_t i = head;
+  for (; i + kWidth <= bytes; i += kWidth) {
+#if defined(ATER_CPU_AVX512)
+    _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + i),
+                        _mm512_loadu_si512(src + i));
+#else
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+#endif
+  }
+  std::memcpy(dst + i, src + i, bytes - i);
+  // streaming stores are weakly ordered: publish them before returning
+  _mm_sfence();
+#else
+  std::memcpy(dst, src, bytes);
+#endif
+}
+
+// num_blocks blocks from src on in the source, dst on in the destination.
+struct BlockRun {
+  int64_t src;
+  int64_t dst;
+  int64_t num_blocks;
+};
+
+// mapping: num_pairs (src, dst) pairs, row major. Pairs are taken in (src,
+// dst) order; runs grow while both sides continue.
+inline std::vector<BlockRun> coalesce_block_mapping(const int64_t* mapping,
+                                                    int64_t num_pairs) {
+  std::vector<std::pair<int64_t, int64_t>> pairs(num_pairs);
+  for (int64_t i = 0; i < num_pairs; i++) {
+    pairs[i] = {mapping[2 * i], mapping[2 * i + 1]};
+  }
+  std::sort(pairs.begin(), pairs.end());
+  std::vector<BlockRun> runs;
+  for (const auto& pr : pairs) {
+    if (!runs.empty()) {
+      BlockRun& r = runs.back();
+      if (pr.first == r.src + r.num_blocks && pr.second == r.dst + r.num_blocks) {
+        r.num_blocks++;
+        continue;
+      }
+    }
+    runs.push_back({pr.first, pr.second, 1});
+  }
+  return runs;
+}
+
+// Host to host copy of runs of block_bytes blocks. Runs are cut into chunks
+// of about chunk_bytes so that one long run still spreads over every thread.
+inline void copy_block_runs(char* dst, const char* src, const std::vector<BlockRun>& runs,
+                            int64_t block_bytes, int64_t chunk_bytes = int64_t(1) << 20) {
+  struct Chunk {
+    char* dst;
+    const char* src;
+    int64_t bytes;
+  };
+  std::vector<Chunk> chunks;
+  for (const BlockRun& r : runs) {
+    const int64_t bytes = r.num_blocks * block_bytes;
+    char* d = dst + r.dst * block_bytes;
+    const char* s = src + r.src * block_bytes;
+    for (int64_t off = 0; off < bytes; off += chunk_bytes) {
+      chunks.push_back({d + off, s + off, std::min(chunk_bytes, bytes - off)});
+    }
+  }
+  ThreadPool::instance().parallel_for(int64_t(chunks.size()), [&](int64_t i, int) {
+    stream_copy(chunks[i].dst, chunks[i].src, chunks[i].bytes);
+  });
+}
+
+// copy_blocks over host caches: for every (src, dst) pair of mapping, block
+// src of each layer's key and value cache is copied to block dst. The
+// (layer, pair) copies are spread over the pool.
+inline void copy_blocks(char* const* key_caches, char* const* value_caches, int num_layers,
+                        const int64_t* mapping, int64_t num_pairs, int64_t key_block_bytes,
+                        int64_t value_block_bytes) {
+  ThreadPool::instance().parallel_for(num_layers * num_pairs, [&](int64_t i, int) {
+    const int64_t layer = i / num_pairs;
+    const int64_t src = mapping[2 * (i % num_pairs)];
+    const int64_t dst = mapping[2 * (i % num_pairs) + 1];
+    stream_copy(key_caches[layer] + dst * key_block_bytes,
+                key_caches[layer] + src * key_block_bytes, key_block_bytes);
+    stream_copy(value_caches[layer] + dst * value_block_bytes,
+                value_caches[layer] + src * value_block_bytes, value_block_bytes);
+  });
+}
+
+}  // namespace cpu
+}  // namespace ater
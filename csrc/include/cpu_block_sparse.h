@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_block_sparse.h
+ * @Description: Query-aware block sparsity for long-context decode (Quest).
+ *               The cache writers keep a channel-wise min / max of the keys
+ *               of every (block, kv head); decode bounds each block's
+ *               largest logit with them,
+ *                 score(q, block) = sum_d max(q_d * kmin_d, q_d * kmax_d),
+ *               and attends only to the top blocks plus the most recent one.
+ */
+
+#pragma once
+
+#include "cpu_paged_attention.h"
+
+namespace ater {
+namespace cpu {
+
+// Key summaries [num_blocks, num_kv_heads, 2, head_size] float: row 0 is the
+// channel-wise min, row 1 the max of the keys written to the block.
+inline float* key_summary(float* summaries, int64_t block, int kv_head, int num_kv_heads,
+                          int head_size) {
+  return summaries + (block * num_kv_heads + kv_head) * 2 * head_size;
+}
+
+inline const float* key_summary(const float* summaries, int64_t block, int kv_head,
+                                int num_kv_heads, int head_size) {
+  return summaries + (block * num_kv_heads + kv_head) * 2 * head_size;
+}
+
+// Widens the summaries of the blocks that key[num_tokens, num_kv_heads,
+// head_size] is written to. A block's summary is reset when its first slot
+// is written, so reused blocks do not keep the bounds of earlier contents.
+template <typename scalar_t>
+void update_key_summaries(const scalar_t* key, int64_t key_stride, const int64_t* slot_mapping,
+                          int64_t num_tokens, int num_kv_heads, int head_size, int block_size,
+                          float* summaries) {
+  ThreadPool& pool = ThreadPool::instance();
+  pool.parallel_for(num_tokens, [&](int64_t i, int) {
+    const int64_t slot = slot_mapping[i];
+    if (slot < 0 || slot % block_size != 0) {
+      return;
+    }
+    for (int h = 0; h < num_kv_heads; h++) {
+      float* s = key_summary(summaries, slot / block_size, h, num_kv_heads, head_size);
+      std::fill(s, s + head_size, std::numeric_limits<float>::infinity());
+      std::fill(s + head_size, s + 2 * head_size, -std::numeric_limits<float>::infinity());
+    }
+  });
+  // one kv head per item: tokens of a block never race on its summary
+  pool.parallel_for(num_kv_heads, [&](int64_t h, int) {
+    for (int64_t i = 0; i < num_tokens; i++) {
+      const int64_t slot = slot_mapping[i];
+      if (slot < 0) {
+        continue;
+      }
+      float* s = key_summary(summaries, slot / block_size, h, num_kv_heads, head_size);
+      const scalar_t* k = key + i * key_stride + h * head_size;
+      for (int d = 0; d < head_size; d++) {
+        const float v = to_float(k[d]);
+        s[d] = std::min(s[d], v);
+        s[head_size + d] = std::max(s[head_size + d], v);
+      }
+    }
+  });
+}
+
+// Block tables of the selected blocks, one per (seq, kv_head), and the
+// token count each sequence keeps: the top blocks are full, the last one
+// keeps its valid tokens.
+struct BlockSelection {
+  std::vector<int> block_tables;  // [num_seqs, num_kv_heads, width]
+  std::vector<int> context_lens;  // [num_seqs]
+  int width;                      // top_blocks + 1
+};
+
+// Upper bound of q . k over the keys of a block, summed over the GQA rows.
+inline float block_score(const float* q, int rows, int head_size, const float* summary) {
+  constexpr int W = Vec16f::kSize;
+  Vec16f acc = Vec16f::zero();
+  for (int r = 0; r < rows; r++) {
+    const float* qr = q + size_t(r) * head_size;
+    for (int d = 0; d < head_size; d += W) {
+      const int n = std::min(W, head_size - d);
+      const Vec16f qv = Vec16f::load_partial(qr + d, n);
+      const Vec16f lo = Vec16f::load_partial(summary + d, n);
+      const Vec16f hi = Vec16f::load_partial(summary + head_size + d, n);
+      acc = acc + max(qv * lo, qv * hi);
+    }
+  }
+  return acc.reduce_add();
+}
+
+// Picks, for every (seq, kv_head) of a q_len = 1 decode batch, the
+// top_blocks blocks with the highest score plus the last block. Selected
+// blocks keep their order in the sequence; sequences with at most
+// top_blocks + 1 blocks keep all of them.
+template <typename scalar_t>
+BlockSelection select_blocks(const PagedAttentionParams& p, const float* summaries,
+                             int block_size, const scalar_t* query, int top_blocks) {
+  BlockSelection sel;
+  sel.width = top_blocks + 1;
+  sel.block_tables.assign(size_t(p.num_seqs) * p.num_kv_heads * sel.width, 0);
+  sel.context_lens.resize(p.num_seqs);
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    const int len = p.context_lens[seq];
+    const int n_blocks = (len + block_size - 1) / block_size;
+    sel.context_lens[seq] =
+        n_blocks <= sel.width ? len : len - (n_blocks - sel.width) * block_size;
+  }
+
+  const int gqa = p.num_heads / p.num_kv_heads;
+  const int hs = p.head_size;
+  ThreadPool::instance().parallel_for(
+      int64_t(p.num_seqs) * p.num_kv_heads, [&](int64_t item, int) {
+        const int seq = int(item / p.num_kv_heads);
+        const int kv_head = int(item % p.num_kv_heads);
+        const int n_blocks = (p.context_lens[seq] + block_size - 1) / block_size;
+        const int* table = p.block_tables + int64_t(seq) * p.max_num_blocks_per_seq;
+        int* dst = &sel.block_tables[size_t(item) * sel.width];
+        if (n_blocks <= sel.width) {
+          std::copy(table, table + n_blocks, dst);
+          return;
+        }
+
+        static thread_local std::vector<float> q;
+        static thread_local std::vector<float> scores;
+        static thread_local std::vector<int> order;
+        q.resize(size_t(gqa) * hs);
+        for (int r = 0; r < gqa; r++) {
+          load_row(&q[size_t(r) * hs],
+                   query + int64_t(seq) * p.q_stride + int64_t(kv_head * gqa + r) * p.q_head_stride,
+                   hs);
+        }
+        // the last block is always attended, the others compete
+        const int candidates = n_blocks - 1;
+        scores.resize(candidates);
+        order.resize(candidates);
+        for (int b = 0; b < candidates; b++) {
+          scores[b] = block_score(q.data(), gqa, hs,
+                                  key_summary(summaries, table[b], kv_head, p.num_kv_heads, hs));
+          order[b] = b;
+        }
+        std::nth_element(order.begin(), order.begin() + top_blocks, order.end(),
+                         [&](int a, int b) { return scores[a] > scores[b]; });
+        std::sort(order.begin(), order.begin() + top_blocks);
+        for (int i = 0; i < top_blocks; i++) {
+          dst[i] = table[order[i]];
+        }
+        dst[top_blocks] = table[n_blocks - 1];
+      });
+  return sel;
+}
+
+// Decode over the selected blocks only: p describes the full batch (q_len =
+// 1, no alibi or sliding window, since selected tokens lose their
+// positions); its block tables, context lens and workspace are replaced by
+// those of the selection.
+template <typename scalar_t, typename cache_t, typename out_t>
+void paged_attention_block_sparse(PagedAttentionParams p, const PagedKV<cache_t>& kv,
+                                  const float* summaries, int top_blocks, int num_workers,
+                                  const scalar_t* query, out_t* out) {
+  const BlockSelection sel = select_blocks(p, summaries, kv.block_size, query, top_blocks);
+  p.block_tables = sel.block_tables.data();
+  p.max_num_blocks_per_seq = p.num_kv_heads * sel.width;
+  p.block_table_head_stride = sel.width;
+  p.context_lens = sel.context_lens.data();
+  p.partition_size = choose_partition_size(p.context_lens, p.num_seqs, p.num_kv_heads,
+                                           kv.block_size, num_workers);
+  p.max_num_partitions = 0;
+
+  std::vector<int> offsets(p.num_seqs + 1);
+  const int64_t rows =
+      ragged_partition_offsets(p.context_lens, p.num_seqs, p.partition_size, offsets.data()) *
+      p.num_heads;
+  p.partition_offsets = offsets.data();
+  std::vector<float> exp_sums(rows);
+  std::vector<float> max_logits(rows);
+  std::vector<scalar_t> tmp_out(size_t(rows) * head_size_v_of(p));
+  paged_attention_decode(p, kv, query, exp_sums.data(), max_logits.data(), tmp_out.data(), out);
+}
+
+}  // namespace cpu
+}  // namespace ater
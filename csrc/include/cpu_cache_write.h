@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_cache_write.h
+ * @Description: Host counterpart of reshape_and_cache /
+ *               reshape_and_cache_flash: scatters new keys and values into a
+ *               paged cache in any layout of cpu_paged_kv.h, optionally
+ *               keeping the block key summaries of cpu_block_sparse.h.
+ */
+
+#pragma once
+
+#include "cpu_block_sparse.h"
+
+namespace ater {
+namespace cpu {
+
+// One cache entry: x / scale, i.e. x * inv_scale, in the cache dtype.
+template <typename scalar_t, typename cache_t>
+inline cache_t to_cache(const scalar_t x, float inv_scale) {
+  if constexpr (std::is_same<scalar_t, cache_t>::value) {
+    return x;
+  } else {
+    return from_float<cache_t>(to_float(x) * inv_scale);
+  }
+}
+
+// Stores key k [head_size] / value v [head_size_v] of kv head h as token t of
+// block.
+template <typename scalar_t, typename cache_t>
+inline void store_kv_token(const PagedKV<cache_t>& kv, cache_t* key_cache, cache_t* value_cache,
+                           int64_t block, int t, int h, const scalar_t* k, const scalar_t* v,
+                           int head_size, int head_size_v) {
+  const float inv_k = 1.0f / kv.k_scale_of(h);
+  const float inv_v = 1.0f / kv.v_scale_of(h);
+  for (int d = 0; d < head_size; d++) {
+    key_cache[key_offset(kv, block, h, t, d)] = to_cache<scalar_t, cache_t>(k[d], inv_k);
+  }
+  for (int d = 0; d < head_size_v; d++) {
+    value_cache[value_offset(kv, block, h, t, d, head_size_v)] =
+        to_cache<scalar_t, cache_t>(v[d], inv_v);
+  }
+}
+
+// key [num_tokens, num_kv_heads, head_size] / value [num_tokens,
+// num_kv_heads, head_size_v] (rows key_stride / value_stride apart) go to the
+// slots of slot_mapping; negative slots are padding. head_size_v 0 means
+// head_size. kv supplies the layout and strides of key_cache / value_cache;
+// entries are stored as x / k_scale (x / v_scale), per kv head with
+// k_head_scales / v_head_scales.
+template <typename scalar_t, typename cache_t>
+void reshape_and_cache(const scalar_t* key, const scalar_t* value, int64_t key_stride,
+                       int64_t value_stride, const int64_t* slot_mapping, int64_t num_tokens,
+                       int num_kv_heads, int head_size, const PagedKV<cache_t>& kv,
+                       cache_t* key_cache, cache_t* value_cache, int head_size_v = 0) {
+  const int bs = kv.block_size;
+  const int vhs = head_size_v > 0 ? head_size_v : head_size;
+  ThreadPool::instance().parallel_for(num_tokens, [&](int64_t i, int) {
+    const int64_t slot = slot_mapping[i];
+    if (slot < 0) {
+      return;
+    }
+    for (int h = 0; h < num_kv_heads; h++) {
+      store_kv_token(kv, key_cache, value_cache, slot / bs, int(slot % bs), h,
+                     key + i * key_stride + h * head_size, value + i * value_stride + h * vhs,
+                     head_size, vhs);
+    }
+  });
+}
+
+}  // namespace cpu
+}  // namespace ater
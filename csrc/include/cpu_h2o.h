@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_h2o.h
+ * @Description: Heavy-hitter (H2O) KV eviction. Decode adds every cached
+ *               token's attention probability, summed over the query rows
+ *               of its kv head, to an accumulated mass; compaction keeps
+ *               the heaviest tokens of the full blocks before the recent
+ *               window, repacks them in place and releases the emptied
+ *               blocks.
+ */
+
+#pragma once
+
+#include "cpu_paged_attention.h"
+
+namespace ater {
+namespace cpu {
+
+// Adds the final softmax probability of every token to mass [num_seqs,
+// num_kv_heads, mass_head_stride] (logical token order), using the partition
+// probabilities p.probs (p.probs_offsets set) and the softmax states of a
+// finished decode.
+inline void accumulate_attention_mass(const PagedAttentionParams& p, const float* exp_sums,
+                                      const float* max_logits, int64_t mass_head_stride,
+                                      float* mass) {
+  const int gqa = p.num_heads / p.num_kv_heads;
+  const int psize = p.partition_size;
+  ThreadPool::instance().parallel_for(
+      int64_t(p.num_seqs) * p.num_kv_heads, [&](int64_t item, int) {
+        const int seq = int(item / p.num_kv_heads);
+        const int kv_head = int(item % p.num_kv_heads);
+        if (!is_decode_seq(p, seq)) {
+          return;
+        }
+        const int ctx = p.context_lens[seq];
+        const int n_parts = num_partitions_of(ctx, psize);
+        float* row_mass = mass + item * mass_head_stride;
+        static thread_local std::vector<float> weights;
+        weights.resize(n_parts);
+        for (int j = 0; j < query_len_of(p, seq); j++) {
+          for (int r = 0; r < gqa; r++) {
+            const int head = j * p.num_heads + kv_head * gqa + r;
+            const int64_t base = workspace_index(p, seq, head, 0);
+            // the normalizer of the reduce, as in fold_partitions
+            float global_max = -std::numeric_limits<float>::infinity();
+            for (int i = 0; i < n_parts; i++) {
+              if (partition_visible(p, seq, i)) {
+                global_max = std::max(global_max, max_logits[base + i]);
+              }
+            }
+            float total = 0.0f;
+            for (int i = 0; i < n_parts; i++) {
+              weights[i] = !partition_visible(p, seq, i) || exp_sums[base + i] == 0.0f
+                               ? 0.0f
+                               : std::exp(max_logits[base + i] - global_max);
+              total += exp_sums[base + i] * weights[i];
+            }
+            if (total <= 0.0f) {
+              continue;
+            }
+            for (int i = 0; i < n_parts; i++) {
+              if (weights[i] == 0.0f) {
+                continue;
+              }
+              const Vec16f w = Vec16f::broadcast(weights[i] / total);
+              const float* prob = p.probs + probs_index(p, seq, head, i);
+              float* dst = row_mass + int64_t(i) * psize;
+              const int n = std::min(psize, ctx - i * psize);
+              for (int t = 0; t < n; t += Vec16f::kSize) {
+                const int m = std::min(Vec16f::kSize, n - t);
+                fma(Vec16f::load_partial(prob + t, m), w, Vec16f::load_partial(dst + t, m))
+                    .store_partial(dst + t, m);
+              }
+            }
+          }
+        }
+      });
+}
+
+// Compacts every sequence whose full blocks before the last recent_tokens
+// tokens outnumber heavy_blocks: per kv head, the heavy_blocks * block_size
+// tokens of those blocks with the largest mass are moved, in order, to the
+// first heavy_blocks blocks (cache entries and mass alike), the remaining
+// blocks of the prefix are dropped from block_tables and context_lens
+// shrinks accordingly. The recent window and the partial blocks are not
+// touched. Compacted blocks must not be shared with other sequences (copy
+// them first). Returns the physical blocks no longer referenced.
+// head_size_v 0 means head_size.
+template <typename cache_t>
+std::vector<int> h2o_compact(const PagedKV<cache_t>& kv, cache_t* key_cache, cache_t* value_cache,
+                             int num_kv_heads, int head_size, int* block_tables,
+                             int max_num_blocks_per_seq, int* context_lens, int num_seqs,
+                             float* mass, int64_t mass_head_stride, int heavy_blocks,
+                             int recent_tokens, int head_size_v = 0) {
+  const int bs = kv.block_size;
+  const int vhs = head_size_v > 0 ? head_size_v : head_size;
+  auto compacted_blocks = [&](int seq) {
+    const int n = std::max(0, context_lens[seq] - recent_tokens) / bs;
+    return n > heavy_blocks ? n : 0;
+  };
+  const int keep = heavy_blocks * bs;
+
+  ThreadPool::instance().parallel_for(int64_t(num_seqs) * num_kv_heads, [&](int64_t item, int) {
+    const int seq = int(item / num_kv_heads);
+    const int h = int(item % num_kv_heads);
+    const int n_cmp = compacted_blocks(seq);
+    if (n_cmp == 0) {
+      return;
+    }
+    const int ctx = context_lens[seq];
+    const int prefix = n_cmp * bs;
+    const int* table = block_tables + int64_t(seq) * max_num_blocks_per_seq;
+    float* row_mass = mass + item * mass_head_stride;
+
+    static thread_local std::vector<int> order;
+    static thread_local std::vector<char> kept;
+    order.resize(prefix);
+    for (int t = 0; t < prefix; t++) {
+      order[t] = t;
+    }
+    // ties (e.g. tokens never attended under a sliding window) go to the
+    // older token, so the selection is deterministic
+    std::nth_element(order.begin(), order.begin() + keep, order.end(), [&](int a, int b) {
+      return row_mass[a] > row_mass[b] || (row_mass[a] == row_mass[b] && a < b);
+    });
+    kept.assign(prefix, 0);
+    for (int i = 0; i < keep; i++) {
+      kept[order[i]] = 1;
+    }
+    // survivors only move towards the front, so one forward pass is in place
+    int dst = 0;
+    for (int src = 0; src < prefix; src++) {
+      if (!kept[src]) {
+        continue;
+      }
+      if (src != dst) {
+        const int64_t sb = table[src / bs], db = table[dst / bs];
+        for (int d = 0; d < head_size; d++) {
+          key_cache[key_offset(kv, db, h, dst % bs, d)] =
+              key_cache[key_offset(kv, sb, h, src % bs, d)];
+        }
+        for (int d = 0; d < vhs; d++) {
+          value_cache[value_offset(kv, db, h, dst % bs, d, vhs)] =
+              value_cache[value_offset(kv, sb, h, src % bs, d, vhs)];
+        }
+        row_mass[dst] = row_mass[src];
+      }
+      dst++;
+    }
+    // the remaining blocks shift down by whole blocks in the block table
+    std::copy(row_mass + prefix, row_mass + ctx, row_mass + keep);
+    std::fill(row_mass + keep + (ctx - prefix), row_mass + ctx, 0.0f);
+  });
+
+  std::vector<int> freed;
+  for (int seq = 0; seq < num_seqs; seq++) {
+    const int n_cmp = compacted_blocks(seq);
+    if (n_cmp == 0) {
+      continue;
+    }
+    int* table = block_tables + int64_t(seq) * max_num_blocks_per_seq;
+    const int n_blocks = (context_lens[seq] + bs - 1) / bs;
+    freed.insert(freed.end(), table + heavy_blocks, table + n_cmp);
+    std::copy(table + n_cmp, table + n_blocks, table + heavy_blocks);
+    std::fill(table + heavy_blocks + (n_blocks - n_cmp), table + n_blocks, 0);
+    context_lens[seq] -= (n_cmp - heavy_blocks) * bs;
+  }
+  return freed;
+}
+
+}  // namespace cpu
+}  // namespace ater
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_merge_attn.h
+ * @Description: Host merge of partial attention results (split KV across
+ *               tiers, processes, or prefix / suffix) into the final output,
+ *               with the softmax-state math of
+ *               paged_attention_ll4mi_reduce_kernel.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "cpu_parallel.h"
+#include "cpu_vec.h"
+
+namespace ater {
+namespace cpu {
+
+// Merges num_partials results for the same num_rows rows (a row is one
+// (token, head)). partial_out is [num_partials, num_rows, head_size], each
+// partial normalized by its own exp sum; max_logits and exp_sums are
+// [num_partials, num_rows]. With M = max_i m_i and
+// G = sum_i s_i * exp(m_i - M):
+//   out = sum_i o_i * s_i * exp(m_i - M) / (G + 1e-6)
+// exp_sums == nullptr means max_logits hold log-sum-exp values (s_i = 1).
+// out_lse, if given, receives M + log(G) per row. Partials with s_i == 0 or
+// m_i == -inf are empty and contribute nothing.
+template <typename scalar_t, typename out_t>
+void merge_attn_states(int num_partials, int64_t num_rows, int head_size,
+                       const scalar_t* partial_out, const float* max_logits,
+                       const float* exp_sums, out_t* out, float* out_lse) {
+  const int hs = head_size;
+  ThreadPool::instance().parallel_for(
+      num_rows,
+      [&](int64_t row, int) {
+        static thread_local std::vector<float> weights;
+        weights.resize(num_partials);
+        float m = -std::numeric_limits<float>::infinity();
+        for (int i = 0; i < num_partials; i++) {
+          const float s = exp_sums != nullptr ? exp_sums[i * num_rows + row] : 1.0f;
+          if (s > 0.0f) {
+            m = std::max(m, max_logits[i * num_rows + row]);
+          }
+        }
+        float sum = 0.0f;
+        for (int i = 0; i < num_partials; i++) {
+          const float s = exp_sums != nullptr ? exp_sums[i * num_rows + row] : 1.0f;
+          const float mi = max_logits[i * num_rows + row];
+          weights[i] = s > 0.0f && mi > -std::numeric_limits<float>::infinity()
+                           ? s * std::exp(mi - m)
+                           : 0.0f;
+          sum += weights[i];
+        }
+        if (out_lse != nullptr) {
+          out_lse[row] = sum > 0.0f ? m + std::log(sum) : -std::numeric_limits<float>::infinity();
+        }
+        const float inv_sum = 1.0f / (sum + 1e-6f);
+        for (int i = 0; i < num_partials; i++) {
+          weights[i] *= inv_sum;
+        }
+
+        out_t* out_row = out + row * hs;
+        for (int d = 0; d < hs; d += Vec16f::kSize) {
+          const int n = std::min(Vec16f::kSize, hs - d);
+          Vec16f acc = Vec16f::zero();
+          for (int i = 0; i < num_partials; i++) {
+            if (weights[i] == 0.0f) {
+              continue;
+            }
+            const scalar_t* src = partial_out + (i * num_rows + row) * hs + d;
+            acc = fma(n == Vec16f::kSize ? load_cvt(src) : load_cvt_partial(src, n),
+                      Vec16f::broadcast(weights[i]), acc);
+          }
+          if (n == Vec16f::kSize) {
+            store_cvt(out_row + d, acc);
+          } else {
+            store_cvt_partial(out_row + d, acc, n);
+          }
+        }
+      },
+      std::max<int64_t>(1, 2048 / hs));
+}
+
+}  // namespace cpu
+}  // namespace ater
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_mla.h
+ * @Description: Host MLA (multi-head latent attention) decode over a paged
+ *               latent cache. Every token is cached once for all heads as
+ *               [kv_c (kv_lora_rank), k_pe (rope_dim)]; with W_UK absorbed
+ *               into the query and W_UV applied to the output by the caller,
+ *               each head attends with
+ *                 logit = scale * (q_c . kv_c + q_pe . k_pe),  out = P kv_c
+ *               i.e. MQA with head_size_qk = kv_lora_rank + rope_dim and
+ *               head_size_v = kv_lora_rank. Same split-KV workspace contract
+ *               and reduce as cpu_paged_attention.h.
+ */
+
+#pragma once
+
+#include "cpu_paged_attention.h"
+
+namespace ater {
+namespace cpu {
+
+// Paged latent cache [num_blocks, block_size, kv_lora_rank + rope_dim], as
+// written by concat_and_cache_mla. Strides are in elements.
+template <typename cache_t>
+struct MLAKVCache {
+  const cache_t* cache;
+  int64_t block_stride;
+  int64_t entry_stride;
+  int block_size;
+  int kv_lora_rank;
+  int rope_dim;
+  float scale;  // dequant scale of the entries (fp8 cache)
+};
+
+// Writes concat(kv_c, k_pe) / scale of every token to its slot; negative
+// slots are padding.
+template <typename scalar_t, typename cache_t>
+void mla_cache_write(const scalar_t* kv_c, int64_t kv_c_stride, const scalar_t* k_pe,
+                     int64_t k_pe_stride, const int64_t* slot_mapping, int64_t num_tokens,
+                     cache_t* kv_cache, int64_t block_stride, int64_t entry_stride,
+                     int block_size, int kv_lora_rank, int rope_dim, float scale) {
+  const float inv_scale = 1.0f / scale;
+  ThreadPool::instance().parallel_for(num_tokens, [&](int64_t i, int) {
+    const int64_t slot = slot_mapping[i];
+    if (slot < 0) {
+      return;
+    }
+    cache_t* entry = kv_cache + slot / block_size * block_stride + slot % block_size * entry_stride;
+    auto write = [&](cache_t* dst, const scalar_t* src, int n) {
+      if constexpr (std::is_same<scalar_t, cache_t>::value) {
+        std::memcpy(dst, src, n * sizeof(cache_t));
+      } else {
+        for (int d = 0; d < n; d++) {
+          dst[d] = from_float<cache_t>(to_float(src[d]) * inv_scale);
+        }
+      }
+    };
+    write(entry, kv_c + i * kv_c_stride, kv_lora_rank);
+    write(entry + kv_lora_rank, k_pe + i * k_pe_stride, rope_dim);
+  });
+}
+
+struct MLADecodeScratch {
+  std::vector<float> q;       // [num_heads, dim], scaled, zero padded
+  std::vector<float> kv;      // [block_size, dim], one block in float
+  std::vector<float> logits;  // [num_heads, partition_size]
+  std::vector<float> acc;     // [num_heads, rank]
+  std::vector<float> row_max;
+  std::vector<float> row_sum;
+
+  static MLADecodeScratch& local() {
+    static thread_local MLADecodeScratch s;
+    return s;
+  }
+};
+
+// One partition of one sequence for all heads: every cache entry is
+// converted to float once and used by all heads. Rows are laid out
+// [kv_c | pad | k_pe | pad] with both parts padded to Vec16f, so QK^T runs
+// over dim = rank + rope floats and PV over the first rank.
+template <typename scalar_t, typename cache_t>
+void mla_decode_partition(const PagedAttentionParams& p, const MLAKVCache<cache_t>& kv,
+                          const scalar_t* query, int seq, int partition, float* exp_sums,
+                          float* max_logits, scalar_t* tmp_out) {
+  constexpr int W = Vec16f::kSize;
+  constexpr int ROW_TILE = 4;
+  constexpr int TOK_TILE = 2;
+  constexpr int PV_ROW_TILE = 8;
+  const int lora = kv.kv_lora_rank;
+  const int rope = kv.rope_dim;
+  const int rank = (lora + W - 1) / W * W;
+  const int dim = rank + (rope + W - 1) / W * W;
+  const int heads = p.num_heads;
+  const int bs = kv.block_size;
+  const int psize = p.partition_size;
+  const int tok_begin = partition * psize;
+  const int tok_end = std::min(p.context_lens[seq], tok_begin + psize);
+  const int num_tokens = tok_end - tok_begin;
+  const int* block_table = p.block_tables + int64_t(seq) * p.max_num_blocks_per_seq;
+
+  MLADecodeScratch& s = MLADecodeScratch::local();
+  s.q.assign(size_t(heads) * dim, 0.0f);
+  s.kv.assign(size_t(bs) * dim, 0.0f);
+  s.logits.resize(size_t(heads) * psize);
+  s.acc.assign(size_t(heads) * rank, 0.0f);
+  s.row_max.resize(heads);
+  s.row_sum.resize(heads);
+
+  const float q_mul = p.scale * kv.scale;
+  for (int h = 0; h < heads; h++) {
+    const scalar_t* q = query + int64_t(seq) * p.q_stride + int64_t(h) * p.q_head_stride;
+    float* dst = &s.q[size_t(h) * dim];
+    for (int d = 0; d < lora; d++) {
+      dst[d] = to_float(q[d]) * q_mul;
+    }
+    for (int d = 0; d < rope; d++) {
+      dst[rank + d] = to_float(q[lora + d]) * q_mul;
+    }
+  }
+
+  auto load_block = [&](int b, int n_valid) {
+    const cache_t* src = kv.cache + int64_t(block_table[b]) * kv.block_stride;
+    for (int t = 0; t < n_valid; t++) {
+      const cache_t* entry = src + t * kv.entry_stride;
+      load_row(&s.kv[size_t(t) * dim], entry, lora);
+      load_row(&s.kv[size_t(t) * dim + rank], entry + lora, rope);
+    }
+  };
+
+  const int first_block = tok_begin / bs;
+  const int last_block = (tok_end - 1) / bs;
+
+  // QK^T
+  for (int b = first_block; b <= last_block; b++) {
+    const int t0 = b * bs;
+    const int n_valid = std::min(bs, tok_end - t0);
+    load_block(b, n_valid);
+    for (int t = 0; t < n_valid; t += TOK_TILE) {
+      const int nt = std::min(TOK_TILE, n_valid - t);
+      for (int r0 = 0; r0 < heads; r0 += ROW_TILE) {
+        const int nr = std::min(ROW_TILE, heads - r0);
+        Vec16f acc[ROW_TILE][TOK_TILE];
+        for (int r = 0; r < ROW_TILE; r++) {
+          for (int u = 0; u < TOK_TILE; u++) {
+            acc[r][u] = Vec16f::zero();
+          }
+        }
+        for (int c = 0; c < dim; c += W) {
+          Vec16f k[TOK_TILE];
+          for (int u = 0; u < nt; u++) {
+            k[u] = Vec16f::load(&s.kv[size_t(t + u) * dim + c]);
+          }
+          for (int r = 0; r < nr; r++) {
+            const Vec16f q = Vec16f::load(&s.q[size_t(r0 + r) * dim + c]);
+            for (int u = 0; u < nt; u++) {
+              acc[r][u] = fma(q, k[u], acc[r][u]);
+            }
+          }
+        }
+        for (int r = 0; r < nr; r++) {
+          for (int u = 0; u < nt; u++) {
+            s.logits[size_t(r0 + r) * psize + (t0 - tok_begin) + t + u] = acc[r][u].reduce_add();
+          }
+        }
+      }
+    }
+  }
+
+  // softmax within the partition
+  for (int h = 0; h < heads; h++) {
+    float* logits = &s.logits[size_t(h) * psize];
+    Vec16f vmax = Vec16f::broadcast(-std::numeric_limits<float>::infinity());
+    int t = 0;
+    for (; t + W <= num_tokens; t += W) {
+      vmax = max(vmax, Vec16f::load(logits + t));
+    }
+    float m = vmax.reduce_max();
+    for (; t < num_tokens; t++) {
+      m = std::max(m, logits[t]);
+    }
+    const Vec16f vm = Vec16f::broadcast(m);
+    Vec16f vsum = Vec16f::zero();
+    for (t = 0; t + W <= num_tokens; t += W) {
+      const Vec16f e = exp(Vec16f::load(logits + t) - vm);
+      e.store(logits + t);
+      vsum = vsum + e;
+    }
+    if (t < num_tokens) {
+      const int n = num_tokens - t;
+      exp(Vec16f::load_partial(logits + t, n) - vm).store_partial(logits + t, n);
+      vsum = vsum + Vec16f::load_partial(logits + t, n);
+    }
+    s.row_max[h] = m;
+    s.row_sum[h] = vsum.reduce_add();
+  }
+
+  // PV over the latent part; the accumulators of a head tile stay in
+  // registers across the tokens of a block
+  for (int b = first_block; b <= last_block; b++) {
+    const int t0 = b * bs;
+    const int n_valid = std::min(bs, tok_end - t0);
+    load_block(b, n_valid);
+    for (int r0 = 0; r0 < heads; r0 += PV_ROW_TILE) {
+      const int nr = std::min(PV_ROW_TILE, heads - r0);
+      const float* prob = &s.logits[size_t(r0) * psize + (t0 - tok_begin)];
+      for (int c = 0; c < rank; c += W) {
+        Vec16f acc[PV_ROW_TILE];
+        for (int r = 0; r < nr; r++) {
+          acc[r] = Vec16f::load(&s.acc[size_t(r0 + r) * rank + c]);
+        }
+        for (int t = 0; t < n_valid; t++) {
+          const Vec16f v = Vec16f::load(&s.kv[size_t(t) * dim + c]);
+          for (int r = 0; r < nr; r++) {
+            acc[r] = fma(v, Vec16f::broadcast(prob[size_t(r) * psize + t]), acc[r]);
+          }
+        }
+        for (int r = 0; r < nr; r++) {
+          acc[r].store(&s.acc[size_t(r0 + r) * rank + c]);
+        }
+      }
+    }
+  }
+
+  for (int h = 0; h < heads; h++) {
+    const int64_t idx = workspace_index(p, seq, h, partition);
+    max_logits[idx] = s.row_max[h];
+    exp_sums[idx] = s.row_sum[h];
+    store_row(tmp_out + idx * lora, &s.acc[size_t(h) * rank], lora, kv.scale / s.row_sum[h]);
+  }
+}
+
+// p describes the batch with num_kv_heads = 1, head_size = kv_lora_rank
+// (the output width) and q_len = 1; query rows are kv_lora_rank + rope_dim
+// wide. out is [num_seqs, num_heads, kv_lora_rank] in the latent space.
+template <typename scalar_t, typename cache_t, typename out_t>
+void mla_decode(const PagedAttentionParams& p, const MLAKVCache<cache_t>& kv,
+                const scalar_t* query, float* exp_sums, float* max_logits, scalar_t* tmp_out,
+                out_t* out) {
+  const DecodePlan plan = plan_decode(p.context_lens, p.num_seqs, 1, p.partition_size);
+  ThreadPool::instance().parallel_for(int64_t(plan.items.size()), [&](int64_t i, int) {
+    const DecodeWorkItem& w = plan.items[i];
+    mla_decode_partition(p, kv, query, w.seq, w.partition, exp_sums, max_logits, tmp_out);
+  });
+  paged_decode_reduce_all(p, exp_sums, max_logits, tmp_out, out);
+}
+
+}  // namespace cpu
+}  // namespace ater
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_ops_common.h
+ * @Description: Torch glue shared by the host attention ops
+ *               (attention_cpu.cpp) and the host cache writers
+ *               (cache_cpu.cpp): dtype mapping, kv cache layout and
+ *               validation, and the kv_cache_dtype dispatch.
+ */
+
+#pragma once
+#include <torch/all.h>
+
+#include "cpu_paged_kv.h"
+#include "cpu_vec.h"
+
+template <typename T>
+struct CpuType {
+  using type = T;
+};
+template <>
+struct CpuType<at::Half> {
+  using type = ater::cpu::fp16_t;
+};
+template <>
+struct CpuType<at::BFloat16> {
+  using type = ater::cpu::bf16_t;
+};
+
+template <typename T>
+typename CpuType<T>::type* cpu_ptr(torch::Tensor& t) {
+  return reinterpret_cast<typename CpuType<T>::type*>(t.data_ptr<T>());
+}
+
+// The layout the cache was written in (see cpu_paged_kv.h): a 4-D key_cache
+// is reshape_and_cache_flash, a 5-D value_cache reshape_and_cache with
+// asm_layout.
+inline ater::cpu::KVLayout kv_layout_of(const torch::Tensor& key_cache,
+                                        const torch::Tensor& value_cache) {
+  if (key_cache.dim() == 4) {
+    return ater::cpu::KVLayout::kFlash;
+  }
+  return value_cache.dim() == 5 ? ater::cpu::KVLayout::kAsm
+                                : ater::cpu::KVLayout::kVllm;
+}
+
+// Head size of V as stored in value_cache; it may differ from the Q / K
+// head size (hdim_qk != hdim_v).
+inline int64_t value_head_size_of(const torch::Tensor& key_cache,
+                                  const torch::Tensor& value_cache) {
+  switch (kv_layout_of(key_cache, value_cache)) {
+    case ater::cpu::KVLayout::kFlash:
+    case ater::cpu::KVLayout::kAsm:
+      return value_cache.size(3);
+    default:
+      return value_cache.size(2);
+  }
+}
+
+inline void check_kv_cache(const torch::Tensor& key_cache,
+                           const torch::Tensor& value_cache,
+                           int64_t num_kv_heads, int64_t head_size,
+                           int64_t block_size, int64_t head_size_v) {
+  TORCH_CHECK(key_cache.is_contiguous() && value_cache.is_contiguous(),
+              "kv cache must be contiguous");
+  const int64_t x = 16 / key_cache.element_size();
+  const int64_t num_blocks = key_cache.size(0);
+  switch (kv_layout_of(key_cache, value_cache)) {
+    case ater::cpu::KVLayout::kFlash:
+      TORCH_CHECK(key_cache.sizes() ==
+                          torch::IntArrayRef({num_blocks, block_size,
+                                              num_kv_heads, head_size}) &&
+                      value_cache.sizes() ==
+                          torch::IntArrayRef({num_blocks, block_size,
+                                              num_kv_heads, head_size_v}) &&
+                      head_size % x == 0,
+                  "flash kv cache must be [num_blocks, block_size, "
+                  "num_kv_heads, head_size (head_size_v)] with head_size a "
+                  "multiple of x = 16 / element_size");
+      break;
+    case ater::cpu::KVLayout::kAsm:
+      TORCH_CHECK(value_cache.sizes() ==
+                      torch::IntArrayRef({num_blocks, num_kv_heads,
+                                          block_size / x, head_size_v, x}) &&
+                      block_size % x == 0,
+                  "asm value_cache must be [num_blocks, num_kv_heads, "
+                  "block_size/x, head_size_v, x]");
+      [[fallthrough]];
+    default:
+      TORCH_CHECK(key_cache.dim() == 5 &&
+                      key_cache.sizes() ==
+                          torch::IntArrayRef({num_blocks, num_kv_heads,
+                                              head_size / x, block_size, x}) &&
+                      head_size % x == 0,
+                  "key_cache must be [num_blocks, num_kv_heads, head_size/x, "
+                  "block_size, x] with x = 16 / element_size");
+      TORCH_CHECK(value_cache.dim() == 5 ||
+                      value_cache.sizes() ==
+                          torch::IntArrayRef({num_blocks, num_kv_heads,
+                                              head_size_v, block_size}),
+                  "value_cache must be [num_blocks, num_kv_heads, head_size_v, "
+                  "block_size]");
+      break;
+  }
+}
+
+// Per kv head fp8 scales [num_kv_heads] float32, used in place of the scalar
+// k_scale / v_scale.
+inline void check_head_scales(
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales, int64_t num_kv_heads,
+    const std::string& kv_cache_dtype) {
+  TORCH_CHECK(k_head_scales.has_value() == v_head_scales.has_value(),
+              "k_head_scales and v_head_scales go together");
+  if (!k_head_scales) {
+    return;
+  }
+  TORCH_CHECK(kv_cache_dtype != "auto",
+              "per-head kv scales need a quantized kv cache");
+  for (const torch::Tensor* t :
+       {&k_head_scales.value(), &v_head_scales.value()}) {
+    TORCH_CHECK(t->device().is_cpu() && t->dtype() == at::ScalarType::Float &&
+                    t->is_contiguous() && t->numel() == num_kv_heads,
+                "k_head_scales / v_head_scales must be contiguous float32 "
+                "[num_kv_heads] CPU tensors");
+  }
+}
+
+template <typename KVT>
+ater::cpu::PagedKV<KVT> make_paged_kv(
+    torch::Tensor& key_cache, torch::Tensor& value_cache,
+    const int block_size, float k_scale, float v_scale,
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales) {
+  ater::cpu::PagedKV<KVT> kv;
+  kv.k_cache = reinterpret_cast<const KVT*>(key_cache.data_ptr());
+  kv.v_cache = reinterpret_cast<const KVT*>(value_cache.data_ptr());
+  kv.layout = kv_layout_of(key_cache, value_cache);
+  kv.k_block_stride = key_cache.stride(0);
+  kv.v_block_stride = value_cache.stride(0);
+  if (kv.layout == ater::cpu::KVLayout::kFlash) {
+    kv.k_token_stride = key_cache.stride(1);
+    kv.k_head_stride = key_cache.stride(2);
+    kv.v_token_stride = value_cache.stride(1);
+    kv.v_head_stride = value_cache.stride(2);
+  } else {
+    kv.k_head_stride = key_cache.stride(1);
+    kv.v_head_stride = value_cache.stride(1);
+  }
+  kv.block_size = block_size;
+  kv.k_scale = k_scale;
+  kv.v_scale = v_scale;
+  if (k_head_scales) {
+    kv.k_head_scales = k_head_scales.value().data_ptr<float>();
+    kv.v_head_scales = v_head_scales.value().data_ptr<float>();
+  }
+  return kv;
+}
+
+// Channel-wise key min / max of every block (see cpu_block_sparse.h).
+inline void check_key_summaries(const torch::Tensor& key_summaries,
+                                int64_t num_blocks, int64_t num_kv_heads,
+                                int64_t head_size) {
+  TORCH_CHECK(key_summaries.device().is_cpu() &&
+                  key_summaries.dtype() == at::ScalarType::Float &&
+                  key_summaries.is_contiguous() &&
+                  key_summaries.sizes() ==
+                      torch::IntArrayRef({num_blocks, num_kv_heads, 2,
+                                          head_size}),
+              "key_summaries must be a contiguous float32 [num_blocks, "
+              "num_kv_heads, 2, head_size] CPU tensor");
+}
+
+// Activation dtype against a kv_cache_dtype cache: calls FN(T, KVT).
+#define CPU_DISPATCH_BY_KV_CACHE_DTYPE(DTYPE, KV_CACHE_DTYPE, CACHE_DTYPE, FN) \
+  if (KV_CACHE_DTYPE == "auto") {                                              \
+    TORCH_CHECK(CACHE_DTYPE == DTYPE,                                          \
+                "kv cache dtype must match for kv_cache_dtype=auto");          \
+    if (DTYPE == at::ScalarType::Half) {                                       \
+      FN(at::Half, ater::cpu::fp16_t);                                         \
+    } else if (DTYPE == at::ScalarType::BFloat16) {                            \
+      FN(at::BFloat16, ater::cpu::bf16_t);                                     \
+    } else if (DTYPE == at::ScalarType::Float) {                               \
+      FN(float, float);                                                        \
+    } else {                                                                   \
+      TORCH_CHECK(false, "Unsupported data type: ", DTYPE);                    \
+    }                                                                          \
+  } else if (KV_CACHE_DTYPE == "fp8" || KV_CACHE_DTYPE == "fp8_e4m3") {        \
+    if (DTYPE == at::ScalarType::Half) {                                       \
+      FN(at::Half, ater::cpu::fp8_e4m3fnuz_t);                                 \
+    } else if (DTYPE == at::ScalarType::BFloat16) {                            \
+      FN(at::BFloat16, ater::cpu::fp8_e4m3fnuz_t);                             \
+    } else if (DTYPE == at::ScalarType::Float) {                               \
+      FN(float, ater::cpu::fp8_e4m3fnuz_t);                                    \
+    } else {                                                                   \
+      TORCH_CHECK(false, "Unsupported data type: ", DTYPE);                    \
+    }                                                                          \
+  } else {                                                                     \
+    TORCH_CHECK(false, "Unsupported KV cache dtype: ", KV_CACHE_DTYPE);        \
+  }
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_paged_append.h
+ * @Description: Fused decode step: stores each sequence's new key / value in
+ *               its cache slot and attends over the cache in the same
+ *               parallel region. The partitions read the tokens already in
+ *               the cache; the one holding the new position folds the new
+ *               token into its softmax state straight from the input rows,
+ *               so it is written once and never read back.
+ */
+
+#pragma once
+
+#include "cpu_cache_write.h"
+#include "cpu_paged_attention.h"
+
+namespace ater {
+namespace cpu {
+
+// Folds the new token of (seq, kv_head) into the partition state of its query
+// heads. k / v are the token as stored in the cache (cache dtype, unscaled),
+// widened to float; `empty` marks a partition without cached tokens, whose
+// state is just the new token's. p_old is the params of the cached tokens:
+// the new token sits at position p_old.context_lens[seq].
+template <typename scalar_t, typename cache_t>
+void append_token_rows(const PagedAttentionParams& p_old, const PagedKV<cache_t>& kv,
+                       const scalar_t* query, int seq, int kv_head, int partition,
+                       const float* k, const float* v, bool empty, float* exp_sums,
+                       float* max_logits, scalar_t* tmp_out) {
+  const int gqa = p_old.num_heads / p_old.num_kv_heads;
+  const int hs = p_old.head_size;
+  const int vhs = head_size_v_of(p_old);
+  const float q_mul = p_old.scale * kv.k_scale_of(kv_head);
+  const float v_mul = kv.v_scale_of(kv_head);
+  for (int r = 0; r < gqa; r++) {
+    const int head = kv_head * gqa + r;
+    const scalar_t* q = query + seq * p_old.q_stride + head * p_old.q_head_stride;
+    Vec16f acc = Vec16f::broadcast(0.0f);
+    for (int d = 0; d < hs; d += Vec16f::kSize) {
+      const int n = std::min(Vec16f::kSize, hs - d);
+      const Vec16f qv = n == Vec16f::kSize ? load_cvt(q + d) : load_cvt_partial(q + d, n);
+      acc = fma(qv, Vec16f::load_partial(k + d, n), acc);
+    }
+    float logit = acc.reduce_add() * q_mul;
+    // the cached tokens' ALiBi bias is relative to the old length (the
+    // kernel's limit), one position behind the new token
+    if (p_old.alibi_slopes != nullptr) {
+      logit += p_old.alibi_slopes[head];
+    }
+
+    const int64_t idx = workspace_index(p_old, seq, head, partition);
+    scalar_t* row = tmp_out + idx * vhs;
+    const float m_old = empty ? -std::numeric_limits<float>::infinity() : max_logits[idx];
+    const float s_old = empty ? 0.0f : exp_sums[idx];
+    const float m = std::max(m_old, logit);
+    const float a = s_old > 0.0f ? s_old * std::exp(m_old - m) : 0.0f;
+    const float b = std::exp(logit - m);
+    const float inv = 1.0f / (a + b);
+    const Vec16f wa = Vec16f::broadcast(a * inv);
+    const Vec16f wb = Vec16f::broadcast(b * inv * v_mul);
+    for (int d = 0; d < vhs; d += Vec16f::kSize) {
+      const int n = std::min(Vec16f::kSize, vhs - d);
+      const Vec16f prev = a == 0.0f             ? Vec16f::broadcast(0.0f)
+                          : n == Vec16f::kSize ? load_cvt(row + d)
+                                               : load_cvt_partial(row + d, n);
+      const Vec16f o = fma(Vec16f::load_partial(v + d, n), wb, prev * wa);
+      if (n == Vec16f::kSize) {
+        store_cvt(row + d, o);
+      } else {
+        store_cvt_partial(row + d, o, n);
+      }
+    }
+    max_logits[idx] = m;
+    exp_sums[idx] = a + b;
+  }
+}
+
+// One decode step with q_len 1 over the dense workspace. p.context_lens
+// include the new token; key [num_seqs, num_kv_heads, head_size] / value
+// [num_seqs, num_kv_heads, head_size_v] (rows key_stride / value_stride
+// apart) go to slot_mapping[seq], as reshape_and_cache stores them. A
+// negative slot means the sequence appends nothing and attends over its
+// context_lens tokens as they are. Sliding windows, per-token scales and the
+// attention mass are not supported.
+template <typename scalar_t, typename cache_t, typename out_t>
+void paged_attention_append_decode(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                                   const scalar_t* query, const scalar_t* key,
+                                   const scalar_t* value, int64_t key_stride,
+                                   int64_t value_stride, const int64_t* slot_mapping,
+                                   cache_t* key_cache, cache_t* value_cache, float* exp_sums,
+                                   float* max_logits, scalar_t* tmp_out, out_t* out) {
+  const int psize = p.partition_size;
+  const int hs = p.head_size;
+  const int vhs = head_size_v_of(p);
+  std::vector<int> old_lens(p.num_seqs);
+  for (int i = 0; i < p.num_seqs; i++) {
+    old_lens[i] = slot_mapping[i] < 0 ? p.context_lens[i] : p.context_lens[i] - 1;
+  }
+  // the cached tokens only: same workspace rows (dense), shorter causal limit
+  PagedAttentionParams p_old = p;
+  p_old.context_lens = old_lens.data();
+
+  // items cover the partitions of the new lengths, so the one opened by the
+  // new token gets its item as well
+  const DecodePlan plan = plan_decode(p.context_lens, p.num_seqs, p.num_kv_heads, psize);
+  ThreadPool::instance().parallel_for(int64_t(plan.items.size()), [&](int64_t i, int) {
+    const DecodeWorkItem& w = plan.items[i];
+    const int tok_begin = w.partition * psize;
+    const int old_len = old_lens[w.seq];
+    const bool empty = tok_begin >= old_len;
+    if (!empty) {
+      paged_decode_partition(p_old, kv, query, w, exp_sums, max_logits, tmp_out);
+    }
+    const int64_t slot = slot_mapping[w.seq];
+    if (slot < 0 || old_len >= tok_begin + psize) {
+      return;
+    }
+    // the new token's block belongs to this partition alone (partitions are
+    // block aligned), and its reads above are done
+    const scalar_t* k = key + w.seq * key_stride + int64_t(w.kv_head) * hs;
+    const scalar_t* v = value + w.seq * value_stride + int64_t(w.kv_head) * vhs;
+    store_kv_token(kv, key_cache, value_cache, slot / kv.block_size,
+                   int(slot % kv.block_size), w.kv_head, k, v, hs, vhs);
+    // attend to the token exactly as a later step will read it back
+    static thread_local std::vector<float> kf, vf;
+    kf.resize(hs);
+    vf.resize(vhs);
+    const float inv_k = 1.0f / kv.k_scale_of(w.kv_head);
+    const float inv_v = 1.0f / kv.v_scale_of(w.kv_head);
+    for (int d = 0; d < hs; d++) {
+      kf[d] = to_float(to_cache<scalar_t, cache_t>(k[d], inv_k));
+    }
+    for (int d = 0; d < vhs; d++) {
+      vf[d] = to_float(to_cache<scalar_t, cache_t>(v[d], inv_v));
+    }
+    append_token_rows(p_old, kv, query, w.seq, w.kv_head, w.partition, kf.data(), vf.data(),
+                      empty, exp_sums, max_logits, tmp_out);
+  });
+  paged_decode_reduce_all(p, exp_sums, max_logits, tmp_out, out);
+}
+
+}  // namespace cpu
+}  // namespace ater
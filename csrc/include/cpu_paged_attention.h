@@ -0,0 +1,1087 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_paged_attention.h
+ * @Description: Host paged-attention decode engine. Reads any cache layout
+ *               of cpu_paged_kv.h and honors the same partition-then-reduce
+ *               contract as
+ *               paged_attention_ll4mi_QKV_mfma16_kernel +
+ *               paged_attention_ll4mi_reduce_kernel:
+ *                 max_logits[s][h][p] = max of the scaled logits of partition p
+ *                 exp_sums[s][h][p]   = sum(exp(logit - max_logits[s][h][p]))
+ *                 tmp_out[s][h][p][:] = partition output / exp_sums[s][h][p]
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <type_traits>
+#include <vector>
+
+#include "cpu_paged_kv.h"
+#include "cpu_parallel.h"
+#include "cpu_vec.h"
+
+namespace ater {
+namespace cpu {
+
+struct PagedAttentionParams {
+  int num_seqs;
+  int num_heads;
+  int num_kv_heads;
+  int head_size;
+  float scale;
+  // Query tokens per sequence (> 1 for speculative decode verification);
+  // query row (seq, j) is seq * q_len + j. Token j attends causally to the
+  // first context_len - q_len + j + 1 cached tokens, i.e. the draft tokens
+  // are already appended to the cache.
+  int q_len;
+  // Variable query lengths instead of q_len: [num_seqs + 1] prefix sum, query
+  // rows of seq are [cu_seqlens_q[seq], cu_seqlens_q[seq + 1]). Only
+  // sequences with at most kMaxDecodeQueryLen rows take the split-KV decode
+  // path; longer ones are prefill (see cpu_paged_prefill.h). Requires the
+  // ragged workspace.
+  const int* cu_seqlens_q;
+  int64_t q_stride;       // stride between query rows
+  int64_t q_head_stride;  // stride between heads
+  const int* block_tables;  // [num_seqs, max_num_blocks_per_seq]
+  int max_num_blocks_per_seq;
+  const int* context_lens;    // [num_seqs]
+  const float* alibi_slopes;  // [num_heads] or nullptr
+  // Sliding window: a query at position i sees cached tokens
+  // (i - window_size, i] plus the first num_sink_tokens tokens (attention
+  // sinks). window_size <= 0 disables both.
+  int window_size;
+  int num_sink_tokens;
+  int partition_size;         // multiple of block_size
+  int max_num_partitions;     // last dim of exp_sums / max_logits
+  // Ragged workspace: prefix sum of per-sequence partition counts
+  // [num_seqs + 1]. Sequence s owns rows [offsets[s] * H, offsets[s + 1] * H)
+  // of exp_sums / max_logits / tmp_out, head-major, with H = q_len * num_heads.
+  // With cu_seqlens_q the counts are already multiplied by each sequence's
+  // query length (and zero for prefill sequences) and H = num_heads.
+  // nullptr selects the dense [num_seqs * q_len, num_heads, max_num_partitions]
+  // layout.
+  const int* partition_offsets;
+  // The reduce stores out / out_scale: the fp8_out_scale of a quantized
+  // (fp8_e4m3fnuz_t) out.
+  float out_scale = 1.0f;
+  // Per kv head block tables (block-sparse decode, cpu_block_sparse.h): the
+  // table of (seq, kv_head) starts at seq * max_num_blocks_per_seq +
+  // kv_head * block_table_head_stride. 0 shares one table across heads.
+  int block_table_head_stride = 0;
+  // Optional token probabilities exp(logit - max_logits) of the computed
+  // partitions, for the attention mass of cpu_h2o.h. Packed by sequence:
+  // (seq, head) owns context_len floats from probs_offsets[seq] +
+  // head * context_len on (see probs_index / ragged_probs_offsets).
+  float* probs = nullptr;
+  const int64_t* probs_offsets = nullptr;
+  // Head size of V, and so of out / tmp_out, when it differs from the Q / K
+  // head_size (DeepSeek prefill: 192 / 128, cross-attention); 0 means
+  // head_size.
+  int head_size_v = 0;
+};
+
+inline int head_size_v_of(const PagedAttentionParams& p) {
+  return p.head_size_v > 0 ? p.head_size_v : p.head_size;
+}
+
+// One unit of decode work: all query heads (of all q_len query tokens) of
+// one kv head over one partition of one sequence.
+struct DecodeWorkItem {
+  int seq;
+  int kv_head;
+  int partition;
+};
+
+inline int num_partitions_of(int context_len, int partition_size) {
+  return (context_len + partition_size - 1) / partition_size;
+}
+
+// Longest per-sequence query that still takes the split-KV decode path.
+constexpr int kMaxDecodeQueryLen = 8;
+
+inline int query_len_of(const PagedAttentionParams& p, int seq) {
+  return p.cu_seqlens_q != nullptr ? p.cu_seqlens_q[seq + 1] - p.cu_seqlens_q[seq] : p.q_len;
+}
+
+inline int64_t query_start_of(const PagedAttentionParams& p, int seq) {
+  return p.cu_seqlens_q != nullptr ? p.cu_seqlens_q[seq] : int64_t(seq) * p.q_len;
+}
+
+inline bool is_decode_seq(const PagedAttentionParams& p, int seq) {
+  return p.cu_seqlens_q == nullptr || query_len_of(p, seq) <= kMaxDecodeQueryLen;
+}
+
+// First token past the sinks that a query row with causal limit `limit`
+// (it sees tokens < limit) can attend to.
+inline int window_begin(const PagedAttentionParams& p, int limit) {
+  return p.window_size > 0 ? std::max(0, limit - p.window_size) : 0;
+}
+
+inline bool is_sink_token(const PagedAttentionParams& p, int t) {
+  return p.window_size > 0 && t < p.num_sink_tokens;
+}
+
+// Whether any query row of seq attends to a token in [begin, end). Rows'
+// windows start no earlier than that of the first query token, so tokens
+// outside the sinks and before it are never read.
+inline bool range_visible(const PagedAttentionParams& p, int seq, int begin, int end) {
+  if (p.window_size <= 0 || begin < p.num_sink_tokens) {
+    return true;
+  }
+  const int first_limit = p.context_lens[seq] - query_len_of(p, seq) + 1;
+  return end > window_begin(p, first_limit);
+}
+
+inline bool partition_visible(const PagedAttentionParams& p, int seq, int partition) {
+  const int begin = partition * p.partition_size;
+  return range_visible(p, seq, begin,
+                       std::min(p.context_lens[seq], begin + p.partition_size));
+}
+
+// Output rows of a sequence: one per (query token, head).
+inline int heads_of(const PagedAttentionParams& p, int seq) {
+  return query_len_of(p, seq) * p.num_heads;
+}
+
+// Row of exp_sums / max_logits (and tmp_out, times head_size_v) holding
+// (seq, head, partition), with head = j * num_heads + query head for query
+// token j.
+inline int64_t workspace_index(const PagedAttentionParams& p, int seq, int head, int partition) {
+  if (p.partition_offsets != nullptr) {
+    const int64_t begin = p.partition_offsets[seq];
+    const int64_t n = num_partitions_of(p.context_lens[seq], p.partition_size);
+    const int64_t rows = p.cu_seqlens_q != nullptr ? p.num_heads : int64_t(p.q_len) * p.num_heads;
+    return (begin * rows + head * n) + partition;
+  }
+  return (int64_t(seq) * p.q_len * p.num_heads + head) * p.max_num_partitions + partition;
+}
+
+// First of the probs of (seq, head, partition), head as in workspace_index.
+inline int64_t probs_index(const PagedAttentionParams& p, int seq, int head, int partition) {
+  return p.probs_offsets[seq] + int64_t(head) * p.context_lens[seq] +
+         int64_t(partition) * p.partition_size;
+}
+
+// Fills offsets[0..num_seqs] for probs and returns the total: each decode
+// sequence holds heads_of(seq) * context_len floats, i.e. the probabilities
+// of the tokens it actually attends to, not a max_context_len-wide row.
+inline int64_t ragged_probs_offsets(const PagedAttentionParams& p, int64_t* offsets) {
+  int64_t total = 0;
+  for (int i = 0; i < p.num_seqs; i++) {
+    offsets[i] = total;
+    if (is_decode_seq(p, i)) {
+      total += int64_t(heads_of(p, i)) * p.context_lens[i];
+    }
+  }
+  offsets[p.num_seqs] = total;
+  return total;
+}
+
+// Fills offsets[0..num_seqs] with the prefix sum of per-sequence partition
+// counts and returns the total, i.e. the ragged workspace holds
+// total * q_len * num_heads rows instead of
+// num_seqs * q_len * num_heads * max_num_partitions.
+inline int64_t ragged_partition_offsets(const int* context_lens, int num_seqs, int partition_size,
+                                        int* offsets) {
+  int64_t total = 0;
+  for (int i = 0; i < num_seqs; i++) {
+    offsets[i] = int(total);
+    total += num_partitions_of(context_lens[i], partition_size);
+  }
+  offsets[num_seqs] = int(total);
+  return total;
+}
+
+// Ragged offsets for a cu_seqlens_q batch: decode sequences get
+// num_partitions * query_len slots, prefill sequences none. The workspace
+// holds total * num_heads rows.
+inline int64_t varlen_partition_offsets(const PagedAttentionParams& p, int* offsets) {
+  int64_t total = 0;
+  for (int i = 0; i < p.num_seqs; i++) {
+    offsets[i] = int(total);
+    if (is_decode_seq(p, i)) {
+      total += int64_t(num_partitions_of(p.context_lens[i], p.partition_size)) * query_len_of(p, i);
+    }
+  }
+  offsets[p.num_seqs] = int(total);
+  return total;
+}
+
+////// row helpers ///////
+
+template <typename T>
+inline void load_row(float* dst, const T* src, int n) {
+  int i = 0;
+  for (; i + Vec16f::kSize <= n; i += Vec16f::kSize) {
+    load_cvt(src + i).store(dst + i);
+  }
+  if (i < n) {
+    load_cvt_partial(src + i, n - i).store_partial(dst + i, n - i);
+  }
+}
+
+template <typename T>
+inline void store_row(T* dst, const float* src, int n, float mul = 1.0f) {
+  const Vec16f m = Vec16f::broadcast(mul);
+  int i = 0;
+  for (; i + Vec16f::kSize <= n; i += Vec16f::kSize) {
+    store_cvt(dst + i, Vec16f::load(src + i) * m);
+  }
+  if (i < n) {
+    store_cvt_partial(dst + i, Vec16f::load_partial(src + i, n - i) * m, n - i);
+  }
+}
+
+////// decode: one (seq, kv_head, partition) ///////
+
+struct DecodeScratch {
+  std::vector<Vec16f> q_lanes;  // [rows, head_size / x] x-periodic copies of q
+  std::vector<Vec16f> v_acc;    // [rows, head_size_v], lane = token in chunk
+  std::vector<float> logits;    // [rows, partition_size]
+  std::vector<float> out_row;   // [head_size_v]
+  std::vector<float> row_max;   // [rows]
+  std::vector<float> row_sum;   // [rows]
+  std::vector<int> row_seq;     // [rows] sequence of the row
+  std::vector<int> row_token;   // [rows] query token of the row
+  std::vector<int> row_head;    // [rows] query head of the row
+  std::vector<int8_t> q_i8;     // [rows, head_size] int8 q for an int8 cache
+  std::vector<float> q_deq;     // [rows] dequant factor of q_i8 dots
+  std::vector<int32_t> q_bias;  // [rows] 128 * sum(q_i8), see DotS8
+
+  static DecodeScratch& local() {
+    static thread_local DecodeScratch s;
+    return s;
+  }
+};
+
+// Scaled logits of one int8 K block for all rows of s (q_i8 / q_deq /
+// q_bias set): logits[r * logits_stride + t] for tokens t < n_valid.
+inline void paged_qk_block_s8(const DecodeScratch& s, const int8_t* k_block, int bs, int n_valid,
+                              int hs, int rows, float* logits, int logits_stride) {
+  constexpr int X = 16;
+  constexpr int ROW_TILE = 8;
+  constexpr int T = DotS8::kTokens;
+  const int n_chunks = hs / X;
+  for (int t = 0; t < n_valid; t += T) {
+    const int nt = std::min(T, n_valid - t);
+    for (int r0 = 0; r0 < rows; r0 += ROW_TILE) {
+      const int nr = std::min(ROW_TILE, rows - r0);
+      DotS8 acc[ROW_TILE];
+      for (int r = 0; r < nr; r++) {
+        acc[r] = DotS8::zero();
+      }
+      for (int c = 0; c < n_chunks; c++) {
+        const DotS8::KRows k = DotS8::load_k(k_block + (int64_t(c) * bs + t) * X, nt);
+        const int8_t* q = &s.q_i8[size_t(r0) * hs + c * X];
+        for (int r = 0; r < nr; r++) {
+          acc[r].add(k, q + size_t(r) * hs);
+        }
+      }
+      for (int r = 0; r < nr; r++) {
+        int32_t dots[T];
+        acc[r].store(dots);
+        float* row = logits + size_t(r0 + r) * logits_stride + t;
+        for (int u = 0; u < nt; u++) {
+          row[u] = float(dots[u] - s.q_bias[r0 + r]) * s.q_deq[r0 + r];
+        }
+      }
+    }
+  }
+}
+
+// One partition of one kv head for the query rows of all sequences in
+// seqs[0, num_seqs), which must map the partition to the same KV blocks
+// (seqs[0]'s block table is read). Each sequence's rows are written to its
+// own workspace slots, so a shared-prefix partition is read once for all of
+// them and the reduce merges it like any other partition.
+// LAYOUT is kv.layout. HEAD_SIZE / HEAD_SIZE_V / BLOCK_SIZE > 0 fix the
+// shape at compile time (see decode_kernel_registry); 0 takes it from p / kv.
+template <typename scalar_t, typename cache_t, KVLayout LAYOUT, int HEAD_SIZE = 0,
+          int HEAD_SIZE_V = 0, int BLOCK_SIZE = 0>
+void paged_decode_partition_rows_kernel(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                                        const scalar_t* query, const int* seqs, int num_seqs,
+                                        int kv_head, int partition, float* exp_sums,
+                                        float* max_logits, scalar_t* tmp_out) {
+  constexpr int X = PagedKV<cache_t>::X;
+  constexpr int TPV = Vec16f::kSize / X;  // tokens covered by one K vector
+  constexpr int ROW_TILE = 8;
+  const int hs = HEAD_SIZE > 0 ? HEAD_SIZE : p.head_size;
+  const int vhs = HEAD_SIZE_V > 0 ? HEAD_SIZE_V : head_size_v_of(p);
+  const int bs = BLOCK_SIZE > 0 ? BLOCK_SIZE : kv.block_size;
+  const int psize = p.partition_size;
+  const int gqa = p.num_heads / p.num_kv_heads;
+  const int head0 = kv_head * gqa;
+  const int n_chunks = hs / X;
+
+  const KVBlockReader<cache_t, LAYOUT> blocks(kv, hs, vhs);
+
+  const int tok_begin = partition * psize;
+  const int tok_end = std::min(p.context_lens[seqs[0]], tok_begin + psize);
+  const int num_tokens = tok_end - tok_begin;
+  const int* block_table = p.block_tables + int64_t(seqs[0]) * p.max_num_blocks_per_seq +
+                           int64_t(kv_head) * p.block_table_head_stride;
+
+  // With a sliding window, blocks past the sinks that end before the earliest
+  // window start of any row are never loaded; a partition made only of such
+  // blocks is not computed at all (the reduce skips it too).
+  int window_lo = tok_begin;
+  if (p.window_size > 0) {
+    window_lo = tok_end;
+    for (int i = 0; i < num_seqs; i++) {
+      window_lo = std::min(window_lo, window_begin(p, p.context_lens[seqs[i]] -
+                                                          query_len_of(p, seqs[i]) + 1));
+    }
+  }
+  auto block_skipped = [&](int t0, int n) { return t0 + n <= window_lo && !is_sink_token(p, t0); };
+  if (block_skipped(tok_begin, num_tokens)) {
+    return;
+  }
+
+  // rows of a sequence are j * gqa + r for query token j and GQA head r
+  DecodeScratch& s = DecodeScratch::local();
+  s.row_seq.clear();
+  s.row_token.clear();
+  s.row_head.clear();
+  for (int i = 0; i < num_seqs; i++) {
+    const int q_len = query_len_of(p, seqs[i]);
+    for (int j = 0; j < q_len; j++) {
+      for (int r = 0; r < gqa; r++) {
+        s.row_seq.push_back(seqs[i]);
+        s.row_token.push_back(j);
+        s.row_head.push_back(head0 + r);
+      }
+    }
+  }
+  const int rows = int(s.row_seq.size());
+  s.q_lanes.resize(size_t(rows) * n_chunks);
+  s.v_acc.resize(size_t(rows) * vhs);
+  s.logits.resize(size_t(rows) * psize);
+  s.out_row.resize(vhs);
+  s.row_max.resize(rows);
+  s.row_sum.resize(rows);
+
+  // q * scale * k_scale, laid out to match a [TPV tokens x X dims] K vector;
+  // against an int8 cache q is quantized per row instead and QK^T runs on
+  // int8 dot products
+  constexpr bool kInt8Dot = std::is_same<cache_t, int8_t>::value;
+  const float q_mul = p.scale * kv.k_scale_of(kv_head);
+  if (kInt8Dot) {
+    s.q_i8.resize(size_t(rows) * hs);
+    s.q_deq.resize(rows);
+    s.q_bias.resize(rows);
+  }
+  for (int r = 0; r < rows; r++) {
+    const scalar_t* q = query + (query_start_of(p, s.row_seq[r]) + s.row_token[r]) * p.q_stride +
+                        int64_t(s.row_head[r]) * p.q_head_stride;
+    if (kInt8Dot) {
+      float amax = 0.0f;
+      for (int d = 0; d < hs; d++) {
+        amax = std::max(amax, std::abs(to_float(q[d])));
+      }
+      const float inv = amax > 0.0f ? 127.0f / amax : 0.0f;
+      int32_t sum = 0;
+      for (int d = 0; d < hs; d++) {
+        const int8_t v = int8_t(std::nearbyint(to_float(q[d]) * inv));
+        s.q_i8[size_t(r) * hs + d] = v;
+        sum += v;
+      }
+      s.q_deq[r] = amax / 127.0f * q_mul;
+      s.q_bias[r] = 128 * sum;
+      continue;
+    }
+    for (int c = 0; c < n_chunks; c++) {
+      alignas(64) float lanes[Vec16f::kSize];
+      for (int j = 0; j < Vec16f::kSize; j++) {
+        lanes[j] = to_float(q[c * X + j % X]) * q_mul;
+      }
+      s.q_lanes[r * n_chunks + c] = Vec16f::load(lanes);
+    }
+  }
+
+  // QK^T
+  const int first_block = tok_begin / bs;
+  const int last_block = (tok_end - 1) / bs;
+  for (int b = first_block; b <= last_block; b++) {
+    const int64_t block = block_table[b];
+    const int t0 = b * bs;
+    const int n_valid = std::min(bs, tok_end - t0);
+    if (block_skipped(t0, n_valid)) {
+      continue;
+    }
+    const cache_t* k_block = blocks.k(block, kv_head, n_valid);
+    if (kInt8Dot) {
+      paged_qk_block_s8(s, reinterpret_cast<const int8_t*>(k_block), bs, n_valid, hs, rows,
+                        &s.logits[t0 - tok_begin], psize);
+    } else {
+      const int n_groups = (n_valid + TPV - 1) / TPV;
+      for (int g = 0; g < n_groups; g++) {
+        for (int r0 = 0; r0 < rows; r0 += ROW_TILE) {
+          const int nr = std::min(ROW_TILE, rows - r0);
+          Vec16f acc[ROW_TILE];
+          for (int r = 0; r < nr; r++) {
+            acc[r] = Vec16f::zero();
+          }
+          for (int c = 0; c < n_chunks; c++) {
+            const Vec16f k = load_cvt(k_block + (int64_t(c) * bs + g * TPV) * X);
+            const Vec16f* q = &s.q_lanes[r0 * n_chunks + c];
+            for (int r = 0; r < nr; r++) {
+              acc[r] = fma(k, q[r * n_chunks], acc[r]);
+            }
+          }
+          for (int r = 0; r < nr; r++) {
+            alignas(64) float lanes[Vec16f::kSize];
+            acc[r].store(lanes);
+            float* logits = &s.logits[size_t(r0 + r) * psize + (t0 - tok_begin)];
+            for (int u = 0; u < TPV && g * TPV + u < n_valid; u++) {
+              float dot = 0.0f;
+              for (int i = 0; i < X; i++) {
+                dot += lanes[u * X + i];
+              }
+              logits[g * TPV + u] = dot;
+            }
+          }
+        }
+      }
+    }
+    if (kv.k_token_scales != nullptr) {
+      const float* ks = kv.k_token_scales + kv_head * kv.token_scales_stride + block * bs;
+      for (int r = 0; r < rows; r++) {
+        float* logits = &s.logits[size_t(r) * psize + (t0 - tok_begin)];
+        for (int t = 0; t < n_valid; t++) {
+          logits[t] *= ks[t];
+        }
+      }
+    }
+  }
+
+  // softmax within the partition; the causal limit of a row is a prefix, so
+  // masked tokens just get zero probability
+  float* row_max = s.row_max.data();
+  float* row_sum = s.row_sum.data();
+  for (int r = 0; r < rows; r++) {
+    float* logits = &s.logits[size_t(r) * psize];
+    const int limit =
+        p.context_lens[s.row_seq[r]] - query_len_of(p, s.row_seq[r]) + s.row_token[r] + 1;
+    int n_row = std::max(0, std::min(num_tokens, limit - tok_begin));
+    std::fill(logits + n_row, logits + num_tokens, 0.0f);
+    // [lo, hi): tokens between the sinks and this row's window, including
+    // the skipped blocks
+    int lo = 0, hi = 0;
+    if (p.window_size > 0) {
+      lo = std::max(0, std::min(n_row, p.num_sink_tokens - tok_begin));
+      hi = std::max(lo, std::min(n_row, window_begin(p, limit) - tok_begin));
+      std::fill(logits + lo, logits + hi, -std::numeric_limits<float>::infinity());
+      if (hi - lo == n_row) {
+        std::fill(logits, logits + n_row, 0.0f);
+        n_row = 0;
+      }
+    }
+    if (n_row == 0) {
+      row_max[r] = -std::numeric_limits<float>::infinity();
+      row_sum[r] = 0.0f;
+      continue;
+    }
+    if (p.alibi_slopes != nullptr) {
+      const float slope = p.alibi_slopes[s.row_head[r]];
+      for (int t = 0; t < n_row; t++) {
+        logits[t] += slope * float(tok_begin + t - limit + 1);
+      }
+    }
+    Vec16f vmax = Vec16f::broadcast(-std::numeric_limits<float>::infinity());
+    int t = 0;
+    for (; t + Vec16f::kSize <= n_row; t += Vec16f::kSize) {
+      vmax = max(vmax, Vec16f::load(logits + t));
+    }
+    float m = vmax.reduce_max();
+    for (; t < n_row; t++) {
+      m = std::max(m, logits[t]);
+    }
+    const Vec16f vm = Vec16f::broadcast(m);
+    Vec16f vsum = Vec16f::zero();
+    t = 0;
+    for (; t + Vec16f::kSize <= n_row; t += Vec16f::kSize) {
+      const Vec16f e = exp(Vec16f::load(logits + t) - vm);
+      e.store(logits + t);
+      vsum = vsum + e;
+    }
+    if (t < n_row) {
+      const int n = n_row - t;
+      const Vec16f e = exp(Vec16f::load_partial(logits + t, n) - vm);
+      e.store_partial(logits + t, n);
+      vsum = vsum + Vec16f::load_partial(logits + t, n);
+    }
+    // exp flushes -inf to ~1e-38, not 0
+    std::fill(logits + lo, logits + hi, 0.0f);
+    row_max[r] = m;
+    row_sum[r] = vsum.reduce_add();
+  }
+
+  // PV, accumulated with one lane per token of a 16-token chunk and reduced
+  // once at the end of the partition.
+  std::fill(s.v_acc.begin(), s.v_acc.end(), Vec16f::zero());
+  for (int b = first_block; b <= last_block; b++) {
+    const int64_t block = block_table[b];
+    const int t0 = b * bs;
+    const int n_valid = std::min(bs, tok_end - t0);
+    if (block_skipped(t0, n_valid)) {
+      continue;
+    }
+    const cache_t* v_block = blocks.v(block, kv_head, n_valid);
+    for (int u = 0; u < n_valid; u += Vec16f::kSize) {
+      const int n = std::min(Vec16f::kSize, n_valid - u);
+      // per-token V scales fold into the probabilities
+      const Vec16f vs =
+          kv.v_token_scales != nullptr
+              ? Vec16f::load_partial(kv.v_token_scales + kv_head * kv.token_scales_stride +
+                                         block * bs + u,
+                                     n)
+              : Vec16f::broadcast(1.0f);
+      for (int r0 = 0; r0 < rows; r0 += ROW_TILE) {
+        const int nr = std::min(ROW_TILE, rows - r0);
+        Vec16f prob[ROW_TILE];
+        for (int r = 0; r < nr; r++) {
+          prob[r] = Vec16f::load_partial(&s.logits[size_t(r0 + r) * psize + (t0 - tok_begin) + u], n) *
+                    vs;
+        }
+        for (int d = 0; d < vhs; d++) {
+          const cache_t* v_row = v_block + int64_t(d) * bs + u;
+          const Vec16f v = n == Vec16f::kSize ? load_cvt(v_row) : load_cvt_partial(v_row, n);
+          Vec16f* acc = &s.v_acc[size_t(r0) * vhs + d];
+          for (int r = 0; r < nr; r++) {
+            acc[r * vhs] = fma(v, prob[r], acc[r * vhs]);
+          }
+        }
+      }
+    }
+  }
+
+  for (int r = 0; r < rows; r++) {
+    const int64_t idx = workspace_index(p, s.row_seq[r], s.row_token[r] * p.num_heads + s.row_head[r],
+                                        partition);
+    max_logits[idx] = row_max[r];
+    exp_sums[idx] = row_sum[r];
+    for (int d = 0; d < vhs; d++) {
+      s.out_row[d] = s.v_acc[size_t(r) * vhs + d].reduce_add();
+    }
+    store_row(tmp_out + idx * vhs, s.out_row.data(), vhs,
+              row_sum[r] > 0.0f ? kv.v_scale_of(kv_head) / row_sum[r] : 0.0f);
+    if (p.probs != nullptr) {
+      std::copy(&s.logits[size_t(r) * psize], &s.logits[size_t(r) * psize] + num_tokens,
+                p.probs + probs_index(p, s.row_seq[r],
+                                      s.row_token[r] * p.num_heads + s.row_head[r], partition));
+    }
+  }
+}
+
+////// kernel registry ///////
+
+template <typename scalar_t, typename cache_t>
+using DecodeRowsKernel = void (*)(const PagedAttentionParams&, const PagedKV<cache_t>&,
+                                  const scalar_t*, const int*, int, int, int, float*, float*,
+                                  scalar_t*);
+
+// A shape specialization of the decode kernel, one instantiation per cache
+// layout (indexed by KVLayout); block_size 0 matches any.
+template <typename scalar_t, typename cache_t>
+struct DecodeKernelEntry {
+  int head_size;
+  int head_size_v;
+  int block_size;
+  DecodeRowsKernel<scalar_t, cache_t> kernels[3];
+};
+
+#define ATER_CPU_DECODE_KERNEL_LAYOUT(LAYOUT, HEAD_SIZE, HEAD_SIZE_V, BLOCK_SIZE)  \
+  &paged_decode_partition_rows_kernel<scalar_t, cache_t, KVLayout::LAYOUT, HEAD_SIZE, \
+                                      HEAD_SIZE_V, BLOCK_SIZE>
+
+#define ATER_CPU_DECODE_KERNEL_QKV(HEAD_SIZE, HEAD_SIZE_V, BLOCK_SIZE)             \
+  {HEAD_SIZE,                                                                      \
+   HEAD_SIZE_V,                                                                    \
+   BLOCK_SIZE,                                                                     \
+   {ATER_CPU_DECODE_KERNEL_LAYOUT(kVllm, HEAD_SIZE, HEAD_SIZE_V, BLOCK_SIZE),      \
+    ATER_CPU_DECODE_KERNEL_LAYOUT(kAsm, HEAD_SIZE, HEAD_SIZE_V, BLOCK_SIZE),       \
+    ATER_CPU_DECODE_KERNEL_LAYOUT(kFlash, HEAD_SIZE, HEAD_SIZE_V, BLOCK_SIZE)}}
+
+#define ATER_CPU_DECODE_KERNEL(HEAD_SIZE, BLOCK_SIZE) \
+  ATER_CPU_DECODE_KERNEL_QKV(HEAD_SIZE, HEAD_SIZE, BLOCK_SIZE)
+
+// Compile-time shape specializations for the served head sizes, exact
+// (head_size, block_size) entries first, then the (QK, V) head size pairs
+// that differ. Lookup order: exact match, then the head sizes with any block
+// size, then the runtime-shaped kernel, so every shape runs, just with fewer
+// constants folded.
+template <typename scalar_t, typename cache_t>
+const std::vector<DecodeKernelEntry<scalar_t, cache_t>>& decode_kernel_registry() {
+  static const std::vector<DecodeKernelEntry<scalar_t, cache_t>> kernels = {
+      ATER_CPU_DECODE_KERNEL(128, 16),         ATER_CPU_DECODE_KERNEL(64, 0),
+      ATER_CPU_DECODE_KERNEL(80, 0),           ATER_CPU_DECODE_KERNEL(96, 0),
+      ATER_CPU_DECODE_KERNEL(112, 0),          ATER_CPU_DECODE_KERNEL(128, 0),
+      ATER_CPU_DECODE_KERNEL(192, 0),          ATER_CPU_DECODE_KERNEL(256, 0),
+      ATER_CPU_DECODE_KERNEL_QKV(192, 128, 0), ATER_CPU_DECODE_KERNEL_QKV(128, 64, 0),
+  };
+  return kernels;
+}
+
+#undef ATER_CPU_DECODE_KERNEL
+#undef ATER_CPU_DECODE_KERNEL_QKV
+#undef ATER_CPU_DECODE_KERNEL_LAYOUT
+
+template <typename scalar_t, typename cache_t>
+DecodeRowsKernel<scalar_t, cache_t> lookup_decode_kernel(int head_size, int head_size_v,
+                                                         int block_size, KVLayout layout) {
+  for (const auto& e : decode_kernel_registry<scalar_t, cache_t>()) {
+    if (e.head_size == head_size && e.head_size_v == head_size_v &&
+        (e.block_size == block_size || e.block_size == 0)) {
+      return e.kernels[int(layout)];
+    }
+  }
+  return dispatch_kv_layout(layout, [](auto l) -> DecodeRowsKernel<scalar_t, cache_t> {
+    return &paged_decode_partition_rows_kernel<scalar_t, cache_t, decltype(l)::value>;
+  });
+}
+
+template <typename scalar_t, typename cache_t>
+void paged_decode_partition_rows(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                                 const scalar_t* query, const int* seqs, int num_seqs,
+                                 int kv_head, int partition, float* exp_sums, float* max_logits,
+                                 scalar_t* tmp_out) {
+  lookup_decode_kernel<scalar_t, cache_t>(p.head_size, head_size_v_of(p), kv.block_size,
+                                          kv.layout)(p, kv, query, seqs, num_seqs, kv_head, partition, exp_sums, max_logits, tmp_out);
+}
+
+template <typename scalar_t, typename cache_t>
+void paged_decode_partition(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                            const scalar_t* query, const DecodeWorkItem& w, float* exp_sums,
+                            float* max_logits, scalar_t* tmp_out) {
+  paged_decode_partition_rows(p, kv, query, &w.seq, 1, w.kv_head, w.partition, exp_sums,
+                              max_logits, tmp_out);
+}
+
+////// reduce ///////
+
+// Partial softmax states folded per reduce work item. Rows with more
+// partitions than this are reduced as a two-level tree when there are too
+// few (seq, head) rows to keep every worker busy (long single-sequence
+// decode), so one 1M-token row no longer serializes on one thread.
+constexpr int kFoldPartitions = 16;
+
+// Folds partitions [begin, end) of (seq, head) into one softmax state:
+// *m = max of max_logits, *sum = sum_i exp_sums_i * exp(m_i - *m) and
+// acc[head_size_v] = sum_i tmp_out_i * exp_sums_i * exp(m_i - *m), i.e. not yet
+// divided by the sum.
+template <typename scalar_t>
+void fold_partitions(const PagedAttentionParams& p, int seq, int head, int begin, int end,
+                     const float* exp_sums, const float* max_logits, const scalar_t* tmp_out,
+                     float* acc, float* m, float* sum) {
+  const int hs = head_size_v_of(p);
+  const int64_t base = workspace_index(p, seq, head, 0);
+  static thread_local std::vector<float> weights;
+  float global_max = -std::numeric_limits<float>::infinity();
+  // partitions outside every row's sliding window were never written
+  for (int i = begin; i < end; i++) {
+    if (partition_visible(p, seq, i)) {
+      global_max = std::max(global_max, max_logits[base + i]);
+    }
+  }
+  weights.resize(end - begin);
+  float global_exp_sum = 0.0f;
+  for (int i = begin; i < end; i++) {
+    // partitions entirely past a query token's causal limit carry -inf / 0
+    weights[i - begin] = !partition_visible(p, seq, i) || exp_sums[base + i] == 0.0f
+                             ? 0.0f
+                             : exp_sums[base + i] * std::exp(max_logits[base + i] - global_max);
+    global_exp_sum += weights[i - begin];
+  }
+  for (int d = 0; d < hs; d += Vec16f::kSize) {
+    const int n = std::min(Vec16f::kSize, hs - d);
+    Vec16f a = Vec16f::zero();
+    for (int i = begin; i < end; i++) {
+      if (weights[i - begin] == 0.0f) {
+        continue;
+      }
+      const scalar_t* t = tmp_out + (base + i) * hs + d;
+      const Vec16f v = n == Vec16f::kSize ? load_cvt(t) : load_cvt_partial(t, n);
+      a = fma(v, Vec16f::broadcast(weights[i - begin]), a);
+    }
+    a.store_partial(acc + d, n);
+  }
+  *m = global_max;
+  *sum = global_exp_sum;
+}
+
+template <typename scalar_t, typename out_t>
+void paged_decode_reduce(const PagedAttentionParams& p, int seq, int head,
+                         const float* exp_sums, const float* max_logits,
+                         const scalar_t* tmp_out, out_t* out) {
+  const int hs = head_size_v_of(p);
+  const int num_partitions = num_partitions_of(p.context_lens[seq], p.partition_size);
+  out_t* out_row = out + (query_start_of(p, seq) * p.num_heads + head) * hs;
+  static thread_local std::vector<float> acc;
+  acc.assign(hs, 0.0f);
+  if (num_partitions == 0) {
+    store_row(out_row, acc.data(), hs);
+    return;
+  }
+  float m, sum;
+  fold_partitions(p, seq, head, 0, num_partitions, exp_sums, max_logits, tmp_out, acc.data(), &m,
+                  &sum);
+  store_row(out_row, acc.data(), hs, 1.0f / ((sum + 1e-6f) * p.out_scale));
+}
+
+// (seq, head) output row of the decode reduce.
+struct ReduceRow {
+  int seq;
+  int head;
+};
+
+inline std::vector<ReduceRow> decode_reduce_rows(const PagedAttentionParams& p) {
+  std::vector<ReduceRow> rows;
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    if (is_decode_seq(p, seq)) {
+      for (int head = 0; head < heads_of(p, seq); head++) {
+        rows.push_back({seq, head});
+      }
+    }
+  }
+  return rows;
+}
+
+// Two-level reduce: every kFoldPartitions-wide chunk of every row is folded
+// in parallel into states [m, sum, acc[head_size_v]], then each row combines its chunk
+// states. Same result as paged_decode_reduce up to summation order.
+template <typename scalar_t, typename out_t>
+void paged_decode_reduce_tree(const PagedAttentionParams& p, const std::vector<ReduceRow>& rows,
+                              const float* exp_sums, const float* max_logits,
+                              const scalar_t* tmp_out, out_t* out) {
+  const int hs = head_size_v_of(p);
+  const int64_t num_rows = int64_t(rows.size());
+  const int64_t state_size = hs + 2;
+  std::vector<int64_t> chunk_offsets(num_rows + 1, 0);
+  for (int64_t r = 0; r < num_rows; r++) {
+    const int n = num_partitions_of(p.context_lens[rows[r].seq], p.partition_size);
+    chunk_offsets[r + 1] = chunk_offsets[r] + (n + kFoldPartitions - 1) / kFoldPartitions;
+  }
+  std::vector<int64_t> chunk_row(chunk_offsets[num_rows]);
+  for (int64_t r = 0; r < num_rows; r++) {
+    std::fill(chunk_row.begin() + chunk_offsets[r], chunk_row.begin() + chunk_offsets[r + 1], r);
+  }
+  std::vector<float> states(chunk_row.size() * state_size);
+  ThreadPool& pool = ThreadPool::instance();
+  pool.parallel_for(int64_t(chunk_row.size()), [&](int64_t c, int) {
+    const int64_t r = chunk_row[c];
+    const int seq = rows[r].seq;
+    const int n = num_partitions_of(p.context_lens[seq], p.partition_size);
+    const int begin = int(c - chunk_offsets[r]) * kFoldPartitions;
+    float* st = &states[c * state_size];
+    fold_partitions(p, seq, rows[r].head, begin, std::min(n, begin + kFoldPartitions),
+                    exp_sums, max_logits, tmp_out, st + 2, &st[0], &st[1]);
+  });
+  pool.parallel_for(num_rows, [&](int64_t r, int) {
+    static thread_local std::vector<float> acc;
+    acc.assign(hs, 0.0f);
+    float global_max = -std::numeric_limits<float>::infinity();
+    for (int64_t c = chunk_offsets[r]; c < chunk_offsets[r + 1]; c++) {
+      global_max = std::max(global_max, states[c * state_size]);
+    }
+    float global_exp_sum = 0.0f;
+    for (int64_t c = chunk_offsets[r]; c < chunk_offsets[r + 1]; c++) {
+      const float* st = &states[c * state_size];
+      if (st[1] == 0.0f) {
+        continue;
+      }
+      const float w = std::exp(st[0] - global_max);
+      global_exp_sum += st[1] * w;
+      for (int d = 0; d < hs; d++) {
+        acc[d] += st[2 + d] * w;
+      }
+    }
+    out_t* out_row = out + (query_start_of(p, rows[r].seq) * p.num_heads + rows[r].head) * hs;
+    store_row(out_row, acc.data(), hs, 1.0f / ((global_exp_sum + 1e-6f) * p.out_scale));
+  });
+}
+
+////// planner ///////
+
+// Partition sizes the planner picks from: block_size * 2^k within
+// [kMinPartitionSize, kMaxPartitionSize]. Small partitions balance skewed
+// batches, large ones keep the per-item setup and the reduce cheap.
+constexpr int kMinPartitionSize = 128;
+constexpr int kMaxPartitionSize = 4096;
+// Work items per worker we aim for, so that the largest item is a small
+// fraction of one worker's share.
+constexpr int kItemsPerWorker = 4;
+
+// Picks the partition size for one batch from its context_lens and the worker
+// count. min_partition_size is a hard lower bound (e.g. what a preallocated
+// [.., max_num_partitions] workspace can hold); the result is a multiple of
+// block_size.
+inline int choose_partition_size(const int* context_lens, int num_seqs, int num_kv_heads,
+                                 int block_size, int num_workers, int min_partition_size = 0) {
+  int64_t total = 0;
+  int max_len = 0;
+  for (int i = 0; i < num_seqs; i++) {
+    total += context_lens[i];
+    max_len = std::max(max_len, context_lens[i]);
+  }
+  total *= num_kv_heads;
+  const int64_t target = num_workers <= 1
+                             ? int64_t(kMaxPartitionSize)
+                             : total / (int64_t(num_workers) * kItemsPerWorker);
+  int psize = block_size;
+  while (psize < kMinPartitionSize) {
+    psize *= 2;
+  }
+  // no point in partitions longer than the longest sequence
+  const int64_t upper = std::min<int64_t>(kMaxPartitionSize, std::max(max_len, 1));
+  while (psize < target && psize < upper) {
+    psize *= 2;
+  }
+  if (psize < min_partition_size) {
+    psize = (min_partition_size + block_size - 1) / block_size * block_size;
+  }
+  return psize;
+}
+
+struct DecodePlan {
+  int partition_size;
+  std::vector<DecodeWorkItem> items;  // longest first
+};
+
+// Emits one item per (seq, kv_head, partition), ordered by decreasing token
+// count so the pool's dynamic scheduling approximates LPT: full partitions
+// are handed out first and the short tails fill in the gaps at the end.
+inline DecodePlan plan_decode(const int* context_lens, int num_seqs, int num_kv_heads,
+                              int partition_size) {
+  DecodePlan plan;
+  plan.partition_size = partition_size;
+  int64_t n_full = 0;
+  for (int seq = 0; seq < num_seqs; seq++) {
+    n_full += int64_t(context_lens[seq] / partition_size) * num_kv_heads;
+  }
+  std::vector<DecodeWorkItem> tails;
+  plan.items.reserve(n_full);
+  for (int seq = 0; seq < num_seqs; seq++) {
+    const int len = context_lens[seq];
+    const int n_full_parts = len / partition_size;
+    for (int kv_head = 0; kv_head < num_kv_heads; kv_head++) {
+      for (int part = 0; part < n_full_parts; part++) {
+        plan.items.push_back({seq, kv_head, part});
+      }
+      if (len % partition_size != 0) {
+        tails.push_back({seq, kv_head, n_full_parts});
+      }
+    }
+  }
+  std::stable_sort(tails.begin(), tails.end(),
+                   [&](const DecodeWorkItem& a, const DecodeWorkItem& b) {
+                     return context_lens[a.seq] % partition_size >
+                            context_lens[b.seq] % partition_size;
+                   });
+  plan.items.insert(plan.items.end(), tails.begin(), tails.end());
+  return plan;
+}
+
+inline DecodePlan plan_decode(const int* context_lens, int num_seqs, int num_kv_heads,
+                              int block_size, int num_workers, int min_partition_size) {
+  return plan_decode(context_lens, num_seqs, num_kv_heads,
+                     choose_partition_size(context_lens, num_seqs, num_kv_heads, block_size,
+                                           num_workers, min_partition_size));
+}
+
+////// cascade (shared prefix) ///////
+
+// Rows of one cascade item (members x q_len x GQA heads); larger groups are
+// split so the per-thread logits / accumulator scratch stays bounded.
+constexpr int kCascadeMaxRows = 256;
+
+// Sequences whose block tables start with the same blocks (parallel
+// sampling, a reused system prompt) read the same KV for those tokens. The
+// partitions fully inside the common prefix are computed once for the query
+// rows of all members and land in every member's workspace slots, so the
+// regular reduce merges prefix and suffix by log-sum-exp.
+struct CascadeGroup {
+  int begin;  // members[begin, end) of the CascadePlan
+  int end;
+  int num_shared_partitions;
+};
+
+struct CascadePlan {
+  int partition_size;
+  std::vector<int> members;
+  std::vector<CascadeGroup> groups;
+  std::vector<DecodeWorkItem> group_items;  // (group, kv_head, partition)
+  std::vector<DecodeWorkItem> items;        // partitions not covered by a group, longest first
+};
+
+inline CascadePlan plan_cascade(const PagedAttentionParams& p, int block_size) {
+  const int partition_size = p.partition_size;
+  CascadePlan plan;
+  plan.partition_size = partition_size;
+  const int gqa = p.num_heads / p.num_kv_heads;
+  const int blocks_per_partition = partition_size / block_size;
+  std::vector<int> shared(p.num_seqs, 0);
+
+  // candidates: same blocks for the whole first partition
+  std::map<std::vector<int>, std::vector<int>> by_first_partition;
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    if (p.context_lens[seq] >= partition_size) {
+      const int* bt = p.block_tables + int64_t(seq) * p.max_num_blocks_per_seq;
+      by_first_partition[std::vector<int>(bt, bt + blocks_per_partition)].push_back(seq);
+    }
+  }
+  for (const auto& entry : by_first_partition) {
+    const std::vector<int>& seqs = entry.second;
+    size_t i = 0;
+    while (i < seqs.size()) {
+      size_t j = i;
+      int rows = 0;
+      while (j < seqs.size() && rows + query_len_of(p, seqs[j]) * gqa <= kCascadeMaxRows) {
+        rows += query_len_of(p, seqs[j]) * gqa;
+        j++;
+      }
+      j = std::max(j, i + 1);
+      if (j - i >= 2) {
+        // common prefix in tokens, limited to what every member has cached
+        const int* bt0 = p.block_tables + int64_t(seqs[i]) * p.max_num_blocks_per_seq;
+        int prefix = p.context_lens[seqs[i]];
+        for (size_t k = i + 1; k < j; k++) {
+          const int* bt = p.block_tables + int64_t(seqs[k]) * p.max_num_blocks_per_seq;
+          const int len = p.context_lens[seqs[k]];
+          int b = 0;
+          while (b * block_size < std::min(prefix, len) && bt[b] == bt0[b]) {
+            b++;
+          }
+          prefix = std::min({prefix, len, b * block_size});
+        }
+        const int n_shared = prefix / partition_size;
+        const int group = int(plan.groups.size());
+        plan.groups.push_back({int(plan.members.size()), int(plan.members.size() + j - i), n_shared});
+        for (size_t k = i; k < j; k++) {
+          plan.members.push_back(seqs[k]);
+          shared[seqs[k]] = n_shared;
+        }
+        for (int kv_head = 0; kv_head < p.num_kv_heads; kv_head++) {
+          for (int part = 0; part < n_shared; part++) {
+            bool visible = false;
+            for (size_t k = i; k < j; k++) {
+              visible = visible || partition_visible(p, seqs[k], part);
+            }
+            if (!visible) {
+              continue;
+            }
+            plan.group_items.push_back({group, kv_head, part});
+          }
+        }
+      }
+      i = j;
+    }
+  }
+  std::stable_sort(plan.group_items.begin(), plan.group_items.end(),
+                   [&](const DecodeWorkItem& a, const DecodeWorkItem& b) {
+                     const CascadeGroup& ga = plan.groups[a.seq];
+                     const CascadeGroup& gb = plan.groups[b.seq];
+                     return ga.end - ga.begin > gb.end - gb.begin;
+                   });
+
+  // the rest as in plan_decode: full partitions, then tails by length
+  std::vector<DecodeWorkItem> tails;
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    const int len = p.context_lens[seq];
+    const int n_full_parts = len / partition_size;
+    for (int kv_head = 0; kv_head < p.num_kv_heads; kv_head++) {
+      for (int part = shared[seq]; part < n_full_parts; part++) {
+        if (partition_visible(p, seq, part)) {
+          plan.items.push_back({seq, kv_head, part});
+        }
+      }
+      if (len % partition_size != 0 && partition_visible(p, seq, n_full_parts)) {
+        tails.push_back({seq, kv_head, n_full_parts});
+      }
+    }
+  }
+  std::stable_sort(tails.begin(), tails.end(),
+                   [&](const DecodeWorkItem& a, const DecodeWorkItem& b) {
+                     return p.context_lens[a.seq] % partition_size >
+                            p.context_lens[b.seq] % partition_size;
+                   });
+  plan.items.insert(plan.items.end(), tails.begin(), tails.end());
+  return plan;
+}
+
+////// driver ///////
+
+// Reduces every decode row, as a tree when there are few long rows.
+template <typename scalar_t, typename out_t>
+void paged_decode_reduce_all(const PagedAttentionParams& p, const float* exp_sums,
+                             const float* max_logits, const scalar_t* tmp_out, out_t* out) {
+  ThreadPool& pool = ThreadPool::instance();
+  const std::vector<ReduceRow> rows = decode_reduce_rows(p);
+  int max_partitions = 0;
+  for (int i = 0; i < p.num_seqs; i++) {
+    if (is_decode_seq(p, i)) {
+      max_partitions =
+          std::max(max_partitions, num_partitions_of(p.context_lens[i], p.partition_size));
+    }
+  }
+  if (max_partitions > kFoldPartitions &&
+      int64_t(rows.size()) < int64_t(pool.num_threads()) * kItemsPerWorker) {
+    paged_decode_reduce_tree(p, rows, exp_sums, max_logits, tmp_out, out);
+    return;
+  }
+  pool.parallel_for(int64_t(rows.size()), [&](int64_t i, int) {
+    paged_decode_reduce(p, rows[i].seq, rows[i].head, exp_sums, max_logits, tmp_out, out);
+  });
+}
+
+template <typename scalar_t, typename cache_t, typename out_t>
+void paged_attention_decode(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                            const DecodeWorkItem* items, int64_t num_items,
+                            const scalar_t* query, float* exp_sums, float* max_logits,
+                            scalar_t* tmp_out, out_t* out) {
+  ThreadPool& pool = ThreadPool::instance();
+  pool.parallel_for(num_items, [&](int64_t i, int) {
+    paged_decode_partition(p, kv, query, items[i], exp_sums, max_logits, tmp_out);
+  });
+  paged_decode_reduce_all(p, exp_sums, max_logits, tmp_out, out);
+}
+
+// Shared-prefix group items first (they carry the most rows), then the
+// per-sequence items, in one parallel region.
+template <typename scalar_t, typename cache_t, typename out_t>
+void paged_attention_cascade(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                             const CascadePlan& plan, const scalar_t* query, float* exp_sums,
+                             float* max_logits, scalar_t* tmp_out, out_t* out) {
+  ThreadPool& pool = ThreadPool::instance();
+  const int64_t num_group_items = int64_t(plan.group_items.size());
+  pool.parallel_for(num_group_items + int64_t(plan.items.size()), [&](int64_t i, int) {
+    if (i < num_group_items) {
+      const DecodeWorkItem& w = plan.group_items[i];
+      const CascadeGroup& g = plan.groups[w.seq];
+      paged_decode_partition_rows(p, kv, query, plan.members.data() + g.begin, g.end - g.begin,
+                                  w.kv_head, w.partition, exp_sums, max_logits, tmp_out);
+    } else {
+      paged_decode_partition(p, kv, query, plan.items[i - num_group_items], exp_sums,
+                             max_logits, tmp_out);
+    }
+  });
+  paged_decode_reduce_all(p, exp_sums, max_logits, tmp_out, out);
+}
+
+template <typename scalar_t, typename cache_t, typename out_t>
+void paged_attention_decode(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                            const scalar_t* query, float* exp_sums, float* max_logits,
+                            scalar_t* tmp_out, out_t* out) {
+  const DecodePlan plan =
+      plan_decode(p.context_lens, p.num_seqs, p.num_kv_heads, p.partition_size);
+  paged_attention_decode(p, kv, plan.items.data(), int64_t(plan.items.size()), query, exp_sums,
+                         max_logits, tmp_out, out);
+}
+
+}  // namespace cpu
+}  // namespace ater
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_paged_kv.h
+ * @Description: Host view of a paged KV cache in any of the layouts the cache
+ *               writers emit, and a block reader that hands the attention
+ *               engines every block as the same contiguous K / V tiles.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace ater {
+namespace cpu {
+
+// Cache layouts, per block and kv head, with x = 16 / sizeof(cache_t):
+//   kVllm  reshape_and_cache:
+//            key_cache   [num_blocks, num_kv_heads, head_size/x, block_size, x]
+//            value_cache [num_blocks, num_kv_heads, head_size, block_size]
+//   kAsm   reshape_and_cache(asm_layout=true), key_cache as kVllm:
+//            value_cache [num_blocks, num_kv_heads, block_size/x, head_size, x]
+//   kFlash reshape_and_cache_flash:
+//            key_cache   [num_blocks, block_size, num_kv_heads, head_size]
+//            value_cache [num_blocks, block_size, num_kv_heads, head_size]
+// The value_cache head_size may differ from the key_cache one (head_size_v).
+enum class KVLayout { kVllm, kAsm, kFlash };
+
+// Paged KV cache. Strides are in elements; *_token_stride is only used by
+// kFlash, where tokens of a block are not adjacent.
+template <typename cache_t>
+struct PagedKV {
+  static constexpr int X = 16 / sizeof(cache_t);
+  const cache_t* k_cache;
+  const cache_t* v_cache;
+  int64_t k_block_stride;
+  int64_t k_head_stride;
+  int64_t v_block_stride;
+  int64_t v_head_stride;
+  int block_size;
+  float k_scale;
+  float v_scale;
+  // Per-token dequant scales [num_kv_heads, token_scales_stride] indexed by
+  // slot (block * block_size + offset), as written by
+  // reshape_and_cache_with_pertoken_quant. Applied on top of k_scale /
+  // v_scale; nullptr when the cache is not per-token quantized.
+  const float* k_token_scales = nullptr;
+  const float* v_token_scales = nullptr;
+  int64_t token_scales_stride = 0;
+  KVLayout layout = KVLayout::kVllm;
+  int64_t k_token_stride = 0;
+  int64_t v_token_stride = 0;
+  // Per kv head scales [num_kv_heads] of an fp8 cache, used in place of
+  // k_scale / v_scale; nullptr when one scale covers all heads.
+  const float* k_head_scales = nullptr;
+  const float* v_head_scales = nullptr;
+
+  float k_scale_of(int kv_head) const {
+    return k_head_scales != nullptr ? k_head_scales[kv_head] : k_scale;
+  }
+  float v_scale_of(int kv_head) const {
+    return v_head_scales != nullptr ? v_head_scales[kv_head] : v_scale;
+  }
+};
+
+// Element offsets of dim d of token t of a (block, kv head) within the
+// cache, for writers and in-place token moves.
+template <typename cache_t>
+inline int64_t key_offset(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int t, int d) {
+  constexpr int X = PagedKV<cache_t>::X;
+  const int64_t base = block * kv.k_block_stride + kv_head * kv.k_head_stride;
+  if (kv.layout == KVLayout::kFlash) {
+    return base + t * kv.k_token_stride + d;
+  }
+  return base + (int64_t(d / X) * kv.block_size + t) * X + d % X;
+}
+
+template <typename cache_t>
+inline int64_t value_offset(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int t, int d,
+                            int head_size) {
+  constexpr int X = PagedKV<cache_t>::X;
+  const int64_t base = block * kv.v_block_stride + kv_head * kv.v_head_stride;
+  switch (kv.layout) {
+    case KVLayout::kFlash:
+      return base + t * kv.v_token_stride + d;
+    case KVLayout::kAsm:
+      return base + (int64_t(t / X) * head_size + d) * X + t % X;
+    default:
+      return base + int64_t(d) * kv.block_size + t;
+  }
+}
+
+// Index math of one layout. k() / v() return the first n_valid tokens of a
+// (block, kv head) as the kVllm tiles, K [head_size/x, block_size, x] and
+// V [head_size, block_size]: a pointer into the cache where the layout
+// already matches, otherwise the tile packed into buf (block_size *
+// head_size elements). hs is the head size of the tile read, i.e. the V
+// head size for v().
+template <typename cache_t, KVLayout LAYOUT>
+struct KVBlockTiles;
+
+template <typename cache_t>
+struct KVBlockTiles<cache_t, KVLayout::kVllm> {
+  static const cache_t* k(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int, int,
+                          cache_t*) {
+    return kv.k_cache + block * kv.k_block_stride + kv_head * kv.k_head_stride;
+  }
+  static const cache_t* v(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int, int,
+                          cache_t*) {
+    return kv.v_cache + block * kv.v_block_stride + kv_head * kv.v_head_stride;
+  }
+};
+
+template <typename cache_t>
+struct KVBlockTiles<cache_t, KVLayout::kAsm> {
+  static constexpr int X = PagedKV<cache_t>::X;
+  static const cache_t* k(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int hs,
+                          int n_valid, cache_t* buf) {
+    return KVBlockTiles<cache_t, KVLayout::kVllm>::k(kv, block, kv_head, hs, n_valid, buf);
+  }
+  // [bs/x, hs, x] -> [hs, bs]: x tokens of a dim are adjacent in both
+  static const cache_t* v(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int hs,
+                          int n_valid, cache_t* buf) {
+    const cache_t* src = kv.v_cache + block * kv.v_block_stride + kv_head * kv.v_head_stride;
+    const int bs = kv.block_size;
+    for (int j = 0; j * X < n_valid; j++) {
+      for (int d = 0; d < hs; d++) {
+        std::memcpy(buf + int64_t(d) * bs + j * X, src + (int64_t(j) * hs + d) * X,
+                    X * sizeof(cache_t));
+      }
+    }
+    return buf;
+  }
+};
+
+template <typename cache_t>
+struct KVBlockTiles<cache_t, KVLayout::kFlash> {
+  static constexpr int X = PagedKV<cache_t>::X;
+  // [bs, hs] -> [hs/x, bs, x]
+  static const cache_t* k(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int hs,
+                          int n_valid, cache_t* buf) {
+    const cache_t* src = kv.k_cache + block * kv.k_block_stride + kv_head * kv.k_head_stride;
+    const int bs = kv.block_size;
+    for (int t = 0; t < n_valid; t++) {
+      const cache_t* row = src + t * kv.k_token_stride;
+      for (int c = 0; c < hs / X; c++) {
+        std::memcpy(buf + (int64_t(c) * bs + t) * X, row + c * X, X * sizeof(cache_t));
+      }
+    }
+    return buf;
+  }
+  // [bs, hs] -> [hs, bs] through x by x tiles: each token row is read and
+  // each dim row written x elements at a time
+  static const cache_t* v(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int hs,
+                          int n_valid, cache_t* buf) {
+    const cache_t* src = kv.v_cache + block * kv.v_block_stride + kv_head * kv.v_head_stride;
+    const int bs = kv.block_size;
+    cache_t tile[X][X];
+    for (int t0 = 0; t0 < n_valid; t0 += X) {
+      const int nt = std::min(X, n_valid - t0);
+      for (int d0 = 0; d0 < hs; d0 += X) {
+        const int nd = std::min(X, hs - d0);
+        for (int t = 0; t < nt; t++) {
+          std::memcpy(tile[t], src + (t0 + t) * kv.v_token_stride + d0, nd * sizeof(cache_t));
+        }
+        for (int d = 0; d < nd; d++) {
+          cache_t* dst = buf + int64_t(d0 + d) * bs + t0;
+          for (int t = 0; t < nt; t++) {
+            dst[t] = tile[t][d];
+          }
+        }
+      }
+    }
+    return buf;
+  }
+  // Token t of a block: the head_size_v elements are contiguous already, so
+  // token-major readers (prefill) need no tile at all.
+  static const cache_t* v_token(const PagedKV<cache_t>& kv, int64_t block, int kv_head, int t) {
+    return kv.v_cache + block * kv.v_block_stride + kv_head * kv.v_head_stride +
+           t * kv.v_token_stride;
+  }
+};
+
+// Reads blocks of kv as kVllm tiles. The layout is a template parameter
+// (kv.layout must match), so the engines instantiate one inner loop per
+// cache dtype and layout with no per-block dispatch. A K and a V tile of one
+// block can be held at the same time; the next k() / v() call may reuse the
+// buffer. head_size_v defaults to head_size.
+template <typename cache_t, KVLayout LAYOUT>
+class KVBlockReader {
+ public:
+  using Tiles = KVBlockTiles<cache_t, LAYOUT>;
+
+  KVBlockReader(const PagedKV<cache_t>& kv, int head_size, int head_size_v = 0)
+      : kv_(kv), hs_(head_size), vhs_(head_size_v > 0 ? head_size_v : head_size) {
+    if (LAYOUT != KVLayout::kVllm) {
+      buffers().resize(size_t(kv.block_size) * (hs_ + vhs_));
+    }
+  }
+
+  const cache_t* k(int64_t block, int kv_head, int n_valid) const {
+    return Tiles::k(kv_, block, kv_head, hs_, n_valid, buffers().data());
+  }
+
+  const cache_t* v(int64_t block, int kv_head, int n_valid) const {
+    return Tiles::v(kv_, block, kv_head, vhs_, n_valid,
+                    buffers().data() + size_t(kv_.block_size) * hs_);
+  }
+
+ private:
+  static std::vector<cache_t>& buffers() {
+    static thread_local std::vector<cache_t> buf;
+    return buf;
+  }
+
+  const PagedKV<cache_t>& kv_;
+  int hs_;
+  int vhs_;
+};
+
+// Calls fn(std::integral_constant<KVLayout, kv.layout>()), so engines pick
+// their layout instantiation once per call.
+template <typename F>
+inline auto dispatch_kv_layout(KVLayout layout, F&& fn) {
+  switch (layout) {
+    case KVLayout::kAsm:
+      return fn(std::integral_constant<KVLayout, KVLayout::kAsm>());
+    case KVLayout::kFlash:
+      return fn(std::integral_constant<KVLayout, KVLayout::kFlash>());
+    default:
+      return fn(std::integral_constant<KVLayout, KVLayout::kVllm>());
+  }
+}
+
+}  // namespace cpu
+}  // namespace ater
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_paged_prefill.h
+ * @Description: Host varlen attention over the paged KV cache for mixed
+ *               chunked-prefill + decode batches. Prefill sequences are tiled
+ *               flash-attention style (online softmax, output written
+ *               directly); decode sequences go through the split-KV decode
+ *               path of cpu_paged_attention.h. Both kinds of work share one
+ *               parallel region.
+ */
+
+#pragma once
+
+#include "cpu_paged_attention.h"
+
+namespace ater {
+namespace cpu {
+
+// Query rows (query tokens x GQA heads) per prefill tile.
+constexpr int kPrefillTileRows = 64;
+
+inline int prefill_tile_tokens(const PagedAttentionParams& p) {
+  return std::max(1, kPrefillTileRows / (p.num_heads / p.num_kv_heads));
+}
+
+struct PrefillScratch {
+  std::vector<Vec16f> q_lanes;  // [rows, head_size / x]
+  std::vector<Vec16f> k_lanes;  // [head_size / x], one token group of K
+  std::vector<float> v_tile;    // [block_size, head_size_v], token-major
+  std::vector<float> logits;    // [rows, block_size]
+  std::vector<float> acc;       // [rows, head_size_v]
+  std::vector<float> row_max;   // [rows]
+  std::vector<float> row_sum;   // [rows]
+
+  static PrefillScratch& local() {
+    static thread_local PrefillScratch s;
+    return s;
+  }
+};
+
+// One (seq, kv_head, query tile): query tokens [tile * T, tile * T + T) of
+// seq with all their GQA heads against the cached tokens they can see, one
+// KV block at a time. Writes out directly. LAYOUT is kv.layout.
+template <typename scalar_t, typename cache_t, typename out_t, KVLayout LAYOUT>
+void paged_prefill_tile(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                        const scalar_t* query, const DecodeWorkItem& w, out_t* out) {
+  constexpr int X = PagedKV<cache_t>::X;
+  constexpr int TPV = Vec16f::kSize / X;
+  const int hs = p.head_size;
+  const int vhs = head_size_v_of(p);
+  const int bs = kv.block_size;
+  const int gqa = p.num_heads / p.num_kv_heads;
+  const int head0 = w.kv_head * gqa;
+  const int n_chunks = hs / X;
+  const int q_len = query_len_of(p, w.seq);
+  const int tile_tokens = prefill_tile_tokens(p);
+  const int j0 = w.partition * tile_tokens;
+  const int rows = std::min(tile_tokens, q_len - j0) * gqa;  // row = (j - j0) * gqa + r
+  const int context_len = p.context_lens[w.seq];
+  const int* block_table = p.block_tables + int64_t(w.seq) * p.max_num_blocks_per_seq;
+  const KVBlockReader<cache_t, LAYOUT> blocks(kv, hs, vhs);
+  // token j of the chunk sits at position context_len - q_len + j
+  auto limit_of = [&](int row) { return context_len - q_len + j0 + row / gqa + 1; };
+  const int tile_limit = std::max(0, limit_of(rows - 1));
+
+  PrefillScratch& s = PrefillScratch::local();
+  s.q_lanes.resize(size_t(rows) * n_chunks);
+  s.k_lanes.resize(n_chunks);
+  s.v_tile.resize(size_t(bs) * vhs);
+  s.logits.resize(size_t(rows) * bs);
+  s.acc.assign(size_t(rows) * vhs, 0.0f);
+  s.row_max.assign(rows, -std::numeric_limits<float>::infinity());
+  s.row_sum.assign(rows, 0.0f);
+
+  const float q_mul = p.scale * kv.k_scale_of(w.kv_head);
+  for (int r = 0; r < rows; r++) {
+    const scalar_t* q = query + (query_start_of(p, w.seq) + j0 + r / gqa) * p.q_stride +
+                        int64_t(head0 + r % gqa) * p.q_head_stride;
+    for (int c = 0; c < n_chunks; c++) {
+      alignas(64) float lanes[Vec16f::kSize];
+      for (int j = 0; j < Vec16f::kSize; j++) {
+        lanes[j] = to_float(q[c * X + j % X]) * q_mul;
+      }
+      s.q_lanes[r * n_chunks + c] = Vec16f::load(lanes);
+    }
+  }
+
+  // sliding window: blocks past the sinks that end before the first row's
+  // window are never loaded
+  const int window_lo = window_begin(p, limit_of(0));
+  const int num_blocks = (tile_limit + bs - 1) / bs;
+  for (int b = 0; b < num_blocks; b++) {
+    const int64_t block = block_table[b];
+    const int t0 = b * bs;
+    const int n_valid = std::min(bs, tile_limit - t0);
+    if (t0 + n_valid <= window_lo && !is_sink_token(p, t0)) {
+      continue;
+    }
+    const cache_t* k_block = blocks.k(block, w.kv_head, n_valid);
+
+    // S = Q K^T for the whole tile
+    const int n_groups = (n_valid + TPV - 1) / TPV;
+    for (int g = 0; g < n_groups; g++) {
+      Vec16f* k = s.k_lanes.data();
+      for (int c = 0; c < n_chunks; c++) {
+        k[c] = load_cvt(k_block + (int64_t(c) * bs + g * TPV) * X);
+      }
+      for (int r = 0; r < rows; r++) {
+        const Vec16f* q = &s.q_lanes[r * n_chunks];
+        Vec16f acc = Vec16f::zero();
+        for (int c = 0; c < n_chunks; c++) {
+          acc = fma(k[c], q[c], acc);
+        }
+        alignas(64) float lanes[Vec16f::kSize];
+        acc.store(lanes);
+        for (int u = 0; u < TPV && g * TPV + u < n_valid; u++) {
+          float dot = 0.0f;
+          for (int i = 0; i < X; i++) {
+            dot += lanes[u * X + i];
+          }
+          s.logits[size_t(r) * bs + g * TPV + u] = dot;
+        }
+      }
+    }
+    const int64_t slot0 = w.kv_head * kv.token_scales_stride + block * bs;
+    if (kv.k_token_scales != nullptr) {
+      for (int r = 0; r < rows; r++) {
+        for (int t = 0; t < n_valid; t++) {
+          s.logits[size_t(r) * bs + t] *= kv.k_token_scales[slot0 + t];
+        }
+      }
+    }
+
+    // V block, token-major fp32 with per-token scales applied, shared by
+    // every row of the tile; flash blocks are token-major already
+    if (LAYOUT == KVLayout::kFlash) {
+      for (int t = 0; t < n_valid; t++) {
+        load_row(&s.v_tile[size_t(t) * vhs],
+                 KVBlockTiles<cache_t, KVLayout::kFlash>::v_token(kv, block, w.kv_head, t), vhs);
+      }
+    } else {
+      const cache_t* v_block = blocks.v(block, w.kv_head, n_valid);
+      for (int d = 0; d < vhs; d++) {
+        const cache_t* v_row = v_block + int64_t(d) * bs;
+        for (int t = 0; t < n_valid; t++) {
+          s.v_tile[size_t(t) * vhs + d] = to_float(v_row[t]);
+        }
+      }
+    }
+    if (kv.v_token_scales != nullptr) {
+      for (int t = 0; t < n_valid; t++) {
+        const Vec16f vs = Vec16f::broadcast(kv.v_token_scales[slot0 + t]);
+        for (int d = 0; d < vhs; d += Vec16f::kSize) {
+          const int n = std::min(Vec16f::kSize, vhs - d);
+          float* v = &s.v_tile[size_t(t) * vhs + d];
+          (Vec16f::load_partial(v, n) * vs).store_partial(v, n);
+        }
+      }
+    }
+
+    // online softmax update
+    for (int r = 0; r < rows; r++) {
+      const int n_row = std::min(n_valid, limit_of(r) - t0);
+      if (n_row <= 0) {
+        continue;
+      }
+      float* logits = &s.logits[size_t(r) * bs];
+      if (p.alibi_slopes != nullptr) {
+        const float slope = p.alibi_slopes[head0 + r % gqa];
+        for (int t = 0; t < n_row; t++) {
+          logits[t] += slope * float(t0 + t - limit_of(r) + 1);
+        }
+      }
+      int lo = 0, hi = 0;
+      if (p.window_size > 0) {
+        lo = std::max(0, std::min(n_row, p.num_sink_tokens - t0));
+        hi = std::max(lo, std::min(n_row, window_begin(p, limit_of(r)) - t0));
+        if (hi - lo == n_row) {
+          continue;
+        }
+        std::fill(logits + lo, logits + hi, -std::numeric_limits<float>::infinity());
+      }
+      float m = s.row_max[r];
+      for (int t = 0; t < n_row; t++) {
+        m = std::max(m, logits[t]);
+      }
+      const float rescale = std::exp(s.row_max[r] - m);
+      const Vec16f vm = Vec16f::broadcast(m);
+      float sum = 0.0f;
+      for (int t = 0; t < n_row; t += Vec16f::kSize) {
+        const int n = std::min(Vec16f::kSize, n_row - t);
+        const Vec16f e = exp(Vec16f::load_partial(logits + t, n) - vm);
+        e.store_partial(logits + t, n);
+      }
+      std::fill(logits + lo, logits + hi, 0.0f);
+      for (int t = 0; t < n_row; t++) {
+        sum += logits[t];
+      }
+      s.row_max[r] = m;
+      s.row_sum[r] = s.row_sum[r] * rescale + sum;
+      float* acc = &s.acc[size_t(r) * vhs];
+      const Vec16f vr = Vec16f::broadcast(rescale);
+      for (int d = 0; d < vhs; d += Vec16f::kSize) {
+        const int n = std::min(Vec16f::kSize, vhs - d);
+        Vec16f a = Vec16f::load_partial(acc + d, n) * vr;
+        for (int t = 0; t < n_row; t++) {
+          a = fma(Vec16f::broadcast(logits[t]),
+                  Vec16f::load_partial(&s.v_tile[size_t(t) * vhs + d], n), a);
+        }
+        a.store_partial(acc + d, n);
+      }
+    }
+  }
+
+  for (int r = 0; r < rows; r++) {
+    out_t* out_row =
+        out + ((query_start_of(p, w.seq) + j0 + r / gqa) * p.num_heads + head0 + r % gqa) * vhs;
+    store_row(out_row, &s.acc[size_t(r) * vhs], vhs,
+              s.row_sum[r] > 0.0f ? kv.v_scale_of(w.kv_head) / s.row_sum[r] : 0.0f);
+  }
+}
+
+////// varlen planner ///////
+
+// Decode partitions and prefill tiles of one cu_seqlens_q batch, ordered by
+// estimated cost (query rows x visible tokens), largest first.
+inline std::vector<DecodeWorkItem> plan_varlen(const PagedAttentionParams& p) {
+  const int gqa = p.num_heads / p.num_kv_heads;
+  const int tile_tokens = prefill_tile_tokens(p);
+  std::vector<std::pair<int64_t, DecodeWorkItem>> items;
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    const int len = p.context_lens[seq];
+    const int q_len = query_len_of(p, seq);
+    if (is_decode_seq(p, seq)) {
+      const int n = num_partitions_of(len, p.partition_size);
+      for (int kv_head = 0; kv_head < p.num_kv_heads; kv_head++) {
+        for (int part = 0; part < n; part++) {
+          if (!partition_visible(p, seq, part)) {
+            continue;
+          }
+          const int tokens = std::min(p.partition_size, len - part * p.partition_size);
+          items.push_back({int64_t(tokens) * q_len * gqa, {seq, kv_head, part}});
+        }
+      }
+    } else {
+      const int n = (q_len + tile_tokens - 1) / tile_tokens;
+      for (int kv_head = 0; kv_head < p.num_kv_heads; kv_head++) {
+        for (int tile = 0; tile < n; tile++) {
+          const int tokens = std::min(tile_tokens, q_len - tile * tile_tokens);
+          int64_t visible = len - q_len + int64_t(tile) * tile_tokens + tokens;
+          if (p.window_size > 0) {
+            visible = std::min<int64_t>(visible, p.num_sink_tokens + p.window_size + tokens);
+          }
+          items.push_back({visible * tokens * gqa, {seq, kv_head, tile}});
+        }
+      }
+    }
+  }
+  std::stable_sort(items.begin(), items.end(),
+                   [](const auto& a, const auto& b) { return a.first > b.first; });
+  std::vector<DecodeWorkItem> plan(items.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    plan[i] = items[i].second;
+  }
+  return plan;
+}
+
+////// varlen driver ///////
+
+// p.cu_seqlens_q and the ragged workspace (varlen_partition_offsets) must be
+// set. out is [total_query_tokens, num_heads, head_size_v].
+template <typename scalar_t, typename cache_t, typename out_t>
+void paged_attention_varlen(const PagedAttentionParams& p, const PagedKV<cache_t>& kv,
+                            const scalar_t* query, float* exp_sums, float* max_logits,
+                            scalar_t* tmp_out, out_t* out) {
+  ThreadPool& pool = ThreadPool::instance();
+  const std::vector<DecodeWorkItem> items = plan_varlen(p);
+  using PrefillTile = void (*)(const PagedAttentionParams&, const PagedKV<cache_t>&,
+                               const scalar_t*, const DecodeWorkItem&, out_t*);
+  const PrefillTile prefill_tile = dispatch_kv_layout(kv.layout, [](auto l) -> PrefillTile {
+    return &paged_prefill_tile<scalar_t, cache_t, out_t, decltype(l)::value>;
+  });
+  pool.parallel_for(int64_t(items.size()), [&](int64_t i, int) {
+    if (is_decode_seq(p, items[i].seq)) {
+      paged_decode_partition(p, kv, query, items[i], exp_sums, max_logits, tmp_out);
+    } else {
+      prefill_tile(p, kv, query, items[i], out);
+    }
+  });
+  paged_decode_reduce_all(p, exp_sums, max_logits, tmp_out, out);
+}
+
+}  // namespace cpu
+}  // namespace ater
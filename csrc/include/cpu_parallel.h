@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_parallel.h
+ * @Description: Persistent host thread pool for the CPU kernels. Work is
+ *               handed out dynamically (atomic cursor), so callers can pass
+ *               work lists sorted by cost and get LPT-style balancing.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace ater {
+namespace cpu {
+
+class ThreadPool {
+ public:
+  static ThreadPool& instance() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  int num_threads() const { return num_threads_; }
+
+  // Resizes the pool; the calling thread counts as one of the n threads.
+  void set_num_threads(int n) {
+    n = std::max(1, n);
+    if (n == num_threads_) {
+      return;
+    }
+    std::lock_guard<std::mutex> call_lock(call_mutex_);
+    stop_workers();
+    num_threads_ = n;
+    // Workers start from the current generation so that a job published
+    // before a worker first runs is still picked up by it.
+    const uint64_t gen = generation_;
+    for (int tid = 1; tid < n; tid++) {
+      workers_.emplace_back([this, tid, gen] { worker_loop(tid, gen); });
+    }
+  }
+
+  // Calls fn(i, tid) for every i in [0, n), grain items at a time, and blocks
+  // until all are done. Nested calls from a pool thread run inline.
+  template <typename F>
+  void parallel_for(int64_t n, F&& fn, int64_t grain = 1) {
+    if (n <= 0) {
+      return;
+    }
+    grain = std::max<int64_t>(1, grain);
+    if (num_threads_ == 1 || n <= grain || in_pool()) {
+      for (int64_t i = 0; i < n; i++) {
+        fn(i, 0);
+      }
+      return;
+    }
+    std::atomic<int64_t> cursor(0);
+    std::function<void(int)> job = [&](int tid) {
+      for (;;) {
+        const int64_t begin = cursor.fetch_add(grain, std::memory_order_relaxed);
+        if (begin >= n) {
+          break;
+        }
+        const int64_t end = std::min(n, begin + grain);
+        for (int64_t i = begin; i < end; i++) {
+          fn(i, tid);
+        }
+      }
+    };
+    run(job);
+  }
+
+  ~ThreadPool() { stop_workers(); }
+
+ private:
+  // Every torch entry point resizes the pool to at::get_num_threads() before
+  // using it; until then it covers the CPUs the process may run on.
+  ThreadPool() { set_num_threads(default_num_threads()); }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  static int default_num_threads() {
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      return CPU_COUNT(&set);
+    }
+#endif
+    return int(std::thread::hardware_concurrency());
+  }
+
+  static bool& in_pool() {
+    static thread_local bool flag = false;
+    return flag;
+  }
+
+  void run(std::function<void(int)>& job) {
+    std::lock_guard<std::mutex> call_lock(call_mutex_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &job;
+      pending_ = int(workers_.size());
+      error_ = nullptr;
+      generation_++;
+    }
+    cv_.notify_all();
+    in_pool() = true;
+    try {
+      job(0);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) {
+        error_ = std::current_exception();
+      }
+    }
+    in_pool() = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+    job_ = nullptr;
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+  void worker_loop(int tid, uint64_t seen) {
+    for (;;) {
+      std::function<void(int)>* job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+        job = job_;
+      }
+      in_pool() = true;
+      try {
+        (*job)(tid);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+      }
+      in_pool() = false;
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  void stop_workers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_) {
+      w.join();
+    }
+    workers_.clear();
+    stop_ = false;
+  }
+
+  int num_threads_ = 1;
+  std::vector<std::thread> workers_;
+  std::mutex call_mutex_;  // one parallel region at a time
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable done_cv_;
+  std::function<void(int)>* job_ = nullptr;
+  std::exception_ptr error_;
+  uint64_t generation_ = 0;
+  int pending_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace cpu
+}  // namespace ater
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_varlen_attention.h
+ * @Description: Host attention over packed variable-length sequences without
+ *               a KV cache (encoder / embedding / reranker models). Every
+ *               sequence attends to itself only, bidirectionally or causally;
+ *               query tiles stream key / value tiles with an online softmax,
+ *               so the score matrix is never materialized beyond one
+ *               [tile rows, key tile] block.
+ */
+
+#pragma once
+
+#include "cpu_paged_attention.h"
+
+namespace ater {
+namespace cpu {
+
+// Query rows (query tokens x GQA heads) per tile and keys per key tile.
+constexpr int kVarlenTileRows = 128;
+constexpr int kVarlenKeyTile = 64;
+// Query rows sharing each K^T load in the logit kernel (bounded by the
+// accumulators that fit in registers).
+#if defined(ATER_CPU_AVX512)
+constexpr int kVarlenRowBlock = 4;
+#else
+constexpr int kVarlenRowBlock = 2;
+#endif
+
+struct VarlenAttentionParams {
+  int num_seqs;
+  int num_heads;
+  int num_kv_heads;
+  int head_size;
+  int head_size_v;  // 0 means head_size
+  float scale;
+  // Token j of a sequence sees tokens <= j of it instead of all of them.
+  bool causal;
+  // [num_seqs + 1] prefix sum; tokens of seq are [cu_seqlens[seq],
+  // cu_seqlens[seq + 1]) of the packed query / key / value / out.
+  const int* cu_seqlens;
+  int64_t q_stride, q_head_stride;  // token / head strides of query
+  int64_t k_stride, k_head_stride;
+  int64_t v_stride, v_head_stride;
+};
+
+// One unit of work: query tokens [tile * T, tile * T + T) of seq with all
+// GQA heads of kv_head.
+struct VarlenWorkItem {
+  int seq;
+  int kv_head;
+  int tile;
+};
+
+inline int varlen_tile_tokens(const VarlenAttentionParams& p) {
+  return std::max(1, kVarlenTileRows / (p.num_heads / p.num_kv_heads));
+}
+
+// Tiles ordered by estimated cost (query rows x visible keys), largest first.
+inline std::vector<VarlenWorkItem> plan_varlen_attention(const VarlenAttentionParams& p) {
+  const int tile_tokens = varlen_tile_tokens(p);
+  std::vector<std::pair<int64_t, VarlenWorkItem>> items;
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    const int len = p.cu_seqlens[seq + 1] - p.cu_seqlens[seq];
+    const int n = (len + tile_tokens - 1) / tile_tokens;
+    for (int kv_head = 0; kv_head < p.num_kv_heads; kv_head++) {
+      for (int tile = 0; tile < n; tile++) {
+        const int tokens = std::min(tile_tokens, len - tile * tile_tokens);
+        const int64_t visible = p.causal ? int64_t(tile) * tile_tokens + tokens : len;
+        items.push_back({visible * tokens, {seq, kv_head, tile}});
+      }
+    }
+  }
+  std::stable_sort(items.begin(), items.end(),
+                   [](const auto& a, const auto& b) { return a.first > b.first; });
+  std::vector<VarlenWorkItem> plan(items.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    plan[i] = items[i].second;
+  }
+  return plan;
+}
+
+struct VarlenScratch {
+  std::vector<float> q;        // [rows, head_size], scaled
+  std::vector<float> k_t;      // [head_size, kVarlenKeyTile], dim-major
+  std::vector<float> v_tile;   // [kVarlenKeyTile, head_size_v], token-major
+  std::vector<float> logits;   // [rows, kVarlenKeyTile]
+  std::vector<float> acc;      // [rows, head_size_v]
+  std::vector<float> row_max;  // [rows]
+  std::vector<float> row_sum;  // [rows]
+  std::vector<float> rescale;  // [rows] of the current key tile
+
+  static VarlenScratch& local() {
+    static thread_local VarlenScratch s;
+    return s;
+  }
+};
+
+// acc[i][d, d + DV * 16) = acc[i][...] * rescale[i] + sum_t prob[i][t] * V[t]
+// for the first nr of RB rows; the last chunk holds n (<= 16) columns.
+template <int RB, int DV>
+inline void varlen_pv_rows(const float* v_tile, int64_t v_stride, int n, int n_tokens,
+                           const float* const* prob, const float* rescale,
+                           float* const* acc, int d, int nr) {
+  constexpr int W = Vec16f::kSize;
+  Vec16f o[RB][DV];
+  for (int i = 0; i < RB; i++) {
+    const Vec16f vr = Vec16f::broadcast(rescale[i]);
+    for (int c = 0; c < DV; c++) {
+      const int m = c + 1 < DV ? W : n;
+      o[i][c] = Vec16f::load_partial(acc[i] + d + c * W, m) * vr;
+    }
+  }
+  for (int t = 0; t < n_tokens; t++) {
+    Vec16f v[DV];
+    for (int c = 0; c < DV; c++) {
+      const float* v_row = v_tile + t * v_stride + c * W;
+      v[c] = c + 1 < DV || n == W ? Vec16f::load(v_row) : Vec16f::load_partial(v_row, n);
+    }
+    for (int i = 0; i < RB; i++) {
+      const Vec16f pr = Vec16f::broadcast(prob[i][t]);
+      for (int c = 0; c < DV; c++) {
+        o[i][c] = fma(pr, v[c], o[i][c]);
+      }
+    }
+  }
+  for (int i = 0; i < nr; i++) {
+    for (int c = 0; c < DV; c++) {
+      o[i][c].store_partial(acc[i] + d + c * W, c + 1 < DV ? W : n);
+    }
+  }
+}
+
+template <typename scalar_t, typename out_t>
+void varlen_attention_tile(const VarlenAttentionParams& p, const scalar_t* query,
+                           const scalar_t* key, const scalar_t* value, const VarlenWorkItem& w,
+                           out_t* out) {
+  constexpr int KT = kVarlenKeyTile;
+  constexpr int NV = KT / Vec16f::kSize;
+  constexpr int RB = kVarlenRowBlock;
+  const int hs = p.head_size;
+  const int vhs = p.head_size_v > 0 ? p.head_size_v : hs;
+  const int gqa = p.num_heads / p.num_kv_heads;
+  const int head0 = w.kv_head * gqa;
+  const int64_t seq_start = p.cu_seqlens[w.seq];
+  const int len = p.cu_seqlens[w.seq + 1] - int(seq_start);
+  const int tile_tokens = varlen_tile_tokens(p);
+  const int j0 = w.tile * tile_tokens;
+  const int rows = std::min(tile_tokens, len - j0) * gqa;  // row = (j - j0) * gqa + r
+  // keys row can see: [0, limit_of(row))
+  auto limit_of = [&](int row) { return p.causal ? j0 + row / gqa + 1 : len; };
+  const int tile_limit = limit_of(rows - 1);
+
+  VarlenScratch& s = VarlenScratch::local();
+  s.q.resize(size_t(rows) * hs);
+  s.k_t.resize(size_t(hs) * KT);
+  s.v_tile.resize(size_t(KT) * vhs);
+  s.logits.resize(size_t(rows) * KT);
+  s.acc.assign(size_t(rows) * vhs, 0.0f);
+  s.row_max.assign(rows, -std::numeric_limits<float>::infinity());
+  s.row_sum.assign(rows, 0.0f);
+  s.rescale.resize(rows);
+
+  for (int r = 0; r < rows; r++) {
+    const scalar_t* q = query + (seq_start + j0 + r / gqa) * p.q_stride +
+                        int64_t(head0 + r % gqa) * p.q_head_stride;
+    for (int d = 0; d < hs; d++) {
+      s.q[size_t(r) * hs + d] = to_float(q[d]) * p.scale;
+    }
+  }
+
+  for (int t0 = 0; t0 < tile_limit; t0 += KT) {
+    const int n_valid = std::min(KT, tile_limit - t0);
+    // K^T and V of the key tile in fp32, shared by every row of the tile;
+    // columns past n_valid are zero so the logit kernel runs full width
+    for (int t = 0; t < KT; t++) {
+      if (t < n_valid) {
+        const scalar_t* k = key + (seq_start + t0 + t) * p.k_stride +
+                            int64_t(w.kv_head) * p.k_head_stride;
+        const scalar_t* v = value + (seq_start + t0 + t) * p.v_stride +
+                            int64_t(w.kv_head) * p.v_head_stride;
+        for (int d = 0; d < hs; d++) {
+          s.k_t[size_t(d) * KT + t] = to_float(k[d]);
+        }
+        for (int d = 0; d < vhs; d++) {
+          s.v_tile[size_t(t) * vhs + d] = to_float(v[d]);
+        }
+      } else {
+        for (int d = 0; d < hs; d++) {
+          s.k_t[size_t(d) * KT + t] = 0.0f;
+        }
+      }
+    }
+
+    // S = Q K^T, RB rows at a time: one query dim of each row is broadcast
+    // against the KT keys, so every K^T load feeds RB rows
+    for (int r0 = 0; r0 < rows; r0 += RB) {
+      const int nr = std::min(RB, rows - r0);
+      if (limit_of(r0 + nr - 1) <= t0) {
+        continue;
+      }
+      // rows past the tile repeat its last row and are not stored
+      const float* q[RB];
+      for (int i = 0; i < RB; i++) {
+        q[i] = &s.q[size_t(r0 + std::min(i, nr - 1)) * hs];
+      }
+      Vec16f a[RB][NV];
+      for (int i = 0; i < RB; i++) {
+        for (int u = 0; u < NV; u++) {
+          a[i][u] = Vec16f::zero();
+        }
+      }
+      for (int d = 0; d < hs; d++) {
+        Vec16f k[NV];
+        for (int u = 0; u < NV; u++) {
+          k[u] = Vec16f::load(&s.k_t[size_t(d) * KT + u * Vec16f::kSize]);
+        }
+        for (int i = 0; i < RB; i++) {
+          const Vec16f qd = Vec16f::broadcast(q[i][d]);
+          for (int u = 0; u < NV; u++) {
+            a[i][u] = fma(qd, k[u], a[i][u]);
+          }
+        }
+      }
+      for (int i = 0; i < nr; i++) {
+        for (int u = 0; u < NV; u++) {
+          a[i][u].store(&s.logits[size_t(r0 + i) * KT + u * Vec16f::kSize]);
+        }
+      }
+    }
+
+    // online softmax update; probabilities past a row's limit are zeroed so
+    // that P V below can run RB rows over a common key range
+    for (int r = 0; r < rows; r++) {
+      const int n_row = std::max(0, std::min(n_valid, limit_of(r) - t0));
+      float* logits = &s.logits[size_t(r) * KT];
+      std::fill(logits + n_row, logits + n_valid, 0.0f);
+      if (n_row == 0) {
+        s.rescale[r] = 1.0f;
+        continue;
+      }
+      const int n_full = n_row / Vec16f::kSize * Vec16f::kSize;
+      Vec16f vmax = Vec16f::broadcast(s.row_max[r]);
+      for (int t = 0; t < n_full; t += Vec16f::kSize) {
+        vmax = max(vmax, Vec16f::load(logits + t));
+      }
+      float m = vmax.reduce_max();
+      for (int t = n_full; t < n_row; t++) {
+        m = std::max(m, logits[t]);
+      }
+      const Vec16f vm = Vec16f::broadcast(m);
+      Vec16f vsum = Vec16f::zero();
+      for (int t = 0; t < n_full; t += Vec16f::kSize) {
+        const Vec16f e = exp(Vec16f::load(logits + t) - vm);
+        e.store(logits + t);
+        vsum = vsum + e;
+      }
+      float sum = vsum.reduce_add();
+      if (n_full < n_row) {
+        const int n = n_row - n_full;
+        exp(Vec16f::load_partial(logits + n_full, n) - vm).store_partial(logits + n_full, n);
+        for (int t = n_full; t < n_row; t++) {
+          sum += logits[t];
+        }
+      }
+      s.rescale[r] = std::exp(s.row_max[r] - m);
+      s.row_max[r] = m;
+      s.row_sum[r] = s.row_sum[r] * s.rescale[r] + sum;
+    }
+
+    // O = O * rescale + P V, every V load feeding RB rows
+    for (int r0 = 0; r0 < rows; r0 += RB) {
+      const int nr = std::min(RB, rows - r0);
+      const int n_blk = std::max(0, std::min(n_valid, limit_of(r0 + nr - 1) - t0));
+      const float* prob[RB];
+      float* acc[RB];
+      float rescale[RB];
+      for (int i = 0; i < RB; i++) {
+        const int row = r0 + std::min(i, nr - 1);
+        prob[i] = &s.logits[size_t(row) * KT];
+        acc[i] = &s.acc[size_t(row) * vhs];
+        rescale[i] = s.rescale[row];
+      }
+      // two V chunks per pass, so that 2 * RB fma chains are in flight
+      int d = 0;
+      for (; d + 2 * Vec16f::kSize <= vhs; d += 2 * Vec16f::kSize) {
+        varlen_pv_rows<RB, 2>(s.v_tile.data() + d, vhs, Vec16f::kSize, n_blk, prob, rescale,
+                              acc, d, nr);
+      }
+      for (; d < vhs; d += Vec16f::kSize) {
+        varlen_pv_rows<RB, 1>(s.v_tile.data() + d, vhs, std::min(Vec16f::kSize, vhs - d),
+                              n_blk, prob, rescale, acc, d, nr);
+      }
+    }
+  }
+
+  for (int r = 0; r < rows; r++) {
+    out_t* out_row =
+        out + ((seq_start + j0 + r / gqa) * p.num_heads + head0 + r % gqa) * vhs;
+    store_row(out_row, &s.acc[size_t(r) * vhs], vhs,
+              s.row_sum[r] > 0.0f ? 1.0f / s.row_sum[r] : 0.0f);
+  }
+}
+
+// out is a contiguous [total_tokens, num_heads, head_size_v].
+template <typename scalar_t, typename out_t>
+void varlen_attention(const VarlenAttentionParams& p, const scalar_t* query,
+                      const scalar_t* key, const scalar_t* value, out_t* out) {
+  const std::vector<VarlenWorkItem> items = plan_varlen_attention(p);
+  ThreadPool::instance().parallel_for(int64_t(items.size()), [&](int64_t i, int) {
+    varlen_attention_tile(p, query, key, value, items[i], out);
+  });
+}
+
+}  // namespace cpu
+}  // namespace ater
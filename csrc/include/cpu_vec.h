@@ -0,0 +1,644 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cpu_vec.h
+ * @Description: 16-lane fp32 vector and storage-type conversions used by the
+ *               host attention/cache kernels. The ISA is picked at compile
+ *               time (AVX-512 > AVX2+FMA+F16C > scalar, plus VNNI int8 dot
+ *               products where available); the JIT modules that use it build
+ *               with -march=native on the host side, so each host gets its
+ *               widest path, while the prebuilt extension stays on the
+ *               portable baseline. Nothing here is visible to device code.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX512F__)
+  #include <immintrin.h>
+  #define ATER_CPU_AVX512 1
+  #if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+    #define ATER_CPU_AVX512_VNNI 1
+  #endif
+#elif defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+  #include <immintrin.h>
+  #define ATER_CPU_AVX2 1
+  #if defined(__AVXVNNI__)
+    #define ATER_CPU_AVX_VNNI 1
+  #endif
+#endif
+
+namespace ater {
+namespace cpu {
+
+// Storage types. They carry only the bit pattern so that the host code does
+// not depend on the torch/hip half types.
+struct bf16_t {
+  uint16_t x;
+};
+struct fp16_t {
+  uint16_t x;
+};
+// ROCm fp8: e4m3, exponent bias 8, no inf, no -0 (0x80 is NaN).
+struct fp8_e4m3fnuz_t {
+  uint8_t x;
+};
+
+////// scalar conversions ///////
+
+inline float bits_to_float(uint32_t u) {
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+inline uint32_t float_to_bits(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+inline float bf16_to_float(uint16_t h) { return bits_to_float(uint32_t(h) << 16); }
+
+inline uint16_t float_to_bf16(float f) {
+  uint32_t u = float_to_bits(f);
+  if ((u & 0x7fffffff) > 0x7f800000) {
+    return 0x7fc0;
+  }
+  u += 0x7fff + ((u >> 16) & 1);  // RNE
+  return uint16_t(u >> 16);
+}
+
+inline float fp16_to_float(uint16_t h) {
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t man = h & 0x3ff;
+  if (exp == 0x1f) {
+    return bits_to_float(sign | 0x7f800000 | (man << 13));
+  }
+  if (exp == 0) {
+    if (man == 0) {
+      return bits_to_float(sign);
+    }
+    // subnormal: normalize
+    exp = 1;
+    while ((man & 0x400) == 0) {
+      man <<= 1;
+      exp--;
+    }
+    man &= 0x3ff;
+  }
+  return bits_to_float(sign | ((exp + 112) << 23) | (man << 13));
+}
+
+inline uint16_t float_to_fp16(float f) {
+  const uint32_t u = float_to_bits(f);
+  const uint16_t sign = uint16_t((u >> 16) & 0x8000);
+  const uint32_t a = u & 0x7fffffff;
+  if (a > 0x7f800000) {
+    return sign | 0x7e00;
+  }
+  if (a >= 0x477ff000) {  // rounds to >= 65536
+    return sign | 0x7c00;
+  }
+  if (a < 0x38800000) {  // subnormal or zero in fp16
+    const float af = bits_to_float(a);
+    return sign | uint16_t(std::nearbyint(af * 16777216.0f));  // * 2^24
+  }
+  uint32_t r = a + 0xfff + ((a >> 13) & 1);  // RNE on the dropped 13 bits
+  return sign | uint16_t((r - 0x38000000) >> 13);
+}
+
+inline const float* fp8_e4m3fnuz_table() {
+  static const struct Table {
+    float v[256];
+    Table() {
+      for (int i = 0; i < 256; i++) {
+        const int sign = i >> 7;
+        const int exp = (i >> 3) & 0xf;
+        const int man = i & 0x7;
+        float f;
+        if (i == 0x80) {
+          f = std::numeric_limits<float>::quiet_NaN();
+        } else if (exp == 0) {
+          f = std::ldexp(float(man) / 8.0f, -7);
+        } else {
+          f = std::ldexp(1.0f + float(man) / 8.0f, exp - 8);
+        }
+        v[i] = sign ? -f : f;
+      }
+    }
+  } table;
+  return table.v;
+}
+
+inline float fp8_e4m3fnuz_to_float(uint8_t b) { return fp8_e4m3fnuz_table()[b]; }
+
+// RNE, saturating to +-240 like hip_fp8; NaN -> 0x80. Results that round to
+// zero are +0 since 0x80 is NaN.
+inline uint8_t float_to_fp8_e4m3fnuz(float f) {
+  const uint32_t u = float_to_bits(f);
+  const uint8_t sign = uint8_t((u >> 24) & 0x80);
+  const uint32_t a = u & 0x7fffffff;
+  if (a > 0x7f800000) {
+    return 0x80;
+  }
+  uint32_t r;
+  if (a < 0x3c000000) {  // below 2^-7: subnormal or zero in fp8
+    r = uint32_t(std::nearbyint(bits_to_float(a) * 1024.0f));  // * 2^10
+  } else {
+    r = (a + 0x7ffff + ((a >> 20) & 1)) >> 20;  // RNE on the dropped 20 bits
+    r = std::min<uint32_t>(r - (119u << 3), 0x7f);  // rebias 127 -> 8
+  }
+  return r == 0 ? 0 : uint8_t(sign | r);
+}
+
+template <typename T>
+inline float to_float(T v);
+template <>
+inline float to_float<float>(float v) { return v; }
+template <>
+inline float to_float<bf16_t>(bf16_t v) { return bf16_to_float(v.x); }
+template <>
+inline float to_float<fp16_t>(fp16_t v) { return fp16_to_float(v.x); }
+template <>
+inline float to_float<fp8_e4m3fnuz_t>(fp8_e4m3fnuz_t v) {
+  return fp8_e4m3fnuz_to_float(v.x);
+}
+template <>
+inline float to_float<int8_t>(int8_t v) { return float(v); }
+
+template <typename T>
+inline T from_float(float v);
+template <>
+inline float from_float<float>(float v) { return v; }
+template <>
+inline bf16_t from_float<bf16_t>(float v) { return {float_to_bf16(v)}; }
+template <>
+inline fp16_t from_float<fp16_t>(float v) { return {float_to_fp16(v)}; }
+template <>
+inline fp8_e4m3fnuz_t from_float<fp8_e4m3fnuz_t>(float v) {
+  return {float_to_fp8_e4m3fnuz(v)};
+}
+
+////// Vec16f ///////
+
+struct alignas(64) Vec16f {
+  static constexpr int kSize = 16;
+
+#if defined(ATER_CPU_AVX512)
+  __m512 v;
+
+  Vec16f() = default;
+  explicit Vec16f(__m512 v_) : v(v_) {}
+  static Vec16f zero() { return Vec16f(_mm512_setzero_ps()); }
+  static Vec16f broadcast(float f) { return Vec16f(_mm512_set1_ps(f)); }
+  static Vec16f load(const float* p) { return Vec16f(_mm512_loadu_ps(p)); }
+  static Vec16f load_partial(const float* p, int n) {
+    return Vec16f(_mm512_maskz_loadu_ps(__mmask16((1u << n) - 1), p));
+  }
+  void store(float* p) const { _mm512_storeu_ps(p, v); }
+  void store_partial(float* p, int n) const {
+    _mm512_mask_storeu_ps(p, __mmask16((1u << n) - 1), v);
+  }
+  friend Vec16f operator+(Vec16f a, Vec16f b) { return Vec16f(_mm512_add_ps(a.v, b.v)); }
+  friend Vec16f operator-(Vec16f a, Vec16f b) { return Vec16f(_mm512_sub_ps(a.v, b.v)); }
+  friend Vec16f operator*(Vec16f a, Vec16f b) { return Vec16f(_mm512_mul_ps(a.v, b.v)); }
+  friend Vec16f fma(Vec16f a, Vec16f b, Vec16f c) {
+    return Vec16f(_mm512_fmadd_ps(a.v, b.v, c.v));
+  }
+  friend Vec16f max(Vec16f a, Vec16f b) { return Vec16f(_mm512_max_ps(a.v, b.v)); }
+  float reduce_add() const { return _mm512_reduce_add_ps(v); }
+  float reduce_max() const { return _mm512_reduce_max_ps(v); }
+
+#elif defined(ATER_CPU_AVX2)
+  __m256 lo, hi;
+
+  Vec16f() = default;
+  Vec16f(__m256 lo_, __m256 hi_) : lo(lo_), hi(hi_) {}
+  static Vec16f zero() { return Vec16f(_mm256_setzero_ps(), _mm256_setzero_ps()); }
+  static Vec16f broadcast(float f) { return Vec16f(_mm256_set1_ps(f), _mm256_set1_ps(f)); }
+  static Vec16f load(const float* p) {
+    return Vec16f(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8));
+  }
+  static Vec16f load_partial(const float* p, int n) {
+    alignas(64) float tmp[kSize] = {0};
+    std::memcpy(tmp, p, n * sizeof(float));
+    return load(tmp);
+  }
+  void store(float* p) const {
+    _mm256_storeu_ps(p, lo);
+    _mm256_storeu_ps(p + 8, hi);
+  }
+  void store_partial(float* p, int n) const {
+    alignas(64) float tmp[kSize];
+    store(tmp);
+    std::memcpy(p, tmp, n * sizeof(float));
+  }
+  friend Vec16f operator+(Vec16f a, Vec16f b) {
+    return Vec16f(_mm256_add_ps(a.lo, b.lo), _mm256_add_ps(a.hi, b.hi));
+  }
+  friend Vec16f operator-(Vec16f a, Vec16f b) {
+    return Vec16f(_mm256_sub_ps(a.lo, b.lo), _mm256_sub_ps(a.hi, b.hi));
+  }
+  friend Vec16f operator*(Vec16f a, Vec16f b) {
+    return Vec16f(_mm256_mul_ps(a.lo, b.lo), _mm256_mul_ps(a.hi, b.hi));
+  }
+  friend Vec16f fma(Vec16f a, Vec16f b, Vec16f c) {
+    return Vec16f(_mm256_fmadd_ps(a.lo, b.lo, c.lo), _mm256_fmadd_ps(a.hi, b.hi, c.hi));
+  }
+  friend Vec16f max(Vec16f a, Vec16f b) {
+    return Vec16f(_mm256_max_ps(a.lo, b.lo), _mm256_max_ps(a.hi, b.hi));
+  }
+  float reduce_add() const {
+    __m256 s = _mm256_add_ps(lo, hi);
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_movehdup_ps(x));
+    return _mm_cvtss_f32(x);
+  }
+  float reduce_max() const {
+    __m256 s = _mm256_max_ps(lo, hi);
+    __m128 x = _mm_max_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_max_ss(x, _mm_movehdup_ps(x));
+    return _mm_cvtss_f32(x);
+  }
+
+#else
+  float v[kSize];
+
+  static Vec16f zero() { return broadcast(0.0f); }
+  static Vec16f broadcast(float f) {
+    Vec16f r;
+    for (int i = 0; i < kSize; i++) r.v[i] = f;
+    return r;
+  }
+  static Vec16f load(const float* p) {
+    Vec16f r;
+    std::memcpy(r.v, p, sizeof(r.v));
+    return r;
+  }
+  static Vec16f load_partial(const float* p, int n) {
+    Vec16f r = zero();
+    std::memcpy(r.v, p, n * sizeof(float));
+    return r;
+  }
+  void store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+  void store_partial(float* p, int n) const { std::memcpy(p, v, n * sizeof(float)); }
+  #define ATER_CPU_VEC_BINOP(NAME, EXPR)      \
+    friend Vec16f NAME(Vec16f a, Vec16f b) { \
+      Vec16f r;                              \
+      for (int i = 0; i < kSize; i++) {      \
+        r.v[i] = EXPR;                       \
+      }                                      \
+      return r;                              \
+    }
+  ATER_CPU_VEC_BINOP(operator+, a.v[i] + b.v[i])
+  ATER_CPU_VEC_BINOP(operator-, a.v[i] - b.v[i])
+  ATER_CPU_VEC_BINOP(operator*, a.v[i] * b.v[i])
+  ATER_CPU_VEC_BINOP(max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+  #undef ATER_CPU_VEC_BINOP
+  friend Vec16f fma(Vec16f a, Vec16f b, Vec16f c) {
+    Vec16f r;
+    for (int i = 0; i < kSize; i++) r.v[i] = std::fma(a.v[i], b.v[i], c.v[i]);
+    return r;
+  }
+  float reduce_add() const {
+    float s = 0.0f;
+    for (int i = 0; i < kSize; i++) s += v[i];
+    return s;
+  }
+  float reduce_max() const {
+    float s = v[0];
+    for (int i = 1; i < kSize; i++) s = v[i] > s ? v[i] : s;
+    return s;
+  }
+#endif
+};
+
+// exp(x) with |rel err| < 2e-7 on [-87.3, 88.3] (cephes expf polynomial).
+// Inputs below the range flush towards 0, never to -inf / NaN.
+#if defined(ATER_CPU_AVX512)
+inline __m512 exp_ps(__m512 x) {
+  x = _mm512_min_ps(x, _mm512_set1_ps(88.3762626647949f));
+  x = _mm512_max_ps(x, _mm512_set1_ps(-87.3365478515625f));
+  __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)),
+                                  _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+  r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+  __m512 p = _mm512_set1_ps(1.9875691500E-4f);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507E-3f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073E-3f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894E-2f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459E-1f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201E-1f));
+  p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r);
+  p = _mm512_add_ps(p, _mm512_set1_ps(1.0f));
+  return _mm512_scalef_ps(p, n);
+}
+#elif defined(ATER_CPU_AVX2)
+inline __m256 exp_ps(__m256 x) {
+  x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+  x = _mm256_max_ps(x, _mm256_set1_ps(-87.3365478515625f));
+  __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+  __m256 p = _mm256_set1_ps(1.9875691500E-4f);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507E-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073E-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894E-2f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459E-1f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201E-1f));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r);
+  p = _mm256_add_ps(p, _mm256_set1_ps(1.0f));
+  // n is in [-126, 128) after the clamp, so 2^n fits a normal float except
+  // at the very top which only overflows to inf as expf would.
+  __m256i e = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+#endif
+
+inline Vec16f exp(Vec16f x) {
+#if defined(ATER_CPU_AVX512)
+  return Vec16f(exp_ps(x.v));
+#elif defined(ATER_CPU_AVX2)
+  return Vec16f(exp_ps(x.lo), exp_ps(x.hi));
+#else
+  Vec16f r;
+  for (int i = 0; i < Vec16f::kSize; i++) r.v[i] = std::exp(x.v[i]);
+  return r;
+#endif
+}
+
+////// converting loads / stores ///////
+
+// Loads 16 consecutive elements of T and widens them to fp32.
+template <typename T>
+inline Vec16f load_cvt(const T* p);
+
+template <>
+inline Vec16f load_cvt<float>(const float* p) {
+  return Vec16f::load(p);
+}
+
+#if defined(ATER_CPU_AVX512)
+template <>
+inline Vec16f load_cvt<bf16_t>(const bf16_t* p) {
+  __m512i w = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+  return Vec16f(_mm512_castsi512_ps(_mm512_slli_epi32(w, 16)));
+}
+template <>
+inline Vec16f load_cvt<fp16_t>(const fp16_t* p) {
+  return Vec16f(_mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))));
+}
+template <>
+inline Vec16f load_cvt<fp8_e4m3fnuz_t>(const fp8_e4m3fnuz_t* p) {
+  __m512i idx = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  return Vec16f(_mm512_i32gather_ps(idx, fp8_e4m3fnuz_table(), 4));
+}
+template <>
+inline Vec16f load_cvt<int8_t>(const int8_t* p) {
+  __m512i w = _mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  return Vec16f(_mm512_cvtepi32_ps(w));
+}
+#elif defined(ATER_CPU_AVX2)
+template <>
+inline Vec16f load_cvt<bf16_t>(const bf16_t* p) {
+  const __m128i* q = reinterpret_cast<const __m128i*>(p);
+  __m256i lo = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(q)), 16);
+  __m256i hi = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(q + 1)), 16);
+  return Vec16f(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi));
+}
+template <>
+inline Vec16f load_cvt<fp16_t>(const fp16_t* p) {
+  const __m128i* q = reinterpret_cast<const __m128i*>(p);
+  return Vec16f(_mm256_cvtph_ps(_mm_loadu_si128(q)), _mm256_cvtph_ps(_mm_loadu_si128(q + 1)));
+}
+template <>
+inline Vec16f load_cvt<fp8_e4m3fnuz_t>(const fp8_e4m3fnuz_t* p) {
+  const float* table = fp8_e4m3fnuz_table();
+  __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m256i lo = _mm256_cvtepu8_epi32(b);
+  __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(b, 8));
+  return Vec16f(_mm256_i32gather_ps(table, lo, 4), _mm256_i32gather_ps(table, hi, 4));
+}
+template <>
+inline Vec16f load_cvt<int8_t>(const int8_t* p) {
+  __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  return Vec16f(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(b)),
+                _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(b, 8))));
+}
+#else
+template <typename T>
+inline Vec16f load_cvt(const T* p) {
+  Vec16f r;
+  for (int i = 0; i < Vec16f::kSize; i++) r.v[i] = to_float(p[i]);
+  return r;
+}
+#endif
+
+// Loads n (< 16) elements, zero filling the remaining lanes.
+template <typename T>
+inline Vec16f load_cvt_partial(const T* p, int n) {
+  T tmp[Vec16f::kSize];
+  std::memset(static_cast<void*>(tmp), 0, sizeof(tmp));
+  std::memcpy(static_cast<void*>(tmp), p, n * sizeof(T));
+  return load_cvt(tmp);
+}
+
+// Narrows and stores 16 lanes as T.
+template <typename T>
+inline void store_cvt(T* p, Vec16f v);
+
+template <>
+inline void store_cvt<float>(float* p, Vec16f v) {
+  v.store(p);
+}
+
+#if defined(ATER_CPU_AVX512)
+template <>
+inline void store_cvt<bf16_t>(bf16_t* p, Vec16f v) {
+  __m512i u = _mm512_castps_si512(v.v);
+  __m512i rnd = _mm512_add_epi32(_mm512_set1_epi32(0x7fff),
+                                 _mm512_and_si512(_mm512_srli_epi32(u, 16), _mm512_set1_epi32(1)));
+  __m512i r = _mm512_srli_epi32(_mm512_add_epi32(u, rnd), 16);
+  __mmask16 nan = _mm512_cmp_ps_mask(v.v, v.v, _CMP_UNORD_Q);
+  r = _mm512_mask_mov_epi32(r, nan, _mm512_set1_epi32(0x7fc0));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_cvtepi32_epi16(r));
+}
+template <>
+inline void store_cvt<fp16_t>(fp16_t* p, Vec16f v) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+                      _mm512_cvtps_ph(v.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+}
+#elif defined(ATER_CPU_AVX2)
+inline __m128i cvt_ps_bf16_256(__m256 v) {
+  __m256i u = _mm256_castps_si256(v);
+  __m256i rnd = _mm256_add_epi32(_mm256_set1_epi32(0x7fff),
+                                 _mm256_and_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(1)));
+  __m256i r = _mm256_srli_epi32(_mm256_add_epi32(u, rnd), 16);
+  __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+  r = _mm256_blendv_epi8(r, _mm256_set1_epi32(0x7fc0), nan);
+  r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0xd8);
+  return _mm256_castsi256_si128(r);
+}
+template <>
+inline void store_cvt<bf16_t>(bf16_t* p, Vec16f v) {
+  __m128i* q = reinterpret_cast<__m128i*>(p);
+  _mm_storeu_si128(q, cvt_ps_bf16_256(v.lo));
+  _mm_storeu_si128(q + 1, cvt_ps_bf16_256(v.hi));
+}
+template <>
+inline void store_cvt<fp16_t>(fp16_t* p, Vec16f v) {
+  __m128i* q = reinterpret_cast<__m128i*>(p);
+  _mm_storeu_si128(q, _mm256_cvtps_ph(v.lo, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  _mm_storeu_si128(q + 1, _mm256_cvtps_ph(v.hi, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+}
+#else
+template <typename T>
+inline void store_cvt(T* p, Vec16f v) {
+  for (int i = 0; i < Vec16f::kSize; i++) p[i] = from_float<T>(v.v[i]);
+}
+#endif
+
+// fp8 output rows are stored once per reduce; no vector encoder needed.
+template <>
+inline void store_cvt<fp8_e4m3fnuz_t>(fp8_e4m3fnuz_t* p, Vec16f v) {
+  float tmp[Vec16f::kSize];
+  v.store(tmp);
+  for (int i = 0; i < Vec16f::kSize; i++) p[i] = from_float<fp8_e4m3fnuz_t>(tmp[i]);
+}
+
+template <typename T>
+inline void store_cvt_partial(T* p, Vec16f v, int n) {
+  T tmp[Vec16f::kSize];
+  store_cvt(tmp, v);
+  std::memcpy(static_cast<void*>(p), tmp, n * sizeof(T));
+}
+
+////// int8 dot products ///////
+
+// int32 dot products of kTokens consecutive 16-byte int8 K rows (one X-wide
+// chunk of the paged key layout per token) with a 16-byte int8 q chunk,
+// accumulated over chunks. vpdpbusd multiplies unsigned by signed bytes, so
+// K is flipped to unsigned (k ^ 0x80 == k + 128) and every dot carries an
+// extra 128 * sum(q), on all paths; the caller subtracts it once.
+struct alignas(64) DotS8 {
+#if defined(ATER_CPU_AVX512_VNNI)
+  static constexpr int kTokens = 4;
+  using KRows = __m512i;
+  __m512i v;
+
+  static DotS8 zero() { return {_mm512_setzero_si512()}; }
+  // n <= kTokens rows; the others are not read
+  static KRows load_k(const int8_t* k, int n) {
+    const __m512i b = n == kTokens ? _mm512_loadu_si512(k)
+                                   : _mm512_maskz_loadu_epi8((__mmask64(1) << (16 * n)) - 1, k);
+    return _mm512_xor_si512(b, _mm512_set1_epi8(char(0x80)));
+  }
+  void add(KRows k, const int8_t* q) {
+    v = _mm512_dpbusd_epi32(
+        v, k, _mm512_broadcast_i32x4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q))));
+  }
+  void store(int32_t* dots) const {
+    alignas(64) int32_t lanes[16];
+    _mm512_store_si512(lanes, v);
+    for (int u = 0; u < kTokens; u++) {
+      dots[u] = lanes[4 * u] + lanes[4 * u + 1] + lanes[4 * u + 2] + lanes[4 * u + 3];
+    }
+  }
+
+#elif defined(ATER_CPU_AVX_VNNI)
+  static constexpr int kTokens = 2;
+  using KRows = __m256i;
+  __m256i v;
+
+  static DotS8 zero() { return {_mm256_setzero_si256()}; }
+  static KRows load_k(const int8_t* k, int n) {
+    const __m256i b =
+        n == kTokens ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(k))
+                     : _mm256_zextsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(k)));
+    return _mm256_xor_si256(b, _mm256_set1_epi8(char(0x80)));
+  }
+  void add(KRows k, const int8_t* q) {
+    v = _mm256_dpbusd_avx_epi32(
+        v, k, _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q))));
+  }
+  void store(int32_t* dots) const {
+    alignas(32) int32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+    for (int u = 0; u < kTokens; u++) {
+      dots[u] = lanes[4 * u] + lanes[4 * u + 1] + lanes[4 * u + 2] + lanes[4 * u + 3];
+    }
+  }
+
+#elif defined(ATER_CPU_AVX2)
+  // No VNNI: bytes are widened to int16 and multiplied with vpmaddwd, which
+  // is exact (vpmaddubsw would saturate its int16 pair sums on the flipped
+  // K). vphaddd folds the four token dots into one register, token u in
+  // lanes u and u + 4.
+  static constexpr int kTokens = 4;
+  struct KRows {
+    __m256i r[kTokens];
+  };
+  __m256i v;
+
+  static DotS8 zero() { return {_mm256_setzero_si256()}; }
+  static KRows load_k(const int8_t* k, int n) {
+    const __m128i flip = _mm_set1_epi8(char(0x80));
+    KRows rows;
+    for (int u = 0; u < kTokens; u++) {
+      // rows past n become 0 (flip ^ flip) without being read
+      const __m128i b =
+          u < n ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(k + 16 * u)) : flip;
+      rows.r[u] = _mm256_cvtepu8_epi16(_mm_xor_si128(b, flip));
+    }
+    return rows;
+  }
+  void add(const KRows& k, const int8_t* q) {
+    const __m256i q16 =
+        _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q)));
+    const __m256i d01 =
+        _mm256_hadd_epi32(_mm256_madd_epi16(k.r[0], q16), _mm256_madd_epi16(k.r[1], q16));
+    const __m256i d23 =
+        _mm256_hadd_epi32(_mm256_madd_epi16(k.r[2], q16), _mm256_madd_epi16(k.r[3], q16));
+    v = _mm256_add_epi32(v, _mm256_hadd_epi32(d01, d23));
+  }
+  void store(int32_t* dots) const {
+    alignas(32) int32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+    for (int u = 0; u < kTokens; u++) {
+      dots[u] = lanes[u] + lanes[u + 4];
+    }
+  }
+
+#else
+  static constexpr int kTokens = 1;
+  struct KRows {
+    uint8_t b[16];
+  };
+  int32_t v;
+
+  static DotS8 zero() { return {0}; }
+  static KRows load_k(const int8_t* k, int) {
+    KRows r;
+    for (int i = 0; i < 16; i++) r.b[i] = uint8_t(k[i]) ^ 0x80;
+    return r;
+  }
+  void add(const KRows& k, const int8_t* q) {
+    for (int i = 0; i < 16; i++) v += int32_t(k.b[i]) * int32_t(q[i]);
+  }
+  void store(int32_t* dots) const { dots[0] = v; }
+#endif
+};
+
+}  // namespace cpu
+}  // namespace ater
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <torch/extension.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Asynchronous block swaps between a GPU's KV caches and host tiers, so a
+// scheduler can keep decoding while a preempted sequence's blocks move.
+// Requests run in submission order on a worker thread and a side stream of
+// the device; each one first waits for the work queued on the caller's
+// current stream, so blocks written before the call are swapped as written.
+// Host caches in pageable memory are streamed through two reusable pinned
+// staging buffers: the host copy of one chunk overlaps the DMA of the
+// other. Pinned host caches and device to device swaps are copied directly.
+// Swapped tensors must not be touched until the request completes.
+class KVSwapper {
+ public:
+  KVSwapper(int64_t device, int64_t staging_bytes);
+  ~KVSwapper();
+
+  // Queues the block copies src[i] -> dst[i] for every (src, dst) block pair
+  // of block_mapping (int64 [num_pairs, 2], CPU), e.g. the key and value
+  // caches of all layers, and returns the request's handle.
+  int64_t swap_async(const std::vector<torch::Tensor> &src,
+                     const std::vector<torch::Tensor> &dst,
+                     const torch::Tensor &block_mapping);
+  // Whether the request has completed; a completed request is retired and
+  // its error, if any, rethrown. Retired handles count as completed.
+  bool poll(int64_t handle);
+  // Blocks until the request has completed, then retires it as poll does.
+  void wait(int64_t handle);
+  void wait_all();
+  // Requests not retired yet.
+  int64_t num_pending() const;
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
@@ -396,6 +396,8 @@ __global__ __launch_bounds__(NUM_THREADS,5) void paged_attention_ll4mi_QKV_mfma1
                                    // head_size]
     OUTT* __restrict__ final_out,  // [num_seqs, num_heads, head_size]
     int max_ctx_blocks, float k_scale, float v_scale,
+    const float* __restrict__ k_head_scales,  // [num_kv_heads] or nullptr
+    const float* __restrict__ v_head_scales,  // [num_kv_heads] or nullptr
     const float* __restrict__ fp8_out_scale_ptr) {
   constexpr int NWARPS = NUM_THREADS / WARP_SIZE;
   const int warpid = threadIdx.x / WARP_SIZE;
@@ -450,6 +452,10 @@ __global__ __launch_bounds__(NUM_THREADS,5) void paged_attention_ll4mi_QKV_mfma1
 
   const int wg_start_head_idx = blockIdx.z * GQA_RATIO;
   const int wg_start_kv_head_idx = blockIdx.z;
+  if (k_head_scales != nullptr) {
+    k_scale = k_head_scales[wg_start_kv_head_idx];
+    v_scale = v_head_scales[wg_start_kv_head_idx];
+  }
   const int total_num_heads = gridDim.z * GQA_RATIO;
 
   //for QK mfma, tokens in multiples of TOKENS_PER_WARP are spread across warps
@@ -999,6 +1005,8 @@ __global__ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_QKV_kernel(
                                    // head_size]
     OUTT* __restrict__ final_out,  // [num_seqs, num_heads, head_size]
     int max_ctx_blocks, float k_scale, float v_scale,
+    const float* __restrict__ k_head_scales,  // [num_kv_heads] or nullptr
+    const float* __restrict__ v_head_scales,  // [num_kv_heads] or nullptr
     const float* __restrict__ fp8_out_scale_ptr) {
   constexpr int NWARPS = NUM_THREADS / WARP_SIZE;
   const int warpid = threadIdx.x / WARP_SIZE;
@@ -1047,6 +1055,10 @@ __global__ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_QKV_kernel(
 
   const int wg_start_head_idx = blockIdx.z * GQA_RATIO;
   const int wg_start_kv_head_idx = blockIdx.z;
+  if (k_head_scales != nullptr) {
+    k_scale = k_head_scales[wg_start_kv_head_idx];
+    v_scale = v_head_scales[wg_start_kv_head_idx];
+  }
 
   const int warp_start_token_idx =
       partition_start_token_idx + warpid * WARP_SIZE;
@@ -1743,10 +1755,6 @@ __global__ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_QKV_kernel(
   __syncthreads();
 
   if (warpid == 0) {
-    // const float out_scale = (fp8_out_scale_ptr != nullptr) ?
-    // __fdividef(1.0f,(*fp8_out_scale_ptr)) : 1.0f;
-    const float out_scale =
-        (fp8_out_scale_ptr != nullptr) ? 1.0f / (*fp8_out_scale_ptr) : 1.0f;
     _B16x4 vout[QHLOOP][VHELOOP];
     // iterate across heads
   #pragma unroll
@@ -1763,58 +1771,26 @@ __global__ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_QKV_kernel(
       }
     }
 
-    if (context_len > partition_size) {
-      scalar_t* out_ptr = out +
-                          seq_idx * num_heads * max_num_partitions * HEAD_SIZE +
-                          partition_idx * HEAD_SIZE;
-      const int out_num_partitions = max_num_partitions;
-      bit16_t* out_ptr_b16 = reinterpret_cast<bit16_t*>(out_ptr);
-  #pragma unroll
-      for (int qh = 0; qh < QHLOOP; qh++) {
+    // the reduce kernel always runs (the mfma16 kernel has no single
+    // partition shortcut), so the partition workspace is always written and
+    // out, including fp8 out, is produced there
+    scalar_t* out_ptr = out +
+                        seq_idx * num_heads * max_num_partitions * HEAD_SIZE +
+                        partition_idx * HEAD_SIZE;
+    const int out_num_partitions = max_num_partitions;
+    bit16_t* out_ptr_b16 = reinterpret_cast<bit16_t*>(out_ptr);
   #pragma unroll
-        for (int vh = 0; vh < VHELOOP; vh++) {
-          const int head_size_elem = vh * WARP_SIZE + laneid;
+    for (int qh = 0; qh < QHLOOP; qh++) {
   #pragma unroll
-          for (int i = 0; i < 4; i++) {
-            const int head_idx = 4 * qh + i;
-            if (head_idx < GQA_RATIO) {
-              out_ptr_b16[(wg_start_head_idx + head_idx) * out_num_partitions *
-                              HEAD_SIZE +
-                          head_size_elem] = vout[qh][vh][i];
-            }
-          }
-        }
-      }
-    }  // context_len > partition_size
-    else {
-      bit8_t* final_out_ptr_b8;
-      bit16_t* final_out_ptr_b16;
-      if constexpr (std::is_same<OUTT, bit8_t>::value) {
-        final_out_ptr_b8 = final_out + seq_idx * num_heads * HEAD_SIZE;
-      } else {
-        OUTT* out_ptr = final_out + seq_idx * num_heads * HEAD_SIZE;
-        final_out_ptr_b16 = reinterpret_cast<bit16_t*>(out_ptr);
-      }
+      for (int vh = 0; vh < VHELOOP; vh++) {
+        const int head_size_elem = vh * WARP_SIZE + laneid;
   #pragma unroll
-      for (int qh = 0; qh < QHLOOP; qh++) {
-  #pragma unroll
-        for (int vh = 0; vh < VHELOOP; vh++) {
-          const int head_size_elem = vh * WARP_SIZE + laneid;
-  #pragma unroll
-          for (int i = 0; i < 4; i++) {
-            const int head_idx = 4 * qh + i;
-            if (head_idx < GQA_RATIO) {
-              if constexpr (std::is_same<OUTT, bit8_t>::value) {
-                const float tmpf =
-                    out_scale * to_float_b16<scalar_t>(vout[qh][vh][i]);
-                const OUTT tmp = hip_fp8(tmpf).data;
-                final_out_ptr_b8[(wg_start_head_idx + head_idx) * HEAD_SIZE +
-                                 head_size_elem] = tmp;
-              } else {
-                final_out_ptr_b16[(wg_start_head_idx + head_idx) * HEAD_SIZE +
-                                  head_size_elem] = vout[qh][vh][i];
-              }
-            }
+        for (int i = 0; i < 4; i++) {
+          const int head_idx = 4 * qh + i;
+          if (head_idx < GQA_RATIO) {
+            out_ptr_b16[(wg_start_head_idx + head_idx) * out_num_partitions *
+                            HEAD_SIZE +
+                        head_size_elem] = vout[qh][vh][i];
           }
         }
       }
@@ -2026,6 +2002,90 @@ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_reduce_kernel(
   }
 }
 
+
+// First level of the hierarchical reduction for contexts with more than
+// WARP_SIZE * 8 partitions: folds every FOLD_PARTITIONS consecutive
+// partitions into one, keeping the (max_logits, exp_sums, tmp_out) contract,
+// so paged_attention_ll4mi_reduce_kernel can finish with
+// PARTITION_SIZE * FOLD_PARTITIONS sized partitions.
+// Grid: (num_heads, num_seqs, max_num_folded_partitions).
+template <typename scalar_t, int HEAD_SIZE, int PARTITION_SIZE,
+          int FOLD_PARTITIONS>
+__global__ __launch_bounds__(HEAD_SIZE) void paged_attention_ll4mi_fold_kernel(
+    float* __restrict__ folded_exp_sums,    // [num_seqs, num_heads,
+                                            // max_num_folded_partitions]
+    float* __restrict__ folded_max_logits,  // [num_seqs, num_heads,
+                                            // max_num_folded_partitions]
+    scalar_t* __restrict__ folded_tmp_out,  // [num_seqs, num_heads,
+                                            // max_num_folded_partitions,
+                                            // head_size]
+    const float* __restrict__ exp_sums,     // [num_seqs, num_heads,
+                                            // max_num_partitions]
+    const float* __restrict__ max_logits,   // [num_seqs, num_heads,
+                                            // max_num_partitions]
+    const scalar_t* __restrict__ tmp_out,   // [num_seqs, num_heads,
+                                            // max_num_partitions, head_size]
+    const int* __restrict__ context_lens,   // [num_seqs]
+    const int max_num_partitions, const int max_num_folded_partitions) {
+  static_assert(FOLD_PARTITIONS == WARP_SIZE);
+  const int num_heads = gridDim.x;
+  const int head_idx = blockIdx.x;
+  const int seq_idx = blockIdx.y;
+  const int fold_idx = blockIdx.z;
+  const int context_len = context_lens[seq_idx];
+  const int num_partitions = DIVIDE_ROUND_UP(context_len, PARTITION_SIZE);
+  const int first = fold_idx * FOLD_PARTITIONS;
+  if (first >= num_partitions) {
+    return;
+  }
+  const int count = MIN(FOLD_PARTITIONS, num_partitions - first);
+
+  __shared__ float shared_weights[FOLD_PARTITIONS];
+  __shared__ float shared_max_logit;
+  __shared__ float shared_exp_sum;
+
+  const int64_t row = (int64_t)seq_idx * num_heads + head_idx;
+  if (threadIdx.x < WARP_SIZE) {
+    const int partition_no = first + MIN((int)threadIdx.x, count - 1);
+    const float logit = max_logits[row * max_num_partitions + partition_no];
+    float max_logit = logit;
+  #pragma unroll
+    for (int mask = WARP_SIZE / 2; mask >= 1; mask /= 2) {
+      max_logit = fmaxf(max_logit, __shfl_xor(max_logit, mask));
+    }
+    const float weight =
+        (threadIdx.x < count)
+            ? exp_sums[row * max_num_partitions + partition_no] *
+                  expf(logit - max_logit)
+            : 0.0f;
+    shared_weights[threadIdx.x] = weight;
+    float exp_sum = weight;
+  #pragma unroll
+    for (int mask = WARP_SIZE / 2; mask >= 1; mask /= 2) {
+      exp_sum += __shfl_xor(exp_sum, mask);
+    }
+    if (threadIdx.x == 0) {
+      shared_max_logit = max_logit;
+      shared_exp_sum = exp_sum;
+    }
+  }
+  __syncthreads();
+
+  const scalar_t* tmp_out_ptr =
+      tmp_out + (row * max_num_partitions + first) * HEAD_SIZE + threadIdx.x;
+  float acc = 0.0f;
+  for (int j = 0; j < count; j++) {
+    acc += to_float<scalar_t>(tmp_out_ptr[j * HEAD_SIZE]) * shared_weights[j];
+  }
+  const int64_t out_row = row * max_num_folded_partitions + fold_idx;
+  folded_tmp_out[out_row * HEAD_SIZE + threadIdx.x] =
+      from_float<scalar_t>(acc * __fdividef(1.0f, shared_exp_sum));
+  if (threadIdx.x == 0) {
+    folded_max_logits[out_row] = shared_max_logit;
+    folded_exp_sums[out_row] = shared_exp_sum;
+  }
+}
+
 #else  // !defined(__HIP__MI300_MI250__) TODO: Add NAVI support
 
 template <typename scalar_t, typename cache_t,
@@ -2051,6 +2111,8 @@ __global__ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_QKV_mfma16_
                                    // head_size]
     OUTT* __restrict__ final_out,  // [num_seqs, num_heads, head_size]
     int max_ctx_blocks, float k_scale, float v_scale,
+    const float* __restrict__ k_head_scales,  // [num_kv_heads] or nullptr
+    const float* __restrict__ v_head_scales,  // [num_kv_heads] or nullptr
     const float* __restrict__ fp8_out_scale_ptr) {
   UNREACHABLE_CODE
 }
@@ -2078,6 +2140,8 @@ __global__ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_QKV_kernel(
                                    // head_size]
     OUTT* __restrict__ final_out,  // [num_seqs, num_heads, head_size]
     int max_ctx_blocks, float k_scale, float v_scale,
+    const float* __restrict__ k_head_scales,  // [num_kv_heads] or nullptr
+    const float* __restrict__ v_head_scales,  // [num_kv_heads] or nullptr
     const float* __restrict__ fp8_out_scale_ptr) {
   UNREACHABLE_CODE
 }
@@ -2098,6 +2162,20 @@ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_reduce_kernel(
     const int max_num_partitions,
     const float* __restrict__ fp8_out_scale_ptr){UNREACHABLE_CODE}
 
+
+template <typename scalar_t, int HEAD_SIZE, int PARTITION_SIZE,
+          int FOLD_PARTITIONS>
+__global__ __launch_bounds__(HEAD_SIZE) void paged_attention_ll4mi_fold_kernel(
+    float* __restrict__ folded_exp_sums,
+    float* __restrict__ folded_max_logits,
+    scalar_t* __restrict__ folded_tmp_out,
+    const float* __restrict__ exp_sums,
+    const float* __restrict__ max_logits,
+    const scalar_t* __restrict__ tmp_out,
+    const int* __restrict__ context_lens,
+    const int max_num_partitions,
+    const int max_num_folded_partitions){UNREACHABLE_CODE}
+
 #endif  // defined(__HIP__MI300_MI250__) TODO: Add NAVI support
 
 #define LAUNCH_CUSTOM_ATTENTION_MFMA16(GQA_RATIO)                                    \
@@ -2108,7 +2186,8 @@ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_reduce_kernel(
           block_tables_ptr, context_lens_ptr, max_num_blocks_per_seq,         \
           alibi_slopes_ptr, q_stride, kv_block_stride, kv_head_stride,        \
           exp_sums_ptr, max_logits_ptr, tmp_out_ptr, out_ptr, max_ctx_blocks, \
-          k_scale, v_scale, fp8_out_scale_ptr);
+          k_scale, v_scale, k_head_scales_ptr, v_head_scales_ptr,             \
+          fp8_out_scale_ptr);
 
 #define LAUNCH_CUSTOM_ATTENTION(GQA_RATIO)                                    \
   paged_attention_ll4mi_QKV_kernel<T, KVT, KV_DTYPE, OUTT, BLOCK_SIZE,        \
@@ -2118,7 +2197,8 @@ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_reduce_kernel(
           block_tables_ptr, context_lens_ptr, max_num_blocks_per_seq,         \
           alibi_slopes_ptr, q_stride, kv_block_stride, kv_head_stride,        \
           exp_sums_ptr, max_logits_ptr, tmp_out_ptr, out_ptr, max_ctx_blocks, \
-          k_scale, v_scale, fp8_out_scale_ptr);
+          k_scale, v_scale, k_head_scales_ptr, v_head_scales_ptr,             \
+          fp8_out_scale_ptr);
 
 #define LAUNCH_CUSTOM_REDUCTION(NPAR_LOOPS)                          \
   paged_attention_ll4mi_reduce_kernel<T, OUTT, HEAD_SIZE, HEAD_SIZE, \
@@ -2127,8 +2207,27 @@ __launch_bounds__(NUM_THREADS) void paged_attention_ll4mi_reduce_kernel(
           out_ptr, exp_sums_ptr, max_logits_ptr, tmp_out_ptr,        \
           context_lens_ptr, max_num_partitions, fp8_out_scale_ptr);
 
+#define LAUNCH_CUSTOM_REDUCTION_FOLDED(NPAR_LOOPS)                         \
+  paged_attention_ll4mi_reduce_kernel<T, OUTT, HEAD_SIZE, HEAD_SIZE,       \
+                                      PARTITION_SIZE * FOLD_PARTITIONS,    \
+                                      NPAR_LOOPS>                          \
+      <<<reduce_grid, reduce_block, 0, stream>>>(                          \
+          out_ptr, folded_exp_sums_ptr, folded_max_logits_ptr,             \
+          folded_tmp_out_ptr, context_lens_ptr, max_num_folded_partitions, \
+          fp8_out_scale_ptr);
+
+// MFMA16 picks paged_attention_ll4mi_QKV_mfma16_kernel (head size 128, block
+// size 16 only) over paged_attention_ll4mi_QKV_kernel (head size 64 / 128,
+// block size 16 / 32).
+#define LAUNCH_CUSTOM_ATTENTION_KERNEL(GQA_RATIO) \
+  if constexpr (MFMA16) {                         \
+    LAUNCH_CUSTOM_ATTENTION_MFMA16(GQA_RATIO);    \
+  } else {                                        \
+    LAUNCH_CUSTOM_ATTENTION(GQA_RATIO);           \
+  }
+
 template <typename T, typename KVT, vllm::Fp8KVCacheDataType KV_DTYPE,
-          int BLOCK_SIZE, int HEAD_SIZE, typename OUTT, int PARTITION_SIZE_OLD>
+          int BLOCK_SIZE, int HEAD_SIZE, typename OUTT, bool MFMA16>
 void paged_attention_custom_launcher(
     torch::Tensor& out, torch::Tensor& exp_sums, torch::Tensor& max_logits,
     torch::Tensor& tmp_out, torch::Tensor& query, torch::Tensor& key_cache,
@@ -2136,6 +2235,8 @@ void paged_attention_custom_launcher(
     torch::Tensor& block_tables, torch::Tensor& context_lens,
     int max_context_len, const c10::optional<torch::Tensor>& alibi_slopes,
     float k_scale, float v_scale,
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales,
     const c10::optional<torch::Tensor>& fp8_out_scale) {
   int num_seqs = query.size(0);
   int num_heads = query.size(1);
@@ -2160,6 +2261,13 @@ void paged_attention_custom_launcher(
   int* block_tables_ptr = block_tables.data_ptr<int>();
   int* context_lens_ptr = context_lens.data_ptr<int>();
 
+  // NOTE: k_head_scales / v_head_scales are optional and override the
+  // scalar k_scale / v_scale per kv head.
+  const float* k_head_scales_ptr =
+      k_head_scales ? k_head_scales.value().data_ptr<float>() : nullptr;
+  const float* v_head_scales_ptr =
+      v_head_scales ? v_head_scales.value().data_ptr<float>() : nullptr;
+
   // NOTE: fp8_out_scale is optional.
   const float* fp8_out_scale_ptr =
       fp8_out_scale
@@ -2182,68 +2290,52 @@ void paged_attention_custom_launcher(
   const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
   switch (gqa_ratio) {
     case 1:
-      //LAUNCH_CUSTOM_ATTENTION(1);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(1);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(1);
       break;
     case 2:
-      //LAUNCH_CUSTOM_ATTENTION(2);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(2);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(2);
       break;
     case 3:
-      //LAUNCH_CUSTOM_ATTENTION(3);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(3);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(3);
       break;
     case 4:
-      //LAUNCH_CUSTOM_ATTENTION(4);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(4);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(4);
       break;
     case 5:
-      //LAUNCH_CUSTOM_ATTENTION(5);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(5);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(5);
       break;
     case 6:
-      //LAUNCH_CUSTOM_ATTENTION(6);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(6);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(6);
       break;
     case 7:
-      //LAUNCH_CUSTOM_ATTENTION(7);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(7);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(7);
       break;
     case 8:
-      //LAUNCH_CUSTOM_ATTENTION(8);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(8);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(8);
       break;
     case 9:
-      //LAUNCH_CUSTOM_ATTENTION(9);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(9);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(9);
       break;
     case 10:
-      //LAUNCH_CUSTOM_ATTENTION(10);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(10);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(10);
       break;
     case 11:
-      //LAUNCH_CUSTOM_ATTENTION(11);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(11);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(11);
       break;
     case 12:
-      //LAUNCH_CUSTOM_ATTENTION(12);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(12);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(12);
       break;
     case 13:
-      //LAUNCH_CUSTOM_ATTENTION(13);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(13);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(13);
       break;
     case 14:
-      //LAUNCH_CUSTOM_ATTENTION(14);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(14);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(14);
       break;
     case 15:
-      //LAUNCH_CUSTOM_ATTENTION(15);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(15);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(15);
       break;
     case 16:
-      //LAUNCH_CUSTOM_ATTENTION(16);
-      LAUNCH_CUSTOM_ATTENTION_MFMA16(16);
+      LAUNCH_CUSTOM_ATTENTION_KERNEL(16);
       break;
     default:
       TORCH_CHECK(false, "Unsupported gqa ratio: ", gqa_ratio);
@@ -2261,7 +2353,44 @@ void paged_attention_custom_launcher(
     dim3 reduce_grid(num_heads, num_seqs);
     dim3 reduce_block(head_size);
     const int npar_loops = DIVIDE_ROUND_UP(max_num_partitions, WARP_SIZE);
-    // support upto 8*64*256=128K context length
+    // support upto 8*64*256=128K context length in one pass; longer contexts
+    // fold WARP_SIZE partitions at a time first (upto 8*64*64*256=8M tokens)
+    constexpr int FOLD_PARTITIONS = WARP_SIZE;
+    if (npar_loops > 8) {
+      const int max_num_folded_partitions =
+          DIVIDE_ROUND_UP(max_num_partitions, FOLD_PARTITIONS);
+      torch::Tensor folded_exp_sums = torch::empty(
+          {num_seqs, num_heads, max_num_folded_partitions}, exp_sums.options());
+      torch::Tensor folded_max_logits = torch::empty_like(folded_exp_sums);
+      torch::Tensor folded_tmp_out =
+          torch::empty({num_seqs, num_heads, max_num_folded_partitions,
+                        head_size},
+                       tmp_out.options());
+      float* folded_exp_sums_ptr = folded_exp_sums.data_ptr<float>();
+      float* folded_max_logits_ptr = folded_max_logits.data_ptr<float>();
+      T* folded_tmp_out_ptr = reinterpret_cast<T*>(folded_tmp_out.data_ptr());
+      dim3 fold_grid(num_heads, num_seqs, max_num_folded_partitions);
+      paged_attention_ll4mi_fold_kernel<T, HEAD_SIZE, PARTITION_SIZE,
+                                        FOLD_PARTITIONS>
+          <<<fold_grid, reduce_block, 0, stream>>>(
+              folded_exp_sums_ptr, folded_max_logits_ptr, folded_tmp_out_ptr,
+              exp_sums_ptr, max_logits_ptr, tmp_out_ptr, context_lens_ptr,
+              max_num_partitions, max_num_folded_partitions);
+      const int folded_npar_loops =
+          DIVIDE_ROUND_UP(max_num_folded_partitions, WARP_SIZE);
+      if (folded_npar_loops == 1) {
+        LAUNCH_CUSTOM_REDUCTION_FOLDED(1);
+      } else if (folded_npar_loops == 2) {
+        LAUNCH_CUSTOM_REDUCTION_FOLDED(2);
+      } else if (folded_npar_loops <= 4) {
+        LAUNCH_CUSTOM_REDUCTION_FOLDED(4);
+      } else if (folded_npar_loops <= 8) {
+        LAUNCH_CUSTOM_REDUCTION_FOLDED(8);
+      } else {
+        TORCH_CHECK(false, "Unsupported max_context_len: ", max_context_len);
+      }
+      return;
+    }
 #if 1
     switch (npar_loops) {
       case 1:
@@ -2296,74 +2425,89 @@ void paged_attention_custom_launcher(
   //} //if max_context_len > partition_size
 }
 
-#define CALL_CUSTOM_LAUNCHER(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, OUTT,      \
-                             PSIZE)                                            \
-  paged_attention_custom_launcher<T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, OUTT, \
-                                  PSIZE>(                                      \
-      out, exp_sums, max_logits, tmp_out, query, key_cache, value_cache,       \
-      num_kv_heads, scale, block_tables, context_lens, max_context_len,        \
-      alibi_slopes, k_scale, v_scale, fp8_out_scale);
-
-#define CALL_CUSTOM_LAUNCHER_PSIZE(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE,     \
-                                   OUTT)                                      \
-  switch (partition_size) {                                                   \
-    case 256:                                                                 \
-      CALL_CUSTOM_LAUNCHER(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, OUTT, 256); \
-      break;                                                                  \
-    default:                                                                  \
-      TORCH_CHECK(false, "Unsupported partition size: ", partition_size);     \
-      break;                                                                  \
+using paged_attention_launcher_t = void (*)(
+    torch::Tensor&, torch::Tensor&, torch::Tensor&, torch::Tensor&,
+    torch::Tensor&, torch::Tensor&, torch::Tensor&, const int, float,
+    torch::Tensor&, torch::Tensor&, int,
+    const c10::optional<torch::Tensor>&, float, float,
+    const c10::optional<torch::Tensor>&, const c10::optional<torch::Tensor>&,
+    const c10::optional<torch::Tensor>&);
+
+struct PagedAttentionKernel {
+  at::ScalarType q_dtype;
+  vllm::Fp8KVCacheDataType kv_dtype;
+  int head_size;
+  int block_size;
+  bool fp8_out;
+  paged_attention_launcher_t launcher;
+};
+
+#define PA_KERNEL(Q_DTYPE, T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, OUTT,     \
+                  MFMA16)                                                   \
+  {Q_DTYPE, KV_DTYPE, HEAD_SIZE, BLK_SIZE, std::is_same<OUTT, bit8_t>::value, \
+   &paged_attention_custom_launcher<T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, \
+                                    OUTT, MFMA16>}
+
+#define PA_KERNELS_OUT(Q_DTYPE, T, KVT, KV_DTYPE, OUTT)        \
+  PA_KERNEL(Q_DTYPE, T, KVT, KV_DTYPE, 16, 128, OUTT, true),   \
+  PA_KERNEL(Q_DTYPE, T, KVT, KV_DTYPE, 32, 128, OUTT, false),  \
+  PA_KERNEL(Q_DTYPE, T, KVT, KV_DTYPE, 16, 64, OUTT, false),   \
+  PA_KERNEL(Q_DTYPE, T, KVT, KV_DTYPE, 32, 64, OUTT, false)
+
+#define PA_KERNELS(Q_DTYPE, T, KVT, KV_DTYPE)        \
+  PA_KERNELS_OUT(Q_DTYPE, T, KVT, KV_DTYPE, T),      \
+  PA_KERNELS_OUT(Q_DTYPE, T, KVT, KV_DTYPE, bit8_t)
+
+// Compile-time specializations of the custom decode, keyed by (query dtype,
+// kv cache dtype, head size, block size, fp8 out). Lookup takes the first
+// match, so the mfma16 kernel is listed before the ll4mi kernel. Shapes
+// without an entry are reported by paged_attention_rocm_supported and run on
+// the generic paged_attention_v1 / v2 kernels instead (paged_attn.py).
+// fp8 out entries quantize out / fp8_out_scale to e4m3fnuz in the reduce.
+static const PagedAttentionKernel paged_attention_kernels[] = {
+    PA_KERNELS(at::ScalarType::Half, _Float16, _Float16,
+               vllm::Fp8KVCacheDataType::kAuto),
+    PA_KERNELS(at::ScalarType::BFloat16, __hip_bfloat16, __hip_bfloat16,
+               vllm::Fp8KVCacheDataType::kAuto),
+    PA_KERNELS(at::ScalarType::Half, _Float16, uint8_t,
+               vllm::Fp8KVCacheDataType::kFp8E4M3),
+    PA_KERNELS(at::ScalarType::BFloat16, __hip_bfloat16, uint8_t,
+               vllm::Fp8KVCacheDataType::kFp8E4M3),
+};
+
+#undef PA_KERNELS
+#undef PA_KERNELS_OUT
+#undef PA_KERNEL
+
+static const PagedAttentionKernel* find_paged_attention_kernel(
+    at::ScalarType q_dtype, const std::string& kv_cache_dtype, int head_size,
+    int block_size, bool fp8_out) {
+  vllm::Fp8KVCacheDataType kv_dtype;
+  if (kv_cache_dtype == "auto") {
+    kv_dtype = vllm::Fp8KVCacheDataType::kAuto;
+  } else if (kv_cache_dtype == "fp8" || kv_cache_dtype == "fp8_e4m3") {
+    kv_dtype = vllm::Fp8KVCacheDataType::kFp8E4M3;
+  } else {
+    return nullptr;
   }
-/*
-*/
-#if defined(__HIPCC__) && defined(__gfx90a__)
-  #define CALL_CUSTOM_LAUNCHER_OUT(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE)   \
-    if (fp8_out_scale) {                                                    \
-      TORCH_CHECK(false, "fp8 out scale unsupported for gfx90a");           \
-    } else {                                                                \
-      CALL_CUSTOM_LAUNCHER_PSIZE(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, T); \
+  for (const PagedAttentionKernel& k : paged_attention_kernels) {
+    if (k.q_dtype == q_dtype && k.kv_dtype == kv_dtype &&
+        k.head_size == head_size && k.block_size == block_size &&
+        k.fp8_out == fp8_out) {
+      return &k;
     }
-#else
-  #define CALL_CUSTOM_LAUNCHER_OUT(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE)   \
-      CALL_CUSTOM_LAUNCHER_PSIZE(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, T);
-/*
-  #define CALL_CUSTOM_LAUNCHER_OUT(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE)   \
-    if (fp8_out_scale) {                                                    \
-      CALL_CUSTOM_LAUNCHER_PSIZE(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE,     \
-                                 uint8_t);                                  \
-    } else {                                                                \
-      CALL_CUSTOM_LAUNCHER_PSIZE(T, KVT, KV_DTYPE, BLK_SIZE, HEAD_SIZE, T); \
-    }
-    */
-#endif
-#define CALL_CUSTOM_LAUNCHER_BLK(T, KVT, KV_DTYPE, HEAD_SIZE)     \
-  switch (block_size) {                                           \
-    case 16:                                                      \
-      CALL_CUSTOM_LAUNCHER_OUT(T, KVT, KV_DTYPE, 16, HEAD_SIZE);  \
-      break;                                                      \
-    default:                                                      \
-      TORCH_CHECK(false, "Unsupported block size: ", block_size); \
-      break;                                                      \
   }
-/*
-    case 32:                                                      \
-      CALL_CUSTOM_LAUNCHER_OUT(T, KVT, KV_DTYPE, 32, HEAD_SIZE);  \
-      break;                                                      \
-*/
-#define CALL_CUSTOM_LAUNCHER_BLK_HEAD(T, KVT, KV_DTYPE)         \
-  switch (head_size) {                                          \
-    case 128:                                                   \
-      CALL_CUSTOM_LAUNCHER_BLK(T, KVT, KV_DTYPE, 128);          \
-      break;                                                    \
-    default:                                                    \
-      TORCH_CHECK(false, "Unsupported head size: ", head_size); \
-      break;                                                    \
-  }
-/*
-    case 64:                                                    \
-      CALL_CUSTOM_LAUNCHER_BLK(T, KVT, KV_DTYPE, 64);           \
-      break;                                                    \
-*/
+  return nullptr;
+}
+
+bool paged_attention_rocm_supported(torch::Tensor& query,
+                                    const std::string& kv_cache_dtype,
+                                    int64_t block_size) {
+  return find_paged_attention_kernel(query.scalar_type(), kv_cache_dtype,
+                                     query.size(2), block_size,
+                                     false) != nullptr;
+}
+
 void paged_attention(
     torch::Tensor& out,         // [num_seqs, num_heads, head_size]
     torch::Tensor& exp_sums,    // [num_seqs, num_heads, max_num_partitions]
@@ -2381,31 +2525,59 @@ void paged_attention(
     int64_t block_size, int64_t max_context_len,
     const c10::optional<torch::Tensor>& alibi_slopes,
     const std::string& kv_cache_dtype, double k_scale, double v_scale,
-    const c10::optional<torch::Tensor>& fp8_out_scale, int64_t partition_size) {
+    const c10::optional<torch::Tensor>& fp8_out_scale, int64_t partition_size,
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_kv_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_kv_heads]
   const int head_size = query.size(2);
-  if (kv_cache_dtype == "auto") {
-    if (query.dtype() == at::ScalarType::Half) {
-      CALL_CUSTOM_LAUNCHER_BLK_HEAD(_Float16, _Float16,
-                                    vllm::Fp8KVCacheDataType::kAuto);
-    } else if (query.dtype() == at::ScalarType::BFloat16) {
-      CALL_CUSTOM_LAUNCHER_BLK_HEAD(__hip_bfloat16, __hip_bfloat16,
-                                    vllm::Fp8KVCacheDataType::kAuto);
-    } else {
-      TORCH_CHECK(false, "Unsupported data type: ", query.dtype());
-    }
-  } else if (kv_cache_dtype == "fp8" || kv_cache_dtype == "fp8_e4m3") {
-    if (query.dtype() == at::ScalarType::Half) {
-      CALL_CUSTOM_LAUNCHER_BLK_HEAD(_Float16, uint8_t,
-                                    vllm::Fp8KVCacheDataType::kFp8E4M3);
-    } else if (query.dtype() == at::ScalarType::BFloat16) {
-      CALL_CUSTOM_LAUNCHER_BLK_HEAD(__hip_bfloat16, uint8_t,
-                                    vllm::Fp8KVCacheDataType::kFp8E4M3);
-    } else {
-      TORCH_CHECK(false, "Unsupported data type: ", query.dtype());
-    }
+  // the kernels are specialized by a single HEAD_SIZE for q, k and v
+  TORCH_CHECK(value_cache.size(2) == head_size,
+              "paged_attention_rocm needs the value head size of the query");
+  TORCH_CHECK(kv_cache_dtype == "auto" || kv_cache_dtype == "fp8" ||
+                  kv_cache_dtype == "fp8_e4m3",
+              "Unsupported KV cache dtype: ", kv_cache_dtype);
+  TORCH_CHECK(partition_size == 256,
+              "Unsupported partition size: ", partition_size);
+#if defined(__HIPCC__) && defined(__gfx90a__)
+  TORCH_CHECK(!fp8_out_scale, "fp8 out scale unsupported for gfx90a");
+#endif
+  // fused output quantization: out is float8_e4m3fnuz (or its uint8 view)
+  // and fp8_out_scale a one-element float32 tensor on the device
+  const bool fp8_out = fp8_out_scale.has_value();
+  if (fp8_out) {
+    const torch::Tensor& s = fp8_out_scale.value();
+    TORCH_CHECK(out.element_size() == 1,
+                "fp8_out_scale needs a 1-byte (float8_e4m3fnuz) out");
+    TORCH_CHECK(s.dtype() == at::ScalarType::Float && s.numel() == 1 &&
+                    s.device() == query.device(),
+                "fp8_out_scale must be a one-element float32 tensor on the "
+                "query device");
   } else {
-    TORCH_CHECK(false, "Unsupported KV cache dtype: ", kv_cache_dtype);
+    TORCH_CHECK(out.dtype() == query.dtype(), "out must have the query dtype");
+  }
+  // per-kv-head scales of an fp8 cache replace k_scale / v_scale
+  TORCH_CHECK(k_head_scales.has_value() == v_head_scales.has_value(),
+              "k_head_scales and v_head_scales must be given together");
+  if (k_head_scales) {
+    TORCH_CHECK(kv_cache_dtype != "auto",
+                "per-head kv scales need an fp8 kv_cache_dtype");
+    for (const torch::Tensor& s :
+         {k_head_scales.value(), v_head_scales.value()}) {
+      TORCH_CHECK(s.dtype() == at::ScalarType::Float && s.is_contiguous() &&
+                      s.numel() == num_kv_heads && s.device() == query.device(),
+                  "k_head_scales / v_head_scales must be contiguous float32 "
+                  "[num_kv_heads] tensors on the query device");
+    }
   }
+  const PagedAttentionKernel* kernel = find_paged_attention_kernel(
+      query.scalar_type(), kv_cache_dtype, head_size, block_size, fp8_out);
+  TORCH_CHECK(kernel, "No paged_attention_rocm kernel for query dtype ",
+              query.dtype(), ", kv cache dtype ", kv_cache_dtype,
+              ", head size ", head_size, ", block size ", block_size,
+              "; use paged_attention_v1/v2");
+  kernel->launcher(out, exp_sums, max_logits, tmp_out, query, key_cache,
+                   value_cache, num_kv_heads, scale, block_tables,
+                   context_lens, max_context_len, alibi_slopes, k_scale,
+                   v_scale, k_head_scales, v_head_scales, fp8_out_scale);
 }
 
 #undef WARP_SIZE
@@ -0,0 +1,1232 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: attention_cpu.cpp
+ * @Description: Host entry for paged attention. Same signature and workspace
+ *               contract as paged_attention (attention.cu), so callers can
+ *               route decode to the CPU when the KV cache lives in host memory.
+ */
+#include <torch/all.h>
+#include <ATen/Parallel.h>
+
+#include "attention_cpu.h"
+#include "cpu_ops_common.h"
+#include "cpu_paged_attention.h"
+#include "cpu_paged_prefill.h"
+#include "cpu_merge_attn.h"
+#include "cpu_mla.h"
+#include "cpu_h2o.h"
+#include "cpu_varlen_attention.h"
+#include "cpu_paged_append.h"
+
+namespace {
+
+// Heavy-hitter mass of every cached token, in logical order (see cpu_h2o.h).
+void check_attn_mass(const torch::Tensor& attn_mass, int64_t num_seqs,
+                     int64_t num_kv_heads, int64_t max_num_blocks_per_seq,
+                     int64_t block_size) {
+  TORCH_CHECK(attn_mass.device().is_cpu() &&
+                  attn_mass.dtype() == at::ScalarType::Float &&
+                  attn_mass.is_contiguous() &&
+                  attn_mass.sizes() ==
+                      torch::IntArrayRef({num_seqs, num_kv_heads,
+                                          max_num_blocks_per_seq, block_size}),
+              "attn_mass must be a contiguous float32 [num_seqs, num_kv_heads, "
+              "max_num_blocks_per_seq, block_size] CPU tensor");
+}
+
+// A caller-built work_list (paged_attention_cpu_plan) indexes the workspace
+// and block tables directly, so every (seq, kv_head, partition) must be in
+// range, and every partition the reduce reads must be computed by some item.
+void check_work_list(const ater::cpu::PagedAttentionParams& p,
+                     const ater::cpu::DecodeWorkItem* items,
+                     int64_t num_items) {
+  std::vector<int64_t> first(p.num_seqs + 1, 0);
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    first[seq + 1] = first[seq] + ater::cpu::num_partitions_of(
+                                      p.context_lens[seq], p.partition_size);
+  }
+  std::vector<char> covered(first[p.num_seqs] * p.num_kv_heads, 0);
+  for (int64_t i = 0; i < num_items; i++) {
+    const ater::cpu::DecodeWorkItem& w = items[i];
+    TORCH_CHECK(w.seq >= 0 && w.seq < p.num_seqs && w.kv_head >= 0 &&
+                    w.kv_head < p.num_kv_heads && w.partition >= 0 &&
+                    w.partition < first[w.seq + 1] - first[w.seq],
+                "work_list item ", i, " (", w.seq, ", ", w.kv_head, ", ",
+                w.partition, ") is out of range for context_lens");
+    covered[(first[w.seq] + w.partition) * p.num_kv_heads + w.kv_head] = 1;
+  }
+  for (int seq = 0; seq < p.num_seqs; seq++) {
+    for (int64_t part = 0; part < first[seq + 1] - first[seq]; part++) {
+      if (!ater::cpu::partition_visible(p, seq, int(part))) {
+        continue;
+      }
+      for (int kv_head = 0; kv_head < p.num_kv_heads; kv_head++) {
+        TORCH_CHECK(covered[(first[seq] + part) * p.num_kv_heads + kv_head],
+                    "work_list misses partition ", part, " of kv head ",
+                    kv_head, " of sequence ", seq);
+      }
+    }
+  }
+}
+
+// OUT_T is the query dtype, or fp8_e4m3fnuz_t with fp8_out_scale.
+template <typename T, typename KVT, typename OUT_T>
+void paged_attention_cpu_launcher(
+    torch::Tensor& out, torch::Tensor& exp_sums, torch::Tensor& max_logits,
+    torch::Tensor& tmp_out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, const int num_kv_heads, float scale,
+    torch::Tensor& block_tables, torch::Tensor& context_lens,
+    const int block_size, const c10::optional<torch::Tensor>& alibi_slopes,
+    float k_scale, float v_scale,
+    const c10::optional<torch::Tensor>& fp8_out_scale, const int partition_size,
+    const c10::optional<torch::Tensor>& work_list,
+    const c10::optional<torch::Tensor>& partition_offsets,
+    const int window_size, const int num_sink_tokens,
+    const c10::optional<torch::Tensor>& k_dequant_scales,
+    const c10::optional<torch::Tensor>& v_dequant_scales,
+    const c10::optional<torch::Tensor>& attn_mass,
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales) {
+  using scalar_t = typename CpuType<T>::type;
+  ater::cpu::PagedAttentionParams p;
+  p.num_seqs = query.size(0);
+  p.num_heads = query.size(-2);
+  p.num_kv_heads = num_kv_heads;
+  p.head_size = query.size(-1);
+  p.head_size_v = out.size(-1);
+  p.scale = scale;
+  p.q_len = query.dim() == 4 ? query.size(1) : 1;
+  p.cu_seqlens_q = nullptr;
+  p.q_stride = query.stride(-3);
+  p.q_head_stride = query.stride(-2);
+  p.block_tables = block_tables.data_ptr<int>();
+  p.max_num_blocks_per_seq = block_tables.size(1);
+  p.context_lens = context_lens.data_ptr<int>();
+  p.alibi_slopes =
+      alibi_slopes ? alibi_slopes.value().data_ptr<float>() : nullptr;
+  p.window_size = window_size;
+  p.num_sink_tokens = num_sink_tokens;
+  p.partition_size = partition_size;
+  p.max_num_partitions = partition_offsets ? 0 : exp_sums.size(-1);
+  p.partition_offsets =
+      partition_offsets ? partition_offsets.value().data_ptr<int>() : nullptr;
+  p.out_scale =
+      fp8_out_scale ? fp8_out_scale.value().data_ptr<float>()[0] : 1.0f;
+  OUT_T* out_ptr = reinterpret_cast<OUT_T*>(out.data_ptr());
+
+  ater::cpu::PagedKV<KVT> kv =
+      make_paged_kv<KVT>(key_cache, value_cache, block_size, k_scale, v_scale,
+                         k_head_scales, v_head_scales);
+  if (k_dequant_scales) {
+    kv.k_token_scales = k_dequant_scales.value().data_ptr<float>();
+    kv.v_token_scales = v_dequant_scales.value().data_ptr<float>();
+    kv.token_scales_stride = k_dequant_scales.value().size(1);
+  }
+
+  // heavy-hitter mass: the partitions also keep their token probabilities,
+  // packed per sequence (whatever the workspace layout) in a buffer that is
+  // reused across steps
+  static thread_local std::vector<int64_t> probs_offsets;
+  static thread_local std::vector<float> probs;
+  if (attn_mass) {
+    probs_offsets.resize(p.num_seqs + 1);
+    probs.resize(ater::cpu::ragged_probs_offsets(p, probs_offsets.data()));
+    p.probs = probs.data();
+    p.probs_offsets = probs_offsets.data();
+  }
+
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  if (work_list) {
+    const auto* items = reinterpret_cast<const ater::cpu::DecodeWorkItem*>(
+        work_list.value().data_ptr<int>());
+    check_work_list(p, items, work_list.value().size(0));
+    ater::cpu::paged_attention_decode<scalar_t, KVT, OUT_T>(
+        p, kv, items, work_list.value().size(0), cpu_ptr<T>(query),
+        exp_sums.data_ptr<float>(), max_logits.data_ptr<float>(),
+        cpu_ptr<T>(tmp_out), out_ptr);
+  } else {
+    // planned here, where block_tables are known: sequences sharing leading
+    // blocks read those partitions once (cascade)
+    const ater::cpu::CascadePlan plan =
+        ater::cpu::plan_cascade(p, block_size);
+    ater::cpu::paged_attention_cascade<scalar_t, KVT, OUT_T>(
+        p, kv, plan, cpu_ptr<T>(query), exp_sums.data_ptr<float>(),
+        max_logits.data_ptr<float>(), cpu_ptr<T>(tmp_out), out_ptr);
+  }
+  if (attn_mass) {
+    const torch::Tensor& mass = attn_mass.value();
+    ater::cpu::accumulate_attention_mass(
+        p, exp_sums.data_ptr<float>(), max_logits.data_ptr<float>(),
+        mass.size(2) * mass.size(3), mass.data_ptr<float>());
+  }
+}
+
+template <typename T, typename KVT>
+void paged_attention_varlen_cpu_launcher(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, const int num_kv_heads, float scale,
+    torch::Tensor& block_tables, torch::Tensor& cu_seqlens_q,
+    torch::Tensor& context_lens, const int block_size,
+    const c10::optional<torch::Tensor>& alibi_slopes, float k_scale,
+    float v_scale, const int window_size, const int num_sink_tokens,
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales) {
+  using scalar_t = typename CpuType<T>::type;
+  ater::cpu::PagedAttentionParams p;
+  p.num_seqs = context_lens.size(0);
+  p.num_heads = query.size(1);
+  p.num_kv_heads = num_kv_heads;
+  p.head_size = query.size(2);
+  p.head_size_v = out.size(2);
+  p.scale = scale;
+  p.q_len = 0;
+  p.cu_seqlens_q = cu_seqlens_q.data_ptr<int>();
+  p.q_stride = query.stride(0);
+  p.q_head_stride = query.stride(1);
+  p.block_tables = block_tables.data_ptr<int>();
+  p.max_num_blocks_per_seq = block_tables.size(1);
+  p.context_lens = context_lens.data_ptr<int>();
+  p.alibi_slopes =
+      alibi_slopes ? alibi_slopes.value().data_ptr<float>() : nullptr;
+  p.window_size = window_size;
+  p.num_sink_tokens = num_sink_tokens;
+  p.partition_size = ater::cpu::choose_partition_size(
+      p.context_lens, p.num_seqs, num_kv_heads, block_size,
+      at::get_num_threads());
+  p.max_num_partitions = 0;
+
+  // decode rows only; prefill tiles write out directly
+  torch::Tensor partition_offsets = torch::empty(
+      {p.num_seqs + 1}, torch::TensorOptions().dtype(at::ScalarType::Int));
+  const int64_t rows =
+      ater::cpu::varlen_partition_offsets(p, partition_offsets.data_ptr<int>()) *
+      p.num_heads;
+  p.partition_offsets = partition_offsets.data_ptr<int>();
+  torch::Tensor exp_sums =
+      torch::empty({rows}, query.options().dtype(at::ScalarType::Float));
+  torch::Tensor max_logits = torch::empty_like(exp_sums);
+  torch::Tensor tmp_out = torch::empty({rows, p.head_size_v}, query.options());
+
+  const ater::cpu::PagedKV<KVT> kv =
+      make_paged_kv<KVT>(key_cache, value_cache, block_size, k_scale, v_scale,
+                         k_head_scales, v_head_scales);
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  ater::cpu::paged_attention_varlen<scalar_t, KVT, scalar_t>(
+      p, kv, cpu_ptr<T>(query), exp_sums.data_ptr<float>(),
+      max_logits.data_ptr<float>(), cpu_ptr<T>(tmp_out), cpu_ptr<T>(out));
+}
+
+static_assert(sizeof(ater::cpu::DecodeWorkItem) == 3 * sizeof(int),
+              "work_list rows are (seq, kv_head, partition) int32 triples");
+
+}  // namespace
+
+#define CALL_CPU_LAUNCHER_OUT(T, KVT, OUT_T)                                  \
+  paged_attention_cpu_launcher<T, KVT, OUT_T>(                                \
+      out, exp_sums, max_logits, tmp_out, query, key_cache, value_cache,      \
+      num_kv_heads, scale, block_tables, context_lens, block_size,            \
+      alibi_slopes, k_scale, v_scale, fp8_out_scale, partition_size,         \
+      work_list, partition_offsets, window_size, num_sink_tokens,             \
+      k_dequant_scales, v_dequant_scales, attn_mass, k_head_scales,           \
+      v_head_scales);
+
+#define CALL_CPU_LAUNCHER(T, KVT)                                   \
+  if (fp8_out_scale) {                                              \
+    CALL_CPU_LAUNCHER_OUT(T, KVT, ater::cpu::fp8_e4m3fnuz_t);       \
+  } else {                                                          \
+    CALL_CPU_LAUNCHER_OUT(T, KVT, typename CpuType<T>::type);       \
+  }
+
+#define CALL_CPU_LAUNCHER_KV(KVT)                                     \
+  if (query.dtype() == at::ScalarType::Half) {                        \
+    CALL_CPU_LAUNCHER(at::Half, KVT);                                 \
+  } else if (query.dtype() == at::ScalarType::BFloat16) {             \
+    CALL_CPU_LAUNCHER(at::BFloat16, KVT);                             \
+  } else if (query.dtype() == at::ScalarType::Float) {                \
+    CALL_CPU_LAUNCHER(float, KVT);                                    \
+  } else {                                                            \
+    TORCH_CHECK(false, "Unsupported data type: ", query.dtype());     \
+  }
+
+void paged_attention_cpu(
+    torch::Tensor& out,         // [num_seqs, num_heads, head_size_v]
+    torch::Tensor& exp_sums,    // [num_seqs, num_heads, max_num_partitions]
+                                // or ragged [total_partitions * num_heads]
+    torch::Tensor& max_logits,  // same as exp_sums
+    torch::Tensor&
+        tmp_out,  // [num_seqs, num_heads, max_num_partitions, head_size_v]
+                  // or ragged [total_partitions * num_heads, head_size_v]
+    torch::Tensor& query,  // [num_seqs, num_heads, head_size] or
+                           // [num_seqs, q_len, num_heads, head_size]
+    torch::Tensor&
+        key_cache,  // [num_blocks, num_heads, head_size/x, block_size, x]
+    torch::Tensor&
+        value_cache,  // [num_blocks, num_heads, head_size, block_size]
+    int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables,  // [num_seqs, max_num_blocks_per_seq]
+    torch::Tensor& context_lens,  // [num_seqs]
+    int64_t block_size, int64_t max_context_len,
+    const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    const c10::optional<torch::Tensor>& fp8_out_scale, int64_t partition_size,
+    const c10::optional<torch::Tensor>& work_list,
+    const c10::optional<torch::Tensor>& partition_offsets,  // [num_seqs + 1]
+    int64_t window_size, int64_t num_sink_tokens,
+    const c10::optional<torch::Tensor>&
+        k_dequant_scales,  // [num_kv_heads, max_kv_tokens]
+    const c10::optional<torch::Tensor>&
+        v_dequant_scales,  // [num_kv_heads, max_kv_tokens]
+    const c10::optional<torch::Tensor>&
+        attn_mass,  // [num_seqs, num_kv_heads, max_num_blocks_per_seq,
+                    //  block_size]
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_kv_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_kv_heads]
+  for (const torch::Tensor* t :
+       {&out, &exp_sums, &max_logits, &tmp_out, &query, &key_cache,
+        &value_cache, &block_tables, &context_lens}) {
+    TORCH_CHECK(t->device().is_cpu(), "paged_attention_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(query.dim() == 3 || query.dim() == 4,
+              "query must be [num_seqs, (q_len,) num_heads, head_size]");
+  TORCH_CHECK(query.stride(-1) == 1, "query must be contiguous in head_size");
+  TORCH_CHECK(query.dim() == 3 || query.stride(0) == query.size(1) * query.stride(1),
+              "query tokens of a sequence must be contiguous");
+  const int64_t num_heads = query.size(-2);
+  const int64_t head_size = query.size(-1);
+  // V (and out) may be narrower or wider than Q / K
+  const int64_t head_size_v = value_head_size_of(key_cache, value_cache);
+  TORCH_CHECK(out.sizes().slice(0, out.dim() - 1) ==
+                      query.sizes().slice(0, query.dim() - 1) &&
+                  out.size(-1) == head_size_v,
+              "out must have the query shape with head_size_v last");
+  const int64_t q_len = query.dim() == 4 ? query.size(1) : 1;
+  TORCH_CHECK(out.is_contiguous() && tmp_out.is_contiguous() &&
+                  exp_sums.is_contiguous() && max_logits.is_contiguous(),
+              "out and workspaces must be contiguous");
+  const int64_t num_seqs = query.size(0);
+  TORCH_CHECK(block_tables.dtype() == at::ScalarType::Int &&
+                  block_tables.is_contiguous() && block_tables.dim() == 2 &&
+                  block_tables.size(0) == num_seqs,
+              "block_tables must be contiguous int32 [num_seqs, "
+              "max_num_blocks_per_seq]");
+  TORCH_CHECK(context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous() &&
+                  context_lens.numel() == num_seqs,
+              "context_lens must be contiguous int32 [num_seqs]");
+  // the workspace is sized and the block tables are read from the real
+  // lengths; max_context_len is only the caller's bound
+  const int* lens = context_lens.data_ptr<int>();
+  int64_t max_len = 0;
+  for (int64_t i = 0; i < num_seqs; i++) {
+    TORCH_CHECK(lens[i] >= 0 && (int64_t(lens[i]) + block_size - 1) /
+                                        block_size <=
+                                    block_tables.size(1),
+                "context_lens[", i, "] = ", lens[i],
+                " does not fit block_tables");
+    max_len = std::max<int64_t>(max_len, lens[i]);
+  }
+  TORCH_CHECK(exp_sums.dtype() == at::ScalarType::Float &&
+                  max_logits.dtype() == at::ScalarType::Float &&
+                  max_logits.sizes() == exp_sums.sizes(),
+              "exp_sums and max_logits must be float32 of the same shape");
+  TORCH_CHECK(tmp_out.dtype() == query.dtype(),
+              "tmp_out must have the query dtype");
+  if (fp8_out_scale) {
+    // fused output quantization: the reduce stores out / fp8_out_scale
+    const torch::Tensor& s = fp8_out_scale.value();
+    TORCH_CHECK(out.dtype() == at::ScalarType::Float8_e4m3fnuz ||
+                    out.dtype() == at::ScalarType::Byte,
+                "fp8_out_scale needs a float8_e4m3fnuz (or uint8) out");
+    TORCH_CHECK(s.device().is_cpu() && s.dtype() == at::ScalarType::Float &&
+                    s.numel() == 1,
+                "fp8_out_scale must be a one-element float32 CPU tensor");
+  } else {
+    TORCH_CHECK(out.dtype() == query.dtype(), "out must have the query dtype");
+  }
+  TORCH_CHECK(num_heads % num_kv_heads == 0,
+              "num_heads must be a multiple of num_kv_heads");
+  TORCH_CHECK(num_sink_tokens >= 0, "num_sink_tokens must be non-negative");
+  check_kv_cache(key_cache, value_cache, num_kv_heads, head_size, block_size,
+                 head_size_v);
+  if (partition_size <= 0) {
+    // auto: the smallest partition a dense workspace can hold is the lower
+    // bound; a ragged workspace was sized for a given partition_size already
+    TORCH_CHECK(!work_list && !partition_offsets,
+                "work_list and partition_offsets require an explicit "
+                "partition_size");
+    const int64_t max_parts = std::max<int64_t>(exp_sums.size(-1), 1);
+    partition_size = ater::cpu::choose_partition_size(
+        lens, num_seqs, num_kv_heads, block_size, at::get_num_threads(),
+        (max_len + max_parts - 1) / max_parts);
+  }
+  TORCH_CHECK(partition_size % block_size == 0,
+              "partition_size must be a multiple of block_size");
+  if (partition_offsets) {
+    const torch::Tensor& offsets = partition_offsets.value();
+    TORCH_CHECK(offsets.dtype() == at::ScalarType::Int &&
+                    offsets.is_contiguous() &&
+                    offsets.numel() == num_seqs + 1,
+                "partition_offsets must be a contiguous int32 [num_seqs + 1] "
+                "tensor");
+    const int* offs = offsets.data_ptr<int>();
+    for (int64_t i = 0; i < num_seqs; i++) {
+      TORCH_CHECK(offs[i + 1] - offs[i] ==
+                      ater::cpu::num_partitions_of(lens[i], partition_size),
+                  "partition_offsets do not match context_lens for sequence ", i);
+    }
+    const int64_t rows = int64_t(offs[num_seqs]) * q_len * num_heads;
+    TORCH_CHECK(exp_sums.numel() >= rows && max_logits.numel() >= rows &&
+                    tmp_out.numel() >= rows * head_size_v,
+                "ragged workspace too small: need ", rows, " rows");
+  } else {
+    // dense: [num_seqs, (q_len,) num_heads, max_num_partitions] rows
+    const int64_t max_parts = exp_sums.size(-1);
+    const int64_t rows = num_seqs * q_len * num_heads;
+    TORCH_CHECK(exp_sums.numel() == rows * max_parts &&
+                    tmp_out.dim() == exp_sums.dim() + 1 &&
+                    tmp_out.size(-2) == max_parts &&
+                    tmp_out.size(-1) == head_size_v &&
+                    tmp_out.numel() == rows * max_parts * head_size_v,
+                "dense workspace must be exp_sums / max_logits [num_seqs, "
+                "(q_len,) num_heads, max_num_partitions] and tmp_out "
+                "[num_seqs, (q_len,) num_heads, max_num_partitions, "
+                "head_size_v]");
+    TORCH_CHECK(max_parts * partition_size >= max_len,
+                "workspace too small for the longest context_lens (", max_len,
+                ")");
+  }
+  TORCH_CHECK(!work_list || (work_list.value().dtype() == at::ScalarType::Int &&
+                             work_list.value().is_contiguous() &&
+                             work_list.value().dim() == 2 &&
+                             work_list.value().size(1) == 3),
+              "work_list must be a contiguous int32 [num_items, 3] tensor");
+  TORCH_CHECK(k_dequant_scales.has_value() == v_dequant_scales.has_value(),
+              "k_dequant_scales and v_dequant_scales go together");
+  if (k_dequant_scales) {
+    // per-token quantized cache (reshape_and_cache_with_pertoken_quant)
+    const torch::Tensor& ks = k_dequant_scales.value();
+    const torch::Tensor& vs = v_dequant_scales.value();
+    TORCH_CHECK(kv_cache_dtype != "auto",
+                "per-token dequant scales need an int8 or fp8 kv cache");
+    TORCH_CHECK(ks.device().is_cpu() && vs.device().is_cpu() &&
+                    ks.dtype() == at::ScalarType::Float &&
+                    vs.dtype() == at::ScalarType::Float &&
+                    ks.is_contiguous() && vs.is_contiguous() &&
+                    ks.dim() == 2 && ks.sizes() == vs.sizes() &&
+                    ks.size(0) == num_kv_heads &&
+                    ks.size(1) >= key_cache.size(0) * block_size,
+                "dequant scales must be contiguous float32 [num_kv_heads, "
+                "max_kv_tokens] CPU tensors covering every cache slot");
+  }
+  if (attn_mass) {
+    check_attn_mass(attn_mass.value(), num_seqs, num_kv_heads,
+                    block_tables.size(1), block_size);
+  }
+  check_head_scales(k_head_scales, v_head_scales, num_kv_heads,
+                    kv_cache_dtype);
+
+  if (kv_cache_dtype == "auto") {
+    TORCH_CHECK(key_cache.dtype() == query.dtype(),
+                "kv cache dtype must match query for kv_cache_dtype=auto");
+    if (query.dtype() == at::ScalarType::Half) {
+      CALL_CPU_LAUNCHER(at::Half, ater::cpu::fp16_t);
+    } else if (query.dtype() == at::ScalarType::BFloat16) {
+      CALL_CPU_LAUNCHER(at::BFloat16, ater::cpu::bf16_t);
+    } else if (query.dtype() == at::ScalarType::Float) {
+      CALL_CPU_LAUNCHER(float, float);
+    } else {
+      TORCH_CHECK(false, "Unsupported data type: ", query.dtype());
+    }
+  } else if (kv_cache_dtype == "fp8" || kv_cache_dtype == "fp8_e4m3") {
+    CALL_CPU_LAUNCHER_KV(ater::cpu::fp8_e4m3fnuz_t);
+  } else if (kv_cache_dtype == "int8") {
+    // QK^T on int8 dot products against a per-row quantized query
+    TORCH_CHECK(k_dequant_scales,
+                "kv_cache_dtype=int8 needs k_dequant_scales / v_dequant_scales");
+    CALL_CPU_LAUNCHER_KV(int8_t);
+  } else {
+    TORCH_CHECK(false, "Unsupported KV cache dtype: ", kv_cache_dtype);
+  }
+}
+
+int64_t paged_attention_cpu_partition_size(
+    torch::Tensor& context_lens,  // [num_seqs]
+    int64_t num_kv_heads, int64_t block_size) {
+  TORCH_CHECK(context_lens.device().is_cpu() &&
+                  context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous(),
+              "context_lens must be a contiguous int32 CPU tensor");
+  TORCH_CHECK(block_size > 0, "block_size must be positive");
+  return ater::cpu::choose_partition_size(
+      context_lens.data_ptr<int>(), context_lens.size(0), num_kv_heads,
+      block_size, at::get_num_threads());
+}
+
+std::tuple<torch::Tensor, int64_t> paged_attention_cpu_plan(
+    torch::Tensor& context_lens,  // [num_seqs]
+    int64_t num_kv_heads, int64_t block_size, int64_t partition_size) {
+  if (partition_size <= 0) {
+    partition_size = paged_attention_cpu_partition_size(
+        context_lens, num_kv_heads, block_size);
+  }
+  TORCH_CHECK(context_lens.device().is_cpu() &&
+                  context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous(),
+              "context_lens must be a contiguous int32 CPU tensor");
+  const int* lens = context_lens.data_ptr<int>();
+  const int num_seqs = context_lens.size(0);
+  TORCH_CHECK(partition_size % block_size == 0,
+              "partition_size must be a multiple of block_size");
+  const ater::cpu::DecodePlan plan =
+      ater::cpu::plan_decode(lens, num_seqs, num_kv_heads, partition_size);
+  torch::Tensor work_list = torch::empty(
+      {int64_t(plan.items.size()), 3},
+      torch::TensorOptions().dtype(at::ScalarType::Int));
+  std::copy(plan.items.begin(), plan.items.end(),
+            reinterpret_cast<ater::cpu::DecodeWorkItem*>(
+                work_list.data_ptr<int>()));
+  return {work_list, partition_size};
+}
+
+void paged_attention_multi_token_cpu(
+    torch::Tensor& out,    // [num_seqs, q_len, num_heads, head_size_v]
+    torch::Tensor& query,  // [num_seqs, q_len, num_heads, head_size]
+    torch::Tensor&
+        key_cache,  // [num_blocks, num_heads, head_size/x, block_size, x]
+    torch::Tensor&
+        value_cache,  // [num_blocks, num_heads, head_size, block_size]
+    int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables,  // [num_seqs, max_num_blocks_per_seq]
+    torch::Tensor& context_lens,  // [num_seqs], including the q_len tokens
+    int64_t block_size, int64_t max_context_len,
+    const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    int64_t window_size, int64_t num_sink_tokens,
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_kv_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_kv_heads]
+  TORCH_CHECK(query.dim() == 4 && out.dim() == 4,
+              "query / out must be [num_seqs, q_len, num_heads, head_size]");
+  const int64_t num_heads = query.size(2);
+  const int64_t partition_size =
+      paged_attention_cpu_partition_size(context_lens, num_kv_heads, block_size);
+  torch::Tensor partition_offsets =
+      paged_attention_cpu_workspace(context_lens, partition_size);
+  const int64_t rows =
+      int64_t(partition_offsets.data_ptr<int>()[context_lens.numel()]) *
+      query.size(1) * num_heads;
+  torch::Tensor exp_sums =
+      torch::empty({rows}, query.options().dtype(at::ScalarType::Float));
+  torch::Tensor max_logits = torch::empty_like(exp_sums);
+  torch::Tensor tmp_out = torch::empty({rows, out.size(3)}, query.options());
+  paged_attention_cpu(out, exp_sums, max_logits, tmp_out, query, key_cache,
+                      value_cache, num_kv_heads, scale, block_tables,
+                      context_lens, block_size, max_context_len, alibi_slopes,
+                      kv_cache_dtype, k_scale, v_scale, c10::nullopt,
+                      partition_size, c10::nullopt, partition_offsets,
+                      window_size, num_sink_tokens, c10::nullopt,
+                      c10::nullopt, c10::nullopt, k_head_scales,
+                      v_head_scales);
+}
+
+torch::Tensor paged_attention_cpu_workspace(
+    torch::Tensor& context_lens,  // [num_seqs]
+    int64_t partition_size) {
+  TORCH_CHECK(context_lens.device().is_cpu() &&
+                  context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous(),
+              "context_lens must be a contiguous int32 CPU tensor");
+  TORCH_CHECK(partition_size > 0, "partition_size must be positive");
+  torch::Tensor offsets = torch::empty(
+      {context_lens.numel() + 1},
+      torch::TensorOptions().dtype(at::ScalarType::Int));
+  ater::cpu::ragged_partition_offsets(context_lens.data_ptr<int>(),
+                                      context_lens.numel(), partition_size,
+                                      offsets.data_ptr<int>());
+  return offsets;
+}
+
+#define CALL_CPU_VARLEN_LAUNCHER(T, KVT)                                   \
+  paged_attention_varlen_cpu_launcher<T, KVT>(                             \
+      out, query, key_cache, value_cache, num_kv_heads, scale, block_tables, \
+      cu_seqlens_q, context_lens, block_size, alibi_slopes, k_scale, v_scale, \
+      window_size, num_sink_tokens, k_head_scales, v_head_scales);
+
+#define CALL_CPU_VARLEN_LAUNCHER_KV(KVT)                              \
+  if (query.dtype() == at::ScalarType::Half) {                        \
+    CALL_CPU_VARLEN_LAUNCHER(at::Half, KVT);                          \
+  } else if (query.dtype() == at::ScalarType::BFloat16) {             \
+    CALL_CPU_VARLEN_LAUNCHER(at::BFloat16, KVT);                      \
+  } else if (query.dtype() == at::ScalarType::Float) {                \
+    CALL_CPU_VARLEN_LAUNCHER(float, KVT);                             \
+  } else {                                                            \
+    TORCH_CHECK(false, "Unsupported data type: ", query.dtype());     \
+  }
+
+void paged_attention_varlen_cpu(
+    torch::Tensor& out,    // [total_q, num_heads, head_size_v]
+    torch::Tensor& query,  // [total_q, num_heads, head_size]
+    torch::Tensor&
+        key_cache,  // [num_blocks, num_heads, head_size/x, block_size, x]
+    torch::Tensor&
+        value_cache,  // [num_blocks, num_heads, head_size, block_size]
+    int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables,  // [num_seqs, max_num_blocks_per_seq]
+    torch::Tensor& cu_seqlens_q,  // [num_seqs + 1]
+    torch::Tensor& context_lens,  // [num_seqs], including the query tokens
+    int64_t block_size, int64_t max_context_len,
+    const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    int64_t window_size, int64_t num_sink_tokens,
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_kv_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_kv_heads]
+  for (const torch::Tensor* t :
+       {&out, &query, &key_cache, &value_cache, &block_tables, &cu_seqlens_q,
+        &context_lens}) {
+    TORCH_CHECK(t->device().is_cpu(),
+                "paged_attention_varlen_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(query.dim() == 3 && query.stride(-1) == 1,
+              "query must be [total_q, num_heads, head_size], contiguous in "
+              "head_size");
+  const int64_t head_size_v = value_head_size_of(key_cache, value_cache);
+  TORCH_CHECK(out.dim() == 3 && out.size(0) == query.size(0) &&
+                  out.size(1) == query.size(1) && out.size(2) == head_size_v &&
+                  out.is_contiguous() && out.dtype() == query.dtype(),
+              "out must be a contiguous [total_q, num_heads, head_size_v] "
+              "tensor of the query dtype");
+  TORCH_CHECK(block_tables.dtype() == at::ScalarType::Int &&
+                  block_tables.is_contiguous(),
+              "block_tables must be contiguous int32");
+  TORCH_CHECK(context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous(),
+              "context_lens must be contiguous int32");
+  TORCH_CHECK(cu_seqlens_q.dtype() == at::ScalarType::Int &&
+                  cu_seqlens_q.is_contiguous() &&
+                  cu_seqlens_q.numel() == context_lens.numel() + 1,
+              "cu_seqlens_q must be a contiguous int32 [num_seqs + 1] tensor");
+  const int* cu = cu_seqlens_q.data_ptr<int>();
+  const int* lens = context_lens.data_ptr<int>();
+  TORCH_CHECK(cu[0] == 0 && cu[context_lens.numel()] == query.size(0),
+              "cu_seqlens_q must start at 0 and end at total_q");
+  for (int64_t i = 0; i < context_lens.numel(); i++) {
+    TORCH_CHECK(cu[i + 1] >= cu[i] && cu[i + 1] - cu[i] <= lens[i],
+                "query of sequence ", i, " must fit in its context");
+  }
+  TORCH_CHECK(query.size(1) % num_kv_heads == 0,
+              "num_heads must be a multiple of num_kv_heads");
+  TORCH_CHECK(num_sink_tokens >= 0, "num_sink_tokens must be non-negative");
+  check_kv_cache(key_cache, value_cache, num_kv_heads, query.size(2),
+                 block_size, head_size_v);
+  check_head_scales(k_head_scales, v_head_scales, num_kv_heads,
+                    kv_cache_dtype);
+
+  if (kv_cache_dtype == "auto") {
+    TORCH_CHECK(key_cache.dtype() == query.dtype(),
+                "kv cache dtype must match query for kv_cache_dtype=auto");
+    if (query.dtype() == at::ScalarType::Half) {
+      CALL_CPU_VARLEN_LAUNCHER(at::Half, ater::cpu::fp16_t);
+    } else if (query.dtype() == at::ScalarType::BFloat16) {
+      CALL_CPU_VARLEN_LAUNCHER(at::BFloat16, ater::cpu::bf16_t);
+    } else if (query.dtype() == at::ScalarType::Float) {
+      CALL_CPU_VARLEN_LAUNCHER(float, float);
+    } else {
+      TORCH_CHECK(false, "Unsupported data type: ", query.dtype());
+    }
+  } else if (kv_cache_dtype == "fp8" || kv_cache_dtype == "fp8_e4m3") {
+    CALL_CPU_VARLEN_LAUNCHER_KV(ater::cpu::fp8_e4m3fnuz_t);
+  } else {
+    TORCH_CHECK(false, "Unsupported KV cache dtype: ", kv_cache_dtype);
+  }
+}
+
+void merge_attn_states_cpu(
+    torch::Tensor& out,  // [..., head_size]
+    const c10::optional<torch::Tensor>& out_lse,  // [...]
+    torch::Tensor& partial_out,  // [num_partials, ..., head_size]
+    torch::Tensor& max_logits,   // [num_partials, ...], or LSE
+    const c10::optional<torch::Tensor>& exp_sums) {  // [num_partials, ...]
+  TORCH_CHECK(out.device().is_cpu() && partial_out.device().is_cpu() &&
+                  max_logits.device().is_cpu(),
+              "merge_attn_states_cpu expects CPU tensors");
+  TORCH_CHECK(partial_out.dim() == out.dim() + 1 &&
+                  partial_out.sizes().slice(1) == out.sizes(),
+              "partial_out must be [num_partials, *out.shape]");
+  TORCH_CHECK(out.is_contiguous() && partial_out.is_contiguous() &&
+                  max_logits.is_contiguous(),
+              "out, partial_out and max_logits must be contiguous");
+  TORCH_CHECK(out.dtype() == partial_out.dtype(),
+              "out must have the partial_out dtype");
+  const int64_t num_partials = partial_out.size(0);
+  const int64_t head_size = out.size(-1);
+  const int64_t num_rows = out.numel() / std::max<int64_t>(head_size, 1);
+  auto check_state = [&](const torch::Tensor& t, const char* name) {
+    TORCH_CHECK(t.device().is_cpu() && t.dtype() == at::ScalarType::Float &&
+                    t.is_contiguous() && t.numel() == num_partials * num_rows,
+                name, " must be a contiguous float32 [num_partials, ...] "
+                "tensor with one value per partial and row");
+  };
+  check_state(max_logits, "max_logits");
+  if (exp_sums) {
+    check_state(exp_sums.value(), "exp_sums");
+  }
+  if (out_lse) {
+    TORCH_CHECK(out_lse.value().device().is_cpu() &&
+                    out_lse.value().dtype() == at::ScalarType::Float &&
+                    out_lse.value().is_contiguous() &&
+                    out_lse.value().numel() == num_rows,
+                "out_lse must be a contiguous float32 tensor with one value "
+                "per row");
+  }
+  const float* sums = exp_sums ? exp_sums.value().data_ptr<float>() : nullptr;
+  float* lse = out_lse ? out_lse.value().data_ptr<float>() : nullptr;
+
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  if (out.dtype() == at::ScalarType::Half) {
+    ater::cpu::merge_attn_states(
+        num_partials, num_rows, head_size, cpu_ptr<at::Half>(partial_out),
+        max_logits.data_ptr<float>(), sums, cpu_ptr<at::Half>(out), lse);
+  } else if (out.dtype() == at::ScalarType::BFloat16) {
+    ater::cpu::merge_attn_states(
+        num_partials, num_rows, head_size, cpu_ptr<at::BFloat16>(partial_out),
+        max_logits.data_ptr<float>(), sums, cpu_ptr<at::BFloat16>(out), lse);
+  } else if (out.dtype() == at::ScalarType::Float) {
+    ater::cpu::merge_attn_states(
+        num_partials, num_rows, head_size, cpu_ptr<float>(partial_out),
+        max_logits.data_ptr<float>(), sums, cpu_ptr<float>(out), lse);
+  } else {
+    TORCH_CHECK(false, "Unsupported data type: ", out.dtype());
+  }
+}
+
+namespace {
+
+template <typename T, typename KVT>
+void mla_decode_cpu_launcher(torch::Tensor& out, torch::Tensor& query,
+                             torch::Tensor& kv_cache,
+                             torch::Tensor& block_tables,
+                             torch::Tensor& context_lens,
+                             const int kv_lora_rank, float scale,
+                             float k_scale) {
+  using scalar_t = typename CpuType<T>::type;
+  ater::cpu::PagedAttentionParams p;
+  p.num_seqs = query.size(0);
+  p.num_heads = query.size(1);
+  p.num_kv_heads = 1;
+  p.head_size = kv_lora_rank;
+  p.scale = scale;
+  p.q_len = 1;
+  p.cu_seqlens_q = nullptr;
+  p.q_stride = query.stride(0);
+  p.q_head_stride = query.stride(1);
+  p.block_tables = block_tables.data_ptr<int>();
+  p.max_num_blocks_per_seq = block_tables.size(1);
+  p.context_lens = context_lens.data_ptr<int>();
+  p.alibi_slopes = nullptr;
+  p.window_size = 0;
+  p.num_sink_tokens = 0;
+  p.partition_size = ater::cpu::choose_partition_size(
+      p.context_lens, p.num_seqs, 1, kv_cache.size(1), at::get_num_threads());
+  p.max_num_partitions = 0;
+
+  torch::Tensor partition_offsets = torch::empty(
+      {p.num_seqs + 1}, torch::TensorOptions().dtype(at::ScalarType::Int));
+  const int64_t rows =
+      ater::cpu::ragged_partition_offsets(p.context_lens, p.num_seqs,
+                                          p.partition_size,
+                                          partition_offsets.data_ptr<int>()) *
+      p.num_heads;
+  p.partition_offsets = partition_offsets.data_ptr<int>();
+  torch::Tensor exp_sums =
+      torch::empty({rows}, query.options().dtype(at::ScalarType::Float));
+  torch::Tensor max_logits = torch::empty_like(exp_sums);
+  torch::Tensor tmp_out = torch::empty({rows, kv_lora_rank}, query.options());
+
+  ater::cpu::MLAKVCache<KVT> kv;
+  kv.cache = reinterpret_cast<const KVT*>(kv_cache.data_ptr());
+  kv.block_stride = kv_cache.stride(0);
+  kv.entry_stride = kv_cache.stride(1);
+  kv.block_size = kv_cache.size(1);
+  kv.kv_lora_rank = kv_lora_rank;
+  kv.rope_dim = kv_cache.size(2) - kv_lora_rank;
+  kv.scale = k_scale;
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  ater::cpu::mla_decode<scalar_t, KVT, scalar_t>(
+      p, kv, cpu_ptr<T>(query), exp_sums.data_ptr<float>(),
+      max_logits.data_ptr<float>(), cpu_ptr<T>(tmp_out), cpu_ptr<T>(out));
+}
+
+}  // namespace
+
+#define CALL_MLA_DECODE_CPU_LAUNCHER(T, KVT)                                 \
+  mla_decode_cpu_launcher<T, KVT>(out, query, kv_cache, block_tables,        \
+                                  context_lens, kv_lora_rank, scale, k_scale);
+
+void mla_decode_cpu(
+    torch::Tensor& out,       // [num_seqs, num_heads, kv_lora_rank]
+    torch::Tensor& query,     // [num_seqs, num_heads, kv_lora_rank + rope_dim]
+    torch::Tensor& kv_cache,  // [num_blocks, block_size,
+                              //  kv_lora_rank + rope_dim]
+    torch::Tensor& block_tables,  // [num_seqs, max_num_blocks_per_seq]
+    torch::Tensor& context_lens,  // [num_seqs]
+    int64_t kv_lora_rank, double scale, const std::string& kv_cache_dtype,
+    double k_scale) {
+  for (const torch::Tensor* t :
+       {&out, &query, &kv_cache, &block_tables, &context_lens}) {
+    TORCH_CHECK(t->device().is_cpu(), "mla_decode_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(query.dim() == 3 && query.stride(-1) == 1,
+              "query must be [num_seqs, num_heads, kv_lora_rank + rope_dim], "
+              "contiguous in the last dim");
+  TORCH_CHECK(kv_cache.dim() == 3 && kv_cache.size(2) == query.size(2) &&
+                  kv_cache.stride(2) == 1 && kv_lora_rank > 0 &&
+                  kv_lora_rank <= query.size(2),
+              "kv_cache must be [num_blocks, block_size, kv_lora_rank + "
+              "rope_dim] with the query width, contiguous in the last dim");
+  TORCH_CHECK(out.is_contiguous() && out.dtype() == query.dtype() &&
+                  out.sizes() == torch::IntArrayRef({query.size(0),
+                                                     query.size(1),
+                                                     kv_lora_rank}),
+              "out must be a contiguous [num_seqs, num_heads, kv_lora_rank] "
+              "tensor of the query dtype");
+  TORCH_CHECK(block_tables.dtype() == at::ScalarType::Int &&
+                  block_tables.is_contiguous(),
+              "block_tables must be contiguous int32");
+  TORCH_CHECK(context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous() &&
+                  context_lens.numel() == query.size(0),
+              "context_lens must be contiguous int32 [num_seqs]");
+  CPU_DISPATCH_BY_KV_CACHE_DTYPE(query.scalar_type(), kv_cache_dtype, kv_cache.scalar_type(),
+                   CALL_MLA_DECODE_CPU_LAUNCHER);
+}
+
+namespace {
+
+template <typename T, typename KVT>
+void paged_attention_block_sparse_cpu_launcher(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, torch::Tensor& key_summaries,
+    const int num_kv_heads, float scale, torch::Tensor& block_tables,
+    torch::Tensor& context_lens, const int block_size, float k_scale,
+    float v_scale, const int top_blocks,
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales) {
+  using scalar_t = typename CpuType<T>::type;
+  ater::cpu::PagedAttentionParams p;
+  p.num_seqs = query.size(0);
+  p.num_heads = query.size(1);
+  p.num_kv_heads = num_kv_heads;
+  p.head_size = query.size(2);
+  p.head_size_v = out.size(2);
+  p.scale = scale;
+  p.q_len = 1;
+  p.cu_seqlens_q = nullptr;
+  p.q_stride = query.stride(0);
+  p.q_head_stride = query.stride(1);
+  p.block_tables = block_tables.data_ptr<int>();
+  p.max_num_blocks_per_seq = block_tables.size(1);
+  p.context_lens = context_lens.data_ptr<int>();
+  p.alibi_slopes = nullptr;
+  p.window_size = 0;
+  p.num_sink_tokens = 0;
+  p.partition_offsets = nullptr;
+
+  const ater::cpu::PagedKV<KVT> kv =
+      make_paged_kv<KVT>(key_cache, value_cache, block_size, k_scale, v_scale,
+                         k_head_scales, v_head_scales);
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  ater::cpu::paged_attention_block_sparse<scalar_t, KVT, scalar_t>(
+      p, kv, key_summaries.data_ptr<float>(), top_blocks,
+      at::get_num_threads(), cpu_ptr<T>(query), cpu_ptr<T>(out));
+}
+
+}  // namespace
+
+#define CALL_BLOCK_SPARSE_CPU_LAUNCHER(T, KVT)                             \
+  paged_attention_block_sparse_cpu_launcher<T, KVT>(                       \
+      out, query, key_cache, value_cache, key_summaries, num_kv_heads,     \
+      scale, block_tables, context_lens, block_size, k_scale, v_scale,     \
+      top_blocks, k_head_scales, v_head_scales);
+
+void paged_attention_block_sparse_cpu(
+    torch::Tensor& out,    // [num_seqs, num_heads, head_size_v]
+    torch::Tensor& query,  // [num_seqs, num_heads, head_size]
+    torch::Tensor& key_cache, torch::Tensor& value_cache,
+    torch::Tensor& key_summaries,  // [num_blocks, num_kv_heads, 2, head_size]
+    int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables,  // [num_seqs, max_num_blocks_per_seq]
+    torch::Tensor& context_lens,  // [num_seqs]
+    int64_t block_size, const std::string& kv_cache_dtype, double k_scale,
+    double v_scale, int64_t top_blocks,
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_kv_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_kv_heads]
+  for (const torch::Tensor* t : {&out, &query, &key_cache, &value_cache,
+                                 &block_tables, &context_lens}) {
+    TORCH_CHECK(t->device().is_cpu(),
+                "paged_attention_block_sparse_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(query.dim() == 3 && query.stride(-1) == 1,
+              "query must be [num_seqs, num_heads, head_size], contiguous in "
+              "head_size");
+  const int64_t head_size_v = value_head_size_of(key_cache, value_cache);
+  TORCH_CHECK(out.is_contiguous() && out.dim() == 3 &&
+                  out.size(0) == query.size(0) &&
+                  out.size(1) == query.size(1) && out.size(2) == head_size_v &&
+                  out.dtype() == query.dtype(),
+              "out must be a contiguous [num_seqs, num_heads, head_size_v] "
+              "tensor of the query dtype");
+  TORCH_CHECK(block_tables.dtype() == at::ScalarType::Int &&
+                  block_tables.is_contiguous(),
+              "block_tables must be contiguous int32");
+  TORCH_CHECK(context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous() &&
+                  context_lens.numel() == query.size(0),
+              "context_lens must be contiguous int32 [num_seqs]");
+  TORCH_CHECK(query.size(1) % num_kv_heads == 0,
+              "num_heads must be a multiple of num_kv_heads");
+  TORCH_CHECK(top_blocks > 0, "top_blocks must be positive");
+  check_kv_cache(key_cache, value_cache, num_kv_heads, query.size(2),
+                 block_size, head_size_v);
+  check_key_summaries(key_summaries, key_cache.size(0), num_kv_heads,
+                      query.size(2));
+  check_head_scales(k_head_scales, v_head_scales, num_kv_heads,
+                    kv_cache_dtype);
+  CPU_DISPATCH_BY_KV_CACHE_DTYPE(query.scalar_type(), kv_cache_dtype,
+                                 key_cache.scalar_type(),
+                                 CALL_BLOCK_SPARSE_CPU_LAUNCHER);
+}
+
+namespace {
+
+// The moves are plain copies, so the cache is handled by element width.
+template <typename KVT>
+std::vector<int> h2o_compact_cpu_launcher(
+    torch::Tensor& key_cache, torch::Tensor& value_cache,
+    torch::Tensor& attn_mass, torch::Tensor& block_tables,
+    torch::Tensor& context_lens, const int block_size,
+    const int heavy_blocks, const int recent_tokens) {
+  const ater::cpu::PagedKV<KVT> kv =
+      make_paged_kv<KVT>(key_cache, value_cache, block_size, 1.0f, 1.0f,
+                         c10::nullopt, c10::nullopt);
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  return ater::cpu::h2o_compact(
+      kv, reinterpret_cast<KVT*>(key_cache.data_ptr()),
+      reinterpret_cast<KVT*>(value_cache.data_ptr()), attn_mass.size(1),
+      key_cache.dim() == 4 ? key_cache.size(3)
+                           : key_cache.size(2) * key_cache.size(4),
+      block_tables.data_ptr<int>(), block_tables.size(1),
+      context_lens.data_ptr<int>(), context_lens.size(0),
+      attn_mass.data_ptr<float>(), attn_mass.size(2) * attn_mass.size(3),
+      heavy_blocks, recent_tokens, value_head_size_of(key_cache, value_cache));
+}
+
+}  // namespace
+
+torch::Tensor h2o_compact_cpu(
+    torch::Tensor& key_cache,     // any layout of paged_attention_cpu
+    torch::Tensor& value_cache,   // any layout of paged_attention_cpu
+    torch::Tensor& attn_mass,     // [num_seqs, num_kv_heads,
+                                  //  max_num_blocks_per_seq, block_size]
+    torch::Tensor& block_tables,  // [num_seqs, max_num_blocks_per_seq]
+    torch::Tensor& context_lens,  // [num_seqs]
+    int64_t block_size, int64_t heavy_blocks, int64_t recent_tokens) {
+  for (const torch::Tensor* t :
+       {&key_cache, &value_cache, &block_tables, &context_lens}) {
+    TORCH_CHECK(t->device().is_cpu(), "h2o_compact_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(block_tables.dtype() == at::ScalarType::Int &&
+                  block_tables.is_contiguous(),
+              "block_tables must be contiguous int32");
+  TORCH_CHECK(context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous() &&
+                  context_lens.numel() == block_tables.size(0),
+              "context_lens must be contiguous int32 [num_seqs]");
+  TORCH_CHECK(heavy_blocks >= 0 && recent_tokens >= 0,
+              "heavy_blocks and recent_tokens must be non-negative");
+  check_attn_mass(attn_mass, block_tables.size(0), attn_mass.size(1),
+                  block_tables.size(1), block_size);
+  const int64_t num_kv_heads = attn_mass.size(1);
+  const int64_t head_size = key_cache.dim() == 4
+                                ? key_cache.size(3)
+                                : key_cache.size(2) * key_cache.size(4);
+  check_kv_cache(key_cache, value_cache, num_kv_heads, head_size, block_size,
+                 value_head_size_of(key_cache, value_cache));
+
+  std::vector<int> freed;
+  switch (key_cache.element_size()) {
+    case 1:
+      freed = h2o_compact_cpu_launcher<uint8_t>(
+          key_cache, value_cache, attn_mass, block_tables, context_lens,
+          block_size, heavy_blocks, recent_tokens);
+      break;
+    case 2:
+      freed = h2o_compact_cpu_launcher<uint16_t>(
+          key_cache, value_cache, attn_mass, block_tables, context_lens,
+          block_size, heavy_blocks, recent_tokens);
+      break;
+    case 4:
+      freed = h2o_compact_cpu_launcher<float>(
+          key_cache, value_cache, attn_mass, block_tables, context_lens,
+          block_size, heavy_blocks, recent_tokens);
+      break;
+    default:
+      TORCH_CHECK(false, "Unsupported kv cache dtype: ", key_cache.dtype());
+  }
+  torch::Tensor out = torch::empty(
+      {int64_t(freed.size())},
+      torch::TensorOptions().dtype(at::ScalarType::Int));
+  std::copy(freed.begin(), freed.end(), out.data_ptr<int>());
+  return out;
+}
+
+namespace {
+
+template <typename T>
+void varlen_attention_cpu_launcher(torch::Tensor& out, torch::Tensor& query,
+                                   torch::Tensor& key, torch::Tensor& value,
+                                   torch::Tensor& cu_seqlens, float scale,
+                                   bool causal) {
+  ater::cpu::VarlenAttentionParams p;
+  p.num_seqs = cu_seqlens.numel() - 1;
+  p.num_heads = query.size(1);
+  p.num_kv_heads = key.size(1);
+  p.head_size = query.size(2);
+  p.head_size_v = value.size(2);
+  p.scale = scale;
+  p.causal = causal;
+  p.cu_seqlens = cu_seqlens.data_ptr<int>();
+  p.q_stride = query.stride(0);
+  p.q_head_stride = query.stride(1);
+  p.k_stride = key.stride(0);
+  p.k_head_stride = key.stride(1);
+  p.v_stride = value.stride(0);
+  p.v_head_stride = value.stride(1);
+  ater::cpu::varlen_attention(p, cpu_ptr<T>(query), cpu_ptr<T>(key),
+                              cpu_ptr<T>(value), cpu_ptr<T>(out));
+}
+
+}  // namespace
+
+#define CALL_VARLEN_ATTENTION_CPU_LAUNCHER(T)                              \
+  varlen_attention_cpu_launcher<T>(out, query, key, value, cu_seqlens,    \
+                                   scale, causal);
+
+void varlen_attention_cpu(
+    torch::Tensor& out,         // [total_tokens, num_heads, head_size_v]
+    torch::Tensor& query,       // [total_tokens, num_heads, head_size]
+    torch::Tensor& key,         // [total_tokens, num_kv_heads, head_size]
+    torch::Tensor& value,       // [total_tokens, num_kv_heads, head_size_v]
+    torch::Tensor& cu_seqlens,  // [num_seqs + 1]
+    double scale, bool causal) {
+  for (const torch::Tensor* t : {&out, &query, &key, &value, &cu_seqlens}) {
+    TORCH_CHECK(t->device().is_cpu(),
+                "varlen_attention_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(query.dim() == 3 && key.dim() == 3 && value.dim() == 3,
+              "query, key and value must be [total_tokens, heads, head_size]");
+  const int64_t total = query.size(0);
+  TORCH_CHECK(key.size(0) == total && value.size(0) == total &&
+                  value.size(1) == key.size(1) && key.size(2) == query.size(2),
+              "key / value must be [total_tokens, num_kv_heads, head_size "
+              "(head_size_v)] for the tokens of query");
+  TORCH_CHECK(query.size(1) % key.size(1) == 0,
+              "num_heads must be a multiple of num_kv_heads");
+  TORCH_CHECK(query.stride(2) == 1 && key.stride(2) == 1 &&
+                  value.stride(2) == 1,
+              "query, key and value must be contiguous in head_size");
+  TORCH_CHECK(key.dtype() == query.dtype() && value.dtype() == query.dtype(),
+              "query, key and value must have the same dtype");
+  TORCH_CHECK(out.is_contiguous() && out.dtype() == query.dtype() &&
+                  out.dim() == 3 && out.size(0) == total &&
+                  out.size(1) == query.size(1) && out.size(2) == value.size(2),
+              "out must be a contiguous [total_tokens, num_heads, "
+              "head_size_v] tensor of the query dtype");
+  TORCH_CHECK(cu_seqlens.dtype() == at::ScalarType::Int &&
+                  cu_seqlens.is_contiguous() && cu_seqlens.numel() >= 1,
+              "cu_seqlens must be contiguous int32 [num_seqs + 1]");
+  const int* cu = cu_seqlens.data_ptr<int>();
+  TORCH_CHECK(cu[0] == 0 && cu[cu_seqlens.numel() - 1] == total,
+              "cu_seqlens must run from 0 to total_tokens");
+  for (int64_t i = 1; i < cu_seqlens.numel(); i++) {
+    TORCH_CHECK(cu[i] >= cu[i - 1], "cu_seqlens must be non-decreasing");
+  }
+
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  if (query.dtype() == at::ScalarType::Half) {
+    CALL_VARLEN_ATTENTION_CPU_LAUNCHER(at::Half);
+  } else if (query.dtype() == at::ScalarType::BFloat16) {
+    CALL_VARLEN_ATTENTION_CPU_LAUNCHER(at::BFloat16);
+  } else if (query.dtype() == at::ScalarType::Float) {
+    CALL_VARLEN_ATTENTION_CPU_LAUNCHER(float);
+  } else {
+    TORCH_CHECK(false, "Unsupported data type: ", query.dtype());
+  }
+}
+
+namespace {
+
+template <typename T, typename KVT>
+void paged_attention_append_cpu_launcher(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key,
+    torch::Tensor& value, torch::Tensor& key_cache, torch::Tensor& value_cache,
+    torch::Tensor& slot_mapping, const int num_kv_heads, float scale,
+    torch::Tensor& block_tables, torch::Tensor& context_lens,
+    const int block_size, const c10::optional<torch::Tensor>& alibi_slopes,
+    float k_scale, float v_scale,
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales) {
+  using scalar_t = typename CpuType<T>::type;
+  ater::cpu::PagedAttentionParams p;
+  p.num_seqs = query.size(0);
+  p.num_heads = query.size(1);
+  p.num_kv_heads = num_kv_heads;
+  p.head_size = query.size(2);
+  p.head_size_v = out.size(2);
+  p.scale = scale;
+  p.q_len = 1;
+  p.cu_seqlens_q = nullptr;
+  p.q_stride = query.stride(0);
+  p.q_head_stride = query.stride(1);
+  p.block_tables = block_tables.data_ptr<int>();
+  p.max_num_blocks_per_seq = block_tables.size(1);
+  p.context_lens = context_lens.data_ptr<int>();
+  p.alibi_slopes =
+      alibi_slopes ? alibi_slopes.value().data_ptr<float>() : nullptr;
+  p.window_size = 0;
+  p.num_sink_tokens = 0;
+  p.partition_offsets = nullptr;
+  p.partition_size = ater::cpu::choose_partition_size(
+      p.context_lens, p.num_seqs, num_kv_heads, block_size,
+      at::get_num_threads());
+  const int max_context_len =
+      *std::max_element(p.context_lens, p.context_lens + p.num_seqs);
+  p.max_num_partitions = std::max(
+      ater::cpu::num_partitions_of(max_context_len, p.partition_size), 1);
+
+  // dense workspace: a sequence's rows do not move when its new token opens
+  // a partition
+  const int64_t rows = int64_t(p.num_seqs) * p.num_heads * p.max_num_partitions;
+  torch::Tensor exp_sums =
+      torch::empty({rows}, query.options().dtype(at::ScalarType::Float));
+  torch::Tensor max_logits = torch::empty_like(exp_sums);
+  torch::Tensor tmp_out = torch::empty({rows, out.size(2)}, query.options());
+
+  const ater::cpu::PagedKV<KVT> kv =
+      make_paged_kv<KVT>(key_cache, value_cache, block_size, k_scale, v_scale,
+                         k_head_scales, v_head_scales);
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  ater::cpu::paged_attention_append_decode<scalar_t, KVT, scalar_t>(
+      p, kv, cpu_ptr<T>(query), cpu_ptr<T>(key), cpu_ptr<T>(value),
+      key.stride(0), value.stride(0), slot_mapping.data_ptr<int64_t>(),
+      reinterpret_cast<KVT*>(key_cache.data_ptr()),
+      reinterpret_cast<KVT*>(value_cache.data_ptr()),
+      exp_sums.data_ptr<float>(), max_logits.data_ptr<float>(),
+      cpu_ptr<T>(tmp_out), cpu_ptr<T>(out));
+}
+
+}  // namespace
+
+#define CALL_PAGED_ATTENTION_APPEND_CPU_LAUNCHER(T, KVT)                    \
+  paged_attention_append_cpu_launcher<T, KVT>(                              \
+      out, query, key, value, key_cache, value_cache, slot_mapping,         \
+      num_kv_heads, scale, block_tables, context_lens, block_size,          \
+      alibi_slopes, k_scale, v_scale, k_head_scales, v_head_scales);
+
+void paged_attention_append_cpu(
+    torch::Tensor& out,    // [num_seqs, num_heads, head_size_v]
+    torch::Tensor& query,  // [num_seqs, num_heads, head_size]
+    torch::Tensor& key,    // [num_seqs, num_kv_heads, head_size]
+    torch::Tensor& value,  // [num_seqs, num_kv_heads, head_size_v]
+    torch::Tensor& key_cache,     // any layout of paged_attention_cpu
+    torch::Tensor& value_cache,   // any layout of paged_attention_cpu
+    torch::Tensor& slot_mapping,  // [num_seqs]
+    int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables,  // [num_seqs, max_num_blocks_per_seq]
+    torch::Tensor& context_lens,  // [num_seqs], including the new token
+    int64_t block_size, const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_kv_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_kv_heads]
+  for (const torch::Tensor* t :
+       {&out, &query, &key, &value, &key_cache, &value_cache, &slot_mapping,
+        &block_tables, &context_lens}) {
+    TORCH_CHECK(t->device().is_cpu(),
+                "paged_attention_append_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(query.dim() == 3 && query.stride(2) == 1,
+              "query must be [num_seqs, num_heads, head_size], contiguous in "
+              "head_size");
+  const int64_t num_seqs = query.size(0);
+  const int64_t head_size = query.size(2);
+  TORCH_CHECK(key.dim() == 3 && value.dim() == 3 && key.size(0) == num_seqs &&
+                  value.size(0) == num_seqs && key.size(1) == num_kv_heads &&
+                  value.size(1) == num_kv_heads && key.size(2) == head_size &&
+                  key.stride(2) == 1 && key.stride(1) == key.size(2) &&
+                  value.stride(2) == 1 && value.stride(1) == value.size(2),
+              "key and value must be [num_seqs, num_kv_heads, head_size "
+              "(head_size_v)] with contiguous tokens");
+  TORCH_CHECK(key.dtype() == query.dtype() && value.dtype() == query.dtype(),
+              "query, key and value must have the same dtype");
+  TORCH_CHECK(out.is_contiguous() && out.dtype() == query.dtype() &&
+                  out.dim() == 3 && out.size(0) == num_seqs &&
+                  out.size(1) == query.size(1) && out.size(2) == value.size(2),
+              "out must be a contiguous [num_seqs, num_heads, head_size_v] "
+              "tensor of the query dtype");
+  TORCH_CHECK(query.size(1) % num_kv_heads == 0,
+              "num_heads must be a multiple of num_kv_heads");
+  TORCH_CHECK(slot_mapping.dtype() == at::ScalarType::Long &&
+                  slot_mapping.is_contiguous() &&
+                  slot_mapping.numel() == num_seqs,
+              "slot_mapping must be contiguous int64 [num_seqs]");
+  TORCH_CHECK(block_tables.dtype() == at::ScalarType::Int &&
+                  block_tables.is_contiguous() && block_tables.dim() == 2 &&
+                  block_tables.size(0) == num_seqs,
+              "block_tables must be contiguous int32 [num_seqs, "
+              "max_num_blocks_per_seq]");
+  TORCH_CHECK(context_lens.dtype() == at::ScalarType::Int &&
+                  context_lens.is_contiguous() &&
+                  context_lens.numel() == num_seqs && num_seqs > 0,
+              "context_lens must be contiguous int32 [num_seqs]");
+  TORCH_CHECK(kv_cache_dtype != "int8",
+              "paged_attention_append_cpu has no per-token quantized cache");
+  check_kv_cache(key_cache, value_cache, num_kv_heads, head_size, block_size,
+                 value.size(2));
+  // the decode reads the new token back at position context_lens - 1, so its
+  // slot must be the one block_tables maps that position to
+  const int* lens = context_lens.data_ptr<int>();
+  const int64_t* slots = slot_mapping.data_ptr<int64_t>();
+  const int* tables = block_tables.data_ptr<int>();
+  const int64_t max_blocks = block_tables.size(1);
+  const int64_t num_slots = key_cache.size(0) * block_size;
+  for (int64_t i = 0; i < num_seqs; i++) {
+    if (slots[i] < 0) {
+      continue;
+    }
+    TORCH_CHECK(lens[i] >= 1 && (lens[i] - 1) / block_size < max_blocks,
+                "context_lens must count the appended token and fit "
+                "block_tables (sequence ", i, ")");
+    const int64_t pos = lens[i] - 1;
+    const int64_t slot =
+        int64_t(tables[i * max_blocks + pos / block_size]) * block_size +
+        pos % block_size;
+    TORCH_CHECK(slots[i] < num_slots && slots[i] == slot,
+                "slot_mapping[", i, "] = ", slots[i],
+                " is not the cache slot of position context_lens - 1 (",
+                slot, ") or lies outside the cache");
+  }
+  check_head_scales(k_head_scales, v_head_scales, num_kv_heads,
+                    kv_cache_dtype);
+  CPU_DISPATCH_BY_KV_CACHE_DTYPE(query.scalar_type(), kv_cache_dtype,
+                                 key_cache.scalar_type(),
+                                 CALL_PAGED_ATTENTION_APPEND_CPU_LAUNCHER);
+}
+
+#undef CALL_PAGED_ATTENTION_APPEND_CPU_LAUNCHER
+#undef CALL_VARLEN_ATTENTION_CPU_LAUNCHER
+#undef CALL_BLOCK_SPARSE_CPU_LAUNCHER
+#undef CALL_MLA_DECODE_CPU_LAUNCHER
+#undef CALL_CPU_VARLEN_LAUNCHER_KV
+#undef CALL_CPU_VARLEN_LAUNCHER
+#undef CALL_CPU_LAUNCHER_KV
+#undef CALL_CPU_LAUNCHER
+#undef CALL_CPU_LAUNCHER_OUT
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: block_manager.cpp
+ * @Description: Paged KV pool bookkeeping (see block_manager.h). Per-step
+ *               calls walk their batch once and return ready-made tensors,
+ *               so the host cost is a hash lookup per running sequence.
+ *               The prefix cache hashes each full block once, when it fills.
+ */
+#include "block_manager.h"
+
+#include <algorithm>
+
+namespace {
+
+void check_seq_ids(const torch::Tensor& seq_ids) {
+  TORCH_CHECK(seq_ids.device().is_cpu() &&
+                  seq_ids.dtype() == at::ScalarType::Long &&
+                  seq_ids.dim() == 1 && seq_ids.is_contiguous(),
+              "seq_ids must be a contiguous int64 [n] CPU tensor");
+}
+
+// token_ids as int32, which holds any vocabulary
+const int32_t* token_ids_as_int(const torch::Tensor& token_ids, int64_t n,
+                                std::vector<int32_t>& buf) {
+  TORCH_CHECK(token_ids.device().is_cpu() && token_ids.dim() == 1 &&
+                  token_ids.is_contiguous() && token_ids.numel() == n,
+              "token_ids must be a contiguous [", n, "] CPU tensor");
+  if (token_ids.dtype() == at::ScalarType::Int) {
+    return token_ids.data_ptr<int32_t>();
+  }
+  TORCH_CHECK(token_ids.dtype() == at::ScalarType::Long,
+              "token_ids must be int32 or int64");
+  const int64_t* t = token_ids.data_ptr<int64_t>();
+  buf.assign(t, t + n);
+  return buf.data();
+}
+
+constexpr uint64_t kRootHash = 0x9e3779b97f4a7c15ull;
+
+// splitmix64 finalizer
+inline uint64_t mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+uint64_t chain_hash(uint64_t parent, const int32_t* tokens, int64_t n) {
+  uint64_t h = mix(parent);
+  for (int64_t i = 0; i < n; i++) {
+    h = mix(h + kRootHash + uint32_t(tokens[i]));
+  }
+  return h;
+}
+
+}  // namespace
+
+BlockManager::BlockManager(int64_t num_blocks, int64_t block_size,
+                           bool enable_prefix_caching)
+    : block_size_(block_size), prefix_caching_(enable_prefix_caching) {
+  TORCH_CHECK(num_blocks > 0 && num_blocks <= INT32_MAX,
+              "num_blocks must be in [1, 2^31)");
+  TORCH_CHECK(block_size > 0, "block_size must be positive");
+  ref_counts_.assign(num_blocks, 0);
+  // popped from the back: block 0 is handed out first
+  free_blocks_.resize(num_blocks);
+  for (int64_t i = 0; i < num_blocks; i++) {
+    free_blocks_[i] = int(num_blocks - 1 - i);
+  }
+  if (prefix_caching_) {
+    cached_.assign(num_blocks, 0);
+    parent_.assign(num_blocks, -1);
+    num_children_.assign(num_blocks, 0);
+    block_tokens_.resize(num_blocks * block_size);
+    block_hash_.resize(num_blocks);
+    lru_prev_.assign(num_blocks + 1, int(num_blocks));
+    lru_next_.assign(num_blocks + 1, int(num_blocks));
+  }
+}
+
+int64_t BlockManager::ref_count(int64_t block) const {
+  TORCH_CHECK(block >= 0 && block < num_blocks(), "block ", block,
+              " out of range");
+  return ref_counts_[block];
+}
+
+int BlockManager::take_free_block() {
+  int block;
+  if (!free_blocks_.empty()) {
+    block = free_blocks_.back();
+    free_blocks_.pop_back();
+  } else {
+    block = evict_block();
+  }
+  ref_counts_[block] = 1;
+  return block;
+}
+
+void BlockManager::release(int block) {
+  if (--ref_counts_[block] == 0) {
+    if (prefix_caching_ && cached_[block]) {
+      num_evictable_++;
+      if (num_children_[block] == 0) {
+        lru_push(block);
+      }
+    } else {
+      free_blocks_.push_back(block);
+    }
+  }
+}
+
+void BlockManager::lru_push(int block) {
+  const int nil = int(num_blocks());
+  const int last = lru_prev_[nil];
+  lru_prev_[block] = last;
+  lru_next_[block] = nil;
+  lru_next_[last] = block;
+  lru_prev_[nil] = block;
+}
+
+void BlockManager::lru_remove(int block) {
+  lru_next_[lru_prev_[block]] = lru_next_[block];
+  lru_prev_[lru_next_[block]] = lru_prev_[block];
+}
+
+// The oldest unreferenced leaf. Sequences hold whole chains, so the children
+// of an unreferenced block are unreferenced too and the leaf list is never
+// empty while something is evictable. A parent left without cached children
+// becomes a leaf itself.
+int BlockManager::evict_block() {
+  const int block = lru_next_[num_blocks()];
+  lru_remove(block);
+  num_evictable_--;
+  index_.erase(block_hash_[block]);
+  const int parent = parent_[block];
+  if (parent >= 0 && --num_children_[parent] == 0 &&
+      ref_counts_[parent] == 0) {
+    lru_push(parent);
+  }
+  cached_[block] = 0;
+  return block;
+}
+
+// The indexed block with this hash, parent and tokens, or -1.
+int BlockManager::match_block(uint64_t hash, int parent,
+                              const int32_t* tokens) const {
+  auto it = index_.find(hash);
+  if (it == index_.end()) {
+    return -1;
+  }
+  const int block = it->second;
+  const int32_t* cached = block_tokens_.data() + int64_t(block) * block_size_;
+  if (parent_[block] != parent ||
+      !std::equal(tokens, tokens + block_size_, cached)) {
+    return -1;
+  }
+  return block;
+}
+
+// Indexes seq.blocks[k], just filled with tokens, under the previous block.
+// A hash already taken (the same prefix computed twice, or a collision)
+// leaves the block and the rest of the sequence out of the index.
+void BlockManager::index_block(Sequence& seq, size_t k, const int32_t* tokens) {
+  const uint64_t hash = chain_hash(seq.hash, tokens, block_size_);
+  const int block = seq.blocks[k];
+  if (!index_.emplace(hash, block).second) {
+    seq.indexed = false;
+    return;
+  }
+  const int parent = k > 0 ? seq.blocks[k - 1] : -1;
+  cached_[block] = 1;
+  parent_[block] = parent;
+  if (parent >= 0) {
+    num_children_[parent]++;
+  }
+  block_hash_[block] = hash;
+  std::copy(tokens, tokens + block_size_,
+            block_tokens_.begin() + int64_t(block) * block_size_);
+  seq.hash = hash;
+}
+
+int64_t BlockManager::allocate() {
+  TORCH_CHECK(num_free_blocks() > 0, "out of KV cache blocks");
+  return take_free_block();
+}
+
+void BlockManager::free(int64_t block) {
+  TORCH_CHECK(ref_count(block) > 0, "block ", block, " is not allocated");
+  release(int(block));
+}
+
+BlockManager::Sequence& BlockManager::sequence(int64_t seq_id) {
+  auto it = seqs_.find(seq_id);
+  TORCH_CHECK(it != seqs_.end(), "unknown sequence ", seq_id);
+  return it->second;
+}
+
+const BlockManager::Sequence& BlockManager::sequence(int64_t seq_id) const {
+  auto it = seqs_.find(seq_id);
+  TORCH_CHECK(it != seqs_.end(), "unknown sequence ", seq_id);
+  return it->second;
+}
+
+// The next token goes into a partial last block someone else also maps.
+bool BlockManager::needs_copy(const Sequence& seq) const {
+  return seq.num_tokens % block_size_ != 0 && ref_counts_[seq.blocks.back()] > 1;
+}
+
+// Blocks the next append of batch takes: one per full last block, and one
+// per copy of a shared partial last block. Sharers copy in turn and the last
+// one left writes in place, so a block with r references shared by k of the
+// batch costs min(k, r - 1) copies.
+int64_t BlockManager::blocks_needed(const Sequence* const* batch,
+                                    int64_t n) const {
+  static thread_local std::vector<int> shared;
+  shared.clear();
+  int64_t needed = 0;
+  for (int64_t i = 0; i < n; i++) {
+    const Sequence& seq = *batch[i];
+    if (seq.num_tokens % block_size_ == 0) {
+      needed++;
+    } else if (needs_copy(seq)) {
+      shared.push_back(seq.blocks.back());
+    }
+  }
+  std::sort(shared.begin(), shared.end());
+  for (size_t i = 0, j = 0; i < shared.size(); i = j) {
+    while (j < shared.size() && shared[j] == shared[i]) {
+      j++;
+    }
+    needed += std::min<int64_t>(j - i, ref_counts_[shared[i]] - 1);
+  }
+  return needed;
+}
+
+bool BlockManager::can_allocate(int64_t num_tokens) const {
+  return (num_tokens + block_size_ - 1) / block_size_ <= num_free_blocks();
+}
+
+torch::Tensor BlockManager::add_sequence(int64_t seq_id, int64_t num_tokens) {
+  TORCH_CHECK(num_tokens >= 0, "num_tokens must be non-negative");
+  TORCH_CHECK(seqs_.find(seq_id) == seqs_.end(), "sequence ", seq_id,
+              " already exists");
+  TORCH_CHECK(can_allocate(num_tokens), "out of KV cache blocks: sequence ",
+              seq_id, " needs ", (num_tokens + block_size_ - 1) / block_size_,
+              ", ", num_free_blocks(), " free");
+  Sequence& seq = seqs_[seq_id];
+  seq.num_tokens = num_tokens;
+  seq.blocks.resize((num_tokens + block_size_ - 1) / block_size_);
+  for (int& block : seq.blocks) {
+    block = take_free_block();
+  }
+  torch::Tensor slots = torch::empty(
+      {num_tokens}, torch::TensorOptions().dtype(at::ScalarType::Long));
+  int64_t* s = slots.data_ptr<int64_t>();
+  for (int64_t t = 0; t < num_tokens; t++) {
+    s[t] = int64_t(seq.blocks[t / block_size_]) * block_size_ + t % block_size_;
+  }
+  return slots;
+}
+
+std::tuple<torch::Tensor, int64_t> BlockManager::add_sequence_with_prefix(
+    int64_t seq_id, const torch::Tensor& token_ids) {
+  TORCH_CHECK(prefix_caching_, "prefix caching is not enabled");
+  TORCH_CHECK(seqs_.find(seq_id) == seqs_.end(), "sequence ", seq_id,
+              " already exists");
+  const int64_t n = token_ids.numel();
+  static thread_local std::vector<int32_t> buf;
+  const int32_t* tokens = token_ids_as_int(token_ids, n, buf);
+
+  // walk the tree down the prompt's full blocks, leaving the last token out
+  static thread_local std::vector<int> hits;
+  hits.clear();
+  uint64_t hash = kRootHash;
+  int64_t revived = 0;  // hits taken off the eviction list
+  for (int64_t k = 0; (k + 1) * block_size_ < n; k++) {
+    const int32_t* t = tokens + k * block_size_;
+    const uint64_t h = chain_hash(hash, t, block_size_);
+    const int block = match_block(h, hits.empty() ? -1 : hits.back(), t);
+    if (block < 0) {
+      break;
+    }
+    hits.push_back(block);
+    revived += ref_counts_[block] == 0;
+    hash = h;
+  }
+  const int64_t num_cached = int64_t(hits.size()) * block_size_;
+  const int64_t needed =
+      (n + block_size_ - 1) / block_size_ - int64_t(hits.size());
+  TORCH_CHECK(needed <= num_free_blocks() - revived,
+              "out of KV cache blocks: sequence ", seq_id, " needs ", needed,
+              ", ", num_free_blocks() - revived, " free");
+
+  Sequence& seq = seqs_[seq_id];
+  seq.num_tokens = n;
+  seq.indexed = true;
+  seq.hash = hash;
+  for (const int block : hits) {
+    if (ref_counts_[block]++ == 0) {
+      num_evictable_--;
+      if (num_children_[block] == 0) {
+        lru_remove(block);
+      }
+    }
+    seq.blocks.push_back(block);
+  }
+  torch::Tensor slots = torch::empty(
+      {n - num_cached}, torch::TensorOptions().dtype(at::ScalarType::Long));
+  int64_t* s = slots.data_ptr<int64_t>();
+  for (int64_t t = num_cached; t < n; t += block_size_) {
+    const int block = take_free_block();
+    seq.blocks.push_back(block);
+    const int64_t len = std::min(block_size_, n - t);
+    for (int64_t i = 0; i < len; i++) {
+      *s++ = int64_t(block) * block_size_ + i;
+    }
+    if (len < block_size_) {
+      seq.tail.assign(tokens + t, tokens + n);
+    } else if (seq.indexed) {
+      index_block(seq, seq.blocks.size() - 1, tokens + t);
+    }
+  }
+  return {slots, num_cached};
+}
+
+void BlockManager::fork(int64_t parent_id, int64_t child_id) {
+  TORCH_CHECK(seqs_.find(child_id) == seqs_.end(), "sequence ", child_id,
+              " already exists");
+  // copied, not referenced: inserting the child may rehash the map
+  Sequence parent = sequence(parent_id);
+  for (const int block : parent.blocks) {
+    ref_counts_[block]++;
+  }
+  parent.append_step = -1;
+  seqs_.emplace(child_id, std::move(parent));
+}
+
+void BlockManager::free_sequence(int64_t seq_id) {
+  auto it = seqs_.find(seq_id);
+  TORCH_CHECK(it != seqs_.end(), "unknown sequence ", seq_id);
+  for (const int block : it->second.blocks) {
+    release(block);
+  }
+  seqs_.erase(it);
+}
+
+int64_t BlockManager::blocks_needed_to_append(
+    const torch::Tensor& seq_ids) const {
+  check_seq_ids(seq_ids);
+  const int64_t n = seq_ids.numel();
+  const int64_t* ids = seq_ids.data_ptr<int64_t>();
+  static thread_local std::vector<const Sequence*> batch;
+  batch.resize(n);
+  for (int64_t i = 0; i < n; i++) {
+    batch[i] = &sequence(ids[i]);
+  }
+  return blocks_needed(batch.data(), n);
+}
+
+torch::Tensor BlockManager::append_slots(
+    const torch::Tensor& seq_ids,
+    const c10::optional<torch::Tensor>& token_ids) {
+  check_seq_ids(seq_ids);
+  const int64_t n = seq_ids.numel();
+  const int64_t* ids = seq_ids.data_ptr<int64_t>();
+  static thread_local std::vector<int32_t> buf;
+  const int32_t* tokens =
+      prefix_caching_ && token_ids.has_value()
+          ? token_ids_as_int(*token_ids, n, buf)
+          : nullptr;
+  step_++;
+  // one lookup per sequence; the map does not change below
+  static thread_local std::vector<Sequence*> batch;
+  batch.resize(n);
+  for (int64_t i = 0; i < n; i++) {
+    Sequence& seq = sequence(ids[i]);
+    TORCH_CHECK(seq.append_step != step_, "sequence ", ids[i],
+                " appears twice in seq_ids");
+    seq.append_step = step_;
+    batch[i] = &seq;
+  }
+  const int64_t needed = blocks_needed(batch.data(), n);
+  TORCH_CHECK(needed <= num_free_blocks(), "out of KV cache blocks: ",
+              needed, " needed, ", num_free_blocks(), " free");
+
+  torch::Tensor slots =
+      torch::empty({n}, torch::TensorOptions().dtype(at::ScalarType::Long));
+  int64_t* s = slots.data_ptr<int64_t>();
+  for (int64_t i = 0; i < n; i++) {
+    Sequence& seq = *batch[i];
+    const int64_t offset = seq.num_tokens % block_size_;
+    if (offset == 0) {
+      seq.blocks.push_back(take_free_block());
+    } else if (ref_counts_[seq.blocks.back()] > 1) {
+      // copy on write: the other owners keep the original
+      const int src = seq.blocks.back();
+      const int dst = take_free_block();
+      copies_.push_back(src);
+      copies_.push_back(dst);
+      release(src);
+      seq.blocks.back() = dst;
+    }
+    s[i] = int64_t(seq.blocks.back()) * block_size_ + offset;
+    seq.num_tokens++;
+    if (!seq.indexed) {
+      continue;
+    }
+    if (tokens == nullptr) {
+      seq.indexed = false;
+      seq.tail.clear();
+      continue;
+    }
+    seq.tail.push_back(tokens[i]);
+    if (int64_t(seq.tail.size()) == block_size_) {
+      index_block(seq, seq.blocks.size() - 1, seq.tail.data());
+      seq.tail.clear();
+    }
+  }
+  return slots;
+}
+
+torch::Tensor BlockManager::take_copy_mapping() {
+  const int64_t num_pairs = int64_t(copies_.size()) / 2;
+  torch::Tensor mapping = torch::empty(
+      {num_pairs, 2}, torch::TensorOptions().dtype(at::ScalarType::Long));
+  std::copy(copies_.begin(), copies_.end(), mapping.data_ptr<int64_t>());
+  copies_.clear();
+  return mapping;
+}
+
+torch::Tensor BlockManager::block_tables(const torch::Tensor& seq_ids,
+                                         int64_t max_num_blocks) const {
+  check_seq_ids(seq_ids);
+  const int64_t n = seq_ids.numel();
+  const int64_t* ids = seq_ids.data_ptr<int64_t>();
+  static thread_local std::vector<const Sequence*> batch;
+  batch.resize(n);
+  int64_t longest = 0;
+  for (int64_t i = 0; i < n; i++) {
+    batch[i] = &sequence(ids[i]);
+    longest = std::max<int64_t>(longest, batch[i]->blocks.size());
+  }
+  if (max_num_blocks <= 0) {
+    max_num_blocks = std::max<int64_t>(longest, 1);
+  }
+  TORCH_CHECK(longest <= max_num_blocks, "a sequence holds ", longest,
+              " blocks, more than max_num_blocks ", max_num_blocks);
+  torch::Tensor tables = torch::zeros(
+      {n, max_num_blocks}, torch::TensorOptions().dtype(at::ScalarType::Int));
+  int* t = tables.data_ptr<int>();
+  for (int64_t i = 0; i < n; i++) {
+    std::copy(batch[i]->blocks.begin(), batch[i]->blocks.end(),
+              t + i * max_num_blocks);
+  }
+  return tables;
+}
+
+torch::Tensor BlockManager::context_lens(const torch::Tensor& seq_ids) const {
+  check_seq_ids(seq_ids);
+  const int64_t n = seq_ids.numel();
+  const int64_t* ids = seq_ids.data_ptr<int64_t>();
+  torch::Tensor lens =
+      torch::empty({n}, torch::TensorOptions().dtype(at::ScalarType::Int));
+  int* l = lens.data_ptr<int>();
+  for (int64_t i = 0; i < n; i++) {
+    l[i] = int(sequence(ids[i]).num_tokens);
+  }
+  return lens;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: cache_cpu.cpp
+ * @Description: Host counterparts of the cache ops of cache_kernels.cu
+ *               (reshape_and_cache, concat_and_cache_mla, copy_blocks) for a
+ *               KV cache that lives in host memory, written in the layouts
+ *               the CPU attention ops (attention_cpu.cpp) read.
+ */
+#include <torch/all.h>
+#include <ATen/Parallel.h>
+
+#include "cache.h"
+#include "cpu_ops_common.h"
+#include "cpu_cache_write.h"
+#include "cpu_block_copy.h"
+#include "cpu_mla.h"
+
+namespace {
+
+template <typename T, typename KVT>
+void concat_and_cache_mla_cpu_launcher(torch::Tensor& kv_c,
+                                       torch::Tensor& k_pe,
+                                       torch::Tensor& kv_cache,
+                                       torch::Tensor& slot_mapping,
+                                       float scale) {
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  ater::cpu::mla_cache_write(
+      cpu_ptr<T>(kv_c), kv_c.stride(0), cpu_ptr<T>(k_pe), k_pe.stride(0),
+      slot_mapping.data_ptr<int64_t>(), slot_mapping.numel(),
+      reinterpret_cast<KVT*>(kv_cache.data_ptr()), kv_cache.stride(0),
+      kv_cache.stride(1), kv_cache.size(1), kv_c.size(1), k_pe.size(1), scale);
+}
+
+template <typename T, typename KVT>
+void reshape_and_cache_cpu_launcher(
+    torch::Tensor& key, torch::Tensor& value, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, torch::Tensor& slot_mapping,
+    const int block_size, float k_scale, float v_scale,
+    const c10::optional<torch::Tensor>& key_summaries,
+    const c10::optional<torch::Tensor>& k_head_scales,
+    const c10::optional<torch::Tensor>& v_head_scales) {
+  const ater::cpu::PagedKV<KVT> kv =
+      make_paged_kv<KVT>(key_cache, value_cache, block_size, k_scale, v_scale,
+                         k_head_scales, v_head_scales);
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  ater::cpu::reshape_and_cache(
+      cpu_ptr<T>(key), cpu_ptr<T>(value), key.stride(0), value.stride(0),
+      slot_mapping.data_ptr<int64_t>(), slot_mapping.numel(), key.size(1),
+      key.size(2), kv, reinterpret_cast<KVT*>(key_cache.data_ptr()),
+      reinterpret_cast<KVT*>(value_cache.data_ptr()), value.size(2));
+  if (key_summaries) {
+    ater::cpu::update_key_summaries(
+        cpu_ptr<T>(key), key.stride(0), slot_mapping.data_ptr<int64_t>(),
+        slot_mapping.numel(), key.size(1), key.size(2), block_size,
+        key_summaries.value().data_ptr<float>());
+  }
+}
+
+}  // namespace
+
+#define CALL_CONCAT_AND_CACHE_MLA_CPU_LAUNCHER(T, KVT)                     \
+  concat_and_cache_mla_cpu_launcher<T, KVT>(kv_c, k_pe, kv_cache,          \
+                                            slot_mapping, scale);
+
+void concat_and_cache_mla_cpu(
+    torch::Tensor& kv_c,          // [num_tokens, kv_lora_rank]
+    torch::Tensor& k_pe,          // [num_tokens, rope_dim]
+    torch::Tensor& kv_cache,      // [num_blocks, block_size,
+                                  //  kv_lora_rank + rope_dim]
+    torch::Tensor& slot_mapping,  // [num_tokens]
+    const std::string& kv_cache_dtype, double scale) {
+  for (const torch::Tensor* t : {&kv_c, &k_pe, &kv_cache, &slot_mapping}) {
+    TORCH_CHECK(t->device().is_cpu(),
+                "concat_and_cache_mla_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(kv_c.dim() == 2 && k_pe.dim() == 2 &&
+                  kv_c.dtype() == k_pe.dtype() &&
+                  kv_c.size(0) == slot_mapping.numel() &&
+                  k_pe.size(0) == slot_mapping.numel() &&
+                  kv_c.stride(1) == 1 && k_pe.stride(1) == 1,
+              "kv_c / k_pe must be [num_tokens, dim] of one dtype, "
+              "contiguous in dim");
+  TORCH_CHECK(kv_cache.dim() == 3 &&
+                  kv_cache.size(2) == kv_c.size(1) + k_pe.size(1) &&
+                  kv_cache.stride(2) == 1,
+              "kv_cache must be [num_blocks, block_size, kv_lora_rank + "
+              "rope_dim], contiguous in the last dim");
+  TORCH_CHECK(slot_mapping.dtype() == at::ScalarType::Long &&
+                  slot_mapping.is_contiguous(),
+              "slot_mapping must be contiguous int64");
+  CPU_DISPATCH_BY_KV_CACHE_DTYPE(kv_c.scalar_type(), kv_cache_dtype, kv_cache.scalar_type(),
+                   CALL_CONCAT_AND_CACHE_MLA_CPU_LAUNCHER);
+}
+
+#define CALL_RESHAPE_AND_CACHE_CPU_LAUNCHER(T, KVT)                       \
+  reshape_and_cache_cpu_launcher<T, KVT>(key, value, key_cache,           \
+                                         value_cache, slot_mapping,       \
+                                         block_size, k_scale, v_scale,    \
+                                         key_summaries, k_head_scales,    \
+                                         v_head_scales);
+
+void reshape_and_cache_cpu(
+    torch::Tensor& key,    // [num_tokens, num_kv_heads, head_size]
+    torch::Tensor& value,  // [num_tokens, num_kv_heads, head_size_v]
+    torch::Tensor& key_cache,    // any layout of paged_attention_cpu
+    torch::Tensor& value_cache,  // any layout of paged_attention_cpu
+    torch::Tensor& slot_mapping,  // [num_tokens]
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    const c10::optional<torch::Tensor>&
+        key_summaries,  // [num_blocks, num_kv_heads, 2, head_size]
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_kv_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_kv_heads]
+  for (const torch::Tensor* t :
+       {&key, &value, &key_cache, &value_cache, &slot_mapping}) {
+    TORCH_CHECK(t->device().is_cpu(),
+                "reshape_and_cache_cpu expects CPU tensors");
+  }
+  TORCH_CHECK(key.dim() == 3 && value.dim() == 3 &&
+                  key.sizes().slice(0, 2) == value.sizes().slice(0, 2) &&
+                  key.dtype() == value.dtype() && key.stride(2) == 1 &&
+                  key.stride(1) == key.size(2) && value.stride(2) == 1 &&
+                  value.stride(1) == value.size(2),
+              "key and value must be [num_tokens, num_kv_heads, head_size "
+              "(head_size_v)] with contiguous tokens");
+  TORCH_CHECK(slot_mapping.dtype() == at::ScalarType::Long &&
+                  slot_mapping.is_contiguous() &&
+                  slot_mapping.numel() == key.size(0),
+              "slot_mapping must be contiguous int64 [num_tokens]");
+  const int64_t num_kv_heads = key.size(1);
+  const int64_t head_size = key.size(2);
+  const int64_t block_size =
+      key_cache.dim() == 4 ? key_cache.size(1) : key_cache.size(3);
+  check_kv_cache(key_cache, value_cache, num_kv_heads, head_size, block_size,
+                 value.size(2));
+  if (key_summaries) {
+    check_key_summaries(key_summaries.value(), key_cache.size(0),
+                        num_kv_heads, head_size);
+  }
+  check_head_scales(k_head_scales, v_head_scales, num_kv_heads,
+                    kv_cache_dtype);
+  CPU_DISPATCH_BY_KV_CACHE_DTYPE(key.scalar_type(), kv_cache_dtype,
+                                 key_cache.scalar_type(),
+                                 CALL_RESHAPE_AND_CACHE_CPU_LAUNCHER);
+}
+
+void copy_blocks_cpu(
+    std::vector<torch::Tensor> const& key_caches,    // [num_blocks, ...]
+    std::vector<torch::Tensor> const& value_caches,  // [num_blocks, ...]
+    const torch::Tensor& block_mapping) {            // [num_pairs, 2]
+  const int num_layers = key_caches.size();
+  TORCH_CHECK(num_layers == int(value_caches.size()),
+              "key_caches and value_caches must pair up");
+  TORCH_CHECK(block_mapping.device().is_cpu() &&
+                  block_mapping.dtype() == at::ScalarType::Long &&
+                  block_mapping.dim() == 2 && block_mapping.size(1) == 2 &&
+                  block_mapping.is_contiguous(),
+              "block_mapping must be a contiguous int64 [num_pairs, 2] CPU tensor");
+  if (num_layers == 0) {
+    return;
+  }
+  const int64_t num_blocks = key_caches[0].size(0);
+  const int64_t key_block_bytes =
+      key_caches[0].element_size() * key_caches[0].stride(0);
+  const int64_t value_block_bytes =
+      value_caches[0].element_size() * value_caches[0].stride(0);
+  // the caches are caller-owned: the table is just their addresses
+  static thread_local std::vector<char*> key_ptrs, value_ptrs;
+  key_ptrs.resize(num_layers);
+  value_ptrs.resize(num_layers);
+  for (int l = 0; l < num_layers; l++) {
+    const torch::Tensor& k = key_caches[l];
+    const torch::Tensor& v = value_caches[l];
+    TORCH_CHECK(k.device().is_cpu() && v.device().is_cpu(),
+                "copy_blocks_cpu expects CPU tensors");
+    TORCH_CHECK(k.is_contiguous() && v.is_contiguous() &&
+                    k.size(0) == num_blocks && v.size(0) == num_blocks &&
+                    k.element_size() * k.stride(0) == key_block_bytes &&
+                    v.element_size() * v.stride(0) == value_block_bytes,
+                "the caches of every layer must be contiguous and alike");
+    key_ptrs[l] = static_cast<char*>(k.data_ptr());
+    value_ptrs[l] = static_cast<char*>(v.data_ptr());
+  }
+  const int64_t num_pairs = block_mapping.size(0);
+  const int64_t* mapping = block_mapping.data_ptr<int64_t>();
+  for (int64_t i = 0; i < 2 * num_pairs; i++) {
+    TORCH_CHECK(mapping[i] >= 0 && mapping[i] < num_blocks,
+                "block_mapping out of range");
+  }
+  ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+  ater::cpu::copy_blocks(key_ptrs.data(), value_ptrs.data(), num_layers,
+                         mapping, num_pairs, key_block_bytes,
+                         value_block_bytes);
+}
+
+#undef CALL_RESHAPE_AND_CACHE_CPU_LAUNCHER
+#undef CALL_CONCAT_AND_CACHE_MLA_CPU_LAUNCHER
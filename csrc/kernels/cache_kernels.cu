@@ -1,9 +1,11 @@
 #include <torch/all.h>
+#include <ATen/Parallel.h>
 #include <ATen/cuda/CUDAContext.h>
 #include <c10/cuda/CUDAGuard.h>
 
 #include "hip_compat.h"
 #include "dispatch_utils.h"
+#include "cpu_block_copy.h"
 
 #ifdef USE_ROCM
   #include "quant_utils.cuh"
@@ -14,6 +16,7 @@
 #include <algorithm>
 #include <cassert>
 #include <map>
+#include <mutex>
 #include <vector>
 
 #ifdef USE_ROCM
@@ -21,6 +24,10 @@
 typedef __hip_bfloat16 __nv_bfloat16;
 #endif
 
+// Sorts the mapping and copies runs of blocks contiguous on both sides with
+// one transfer each: one memcpy per run on the current stream between a GPU
+// and anything, chunks of runs over the host thread pool between two host
+// caches.
 void swap_blocks(torch::Tensor& src, torch::Tensor& dst,
                  const torch::Tensor& block_mapping) {
   torch::Device src_device = src.device();
@@ -34,31 +41,48 @@ void swap_blocks(torch::Tensor& src, torch::Tensor& dst,
     memcpy_type = cudaMemcpyDeviceToHost;
   } else if (src_device.is_cpu() && dst_device.is_cuda()) {
     memcpy_type = cudaMemcpyHostToDevice;
+  } else if (src_device.is_cpu() && dst_device.is_cpu()) {
+    memcpy_type = cudaMemcpyHostToHost;
   } else {
     TORCH_CHECK(false, "Invalid device combination");
   }
 
   // NOTE(youkaichao): keep in mind that `block_mapping` should be
-  // a cpu tensor, otherwise every `item` call will require a gpu-cpu
-  // synchronization.
+  // a cpu tensor, otherwise reading it requires a gpu-cpu synchronization.
   TORCH_CHECK(block_mapping.device().is_cpu(), "block_mapping must be on CPU");
+  TORCH_CHECK(block_mapping.scalar_type() == at::ScalarType::Long &&
+                  block_mapping.dim() == 2 && block_mapping.size(1) == 2,
+              "block_mapping must be an int64 [num_pairs, 2] tensor");
+  TORCH_CHECK(src.is_contiguous() && dst.is_contiguous(),
+              "src and dst must be contiguous");
+  const int64_t block_size_in_bytes = src.element_size() * src.stride(0);
+  TORCH_CHECK(dst.element_size() * dst.stride(0) == block_size_in_bytes,
+              "src and dst blocks must have the same size");
+
+  const torch::Tensor mapping = block_mapping.contiguous();
+  const std::vector<ater::cpu::BlockRun> runs = ater::cpu::coalesce_block_mapping(
+      mapping.data_ptr<int64_t>(), mapping.size(0));
+  for (const ater::cpu::BlockRun& r : runs) {
+    TORCH_CHECK(r.src >= 0 && r.src + r.num_blocks <= src.size(0) &&
+                    r.dst >= 0 && r.dst + r.num_blocks <= dst.size(0),
+                "block_mapping out of range");
+  }
 
   char* src_ptr = static_cast<char*>(src.data_ptr());
   char* dst_ptr = static_cast<char*>(dst.data_ptr());
-
-  const int64_t block_size_in_bytes = src.element_size() * src[0].numel();
+  if (memcpy_type == cudaMemcpyHostToHost) {
+    // this module's pool, sized like torch's intra-op pool
+    ater::cpu::ThreadPool::instance().set_num_threads(at::get_num_threads());
+    ater::cpu::copy_block_runs(dst_ptr, src_ptr, runs, block_size_in_bytes);
+    return;
+  }
   const at::cuda::OptionalCUDAGuard device_guard(
       src_device.is_cuda() ? src_device : dst_device);
   const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
-  // NOTE(woosuk): This can be slow if the number of blocks is large.
-  const int64_t num_blocks = block_mapping.size(0);
-  for (size_t i = 0; i < num_blocks; i++) {
-    int64_t src_block_number = block_mapping[i][0].item<int64_t>();
-    int64_t dst_block_number = block_mapping[i][1].item<int64_t>();
-    int64_t src_offset = src_block_number * block_size_in_bytes;
-    int64_t dst_offset = dst_block_number * block_size_in_bytes;
-    cudaMemcpyAsync(dst_ptr + dst_offset, src_ptr + src_offset,
-                    block_size_in_bytes, memcpy_type, stream);
+  for (const ater::cpu::BlockRun& r : runs) {
+    cudaMemcpyAsync(dst_ptr + r.dst * block_size_in_bytes,
+                    src_ptr + r.src * block_size_in_bytes,
+                    r.num_blocks * block_size_in_bytes, memcpy_type, stream);
   }
 }
 
@@ -66,10 +90,11 @@ namespace vllm {
 
 // Grid: (num_layers, num_pairs)
 template <typename scalar_t>
-__global__ void copy_blocks_kernel(int64_t* key_cache_ptrs,
-                                   int64_t* value_cache_ptrs,
+__global__ void copy_blocks_kernel(const int64_t* key_cache_ptrs,
+                                   const int64_t* value_cache_ptrs,
                                    const int64_t* __restrict__ block_mapping,
-                                   const int numel_per_block) {
+                                   const int numel_per_block,
+                                   const int numel_per_block_v) {
   const int layer_idx = blockIdx.x;
   const int pair_idx = blockIdx.y;
 
@@ -86,15 +111,82 @@ __global__ void copy_blocks_kernel(int64_t* key_cache_ptrs,
     int64_t dst_offset = dst_block_offset + i;
     key_cache[dst_offset] = key_cache[src_offset];
   }
-  for (int i = threadIdx.x; i < numel_per_block; i += blockDim.x) {
-    int64_t src_offset = src_block_offset + i;
-    int64_t dst_offset = dst_block_offset + i;
+  // value blocks differ in size when head_size_v != head_size
+  const int64_t src_block_offset_v = src_block_number * numel_per_block_v;
+  const int64_t dst_block_offset_v = dst_block_number * numel_per_block_v;
+  for (int i = threadIdx.x; i < numel_per_block_v; i += blockDim.x) {
+    int64_t src_offset = src_block_offset_v + i;
+    int64_t dst_offset = dst_block_offset_v + i;
     value_cache[dst_offset] = value_cache[src_offset];
   }
 }
 
 }  // namespace vllm
 
+namespace {
+
+// Device copy of the key cache addresses of every layer followed by the
+// value cache ones, as copy_blocks_kernel reads them. Tables are kept per
+// (device, cache set) for the kMaxTables most recently used sets, so engines
+// or draft / target models sharing a GPU each keep theirs. A set is uploaded
+// on first use (which synchronizes once, outside the lock) and reused while
+// its addresses stay the same; a set that moved is a new key. An evicted
+// table's tensor goes back to the caching allocator in stream order, so
+// kernels still queued read the version they were launched with.
+torch::Tensor cache_ptr_table(std::vector<torch::Tensor> const& key_caches,
+                              std::vector<torch::Tensor> const& value_caches,
+                              const torch::Device& device) {
+  struct Table {
+    int device;
+    std::vector<int64_t> ptrs;
+    torch::Tensor device_ptrs;
+  };
+  constexpr size_t kMaxTables = 8;
+  static std::mutex mutex;
+  // most recently used first; never destroyed: freeing device tensors during
+  // static teardown may run after the HIP runtime has been unloaded
+  static auto& tables = *new std::vector<Table>();
+  static thread_local std::vector<int64_t> ptrs;
+  const int num_layers = key_caches.size();
+  ptrs.resize(2 * num_layers);
+  for (int layer_idx = 0; layer_idx < num_layers; ++layer_idx) {
+    ptrs[layer_idx] =
+        reinterpret_cast<int64_t>(key_caches[layer_idx].data_ptr());
+    ptrs[num_layers + layer_idx] =
+        reinterpret_cast<int64_t>(value_caches[layer_idx].data_ptr());
+  }
+  const int device_idx = device.index();
+  auto find = [&] {
+    return std::find_if(tables.begin(), tables.end(), [&](const Table& t) {
+      return t.device == device_idx && t.ptrs == ptrs;
+    });
+  };
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = find();
+    if (it != tables.end()) {
+      std::rotate(tables.begin(), it, it + 1);
+      return tables.front().device_ptrs;
+    }
+  }
+  torch::Tensor device_ptrs =
+      torch::from_blob(ptrs.data(), {2 * num_layers}, torch::kInt64)
+          .to(device);
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = find();
+  if (it == tables.end()) {
+    if (tables.size() == kMaxTables) {
+      tables.pop_back();
+    }
+    tables.push_back({device_idx, ptrs, std::move(device_ptrs)});
+    it = tables.end() - 1;
+  }
+  std::rotate(tables.begin(), it, it + 1);
+  return tables.front().device_ptrs;
+}
+
+}  // namespace
+
 // Note: the key_caches and value_caches vectors are constant but
 // not the Tensors they contain. The vectors need to be const refs
 // in order to satisfy pytorch's C++ operator registration code.
@@ -109,58 +201,54 @@ void copy_blocks(std::vector<torch::Tensor> const& key_caches,
   torch::Device cache_device = key_caches[0].device();
   TORCH_CHECK(cache_device.is_cuda());
 
-  // Create data structures for the kernel.
-  // Create an array of pointers to the key and value caches.
-  int64_t key_cache_ptrs[num_layers];
-  int64_t value_cache_ptrs[num_layers];
-  for (int layer_idx = 0; layer_idx < num_layers; ++layer_idx) {
-    key_cache_ptrs[layer_idx] =
-        reinterpret_cast<int64_t>(key_caches[layer_idx].data_ptr());
-    value_cache_ptrs[layer_idx] =
-        reinterpret_cast<int64_t>(value_caches[layer_idx].data_ptr());
-  }
-
   // block_mapping is a 2D tensor with shape (num_pairs, 2).
   int num_pairs = block_mapping.size(0);
+  if (num_pairs == 0) {
+    return;
+  }
 
-  // Move the data structures to the GPU.
-  // NOTE: This synchronizes the CPU and GPU.
-  torch::Tensor key_cache_ptrs_tensor =
-      torch::from_blob(key_cache_ptrs, {num_layers}, torch::kInt64)
-          .to(cache_device);
-  torch::Tensor value_cache_ptrs_tensor =
-      torch::from_blob(value_cache_ptrs, {num_layers}, torch::kInt64)
-          .to(cache_device);
+  // The cache addresses on the GPU; only a new cache set synchronizes.
+  const torch::Tensor ptr_table =
+      cache_ptr_table(key_caches, value_caches, cache_device);
+  const int64_t* key_cache_ptrs = ptr_table.data_ptr<int64_t>();
+  const int64_t* value_cache_ptrs = key_cache_ptrs + num_layers;
 
   // Launch the kernel.
   const int numel_per_block = key_caches[0][0].numel();
+  const int numel_per_block_v = value_caches[0][0].numel();
   dim3 grid(num_layers, num_pairs);
-  dim3 block(std::min(1024, numel_per_block));
+  dim3 block(std::min(1024, std::max(numel_per_block, numel_per_block_v)));
   const at::cuda::OptionalCUDAGuard device_guard(cache_device);
   const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
   VLLM_DISPATCH_FLOATING_AND_BYTE_TYPES(
       key_caches[0].scalar_type(), "copy_blocks_kernel", ([&] {
         vllm::copy_blocks_kernel<scalar_t><<<grid, block, 0, stream>>>(
-            key_cache_ptrs_tensor.data_ptr<int64_t>(),
-            value_cache_ptrs_tensor.data_ptr<int64_t>(),
-            block_mapping.data_ptr<int64_t>(), numel_per_block);
+            key_cache_ptrs, value_cache_ptrs,
+            block_mapping.data_ptr<int64_t>(), numel_per_block,
+            numel_per_block_v);
       }));
 }
 
 namespace vllm {
 
+// value may have its own head size head_size_v (hdim_qk != hdim_v, e.g.
+// 192 / 128); keys and values are then written by separate index ranges of
+// the same loop.
 template <typename scalar_t, typename cache_t, Fp8KVCacheDataType kv_dt, bool asmLayout=false>
 __global__ void reshape_and_cache_kernel(
     const scalar_t* __restrict__ key,    // [num_tokens, num_heads, head_size]
-    const scalar_t* __restrict__ value,  // [num_tokens, num_heads, head_size]
+    const scalar_t* __restrict__ value,  // [num_tokens, num_heads, head_size_v]
     cache_t* __restrict__ key_cache,     // [num_blocks, num_heads, head_size/x,
                                          // block_size, x]
-    cache_t* __restrict__ value_cache,   // [num_blocks, num_heads, head_size,
+    cache_t* __restrict__ value_cache,   // [num_blocks, num_heads, head_size_v,
                                          // block_size]
     const int64_t* __restrict__ slot_mapping,  // [num_tokens]
     const int key_stride, const int value_stride, const int num_heads,
     const int head_size, const int block_size, const int x, const float k_scale,
-    const float v_scale) {
+    const float v_scale,
+    const float* __restrict__ k_head_scales,    // [num_heads] or nullptr
+    const float* __restrict__ v_head_scales,    // [num_heads] or nullptr
+    const int head_size_v) {
   const int64_t token_idx = blockIdx.x;
   const int64_t slot_idx = slot_mapping[token_idx];
   if (slot_idx < 0) {
@@ -171,52 +259,63 @@ __global__ void reshape_and_cache_kernel(
   const int64_t block_idx = slot_idx / block_size;
   const int64_t block_offset = slot_idx % block_size;
 
-  const int n = num_heads * head_size;
+  const int n_k = num_heads * head_size;
+  const int n_v = num_heads * head_size_v;
+  const int n = n_k > n_v ? n_k : n_v;
   for (int i = threadIdx.x; i < n; i += blockDim.x) {
-    const int64_t src_key_idx = token_idx * key_stride + i;
-    const int64_t src_value_idx = token_idx * value_stride + i;
-
-    const int head_idx = i / head_size;
-    const int head_offset = i % head_size;
-    const int x_idx = head_offset / x;
-    const int x_offset = head_offset % x;
-
-    const int64_t tgt_key_idx =
-        block_idx * num_heads * (head_size / x) * block_size * x +
-                     head_idx * (head_size / x) * block_size * x +
-                                          x_idx * block_size * x +
-                                                block_offset * x + 
-                                                          x_offset;
-    int64_t tgt_value_idx;
-    if constexpr (asmLayout)
-    { //[num_blocks, num_heads, block_size/X, head_size, X]
-      const int x_idx_v = block_offset / x;
-      const int x_offset_v = block_offset % x;
-      tgt_value_idx =
-          block_idx * num_heads * head_size * block_size +
-                       head_idx * head_size * block_size +
-                                 x_idx_v * head_size * x +
-                                         head_offset * x +
-                                                x_offset_v;
-    }
-    else
-    { //[num_blocks, num_heads, head_size, block_size]
-      tgt_value_idx =
-          block_idx * num_heads * head_size * block_size +
-                       head_idx * head_size * block_size +
-                                head_offset * block_size +
-                                              block_offset;
+    if (i < n_k) {
+      const int64_t src_key_idx = token_idx * key_stride + i;
+      const int head_idx = i / head_size;
+      const int head_offset = i % head_size;
+      const int x_idx = head_offset / x;
+      const int x_offset = head_offset % x;
+
+      const int64_t tgt_key_idx =
+          block_idx * num_heads * (head_size / x) * block_size * x +
+                       head_idx * (head_size / x) * block_size * x +
+                                            x_idx * block_size * x +
+                                                  block_offset * x +
+                                                            x_offset;
+      scalar_t tgt_key = key[src_key_idx];
+      if constexpr (kv_dt == Fp8KVCacheDataType::kAuto) {
+        key_cache[tgt_key_idx] = tgt_key;
+      } else {
+        key_cache[tgt_key_idx] = fp8::scaled_convert<cache_t, scalar_t, kv_dt>(
+            tgt_key, k_head_scales ? k_head_scales[head_idx] : k_scale);
+      }
     }
-    scalar_t tgt_key = key[src_key_idx];
-    scalar_t tgt_value = value[src_value_idx];
-    if constexpr (kv_dt == Fp8KVCacheDataType::kAuto) {
-      key_cache[tgt_key_idx] = tgt_key;
-      value_cache[tgt_value_idx] = tgt_value;
-    } else {
-      key_cache[tgt_key_idx] =
-          fp8::scaled_convert<cache_t, scalar_t, kv_dt>(tgt_key, k_scale);
-      value_cache[tgt_value_idx] =
-          fp8::scaled_convert<cache_t, scalar_t, kv_dt>(tgt_value, v_scale);
+    if (i < n_v) {
+      const int64_t src_value_idx = token_idx * value_stride + i;
+      const int head_idx = i / head_size_v;
+      const int head_offset = i % head_size_v;
+      int64_t tgt_value_idx;
+      if constexpr (asmLayout)
+      { //[num_blocks, num_heads, block_size/X, head_size_v, X]
+        const int x_idx_v = block_offset / x;
+        const int x_offset_v = block_offset % x;
+        tgt_value_idx =
+            block_idx * num_heads * head_size_v * block_size +
+                         head_idx * head_size_v * block_size +
+                                 x_idx_v * head_size_v * x +
+                                           head_offset * x +
+                                                  x_offset_v;
+      }
+      else
+      { //[num_blocks, num_heads, head_size_v, block_size]
+        tgt_value_idx =
+            block_idx * num_heads * head_size_v * block_size +
+                         head_idx * head_size_v * block_size +
+                                  head_offset * block_size +
+                                                block_offset;
+      }
+      scalar_t tgt_value = value[src_value_idx];
+      if constexpr (kv_dt == Fp8KVCacheDataType::kAuto) {
+        value_cache[tgt_value_idx] = tgt_value;
+      } else {
+        value_cache[tgt_value_idx] =
+            fp8::scaled_convert<cache_t, scalar_t, kv_dt>(
+                tgt_value, v_head_scales ? v_head_scales[head_idx] : v_scale);
+      }
     }
   }
 }
@@ -224,15 +323,18 @@ __global__ void reshape_and_cache_kernel(
 template <typename scalar_t, typename cache_t, Fp8KVCacheDataType kv_dt>
 __global__ void reshape_and_cache_flash_kernel(
     const scalar_t* __restrict__ key,    // [num_tokens, num_heads, head_size]
-    const scalar_t* __restrict__ value,  // [num_tokens, num_heads, head_size]
+    const scalar_t* __restrict__ value,  // [num_tokens, num_heads, head_size_v]
     cache_t* __restrict__ key_cache,     // [num_blocks, block_size, num_heads,
                                          // head_size]
     cache_t* __restrict__ value_cache,   // [num_blocks, block_size, num_heads,
-                                         // head_size]
+                                         // head_size_v]
     const int64_t* __restrict__ slot_mapping,  // [num_tokens]
     const int block_stride, const int key_stride, const int value_stride,
     const int num_heads, const int head_size, const int block_size,
-    const float k_scale, const float v_scale) {
+    const float k_scale, const float v_scale,
+    const float* __restrict__ k_head_scales,    // [num_heads] or nullptr
+    const float* __restrict__ v_head_scales,    // [num_heads] or nullptr
+    const int v_block_stride, const int head_size_v) {
   const int64_t token_idx = blockIdx.x;
   const int64_t slot_idx = slot_mapping[token_idx];
   // NOTE: slot_idx can be -1 if the token is padded
@@ -241,25 +343,134 @@ __global__ void reshape_and_cache_flash_kernel(
   }
   const int64_t block_idx = slot_idx / block_size;
   const int64_t block_offset = slot_idx % block_size;
+  const int n_k = num_heads * head_size;
+  const int n_v = num_heads * head_size_v;
+  const int n = n_k > n_v ? n_k : n_v;
+  for (int i = threadIdx.x; i < n; i += blockDim.x) {
+    if (i < n_k) {
+      const int64_t src_key_idx = token_idx * key_stride + i;
+      const int head_idx = i / head_size;
+      const int64_t tgt_key_idx =
+          block_idx * block_stride + block_offset * n_k + i;
+      scalar_t tgt_key = key[src_key_idx];
+      if constexpr (kv_dt == Fp8KVCacheDataType::kAuto) {
+        key_cache[tgt_key_idx] = tgt_key;
+      } else {
+        key_cache[tgt_key_idx] = fp8::scaled_convert<cache_t, scalar_t, kv_dt>(
+            tgt_key, k_head_scales ? k_head_scales[head_idx] : k_scale);
+      }
+    }
+    if (i < n_v) {
+      const int64_t src_value_idx = token_idx * value_stride + i;
+      const int head_idx = i / head_size_v;
+      const int64_t tgt_value_idx =
+          block_idx * v_block_stride + block_offset * n_v + i;
+      scalar_t tgt_value = value[src_value_idx];
+      if constexpr (kv_dt == Fp8KVCacheDataType::kAuto) {
+        value_cache[tgt_value_idx] = tgt_value;
+      } else {
+        value_cache[tgt_value_idx] =
+            fp8::scaled_convert<cache_t, scalar_t, kv_dt>(
+                tgt_value, v_head_scales ? v_head_scales[head_idx] : v_scale);
+      }
+    }
+  }
+}
+
+// Block key summaries [num_blocks, num_heads, 2, head_size] float for
+// query-aware block-sparse decode: row 0 holds the channel-wise min, row 1
+// the max of the keys written to a block. The reset of a block whose first
+// slot is written runs as its own launch, so it is ordered before the keys
+// of the same call widen the summary.
+__global__ void reset_block_key_summaries_kernel(
+    const int64_t* __restrict__ slot_mapping,  // [num_tokens]
+    float* __restrict__ key_summaries, const int num_heads,
+    const int head_size, const int block_size) {
+  const int64_t slot_idx = slot_mapping[blockIdx.x];
+  if (slot_idx < 0 || slot_idx % block_size != 0) {
+    return;
+  }
+  float* summary =
+      key_summaries + slot_idx / block_size * num_heads * 2 * head_size;
+  const int n = num_heads * 2 * head_size;
+  for (int i = threadIdx.x; i < n; i += blockDim.x) {
+    summary[i] = (i / head_size) % 2 == 0 ? INFINITY : -INFINITY;
+  }
+}
+
+// Non-negative floats order like their int bits, negative ones in reverse
+// like their unsigned bits. v + 0.0f turns -0.0 into +0.0.
+__device__ __forceinline__ void atomic_min_float(float* addr, float v) {
+  v += 0.0f;
+  if (v >= 0.0f) {
+    atomicMin(reinterpret_cast<int*>(addr), __float_as_int(v));
+  } else {
+    atomicMax(reinterpret_cast<unsigned int*>(addr), __float_as_uint(v));
+  }
+}
+
+__device__ __forceinline__ void atomic_max_float(float* addr, float v) {
+  v += 0.0f;
+  if (v >= 0.0f) {
+    atomicMax(reinterpret_cast<int*>(addr), __float_as_int(v));
+  } else {
+    atomicMin(reinterpret_cast<unsigned int*>(addr), __float_as_uint(v));
+  }
+}
+
+template <typename scalar_t>
+__global__ void update_block_key_summaries_kernel(
+    const scalar_t* __restrict__ key,  // [num_tokens, num_heads, head_size]
+    const int64_t* __restrict__ slot_mapping,  // [num_tokens]
+    float* __restrict__ key_summaries, const int key_stride,
+    const int num_heads, const int head_size, const int block_size) {
+  const int64_t token_idx = blockIdx.x;
+  const int64_t slot_idx = slot_mapping[token_idx];
+  if (slot_idx < 0) {
+    return;
+  }
+  float* summary =
+      key_summaries + slot_idx / block_size * num_heads * 2 * head_size;
   const int n = num_heads * head_size;
   for (int i = threadIdx.x; i < n; i += blockDim.x) {
-    const int64_t src_key_idx = token_idx * key_stride + i;
-    const int64_t src_value_idx = token_idx * value_stride + i;
+    const float k = static_cast<float>(key[token_idx * key_stride + i]);
     const int head_idx = i / head_size;
     const int head_offset = i % head_size;
-    const int64_t tgt_key_value_idx = block_idx * block_stride +
-                                      block_offset * num_heads * head_size +
-                                      head_idx * head_size + head_offset;
-    scalar_t tgt_key = key[src_key_idx];
-    scalar_t tgt_value = value[src_value_idx];
+    float* s = summary + head_idx * 2 * head_size + head_offset;
+    atomic_min_float(s, k);
+    atomic_max_float(s + head_size, k);
+  }
+}
+
+// MLA: one entry per token holding the compressed latent kv_c followed by
+// the decoupled RoPE key k_pe, shared by all heads.
+template <typename scalar_t, typename cache_t, Fp8KVCacheDataType kv_dt>
+__global__ void concat_and_cache_mla_kernel(
+    const scalar_t* __restrict__ kv_c,  // [num_tokens, kv_lora_rank]
+    const scalar_t* __restrict__ k_pe,  // [num_tokens, pe_dim]
+    cache_t* __restrict__ kv_cache,     // [num_blocks, block_size,
+                                        // kv_lora_rank + pe_dim]
+    const int64_t* __restrict__ slot_mapping,  // [num_tokens]
+    const int block_stride, const int entry_stride, const int kv_c_stride,
+    const int k_pe_stride, const int kv_lora_rank, const int pe_dim,
+    const int block_size, const float scale) {
+  const int64_t token_idx = blockIdx.x;
+  const int64_t slot_idx = slot_mapping[token_idx];
+  // NOTE: slot_idx can be -1 if the token is padded
+  if (slot_idx < 0) {
+    return;
+  }
+  const int64_t block_idx = slot_idx / block_size;
+  const int64_t block_offset = slot_idx % block_size;
+  cache_t* entry = kv_cache + block_idx * block_stride + block_offset * entry_stride;
+  for (int i = threadIdx.x; i < kv_lora_rank + pe_dim; i += blockDim.x) {
+    const scalar_t src = i < kv_lora_rank
+                             ? kv_c[token_idx * kv_c_stride + i]
+                             : k_pe[token_idx * k_pe_stride + i - kv_lora_rank];
     if constexpr (kv_dt == Fp8KVCacheDataType::kAuto) {
-      key_cache[tgt_key_value_idx] = tgt_key;
-      value_cache[tgt_key_value_idx] = tgt_value;
+      entry[i] = src;
     } else {
-      key_cache[tgt_key_value_idx] =
-          fp8::scaled_convert<cache_t, scalar_t, kv_dt>(tgt_key, k_scale);
-      value_cache[tgt_key_value_idx] =
-          fp8::scaled_convert<cache_t, scalar_t, kv_dt>(tgt_value, v_scale);
+      entry[i] = fp8::scaled_convert<cache_t, scalar_t, kv_dt>(src, scale);
     }
   }
 }
@@ -468,6 +679,59 @@ __global__ void reshape_and_cache_with_per_token_quant_kernel(
 }
 }  // namespace vllm
 
+// Keeps key_summaries [num_blocks, num_heads, 2, head_size] up to date with
+// the keys of one cache write.
+static void update_block_key_summaries(torch::Tensor& key,
+                                       torch::Tensor& slot_mapping,
+                                       torch::Tensor& key_summaries,
+                                       const int block_size,
+                                       const cudaStream_t stream) {
+  int num_tokens = key.size(0);
+  int num_heads = key.size(1);
+  int head_size = key.size(2);
+  TORCH_CHECK(key_summaries.device() == key.device() &&
+                  key_summaries.dtype() == at::ScalarType::Float &&
+                  key_summaries.is_contiguous() && key_summaries.dim() == 4 &&
+                  key_summaries.size(1) == num_heads &&
+                  key_summaries.size(2) == 2 &&
+                  key_summaries.size(3) == head_size,
+              "key_summaries must be a contiguous float32 [num_blocks, "
+              "num_heads, 2, head_size] tensor on the key device");
+  int key_stride = key.stride(0);
+  dim3 grid(num_tokens);
+  dim3 block(std::min(num_heads * 2 * head_size, 512));
+  vllm::reset_block_key_summaries_kernel<<<grid, block, 0, stream>>>(
+      slot_mapping.data_ptr<int64_t>(), key_summaries.data_ptr<float>(),
+      num_heads, head_size, block_size);
+  VLLM_DISPATCH_FLOATING_TYPES(
+      key.scalar_type(), "update_block_key_summaries_kernel", [&] {
+        vllm::update_block_key_summaries_kernel<scalar_t>
+            <<<grid, block, 0, stream>>>(
+                key.data_ptr<scalar_t>(), slot_mapping.data_ptr<int64_t>(),
+                key_summaries.data_ptr<float>(), key_stride, num_heads,
+                head_size, block_size);
+      });
+}
+
+// Device pointer of an optional [num_heads] float32 per-head scale, or
+// nullptr to use the scalar scale.
+static const float* head_scales_ptr(
+    const c10::optional<torch::Tensor>& head_scales, const torch::Tensor& key,
+    const std::string& kv_cache_dtype, const int num_heads) {
+  if (!head_scales) {
+    return nullptr;
+  }
+  TORCH_CHECK(kv_cache_dtype != "auto",
+              "per-head kv scales need an fp8 kv_cache_dtype");
+  const torch::Tensor& s = head_scales.value();
+  TORCH_CHECK(s.device() == key.device() &&
+                  s.dtype() == at::ScalarType::Float && s.is_contiguous() &&
+                  s.numel() == num_heads,
+              "k_head_scales / v_head_scales must be contiguous float32 "
+              "[num_heads] tensors on the key device");
+  return s.data_ptr<float>();
+}
+
 // KV_T is the stored data type of kv-cache.
 // CACHE_T is the data type of key and value tensors.
 // KV_DTYPE is the real data type of kv-cache.
@@ -479,7 +743,8 @@ __global__ void reshape_and_cache_with_per_token_quant_kernel(
           reinterpret_cast<CACHE_T*>(key_cache.data_ptr()),           \
           reinterpret_cast<CACHE_T*>(value_cache.data_ptr()),         \
           slot_mapping.data_ptr<int64_t>(), key_stride, value_stride, \
-          num_heads, head_size, block_size, x, k_scale, v_scale);
+          num_heads, head_size, block_size, x, k_scale, v_scale,      \
+          k_head_ptr, v_head_ptr, head_size_v);
 
 #define CALL_RESHAPE_AND_CACHE_ASM(KV_T, CACHE_T, KV_DTYPE)           \
   vllm::reshape_and_cache_kernel<KV_T, CACHE_T, KV_DTYPE, true>       \
@@ -489,30 +754,42 @@ __global__ void reshape_and_cache_with_per_token_quant_kernel(
           reinterpret_cast<CACHE_T *>(key_cache.data_ptr()),          \
           reinterpret_cast<CACHE_T *>(value_cache.data_ptr()),        \
           slot_mapping.data_ptr<int64_t>(), key_stride, value_stride, \
-          num_heads, head_size, block_size, x, k_scale, v_scale);
+          num_heads, head_size, block_size, x, k_scale, v_scale,      \
+          k_head_ptr, v_head_ptr, head_size_v);
 
 void reshape_and_cache(
     torch::Tensor& key,    // [num_tokens, num_heads, head_size]
-    torch::Tensor& value,  // [num_tokens, num_heads, head_size]
+    torch::Tensor& value,  // [num_tokens, num_heads, head_size_v]
     torch::Tensor&
         key_cache,  // [num_blocks, num_heads, head_size/x, block_size, x]
     torch::Tensor&
-        value_cache,  // [num_blocks, num_heads, head_size, block_size]
+        value_cache,  // [num_blocks, num_heads, head_size_v, block_size]
     torch::Tensor& slot_mapping,  // [num_tokens]
     const std::string& kv_cache_dtype, const double k_scale,
     const double v_scale,
-    const bool asm_layout) {
+    const bool asm_layout,
+    const c10::optional<torch::Tensor>&
+        key_summaries,  // [num_blocks, num_heads, 2, head_size]
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_heads]
   int num_tokens = key.size(0);
   int num_heads = key.size(1);
   int head_size = key.size(2);
+  int head_size_v = value.size(2);
   int block_size = key_cache.size(3);
   int x = key_cache.size(4);
+  TORCH_CHECK(k_head_scales.has_value() == v_head_scales.has_value(),
+              "k_head_scales and v_head_scales must be given together");
+  const float* k_head_ptr =
+      head_scales_ptr(k_head_scales, key, kv_cache_dtype, num_heads);
+  const float* v_head_ptr =
+      head_scales_ptr(v_head_scales, key, kv_cache_dtype, num_heads);
 
   int key_stride = key.stride(0);
   int value_stride = value.stride(0);
 
   dim3 grid(num_tokens);
-  dim3 block(std::min(num_heads * head_size, 512));
+  dim3 block(std::min(num_heads * std::max(head_size, head_size_v), 512));
   const at::cuda::OptionalCUDAGuard device_guard(device_of(key));
   const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
 
@@ -525,6 +802,11 @@ void reshape_and_cache(
     DISPATCH_BY_KV_CACHE_DTYPE(key.dtype(), kv_cache_dtype,
                                CALL_RESHAPE_AND_CACHE)
   }
+  if (key_summaries) {
+    torch::Tensor summaries = key_summaries.value();
+    update_block_key_summaries(key, slot_mapping, summaries, block_size,
+                               stream);
+  }
 }
 
 // KV_T is the stored data type of kv-cache.
@@ -538,34 +820,97 @@ void reshape_and_cache(
           reinterpret_cast<CACHE_T*>(key_cache.data_ptr()),           \
           reinterpret_cast<CACHE_T*>(value_cache.data_ptr()),         \
           slot_mapping.data_ptr<int64_t>(), block_stride, key_stride, \
-          value_stride, num_heads, head_size, block_size, k_scale, v_scale);
+          value_stride, num_heads, head_size, block_size,             \
+          k_scale, v_scale, k_head_ptr, v_head_ptr, v_block_stride,   \
+          head_size_v);
 
 void reshape_and_cache_flash(
     torch::Tensor& key,        // [num_tokens, num_heads, head_size]
-    torch::Tensor& value,      // [num_tokens, num_heads, head_size]
+    torch::Tensor& value,      // [num_tokens, num_heads, head_size_v]
     torch::Tensor& key_cache,  // [num_blocks, block_size, num_heads, head_size]
     torch::Tensor&
-        value_cache,  // [num_blocks, block_size, num_heads, head_size]
+        value_cache,  // [num_blocks, block_size, num_heads, head_size_v]
     torch::Tensor& slot_mapping,  // [num_tokens]
     const std::string& kv_cache_dtype, const double k_scale,
-    const double v_scale) {
+    const double v_scale,
+    const c10::optional<torch::Tensor>&
+        key_summaries,  // [num_blocks, num_heads, 2, head_size]
+    const c10::optional<torch::Tensor>& k_head_scales,  // [num_heads]
+    const c10::optional<torch::Tensor>& v_head_scales) {  // [num_heads]
   int num_tokens = key.size(0);
   int num_heads = key.size(1);
   int head_size = key.size(2);
+  int head_size_v = value.size(2);
   int block_size = key_cache.size(1);
+  TORCH_CHECK(k_head_scales.has_value() == v_head_scales.has_value(),
+              "k_head_scales and v_head_scales must be given together");
+  const float* k_head_ptr =
+      head_scales_ptr(k_head_scales, key, kv_cache_dtype, num_heads);
+  const float* v_head_ptr =
+      head_scales_ptr(v_head_scales, key, kv_cache_dtype, num_heads);
 
   int key_stride = key.stride(0);
   int value_stride = value.stride(0);
   int block_stride = key_cache.stride(0);
-  TORCH_CHECK(key_cache.stride(0) == value_cache.stride(0));
+  int v_block_stride = value_cache.stride(0);
 
   dim3 grid(num_tokens);
-  dim3 block(std::min(num_heads * head_size, 512));
+  dim3 block(std::min(num_heads * std::max(head_size, head_size_v), 512));
   const at::cuda::OptionalCUDAGuard device_guard(device_of(key));
   const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
 
   DISPATCH_BY_KV_CACHE_DTYPE(key.dtype(), kv_cache_dtype,
                              CALL_RESHAPE_AND_CACHE_FLASH);
+  if (key_summaries) {
+    torch::Tensor summaries = key_summaries.value();
+    update_block_key_summaries(key, slot_mapping, summaries, block_size,
+                               stream);
+  }
+}
+
+// KV_T is the data type of kv_c and k_pe.
+// CACHE_T is the stored data type of kv-cache.
+// KV_DTYPE is the real data type of kv-cache.
+#define CALL_CONCAT_AND_CACHE_MLA(KV_T, CACHE_T, KV_DTYPE)               \
+  vllm::concat_and_cache_mla_kernel<KV_T, CACHE_T, KV_DTYPE>             \
+      <<<grid, block, 0, stream>>>(                                      \
+          reinterpret_cast<KV_T*>(kv_c.data_ptr()),                      \
+          reinterpret_cast<KV_T*>(k_pe.data_ptr()),                      \
+          reinterpret_cast<CACHE_T*>(kv_cache.data_ptr()),               \
+          slot_mapping.data_ptr<int64_t>(), block_stride, entry_stride,  \
+          kv_c_stride, k_pe_stride, kv_lora_rank, pe_dim, block_size,    \
+          scale);
+
+void concat_and_cache_mla(
+    torch::Tensor& kv_c,          // [num_tokens, kv_lora_rank]
+    torch::Tensor& k_pe,          // [num_tokens, pe_dim]
+    torch::Tensor& kv_cache,      // [num_blocks, block_size,
+                                  //  kv_lora_rank + pe_dim]
+    torch::Tensor& slot_mapping,  // [num_tokens]
+    const std::string& kv_cache_dtype, const double scale) {
+  int num_tokens = slot_mapping.size(0);
+  int kv_lora_rank = kv_c.size(1);
+  int pe_dim = k_pe.size(1);
+  int block_size = kv_cache.size(1);
+
+  TORCH_CHECK(kv_cache.size(2) == kv_lora_rank + pe_dim,
+              "kv_cache entries must be kv_lora_rank + pe_dim wide");
+  TORCH_CHECK(kv_c.stride(1) == 1 && k_pe.stride(1) == 1 &&
+                  kv_cache.stride(2) == 1,
+              "kv_c, k_pe and kv_cache must be contiguous in the last dim");
+
+  int kv_c_stride = kv_c.stride(0);
+  int k_pe_stride = k_pe.stride(0);
+  int block_stride = kv_cache.stride(0);
+  int entry_stride = kv_cache.stride(1);
+
+  dim3 grid(num_tokens);
+  dim3 block(std::min(kv_lora_rank + pe_dim, 512));
+  const at::cuda::OptionalCUDAGuard device_guard(device_of(kv_c));
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
+
+  DISPATCH_BY_KV_CACHE_DTYPE(kv_c.dtype(), kv_cache_dtype,
+                             CALL_CONCAT_AND_CACHE_MLA);
 }
 
 // KV_T is the stored data type of kv-cache.
@@ -593,7 +938,9 @@ void reshape_and_cache_with_pertoken_quant(
     torch::Tensor& k_dequant_scales,  // [num_heads, max_kv_tokens]
     torch::Tensor& v_dequant_scales,  // [num_heads, max_kv_tokens]
     torch::Tensor& slot_mapping,  // [num_tokens]
-    const bool asm_layout) {
+    const bool asm_layout,
+    const c10::optional<torch::Tensor>&
+        key_summaries) {  // [num_blocks, num_heads, 2, head_size]
   int num_tokens = key.size(0);
   int num_heads = key.size(1);
   int head_size = key.size(2);
@@ -658,6 +1005,11 @@ void reshape_and_cache_with_pertoken_quant(
   {
     TORCH_CHECK(false, "Unsupported data type of kv cache: ", key_cache.dtype());
   }
+  if (key_summaries) {
+    torch::Tensor summaries = key_summaries.value();
+    update_block_key_summaries(key, slot_mapping, summaries, block_size,
+                               stream);
+  }
 }
 
 
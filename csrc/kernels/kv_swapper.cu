@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2024 Advanced Micro Devices, Inc.  All rights reserved.
+ *
+ * @Script: kv_swapper.cu
+ * @Description: Asynchronous KV block swaps (see kv_swapper.h). A request is
+ *               turned into contiguous copies (coalesced block runs) at
+ *               submission; the worker thread issues them on the side
+ *               stream, staging pageable host memory through two pinned
+ *               buffers.
+ */
+#include "kv_swapper.h"
+
+#include <ATen/cuda/CUDAContext.h>
+#include <c10/cuda/CUDAException.h>
+#include <c10/cuda/CUDAGuard.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "cpu_block_copy.h"
+
+struct KVSwapper::Impl {
+  // One contiguous copy.
+  struct Segment {
+    char* dst;
+    const char* src;
+    int64_t bytes;
+  };
+
+  struct Request {
+    std::vector<torch::Tensor> tensors;  // kept alive until retired
+    std::vector<Segment> direct;         // device <-> device or pinned host
+    std::vector<Segment> staged_out;     // device -> pageable host
+    std::vector<Segment> staged_in;      // pageable host -> device
+    std::vector<Segment> host;           // host -> host
+    cudaEvent_t ready = nullptr;  // the caller's stream at submission
+    cudaEvent_t done = nullptr;   // the request's last copy on the side stream
+    bool finished = false;        // the worker is done with it
+    std::exception_ptr error;
+
+    ~Request() {
+      if (ready != nullptr) {
+        cudaEventDestroy(ready);
+      }
+      if (done != nullptr) {
+        cudaEventDestroy(done);
+      }
+    }
+  };
+
+  // Calls fn(pieces) for consecutive pieces of segs holding capacity bytes
+  // each (the last one less).
+  template <typename F>
+  static void for_each_chunk(const std::vector<Segment>& segs, int64_t capacity, F&& fn) {
+    std::vector<Segment> chunk;
+    int64_t used = 0;
+    for (const Segment& seg : segs) {
+      for (int64_t off = 0; off < seg.bytes;) {
+        const int64_t n = std::min(capacity - used, seg.bytes - off);
+        chunk.push_back({seg.dst + off, seg.src + off, n});
+        used += n;
+        off += n;
+        if (used == capacity) {
+          fn(chunk);
+          chunk.clear();
+          used = 0;
+        }
+      }
+    }
+    if (!chunk.empty()) {
+      fn(chunk);
+    }
+  }
+
+  int device;
+  int64_t staging_bytes;
+  cudaStream_t stream = nullptr;
+  char* staging[2] = {nullptr, nullptr};
+  // the stream's last use of each staging buffer
+  cudaEvent_t staged[2] = {nullptr, nullptr};
+  int64_t turn = 0;  // staging buffer of the next chunk
+
+  std::thread worker;
+  mutable std::mutex mutex;
+  std::condition_variable work_cv, done_cv;
+  std::deque<std::shared_ptr<Request>> queue;
+  std::unordered_map<int64_t, std::shared_ptr<Request>> requests;
+  int64_t next_handle = 0;
+  bool stop = false;
+
+  Impl(int device, int64_t staging_bytes)
+      : device(device), staging_bytes(staging_bytes) {
+    const c10::cuda::CUDAGuard device_guard(device);
+    C10_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    for (int b = 0; b < 2; b++) {
+      C10_CUDA_CHECK(cudaHostAlloc(reinterpret_cast<void**>(&staging[b]),
+                                   staging_bytes, cudaHostAllocDefault));
+      C10_CUDA_CHECK(cudaEventCreateWithFlags(&staged[b], cudaEventDisableTiming));
+    }
+    worker = std::thread(&Impl::loop, this);
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    work_cv.notify_all();
+    worker.join();
+    cudaStreamSynchronize(stream);
+    requests.clear();
+    for (int b = 0; b < 2; b++) {
+      cudaFreeHost(staging[b]);
+      cudaEventDestroy(staged[b]);
+    }
+    cudaStreamDestroy(stream);
+  }
+
+  void loop() {
+    cudaSetDevice(device);
+    for (;;) {
+      std::shared_ptr<Request> r;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_cv.wait(lock, [&] { return stop || !queue.empty(); });
+        if (queue.empty()) {
+          return;
+        }
+        r = queue.front();
+        queue.pop_front();
+      }
+      try {
+        run(*r);
+      } catch (...) {
+        r->error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        r->finished = true;
+      }
+      done_cv.notify_all();
+    }
+  }
+
+  void run(Request& r) {
+    C10_CUDA_CHECK(cudaStreamWaitEvent(stream, r.ready, 0));
+    for (const Segment& s : r.direct) {
+      C10_CUDA_CHECK(cudaMemcpyAsync(s.dst, s.src, s.bytes, cudaMemcpyDefault, stream));
+    }
+    if (!r.staged_out.empty()) {
+      copy_out(r.staged_out);
+    }
+    if (!r.staged_in.empty()) {
+      copy_in(r.staged_in);
+    }
+    if (!r.host.empty()) {
+      // earlier requests may still be copying into these host caches
+      C10_CUDA_CHECK(cudaStreamSynchronize(stream));
+      for (const Segment& s : r.host) {
+        std::memcpy(s.dst, s.src, s.bytes);
+      }
+    }
+    C10_CUDA_CHECK(cudaEventRecord(r.done, stream));
+  }
+
+  // device -> staging[b] on the stream; the previous chunk is copied out of
+  // its buffer to the host meanwhile.
+  void copy_out(const std::vector<Segment>& segs) {
+    std::vector<Segment> pending;
+    int pending_buffer = -1;
+    auto drain = [&]() {
+      C10_CUDA_CHECK(cudaEventSynchronize(staged[pending_buffer]));
+      const char* p = staging[pending_buffer];
+      for (const Segment& s : pending) {
+        std::memcpy(s.dst, p, s.bytes);
+        p += s.bytes;
+      }
+    };
+    for_each_chunk(segs, staging_bytes, [&](const std::vector<Segment>& chunk) {
+      const int b = int(turn++ & 1);
+      char* p = staging[b];
+      for (const Segment& s : chunk) {
+        C10_CUDA_CHECK(
+            cudaMemcpyAsync(p, s.src, s.bytes, cudaMemcpyDeviceToHost, stream));
+        p += s.bytes;
+      }
+      C10_CUDA_CHECK(cudaEventRecord(staged[b], stream));
+      if (pending_buffer >= 0) {
+        drain();
+      }
+      pending = chunk;
+      pending_buffer = b;
+    });
+    if (pending_buffer >= 0) {
+      drain();
+    }
+  }
+
+  // host -> staging[b] once the stream is done with it, then staging[b] ->
+  // device on the stream while the next chunk fills the other buffer.
+  void copy_in(const std::vector<Segment>& segs) {
+    for_each_chunk(segs, staging_bytes, [&](const std::vector<Segment>& chunk) {
+      const int b = int(turn++ & 1);
+      C10_CUDA_CHECK(cudaEventSynchronize(staged[b]));
+      char* p = staging[b];
+      for (const Segment& s : chunk) {
+        std::memcpy(p, s.src, s.bytes);
+        p += s.bytes;
+      }
+      p = staging[b];
+      for (const Segment& s : chunk) {
+        C10_CUDA_CHECK(
+            cudaMemcpyAsync(s.dst, p, s.bytes, cudaMemcpyHostToDevice, stream));
+        p += s.bytes;
+      }
+      C10_CUDA_CHECK(cudaEventRecord(staged[b], stream));
+    });
+  }
+
+  // The request of handle, or nullptr once retired.
+  std::shared_ptr<Request> find(int64_t handle) const {
+    auto it = requests.find(handle);
+    if (it == requests.end()) {
+      TORCH_CHECK(handle >= 0 && handle < next_handle, "unknown swap handle ",
+                  handle);
+      return nullptr;
+    }
+    return it->second;
+  }
+
+  void retire(int64_t handle, const Request& r) {
+    const std::exception_ptr error = r.error;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      requests.erase(handle);
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+KVSwapper::KVSwapper(int64_t device, int64_t staging_bytes) {
+  TORCH_CHECK(device >= 0, "device must be a GPU index");
+  TORCH_CHECK(staging_bytes > 0, "staging_bytes must be positive");
+  impl_ = std::make_unique<Impl>(int(device), staging_bytes);
+}
+
+KVSwapper::~KVSwapper() = default;
+
+int64_t KVSwapper::swap_async(const std::vector<torch::Tensor>& src,
+                              const std::vector<torch::Tensor>& dst,
+                              const torch::Tensor& block_mapping) {
+  TORCH_CHECK(src.size() == dst.size(), "src and dst must pair up");
+  TORCH_CHECK(block_mapping.device().is_cpu(), "block_mapping must be on CPU");
+  TORCH_CHECK(block_mapping.scalar_type() == at::ScalarType::Long &&
+                  block_mapping.dim() == 2 && block_mapping.size(1) == 2,
+              "block_mapping must be an int64 [num_pairs, 2] tensor");
+  const torch::Tensor mapping = block_mapping.contiguous();
+  const std::vector<ater::cpu::BlockRun> runs = ater::cpu::coalesce_block_mapping(
+      mapping.data_ptr<int64_t>(), mapping.size(0));
+
+  auto r = std::make_shared<Impl::Request>();
+  for (size_t i = 0; i < src.size(); i++) {
+    const torch::Tensor& s = src[i];
+    const torch::Tensor& d = dst[i];
+    for (const torch::Tensor* t : {&s, &d}) {
+      TORCH_CHECK(t->device().is_cpu() ||
+                      (t->device().is_cuda() && t->device().index() == impl_->device),
+                  "swapped tensors must be on CPU or on GPU ", impl_->device);
+    }
+    TORCH_CHECK(s.is_contiguous() && d.is_contiguous(),
+                "src and dst must be contiguous");
+    const int64_t block_bytes = s.element_size() * s.stride(0);
+    TORCH_CHECK(d.element_size() * d.stride(0) == block_bytes,
+                "src and dst blocks must have the same size");
+    for (const ater::cpu::BlockRun& run : runs) {
+      TORCH_CHECK(run.src >= 0 && run.src + run.num_blocks <= s.size(0) &&
+                      run.dst >= 0 && run.dst + run.num_blocks <= d.size(0),
+                  "block_mapping out of range");
+    }
+    std::vector<Impl::Segment>* segs;
+    if (s.device().is_cpu() && d.device().is_cpu()) {
+      segs = &r->host;
+    } else if (d.device().is_cpu() && !d.is_pinned()) {
+      segs = &r->staged_out;
+    } else if (s.device().is_cpu() && !s.is_pinned()) {
+      segs = &r->staged_in;
+    } else {
+      segs = &r->direct;
+    }
+    char* s_ptr = static_cast<char*>(s.data_ptr());
+    char* d_ptr = static_cast<char*>(d.data_ptr());
+    for (const ater::cpu::BlockRun& run : runs) {
+      segs->push_back({d_ptr + run.dst * block_bytes, s_ptr + run.src * block_bytes,
+                       run.num_blocks * block_bytes});
+    }
+    r->tensors.push_back(s);
+    r->tensors.push_back(d);
+  }
+
+  const c10::cuda::CUDAGuard device_guard(impl_->device);
+  C10_CUDA_CHECK(cudaEventCreateWithFlags(&r->ready, cudaEventDisableTiming));
+  C10_CUDA_CHECK(cudaEventCreateWithFlags(&r->done, cudaEventDisableTiming));
+  C10_CUDA_CHECK(
+      cudaEventRecord(r->ready, at::cuda::getCurrentCUDAStream(impl_->device)));
+  int64_t handle;
+  {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    handle = impl_->next_handle++;
+    impl_->requests.emplace(handle, r);
+    impl_->queue.push_back(r);
+  }
+  impl_->work_cv.notify_one();
+  return handle;
+}
+
+bool KVSwapper::poll(int64_t handle) {
+  std::shared_ptr<Impl::Request> r;
+  {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    r = impl_->find(handle);
+    if (r == nullptr) {
+      return true;
+    }
+    if (!r->finished) {
+      return false;
+    }
+  }
+  if (!r->error) {
+    const cudaError_t err = cudaEventQuery(r->done);
+    if (err == cudaErrorNotReady) {
+      (void)cudaGetLastError();
+      return false;
+    }
+    C10_CUDA_CHECK(err);
+  }
+  impl_->retire(handle, *r);
+  return true;
+}
+
+void KVSwapper::wait(int64_t handle) {
+  std::shared_ptr<Impl::Request> r;
+  {
+    std::unique_lock<std::mutex> lock(impl_->mutex);
+    r = impl_->find(handle);
+    if (r == nullptr) {
+      return;
+    }
+    impl_->done_cv.wait(lock, [&] { return r->finished; });
+  }
+  if (!r->error) {
+    C10_CUDA_CHECK(cudaEventSynchronize(r->done));
+  }
+  impl_->retire(handle, *r);
+}
+
+void KVSwapper::wait_all() {
+  std::vector<int64_t> handles;
+  {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    for (const auto& it : impl_->requests) {
+      handles.push_back(it.first);
+    }
+  }
+  std::sort(handles.begin(), handles.end());
+  for (const int64_t handle : handles) {
+    wait(handle);
+  }
+}
+
+int64_t KVSwapper::num_pending() const {
+  std::lock_guard<std::mutex> lock(impl_->mutex);
+  return int64_t(impl_->requests.size());
+}
@@ -0,0 +1,91 @@
+#include "attention_cpu.h"
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
+{
+    m.def("paged_attention_cpu", &paged_attention_cpu,
+          "paged_attention_cpu(Tensor! out, Tensor exp_sums,"
+          "                Tensor max_logits, Tensor tmp_out,"
+          "                Tensor query, Tensor key_cache,"
+          "                Tensor value_cache, int num_kv_heads,"
+          "                float scale, Tensor block_tables,"
+          "                Tensor context_lens, int block_size,"
+          "                int max_context_len,"
+          "                Tensor? alibi_slopes,"
+          "                str kv_cache_dtype,"
+          "                float k_scale, float v_scale,"
+          "                Tensor? fp8_out_scale, int partition_size,"
+          "                Tensor? work_list,"
+          "                Tensor? partition_offsets,"
+          "                int window_size, int num_sink_tokens,"
+          "                Tensor? k_dequant_scales,"
+          "                Tensor? v_dequant_scales,"
+          "                Tensor(a!)? attn_mass,"
+          "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+    m.def("paged_attention_cpu_partition_size",
+          &paged_attention_cpu_partition_size,
+          "paged_attention_cpu_partition_size(Tensor context_lens,"
+          "                int num_kv_heads, int block_size) -> int");
+    m.def("paged_attention_cpu_plan", &paged_attention_cpu_plan,
+          "paged_attention_cpu_plan(Tensor context_lens, int num_kv_heads,"
+          "                int block_size, int partition_size) -> (Tensor, int)");
+    m.def("paged_attention_cpu_workspace", &paged_attention_cpu_workspace,
+          "paged_attention_cpu_workspace(Tensor context_lens,"
+          "                int partition_size) -> Tensor");
+    m.def("paged_attention_multi_token_cpu", &paged_attention_multi_token_cpu,
+          "paged_attention_multi_token_cpu(Tensor! out, Tensor query,"
+          "                Tensor key_cache, Tensor value_cache,"
+          "                int num_kv_heads, float scale,"
+          "                Tensor block_tables, Tensor context_lens,"
+          "                int block_size, int max_context_len,"
+          "                Tensor? alibi_slopes, str kv_cache_dtype,"
+          "                float k_scale, float v_scale,"
+          "                int window_size, int num_sink_tokens,"
+          "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+    m.def("paged_attention_append_cpu", &paged_attention_append_cpu,
+          "paged_attention_append_cpu(Tensor! out, Tensor query, Tensor key,"
+          "                Tensor value, Tensor! key_cache,"
+          "                Tensor! value_cache, Tensor slot_mapping,"
+          "                int num_kv_heads, float scale,"
+          "                Tensor block_tables, Tensor context_lens,"
+          "                int block_size, Tensor? alibi_slopes,"
+          "                str kv_cache_dtype, float k_scale, float v_scale,"
+          "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+    m.def("paged_attention_varlen_cpu", &paged_attention_varlen_cpu,
+          "paged_attention_varlen_cpu(Tensor! out, Tensor query,"
+          "                Tensor key_cache, Tensor value_cache,"
+          "                int num_kv_heads, float scale,"
+          "                Tensor block_tables, Tensor cu_seqlens_q,"
+          "                Tensor context_lens, int block_size,"
+          "                int max_context_len, Tensor? alibi_slopes,"
+          "                str kv_cache_dtype,"
+          "                float k_scale, float v_scale,"
+          "                int window_size, int num_sink_tokens,"
+          "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+    m.def("merge_attn_states_cpu", &merge_attn_states_cpu,
+          "merge_attn_states_cpu(Tensor! out, Tensor(a!)? out_lse,"
+          "                Tensor partial_out, Tensor max_logits,"
+          "                Tensor? exp_sums) -> ()");
+    m.def("mla_decode_cpu", &mla_decode_cpu,
+          "mla_decode_cpu(Tensor! out, Tensor query, Tensor kv_cache,"
+          "                Tensor block_tables, Tensor context_lens,"
+          "                int kv_lora_rank, float scale,"
+          "                str kv_cache_dtype, float k_scale) -> ()");
+    m.def("paged_attention_block_sparse_cpu", &paged_attention_block_sparse_cpu,
+          "paged_attention_block_sparse_cpu(Tensor! out, Tensor query,"
+          "                Tensor key_cache, Tensor value_cache,"
+          "                Tensor key_summaries, int num_kv_heads,"
+          "                float scale, Tensor block_tables,"
+          "                Tensor context_lens, int block_size,"
+          "                str kv_cache_dtype, float k_scale,"
+          "                float v_scale, int top_blocks,"
+          "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+    m.def("h2o_compact_cpu", &h2o_compact_cpu,
+          "h2o_compact_cpu(Tensor! key_cache, Tensor! value_cache,"
+          "                Tensor! attn_mass, Tensor! block_tables,"
+          "                Tensor! context_lens, int block_size,"
+          "                int heavy_blocks, int recent_tokens) -> Tensor");
+    m.def("varlen_attention_cpu", &varlen_attention_cpu,
+          "varlen_attention_cpu(Tensor! out, Tensor query, Tensor key,"
+          "                Tensor value, Tensor cu_seqlens, float scale,"
+          "                bool causal) -> ()");
+}
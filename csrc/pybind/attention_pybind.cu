@@ -12,5 +12,32 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
           "                int max_context_len,"
           "                Tensor? alibi_slopes,"
           "                str kv_cache_dtype,"
-          "                float k_scale, float v_scale) -> ()");
+          "                float k_scale, float v_scale,"
+          "                Tensor? fp8_out_scale, int partition_size,"
+          "                Tensor? k_head_scales = None,"
+          "                Tensor? v_head_scales = None) -> ()",
+          py::arg("out"),
+          py::arg("exp_sums"),
+          py::arg("max_logits"),
+          py::arg("tmp_out"),
+          py::arg("query"),
+          py::arg("key_cache"),
+          py::arg("value_cache"),
+          py::arg("num_kv_heads"),
+          py::arg("scale"),
+          py::arg("block_tables"),
+          py::arg("context_lens"),
+          py::arg("block_size"),
+          py::arg("max_context_len"),
+          py::arg("alibi_slopes"),
+          py::arg("kv_cache_dtype"),
+          py::arg("k_scale"),
+          py::arg("v_scale"),
+          py::arg("fp8_out_scale"),
+          py::arg("partition_size"),
+          py::arg("k_head_scales") = std::nullopt,
+          py::arg("v_head_scales") = std::nullopt);
+    m.def("paged_attention_rocm_supported", &paged_attention_rocm_supported,
+          "paged_attention_rocm_supported(Tensor query, str kv_cache_dtype,"
+          "                int block_size) -> bool");
 }
\ No newline at end of file
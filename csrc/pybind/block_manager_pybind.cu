@@ -0,0 +1,28 @@
+#include "block_manager.h"
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
+{
+      py::class_<BlockManager>(m, "BlockManager")
+          .def(py::init<int64_t, int64_t, bool>(), py::arg("num_blocks"),
+               py::arg("block_size"), py::arg("enable_prefix_caching") = false)
+          .def_property_readonly("num_blocks", &BlockManager::num_blocks)
+          .def_property_readonly("block_size", &BlockManager::block_size)
+          .def_property_readonly("num_free_blocks", &BlockManager::num_free_blocks)
+          .def_property_readonly("num_cached_blocks", &BlockManager::num_cached_blocks)
+          .def_property_readonly("num_sequences", &BlockManager::num_sequences)
+          .def("ref_count", &BlockManager::ref_count)
+          .def("allocate", &BlockManager::allocate)
+          .def("free", &BlockManager::free)
+          .def("can_allocate", &BlockManager::can_allocate)
+          .def("add_sequence", &BlockManager::add_sequence)
+          .def("add_sequence_with_prefix", &BlockManager::add_sequence_with_prefix)
+          .def("fork", &BlockManager::fork)
+          .def("free_sequence", &BlockManager::free_sequence)
+          .def("blocks_needed_to_append", &BlockManager::blocks_needed_to_append)
+          .def("append_slots", &BlockManager::append_slots,
+               py::arg("seq_ids"), py::arg("token_ids") = py::none())
+          .def("take_copy_mapping", &BlockManager::take_copy_mapping)
+          .def("block_tables", &BlockManager::block_tables,
+               py::arg("seq_ids"), py::arg("max_num_blocks") = 0)
+          .def("context_lens", &BlockManager::context_lens);
+}
@@ -9,22 +9,78 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
             "Tensor block_mapping) -> ()");
 
       m.def("reshape_and_cache", &reshape_and_cache,
-            "reshape_and_cache");
+            "reshape_and_cache",
+            py::arg("key"),
+            py::arg("value"),
+            py::arg("key_cache"),
+            py::arg("value_cache"),
+            py::arg("slot_mapping"),
+            py::arg("kv_cache_dtype"),
+            py::arg("k_scale"),
+            py::arg("v_scale"),
+            py::arg("asm_layout"),
+            py::arg("key_summaries") = std::nullopt,
+            py::arg("k_head_scales") = std::nullopt,
+            py::arg("v_head_scales") = std::nullopt);
       m.def("reshape_and_cache_flash", &reshape_and_cache_flash,
             "reshape_and_cache_flash(Tensor key, Tensor value,"
             "                        Tensor! key_cache,"
             "                        Tensor! value_cache,"
             "                        Tensor slot_mapping,"
             "                        str kv_cache_dtype,"
-            "                        float k_scale, float v_scale) -> ()");
+            "                        float k_scale, float v_scale,"
+            "                        Tensor(a!)? key_summaries = None,"
+            "                        Tensor? k_head_scales = None,"
+            "                        Tensor? v_head_scales = None) -> ()",
+            py::arg("key"),
+            py::arg("value"),
+            py::arg("key_cache"),
+            py::arg("value_cache"),
+            py::arg("slot_mapping"),
+            py::arg("kv_cache_dtype"),
+            py::arg("k_scale"),
+            py::arg("v_scale"),
+            py::arg("key_summaries") = std::nullopt,
+            py::arg("k_head_scales") = std::nullopt,
+            py::arg("v_head_scales") = std::nullopt);
+      m.def("concat_and_cache_mla", &concat_and_cache_mla,
+            "concat_and_cache_mla(Tensor kv_c, Tensor k_pe,"
+            "                     Tensor! kv_cache,"
+            "                     Tensor slot_mapping,"
+            "                     str kv_cache_dtype,"
+            "                     float scale) -> ()");
        m.def("reshape_and_cache_with_pertoken_quant", &reshape_and_cache_with_pertoken_quant,
             "reshape_and_cache_with_pertoken_quant(Tensor key, Tensor value,"
             "                        Tensor! key_cache,"
             "                        Tensor! value_cache,"
             "                        Tensor! k_dequant_scales,"
             "                        Tensor! v_dequant_scales,"
-            "                        Tensor slot_mapping) -> ()");
+            "                        Tensor slot_mapping, bool asm_layout,"
+            "                        Tensor(a!)? key_summaries = None) -> ()",
+            py::arg("key"),
+            py::arg("value"),
+            py::arg("key_cache"),
+            py::arg("value_cache"),
+            py::arg("k_dequant_scales"),
+            py::arg("v_dequant_scales"),
+            py::arg("slot_mapping"),
+            py::arg("asm_layout"),
+            py::arg("key_summaries") = std::nullopt);
       m.def("convert_fp8", &convert_fp8,
             "convert_fp8(Tensor! dst_cache, Tensor src_cache, float scale, "
             "str kv_cache_dtype) -> ()");
+      m.def("reshape_and_cache_cpu", &reshape_and_cache_cpu,
+            "reshape_and_cache_cpu(Tensor key, Tensor value,"
+            "                Tensor! key_cache, Tensor! value_cache,"
+            "                Tensor slot_mapping, str kv_cache_dtype,"
+            "                float k_scale, float v_scale,"
+            "                Tensor(a!)? key_summaries,"
+            "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+      m.def("concat_and_cache_mla_cpu", &concat_and_cache_mla_cpu,
+            "concat_and_cache_mla_cpu(Tensor kv_c, Tensor k_pe,"
+            "                Tensor! kv_cache, Tensor slot_mapping,"
+            "                str kv_cache_dtype, float scale) -> ()");
+      m.def("copy_blocks_cpu", &copy_blocks_cpu,
+            "copy_blocks_cpu(Tensor(a!)[] key_caches, Tensor[](b!) value_caches,"
+            "                Tensor block_mapping) -> ()");
 }
@@ -0,0 +1,15 @@
+#include "kv_swapper.h"
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
+{
+      py::class_<KVSwapper>(m, "KVSwapper")
+          .def(py::init<int64_t, int64_t>(), py::arg("device"),
+               py::arg("staging_bytes") = 64 << 20)
+          .def_property_readonly("num_pending", &KVSwapper::num_pending)
+          .def("swap_async", &KVSwapper::swap_async)
+          .def("poll", &KVSwapper::poll)
+          .def("wait", &KVSwapper::wait,
+               py::call_guard<py::gil_scoped_release>())
+          .def("wait_all", &KVSwapper::wait_all,
+               py::call_guard<py::gil_scoped_release>());
+}
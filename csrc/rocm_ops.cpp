@@ -1,8 +1,11 @@
 #include "activation.h"
 #include "attention.h"
+#include "attention_cpu.h"
 #include "attention_ck.h"
 #include "attention_asm.h"
+#include "block_manager.h"
 #include "cache.h"
+#include "kv_swapper.h"
 #include "moe_op.h"
 #include "moe_sorting.h"
 #include "pos_encoding.h"
@@ -28,7 +31,120 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
             "                int max_context_len,"
             "                Tensor? alibi_slopes,"
             "                str kv_cache_dtype,"
-            "                float k_scale, float v_scale) -> ()");
+            "                float k_scale, float v_scale,"
+            "                Tensor? fp8_out_scale, int partition_size,"
+            "                Tensor? k_head_scales = None,"
+            "                Tensor? v_head_scales = None) -> ()",
+            py::arg("out"),
+            py::arg("exp_sums"),
+            py::arg("max_logits"),
+            py::arg("tmp_out"),
+            py::arg("query"),
+            py::arg("key_cache"),
+            py::arg("value_cache"),
+            py::arg("num_kv_heads"),
+            py::arg("scale"),
+            py::arg("block_tables"),
+            py::arg("context_lens"),
+            py::arg("block_size"),
+            py::arg("max_context_len"),
+            py::arg("alibi_slopes"),
+            py::arg("kv_cache_dtype"),
+            py::arg("k_scale"),
+            py::arg("v_scale"),
+            py::arg("fp8_out_scale"),
+            py::arg("partition_size"),
+            py::arg("k_head_scales") = std::nullopt,
+            py::arg("v_head_scales") = std::nullopt);
+      m.def("paged_attention_rocm_supported", &paged_attention_rocm_supported,
+            "paged_attention_rocm_supported(Tensor query, str kv_cache_dtype,"
+            "                int block_size) -> bool");
+      m.def("paged_attention_cpu", &paged_attention_cpu,
+            "paged_attention_cpu(Tensor! out, Tensor exp_sums,"
+            "                Tensor max_logits, Tensor tmp_out,"
+            "                Tensor query, Tensor key_cache,"
+            "                Tensor value_cache, int num_kv_heads,"
+            "                float scale, Tensor block_tables,"
+            "                Tensor context_lens, int block_size,"
+            "                int max_context_len,"
+            "                Tensor? alibi_slopes,"
+            "                str kv_cache_dtype,"
+            "                float k_scale, float v_scale,"
+            "                Tensor? fp8_out_scale, int partition_size,"
+            "                Tensor? work_list,"
+            "                Tensor? partition_offsets,"
+            "                int window_size, int num_sink_tokens,"
+            "                Tensor? k_dequant_scales,"
+            "                Tensor? v_dequant_scales,"
+            "                Tensor(a!)? attn_mass,"
+            "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+      m.def("paged_attention_cpu_partition_size",
+            &paged_attention_cpu_partition_size,
+            "paged_attention_cpu_partition_size(Tensor context_lens,"
+            "                int num_kv_heads, int block_size) -> int");
+      m.def("paged_attention_cpu_plan", &paged_attention_cpu_plan,
+            "paged_attention_cpu_plan(Tensor context_lens, int num_kv_heads,"
+            "                int block_size, int partition_size) -> (Tensor, int)");
+      m.def("paged_attention_cpu_workspace", &paged_attention_cpu_workspace,
+            "paged_attention_cpu_workspace(Tensor context_lens,"
+            "                int partition_size) -> Tensor");
+      m.def("paged_attention_multi_token_cpu", &paged_attention_multi_token_cpu,
+            "paged_attention_multi_token_cpu(Tensor! out, Tensor query,"
+            "                Tensor key_cache, Tensor value_cache,"
+            "                int num_kv_heads, float scale,"
+            "                Tensor block_tables, Tensor context_lens,"
+            "                int block_size, int max_context_len,"
+            "                Tensor? alibi_slopes, str kv_cache_dtype,"
+            "                float k_scale, float v_scale,"
+            "                int window_size, int num_sink_tokens,"
+            "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+      m.def("paged_attention_append_cpu", &paged_attention_append_cpu,
+            "paged_attention_append_cpu(Tensor! out, Tensor query, Tensor key,"
+            "                Tensor value, Tensor! key_cache,"
+            "                Tensor! value_cache, Tensor slot_mapping,"
+            "                int num_kv_heads, float scale,"
+            "                Tensor block_tables, Tensor context_lens,"
+            "                int block_size, Tensor? alibi_slopes,"
+            "                str kv_cache_dtype, float k_scale, float v_scale,"
+            "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+      m.def("paged_attention_varlen_cpu", &paged_attention_varlen_cpu,
+            "paged_attention_varlen_cpu(Tensor! out, Tensor query,"
+            "                Tensor key_cache, Tensor value_cache,"
+            "                int num_kv_heads, float scale,"
+            "                Tensor block_tables, Tensor cu_seqlens_q,"
+            "                Tensor context_lens, int block_size,"
+            "                int max_context_len, Tensor? alibi_slopes,"
+            "                str kv_cache_dtype,"
+            "                float k_scale, float v_scale,"
+            "                int window_size, int num_sink_tokens,"
+            "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+      m.def("merge_attn_states_cpu", &merge_attn_states_cpu,
+            "merge_attn_states_cpu(Tensor! out, Tensor(a!)? out_lse,"
+            "                Tensor partial_out, Tensor max_logits,"
+            "                Tensor? exp_sums) -> ()");
+      m.def("mla_decode_cpu", &mla_decode_cpu,
+            "mla_decode_cpu(Tensor! out, Tensor query, Tensor kv_cache,"
+            "                Tensor block_tables, Tensor context_lens,"
+            "                int kv_lora_rank, float scale,"
+            "                str kv_cache_dtype, float k_scale) -> ()");
+      m.def("paged_attention_block_sparse_cpu", &paged_attention_block_sparse_cpu,
+            "paged_attention_block_sparse_cpu(Tensor! out, Tensor query,"
+            "                Tensor key_cache, Tensor value_cache,"
+            "                Tensor key_summaries, int num_kv_heads,"
+            "                float scale, Tensor block_tables,"
+            "                Tensor context_lens, int block_size,"
+            "                str kv_cache_dtype, float k_scale,"
+            "                float v_scale, int top_blocks,"
+            "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+      m.def("h2o_compact_cpu", &h2o_compact_cpu,
+            "h2o_compact_cpu(Tensor! key_cache, Tensor! value_cache,"
+            "                Tensor! attn_mass, Tensor! block_tables,"
+            "                Tensor! context_lens, int block_size,"
+            "                int heavy_blocks, int recent_tokens) -> Tensor");
+      m.def("varlen_attention_cpu", &varlen_attention_cpu,
+            "varlen_attention_cpu(Tensor! out, Tensor query, Tensor key,"
+            "                Tensor value, Tensor cu_seqlens, float scale,"
+            "                bool causal) -> ()");
       m.def("swap_blocks", &swap_blocks,
             "swap_blocks(Tensor src, Tensor! dst, Tensor block_mapping) -> ()");
       m.def("copy_blocks", &copy_blocks,
@@ -40,22 +156,81 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
             "                  Tensor! key_cache, Tensor! value_cache,"
             "                  Tensor slot_mapping,"
             "                  str kv_cache_dtype,"
-            "                  float k_scale, float v_scale) -> ()");
+            "                  float k_scale, float v_scale, bool asm_layout,"
+            "                  Tensor(a!)? key_summaries = None,"
+            "                  Tensor? k_head_scales = None,"
+            "                  Tensor? v_head_scales = None) -> ()",
+            py::arg("key"),
+            py::arg("value"),
+            py::arg("key_cache"),
+            py::arg("value_cache"),
+            py::arg("slot_mapping"),
+            py::arg("kv_cache_dtype"),
+            py::arg("k_scale"),
+            py::arg("v_scale"),
+            py::arg("asm_layout"),
+            py::arg("key_summaries") = std::nullopt,
+            py::arg("k_head_scales") = std::nullopt,
+            py::arg("v_head_scales") = std::nullopt);
       m.def("reshape_and_cache_flash", &reshape_and_cache_flash,
             "reshape_and_cache_flash(Tensor key, Tensor value,"
             "                        Tensor! key_cache,"
             "                        Tensor! value_cache,"
             "                        Tensor slot_mapping,"
             "                        str kv_cache_dtype,"
-            "                        float k_scale, float v_scale) -> ()");
+            "                        float k_scale, float v_scale,"
+            "                        Tensor(a!)? key_summaries = None,"
+            "                        Tensor? k_head_scales = None,"
+            "                        Tensor? v_head_scales = None) -> ()",
+            py::arg("key"),
+            py::arg("value"),
+            py::arg("key_cache"),
+            py::arg("value_cache"),
+            py::arg("slot_mapping"),
+            py::arg("kv_cache_dtype"),
+            py::arg("k_scale"),
+            py::arg("v_scale"),
+            py::arg("key_summaries") = std::nullopt,
+            py::arg("k_head_scales") = std::nullopt,
+            py::arg("v_head_scales") = std::nullopt);
+      m.def("concat_and_cache_mla", &concat_and_cache_mla,
+            "concat_and_cache_mla(Tensor kv_c, Tensor k_pe,"
+            "                     Tensor! kv_cache,"
+            "                     Tensor slot_mapping,"
+            "                     str kv_cache_dtype,"
+            "                     float scale) -> ()");
       m.def("reshape_and_cache_with_pertoken_quant", &reshape_and_cache_with_pertoken_quant,
             "reshape_and_cache_with_pertoken_quant(Tensor key, Tensor value,"
             "                  Tensor! key_cache, Tensor! value_cache,"
             "                  Tensor! k_dequant_scales, Tensor! v_dequant_scales,"
-            "                  Tensor slot_mapping) -> ()");
+            "                  Tensor slot_mapping, bool asm_layout,"
+            "                  Tensor(a!)? key_summaries = None) -> ()",
+            py::arg("key"),
+            py::arg("value"),
+            py::arg("key_cache"),
+            py::arg("value_cache"),
+            py::arg("k_dequant_scales"),
+            py::arg("v_dequant_scales"),
+            py::arg("slot_mapping"),
+            py::arg("asm_layout"),
+            py::arg("key_summaries") = std::nullopt);
       m.def("convert_fp8", &convert_fp8,
             "convert_fp8(Tensor! dst_cache, Tensor src_cache, float scale, "
             "str kv_cache_dtype) -> ()");
+      m.def("reshape_and_cache_cpu", &reshape_and_cache_cpu,
+            "reshape_and_cache_cpu(Tensor key, Tensor value,"
+            "                Tensor! key_cache, Tensor! value_cache,"
+            "                Tensor slot_mapping, str kv_cache_dtype,"
+            "                float k_scale, float v_scale,"
+            "                Tensor(a!)? key_summaries,"
+            "                Tensor? k_head_scales, Tensor? v_head_scales) -> ()");
+      m.def("concat_and_cache_mla_cpu", &concat_and_cache_mla_cpu,
+            "concat_and_cache_mla_cpu(Tensor kv_c, Tensor k_pe,"
+            "                Tensor! kv_cache, Tensor slot_mapping,"
+            "                str kv_cache_dtype, float scale) -> ()");
+      m.def("copy_blocks_cpu", &copy_blocks_cpu,
+            "copy_blocks_cpu(Tensor(a!)[] key_caches, Tensor[](b!) value_caches,"
+            "                Tensor block_mapping) -> ()");
 
 #if defined(FIND_CK)
       // ck staff start
@@ -106,4 +281,37 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
       m.def("convert_fp8", &convert_fp8,
             "convert_fp8(Tensor! dst_cache, Tensor src_cache, float scale, "
             "str kv_cache_dtype) -> ()");
+      py::class_<BlockManager>(m, "BlockManager")
+          .def(py::init<int64_t, int64_t, bool>(), py::arg("num_blocks"),
+               py::arg("block_size"), py::arg("enable_prefix_caching") = false)
+          .def_property_readonly("num_blocks", &BlockManager::num_blocks)
+          .def_property_readonly("block_size", &BlockManager::block_size)
+          .def_property_readonly("num_free_blocks", &BlockManager::num_free_blocks)
+          .def_property_readonly("num_cached_blocks", &BlockManager::num_cached_blocks)
+          .def_property_readonly("num_sequences", &BlockManager::num_sequences)
+          .def("ref_count", &BlockManager::ref_count)
+          .def("allocate", &BlockManager::allocate)
+          .def("free", &BlockManager::free)
+          .def("can_allocate", &BlockManager::can_allocate)
+          .def("add_sequence", &BlockManager::add_sequence)
+          .def("add_sequence_with_prefix", &BlockManager::add_sequence_with_prefix)
+          .def("fork", &BlockManager::fork)
+          .def("free_sequence", &BlockManager::free_sequence)
+          .def("blocks_needed_to_append", &BlockManager::blocks_needed_to_append)
+          .def("append_slots", &BlockManager::append_slots,
+               py::arg("seq_ids"), py::arg("token_ids") = py::none())
+          .def("take_copy_mapping", &BlockManager::take_copy_mapping)
+          .def("block_tables", &BlockManager::block_tables,
+               py::arg("seq_ids"), py::arg("max_num_blocks") = 0)
+          .def("context_lens", &BlockManager::context_lens);
+      py::class_<KVSwapper>(m, "KVSwapper")
+          .def(py::init<int64_t, int64_t>(), py::arg("device"),
+               py::arg("staging_bytes") = 64 << 20)
+          .def_property_readonly("num_pending", &KVSwapper::num_pending)
+          .def("swap_async", &KVSwapper::swap_async)
+          .def("poll", &KVSwapper::poll)
+          .def("wait", &KVSwapper::wait,
+               py::call_guard<py::gil_scoped_release>())
+          .def("wait_all", &KVSwapper::wait_all,
+               py::call_guard<py::gil_scoped_release>());
 }
@@ -0,0 +1,173 @@
+import random
+import time
+import torch
+import ater
+
+
+def test_block_manager(num_blocks: int, block_size: int, num_steps: int,
+                       seed: int = 0):
+    # Drives prompts, decode appends, forks and frees through the block
+    # manager against a flat token store per block, applying its copy-on-write
+    # mapping as copy_blocks would, and checks every sequence still reads its
+    # own tokens through block_tables / context_lens.
+    random.seed(seed)
+    manager = ater.block_manager(num_blocks, block_size)
+    cache = torch.full((num_blocks, block_size), -1, dtype=torch.long)
+    tokens = {}
+    next_id = 0
+    for step in range(num_steps):
+        op = random.random()
+        if op < 0.2 and manager.can_allocate(64):
+            n = random.randint(0, 64)
+            slots = manager.add_sequence(next_id, n)
+            values = torch.randint(0, 1 << 30, (n,))
+            cache.view(-1)[slots] = values
+            tokens[next_id] = values.tolist()
+            next_id += 1
+        elif op < 0.3 and tokens:
+            seq_id = random.choice(list(tokens))
+            manager.free_sequence(seq_id)
+            del tokens[seq_id]
+        elif op < 0.4 and tokens:
+            parent = random.choice(list(tokens))
+            manager.fork(parent, next_id)
+            tokens[next_id] = list(tokens[parent])
+            next_id += 1
+        elif tokens:
+            seq_ids = torch.tensor([s for s in tokens if random.random() < 0.7],
+                                   dtype=torch.long)
+            if manager.blocks_needed_to_append(seq_ids) > manager.num_free_blocks:
+                continue
+            slots = manager.append_slots(seq_ids)
+            mapping = manager.take_copy_mapping()
+            cache[mapping[:, 1]] = cache[mapping[:, 0]]
+            values = torch.randint(0, 1 << 30, (seq_ids.numel(),))
+            cache.view(-1)[slots] = values
+            for seq_id, v in zip(seq_ids.tolist(), values.tolist()):
+                tokens[seq_id].append(v)
+        if tokens:
+            seq_ids = torch.tensor(list(tokens), dtype=torch.long)
+            block_tables = manager.block_tables(seq_ids)
+            context_lens = manager.context_lens(seq_ids)
+            for i, seq_id in enumerate(seq_ids.tolist()):
+                n = int(context_lens[i])
+                assert n == len(tokens[seq_id])
+                pos = torch.arange(n)
+                read = cache[block_tables[i, pos // block_size].long(),
+                             pos % block_size]
+                assert read.tolist() == tokens[seq_id], \
+                    f'sequence {seq_id} reads wrong tokens at step {step}'
+    for seq_id in tokens:
+        manager.free_sequence(seq_id)
+    assert manager.num_free_blocks == num_blocks, "blocks leaked"
+    print(f'finish test {num_blocks=} {block_size=} {num_steps=}')
+
+
+def test_prefix_cache(num_blocks: int, block_size: int, num_steps: int,
+                      seed: int = 0):
+    # Prompts built from a few shared prefixes reuse cached blocks; the token
+    # store must read back every sequence's tokens, cached ones included,
+    # while unreferenced blocks are evicted to make room.
+    random.seed(seed)
+    manager = ater.block_manager(num_blocks, block_size,
+                                 enable_prefix_caching=True)
+    cache = torch.full((num_blocks, block_size), -1, dtype=torch.long)
+    prefixes = [[random.randrange(8) for _ in range(random.randint(0, 40))]
+                for _ in range(4)]
+    tokens = {}
+    next_id = 0
+    num_cached_total = 0
+    for step in range(num_steps):
+        op = random.random()
+        if op < 0.3:
+            prompt = random.choice(prefixes) + \
+                [random.randrange(4) for _ in range(random.randint(1, 12))]
+            if not manager.can_allocate(len(prompt)):
+                continue
+            slots, num_cached = manager.add_sequence_with_prefix(
+                next_id, torch.tensor(prompt, dtype=torch.long))
+            assert num_cached % block_size == 0 and num_cached < len(prompt)
+            cache.view(-1)[slots] = torch.tensor(prompt[num_cached:])
+            tokens[next_id] = prompt
+            num_cached_total += num_cached
+            next_id += 1
+        elif op < 0.5 and tokens:
+            seq_id = random.choice(list(tokens))
+            manager.free_sequence(seq_id)
+            del tokens[seq_id]
+        elif op < 0.6 and tokens:
+            parent = random.choice(list(tokens))
+            manager.fork(parent, next_id)
+            tokens[next_id] = list(tokens[parent])
+            next_id += 1
+        elif tokens:
+            seq_ids = torch.tensor([s for s in tokens if random.random() < 0.7],
+                                   dtype=torch.long)
+            if manager.blocks_needed_to_append(seq_ids) > manager.num_free_blocks:
+                continue
+            values = torch.randint(0, 4, (seq_ids.numel(),))
+            slots = manager.append_slots(seq_ids, values)
+            mapping = manager.take_copy_mapping()
+            cache[mapping[:, 1]] = cache[mapping[:, 0]]
+            cache.view(-1)[slots] = values
+            for seq_id, v in zip(seq_ids.tolist(), values.tolist()):
+                tokens[seq_id].append(v)
+        for seq_id in tokens:
+            ids = torch.tensor([seq_id], dtype=torch.long)
+            block_table = manager.block_tables(ids)[0]
+            pos = torch.arange(len(tokens[seq_id]))
+            read = cache[block_table[pos // block_size].long(), pos % block_size]
+            assert read.tolist() == tokens[seq_id], \
+                f'sequence {seq_id} reads wrong tokens at step {step}'
+    assert num_cached_total > 0, "no prefix was reused"
+    for seq_id in tokens:
+        manager.free_sequence(seq_id)
+    assert manager.num_free_blocks == num_blocks, "blocks leaked"
+    print(f'finish test prefix cache {num_blocks=} {block_size=} {num_steps=}'
+          f' {num_cached_total=}')
+
+
+def test_shared_partial_append(block_size: int, num_sharers: int):
+    # num_sharers sequences forked off one partial block append together:
+    # all but the last sharer copy, so the batch fits in num_sharers - 1 free
+    # blocks.
+    manager = ater.block_manager(num_sharers, block_size)
+    manager.add_sequence(0, block_size // 2)
+    for seq_id in range(1, num_sharers):
+        manager.fork(0, seq_id)
+    seq_ids = torch.arange(num_sharers, dtype=torch.long)
+    assert manager.blocks_needed_to_append(seq_ids) == num_sharers - 1
+    slots = manager.append_slots(seq_ids)
+    mapping = manager.take_copy_mapping()
+    assert mapping.size(0) == num_sharers - 1
+    assert len(set((slots // block_size).tolist())) == num_sharers
+    assert manager.num_free_blocks == 0
+    print(f'finish test shared partial append {block_size=} {num_sharers=}')
+
+
+def test_block_manager_step_time(num_seqs: int, ctx_len: int, block_size: int,
+                                 num_iters: int = 100):
+    # host cost of one decode step's bookkeeping for num_seqs running
+    # sequences: slots, copy mapping, block tables and lengths
+    max_blocks = (ctx_len + num_iters + block_size - 1) // block_size
+    manager = ater.block_manager(num_seqs * max_blocks, block_size)
+    for seq_id in range(num_seqs):
+        manager.add_sequence(seq_id, ctx_len)
+    seq_ids = torch.arange(num_seqs, dtype=torch.long)
+    start = time.perf_counter()
+    for _ in range(num_iters):
+        manager.append_slots(seq_ids)
+        manager.take_copy_mapping()
+        manager.block_tables(seq_ids, max_blocks)
+        manager.context_lens(seq_ids)
+    us = (time.perf_counter() - start) / num_iters * 1e6
+    print(f'block manager step: {num_seqs=} {ctx_len=} {block_size=} {us:.1f} us')
+
+
+test_block_manager(64, 4, 2000)
+test_block_manager(512, 16, 2000, seed=1)
+test_prefix_cache(64, 4, 2000)
+test_prefix_cache(256, 16, 2000, seed=1)
+test_shared_partial_append(16, 4)
+test_block_manager_step_time(1024, 2048, 16)
+test_block_manager_step_time(4096, 512, 16)
@@ -1,6 +1,8 @@
+import time
 import torch
 import torch.nn.functional as F
 import ater
+from ater import paged_attn
 from ater.test_common import checkAllclose, perftest
 from typing import List, Optional, Tuple, Union
 
@@ -180,6 +182,113 @@ def test_reshape_and_cache(ctx_lens: int,
         f'finish test {ctx_lens=} {bs=} {num_heads=} {head_size=} {block_size=} {DTyoe_KV=} {DTyoe_KVCache=}')
 
 
+def test_swap_blocks(num_blocks: int, block_shape: Tuple[int, ...],
+                     num_swaps: int, src_device: str, dst_device: str,
+                     shuffled: bool, num_iters: int = 10):
+    # Preemption-style swap of num_swaps blocks into a contiguous range of
+    # the destination; shuffled sources leave nothing to coalesce.
+    dtype = torch.bfloat16
+    src = torch.randn((num_blocks, *block_shape), dtype=dtype, device=src_device)
+    dst = torch.zeros((num_blocks, *block_shape), dtype=dtype, device=dst_device)
+    # the host tier is pinned, as a swap space would be
+    src = src.pin_memory() if src_device == 'cpu' else src
+    dst = dst.pin_memory() if dst_device == 'cpu' else dst
+    src_blocks = torch.randperm(num_blocks)[:num_swaps] if shuffled \
+        else torch.arange(num_swaps)
+    dst_blocks = torch.arange(num_blocks - num_swaps, num_blocks)
+    order = torch.randperm(num_swaps)
+    block_mapping = torch.stack([src_blocks[order], dst_blocks[order]], dim=1)
+
+    ater.swap_blocks(src, dst, block_mapping)
+    checkAllclose(src[src_blocks].to(dst_device), dst[dst_blocks],
+                  msg=f'swap_blocks {src_device}->{dst_device}')
+
+    torch.cuda.synchronize()
+    start = time.perf_counter()
+    for _ in range(num_iters):
+        ater.swap_blocks(src, dst, block_mapping)
+    torch.cuda.synchronize()
+    sec = (time.perf_counter() - start) / num_iters
+    nbytes = num_swaps * src[0].numel() * src.element_size()
+    print(f'swap_blocks {src_device}->{dst_device} {num_swaps=} {shuffled=}: '
+          f'{sec * 1e6:.1f}us, {nbytes / sec / 1e9:.2f} GB/s')
+
+
+def test_swap_async(num_layers: int, num_blocks: int,
+                    block_shape: Tuple[int, ...], num_swaps: int,
+                    pinned: bool):
+    # Swaps a victim's blocks of every layer out to the host and back in
+    # while the GPU keeps computing, polling the handles from the host.
+    dtype = torch.bfloat16
+    swapper = ater.kv_swapper(torch.cuda.current_device())
+    gpu = [torch.randn((2, num_blocks, *block_shape), dtype=dtype,
+                       device='cuda') for _ in range(num_layers)]
+    cpu = [torch.zeros((2, num_blocks, *block_shape), dtype=dtype,
+                       pin_memory=pinned) for _ in range(num_layers)]
+    blocks = torch.randperm(num_blocks)[:num_swaps]
+    mapping = torch.stack([blocks, torch.arange(num_swaps)], dim=1)
+    nbytes = 2 * num_layers * num_swaps * gpu[0][0, 0].numel() * gpu[0].element_size()
+    a = torch.randn(4096, 4096, dtype=dtype, device='cuda')
+
+    start = time.perf_counter()
+    handle = paged_attn.PagedAttention.swap_blocks_async(
+        swapper, gpu, cpu, mapping)
+    num_overlapped = 0
+    while not swapper.poll(handle):
+        a = torch.tanh(a @ a)
+        torch.cuda.synchronize()
+        num_overlapped += 1
+    sec = time.perf_counter() - start
+    print(f'swap out {pinned=}: {nbytes / sec / 1e9:.2f} GB/s, '
+          f'{num_overlapped} matmuls alongside')
+    for g, c in zip(gpu, cpu):
+        checkAllclose(g[:, blocks].cpu(), c[:, :num_swaps], msg='swap out')
+
+    back = [torch.zeros_like(g) for g in gpu]
+    start = time.perf_counter()
+    handle = paged_attn.PagedAttention.swap_blocks_async(
+        swapper, cpu, back, mapping.flip(1).contiguous())
+    swapper.wait(handle)
+    sec = time.perf_counter() - start
+    print(f'swap in {pinned=}: {nbytes / sec / 1e9:.2f} GB/s')
+    assert swapper.num_pending == 0
+    for g, b in zip(gpu, back):
+        checkAllclose(g[:, blocks], b[:, blocks], msg='swap in')
+
+
+def test_copy_blocks(num_layers: int, num_blocks: int, num_pairs: int,
+                     block_shape: Tuple[int, ...],
+                     block_shape_v: Tuple[int, ...], num_iters: int = 100):
+    # beam-search forks across all layers; after the first call the cache
+    # pointer table is reused, so a call costs a kernel launch only
+    dtype = torch.bfloat16
+    key_caches = [torch.randn((num_blocks, *block_shape), dtype=dtype,
+                              device='cuda') for _ in range(num_layers)]
+    value_caches = [torch.randn((num_blocks, *block_shape_v), dtype=dtype,
+                                device='cuda') for _ in range(num_layers)]
+    blocks = torch.randperm(num_blocks)[:2 * num_pairs]
+    block_mapping = blocks.view(num_pairs, 2).cuda()
+    src, dst = block_mapping[:, 0], block_mapping[:, 1]
+    key_ref = [k.clone() for k in key_caches]
+    value_ref = [v.clone() for v in value_caches]
+    for k, v in zip(key_ref, value_ref):
+        k[dst] = k[src]
+        v[dst] = v[src]
+
+    ater.copy_blocks(key_caches, value_caches, block_mapping)
+    for i in range(num_layers):
+        checkAllclose(key_ref[i], key_caches[i], msg=f'copy_blocks key {i}')
+        checkAllclose(value_ref[i], value_caches[i], msg=f'copy_blocks value {i}')
+
+    torch.cuda.synchronize()
+    start = time.perf_counter()
+    for _ in range(num_iters):
+        ater.copy_blocks(key_caches, value_caches, block_mapping)
+    host_us = (time.perf_counter() - start) / num_iters * 1e6
+    torch.cuda.synchronize()
+    print(f'copy_blocks {num_layers=} {num_pairs=}: {host_us:.1f} us host per call')
+
+
 test_reshape_and_cache(4097, 128, (8, 1), 128, 16,
                        torch.bfloat16, torch.bfloat16)
 print('start quant')
@@ -189,3 +298,12 @@ print('start quant')
 test_reshape_and_cache(4097, 128, (8, 1), 128, 16,
                        torch.bfloat16, torch.int8, quantCfg={'y_scale_dtype': torch.float,
                                                              'quant_dtype': torch.int8})
+# one 16-token block of 8 kv heads x 128, 32 KiB in bf16
+for src_device, dst_device in [('cuda', 'cpu'), ('cpu', 'cuda'), ('cpu', 'cpu')]:
+    for shuffled in [False, True]:
+        test_swap_blocks(16384, (8, 128, 16), 10000, src_device, dst_device,
+                         shuffled)
+for pinned in [False, True]:
+    test_swap_async(32, 4096, (8, 128, 16), 1024, pinned)
+test_copy_blocks(80, 1024, 8, (8, 16, 16, 8), (8, 128, 16))
+test_copy_blocks(4, 256, 5, (8, 24, 16, 8), (8, 128, 16))
@@ -642,3 +642,63 @@ test_paged_attention(4097, 128, (8, 1), 128, False, 16,
 # test_paged_attention(4096, 2, (8, 1), 128, False, 16,
 #                      torch.bfloat16, "auto", 0, "cuda:0")
 #  torch.bfloat16, "auto", 0, "cuda:0", w8a16=True)
+
+
+def test_paged_attention_long(
+    ctx_lens: List[int],
+    num_heads: Tuple[int, int],
+    head_size: int,
+    block_size: int,
+    dtype: torch.dtype,
+    seed: int,
+    device: str,
+) -> None:
+    # contexts beyond the 128K single-pass reduce: the ll4mi fold kernel
+    # combines partitions before the reduce
+    torch.set_default_device(device)
+    random.seed(seed)
+    torch.manual_seed(seed)
+    scale = float(1.0 / (head_size**0.5))
+    num_query_heads, num_kv_heads = num_heads
+    num_queries_per_kv = num_query_heads // num_kv_heads
+    num_seqs = len(ctx_lens)
+    max_seq_len = max(ctx_lens)
+    max_num_blocks_per_seq = (max_seq_len + block_size - 1) // block_size
+    num_blocks = max_num_blocks_per_seq * num_seqs
+
+    query = torch.empty(num_seqs, num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+    seq_lens = torch.tensor(ctx_lens, dtype=torch.int)
+    block_tables = torch.stack([torch.randperm(num_blocks)[:max_num_blocks_per_seq]
+                                for _ in range(num_seqs)]).int()
+    key_caches, value_caches = kv_cache_factory(num_blocks, block_size, 1,
+                                                num_kv_heads, head_size,
+                                                "auto", dtype, seed, device)
+    key_cache, value_cache = key_caches[0], value_caches[0]
+    assert ops._use_rocm_custom_paged_attention(query, "auto", block_size,
+                                                num_queries_per_kv, max_seq_len)
+
+    out_ater, time_ater = run_ater(query, key_cache, value_cache, block_tables,
+                                   seq_lens, max_seq_len, "auto", num_kv_heads,
+                                   scale, None, 1.0, 1.0)
+
+    # vectorized reference: the per-token loop of run_native is too slow here
+    out_ref = torch.empty(num_seqs, num_query_heads, head_size)
+    for i, seq_len in enumerate(ctx_lens):
+        pos = torch.arange(seq_len)
+        blocks = block_tables[i].long()[pos // block_size]
+        offs = pos % block_size
+        keys = key_cache[blocks, :, :, offs, :].reshape(
+            seq_len, num_kv_heads, head_size).float()
+        values = value_cache[blocks, :, :, offs].float()
+        keys = keys.repeat_interleave(num_queries_per_kv, dim=1)
+        values = values.repeat_interleave(num_queries_per_kv, dim=1)
+        attn = torch.softmax(
+            scale * torch.einsum("hd,khd->hk", query[i].float(), keys), -1)
+        out_ref[i] = torch.einsum("hk,khd->hd", attn, values)
+    checkAllclose(out_ref, out_ater.float(), atol=2e-2, rtol=2e-2,
+                  msg=f'[long context] ctx: {ctx_lens}, {dtype}: {time_ater}')
+
+
+test_paged_attention_long([200000, 4097, 1], (8, 1), 128, 16, torch.bfloat16,
+                          0, "cuda:0")
@@ -0,0 +1,1191 @@
+import argparse
+import random
+import time
+from types import SimpleNamespace
+from typing import List, Optional
+import torch
+import ater
+from ater import paged_attn as ops
+from ater.test_common import checkAllclose
+
+uniform_range = (-1, 1)
+
+parser = argparse.ArgumentParser(description="CPU paged attention op tests")
+parser.add_argument("--long", action="store_true",
+                    help="also run the 128K+ contexts and the 16K skewed batch")
+args, _ = parser.parse_known_args()
+
+
+def cputest(num_iters=11, num_warmup=2):
+    def decorator(func):
+        def wrapper(*args, **kwargs):
+            for _ in range(num_warmup):
+                data = func(*args, **kwargs)
+            start = time.perf_counter()
+            for _ in range(num_iters):
+                data = func(*args, **kwargs)
+            avg = (time.perf_counter() - start) / num_iters * 1e6
+            return data, avg
+        wrapper.__wrapped__ = func
+        return wrapper
+    return decorator
+
+
+def kv_cache_factory_cpu(num_blocks, block_size, num_kv_heads, head_size,
+                         kv_cache_dtype, dtype):
+    # float master copies in the vLLM paged layout, plus the stored cache
+    if kv_cache_dtype == "auto":
+        x = 16 // torch.tensor([], dtype=dtype).element_size()
+    else:
+        x = 16
+    key = torch.empty(num_blocks, num_kv_heads, head_size // x, block_size, x)
+    value = torch.empty(num_blocks, num_kv_heads, head_size, block_size)
+    key.uniform_(*uniform_range)
+    value.uniform_(*uniform_range)
+    if kv_cache_dtype == "auto":
+        key_cache, value_cache = key.to(dtype), value.to(dtype)
+        return key_cache, value_cache, key_cache.float(), value_cache.float()
+    key_cache = key.to(torch.float8_e4m3fnuz)
+    value_cache = value.to(torch.float8_e4m3fnuz)
+    return (key_cache.view(torch.uint8), value_cache.view(torch.uint8),
+            key_cache.float(), value_cache.float())
+
+
+def to_kv_layout(key_cache, value_cache, kv_layout):
+    # the vLLM layout caches as reshape_and_cache(asm_layout=True) or
+    # reshape_and_cache_flash would have written them
+    num_blocks, num_kv_heads, head_size, block_size = value_cache.shape
+    x = key_cache.shape[-1]
+    if kv_layout == "asm":
+        value_cache = value_cache.view(num_blocks, num_kv_heads, head_size,
+                                       block_size // x, x)
+        return key_cache, value_cache.permute(0, 1, 3, 2, 4).contiguous()
+    if kv_layout == "flash":
+        key_cache = key_cache.permute(0, 3, 1, 2, 4).reshape(
+            num_blocks, block_size, num_kv_heads, head_size)
+        return key_cache, value_cache.permute(0, 3, 1, 2).contiguous()
+    return key_cache, value_cache
+
+
+def paged_batch(ctx_lens, num_heads, head_size, block_size, dtype,
+                kv_cache_dtype=None, kv_layout="vllm", seed=0):
+    # seeded batch of paged sequences: one row of distinct random blocks per
+    # sequence and, given a kv_cache_dtype, a filled cache (in kv_layout)
+    # with its float vLLM-layout reference
+    random.seed(seed)
+    torch.manual_seed(seed)
+    b = SimpleNamespace()
+    b.num_query_heads, b.num_kv_heads = num_heads
+    b.scale = float(1.0 / (head_size**0.5))
+    b.num_seqs = len(ctx_lens)
+    b.max_seq_len = max(ctx_lens)
+    b.max_num_blocks_per_seq = max((b.max_seq_len + block_size - 1) // block_size, 1)
+    b.num_blocks = b.max_num_blocks_per_seq * b.num_seqs
+    b.seq_lens = torch.tensor(ctx_lens, dtype=torch.int)
+    b.block_tables = torch.tensor(
+        [random.sample(range(b.num_blocks), b.max_num_blocks_per_seq)
+         for _ in range(b.num_seqs)], dtype=torch.int)
+    if kv_cache_dtype is not None:
+        key_cache, value_cache, b.key_ref, b.value_ref = kv_cache_factory_cpu(
+            b.num_blocks, block_size, b.num_kv_heads, head_size, kv_cache_dtype,
+            dtype)
+        b.key_cache, b.value_cache = to_kv_layout(key_cache, value_cache, kv_layout)
+    return b
+
+
+def cache_slots(block_table, positions, block_size):
+    # slot_mapping of token positions of one sequence
+    return block_table[positions // block_size].long() * block_size + \
+        positions % block_size
+
+
+def run_native(query, key_cache, value_cache, block_tables, seq_lens,
+               scale, alibi_slopes, k_scale, v_scale, window_size=0,
+               num_sink_tokens=0):
+    num_seqs, num_heads, head_size = query.shape
+    num_kv_heads = value_cache.shape[1]
+    block_size = value_cache.shape[3]
+    gqa = num_heads // num_kv_heads
+    # the value head size may differ from the query / key one
+    output = torch.zeros(num_seqs, num_heads, value_cache.shape[2],
+                         dtype=torch.float)
+    for i in range(num_seqs):
+        seq_len = int(seq_lens[i])
+        if seq_len == 0:
+            continue
+        pos = torch.arange(seq_len)
+        blocks = block_tables[i].long()[pos // block_size]
+        offs = pos % block_size
+        # [seq_len, num_kv_heads, head_size]
+        keys = key_cache[blocks, :, :, offs, :].reshape(
+            seq_len, num_kv_heads, head_size) * k_scale
+        values = value_cache[blocks, :, :, offs] * v_scale
+        keys = keys.repeat_interleave(gqa, dim=1)
+        values = values.repeat_interleave(gqa, dim=1)
+        attn = scale * torch.einsum("hd,khd->hk", query[i].float(), keys)
+        if alibi_slopes is not None:
+            attn += alibi_slopes.view(-1, 1) * (pos - seq_len + 1).float()
+        if window_size > 0:
+            visible = (pos >= seq_len - window_size) | (pos < num_sink_tokens)
+            attn = attn.masked_fill(~visible, float("-inf"))
+        attn = torch.softmax(attn, dim=-1)
+        output[i] = torch.einsum("hk,khd->hd", attn, values)
+    return output.to(query.dtype)
+
+
+@cputest()
+def run_ater(query, key_cache, value_cache, block_tables, seq_lens,
+             max_seq_len, kv_cache_dtype, num_kv_heads, scale, alibi_slopes,
+             k_scale, v_scale, window_size=0, num_sink_tokens=0,
+             k_dequant_scales=None, v_dequant_scales=None,
+             fp8_out_scale=None):
+    return ops.PagedAttention.forward_decode(
+        query,
+        key_cache,
+        value_cache,
+        block_tables,
+        seq_lens,
+        max_seq_len,
+        kv_cache_dtype,
+        num_kv_heads,
+        scale,
+        alibi_slopes,
+        k_scale,
+        v_scale,
+        window_size=window_size,
+        num_sink_tokens=num_sink_tokens,
+        k_dequant_scales=k_dequant_scales,
+        v_dequant_scales=v_dequant_scales,
+        fp8_out_scale=fp8_out_scale,
+    )
+
+
+def test_paged_attention_cpu(
+    ctx_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    use_alibi: bool,
+    block_size: int,
+    dtype: torch.dtype,
+    kv_cache_dtype: str,
+    window_size: int = 0,
+    num_sink_tokens: int = 0,
+    kv_layout: str = "vllm",
+    fp8_out_scale: Optional[float] = None,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype,
+                    kv_cache_dtype, kv_layout, seed)
+    k_scale, v_scale = (1.0, 1.0) if kv_cache_dtype == "auto" else (0.5, 0.7)
+    alibi_slopes = None
+    if use_alibi:
+        alibi_slopes = torch.randn(b.num_query_heads, dtype=torch.float)
+    query = torch.empty(b.num_seqs, b.num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+
+    out_ater, time_ater = run_ater(query, b.key_cache, b.value_cache,
+                                   b.block_tables, b.seq_lens, b.max_seq_len,
+                                   kv_cache_dtype, b.num_kv_heads, b.scale,
+                                   alibi_slopes, k_scale, v_scale,
+                                   window_size, num_sink_tokens,
+                                   fp8_out_scale=None if fp8_out_scale is None
+                                   else torch.tensor([fp8_out_scale]))
+    out_ref = run_native(query, b.key_ref, b.value_ref, b.block_tables,
+                         b.seq_lens, b.scale, alibi_slopes, k_scale, v_scale,
+                         window_size, num_sink_tokens)
+    rtol = 2e-2
+    if fp8_out_scale is not None:
+        # [num_seqs, num_heads * head_size] e4m3fnuz: 3 mantissa bits
+        assert out_ater.dtype == torch.float8_e4m3fnuz
+        out_ater = out_ater.float().view(query.shape) * fp8_out_scale
+        out_ref = out_ref.float()
+        rtol = 7e-2
+    checkAllclose(out_ref, out_ater, atol=2e-2, rtol=rtol,
+                  msg=f'[cpu decode] ctx: {b.max_seq_len}, seqs: {b.num_seqs}, heads: {num_heads}, '
+                      f'{dtype}, kv: {kv_cache_dtype} {kv_layout}, window: {window_size}+{num_sink_tokens}, '
+                      f'fp8 out: {fp8_out_scale}, threads: {torch.get_num_threads()}, {time_ater:.1f} us')
+
+
+for dtype in [torch.float, torch.half, torch.bfloat16]:
+    test_paged_attention_cpu([1, 17, 300, 1000], (8, 1), 128, False, 16,
+                             dtype, "auto")
+test_paged_attention_cpu([513, 0, 255], (16, 2), 128, True, 16,
+                         torch.bfloat16, "auto")
+test_paged_attention_cpu([4097, 700], (8, 8), 64, False, 32,
+                         torch.half, "auto")
+test_paged_attention_cpu([1, 257, 2000], (8, 1), 128, False, 16,
+                         torch.bfloat16, "fp8")
+# head-size specializations of the kernel registry, and the generic kernel
+for head_size, block_size in [(80, 8), (96, 64), (112, 16), (192, 128),
+                              (256, 32), (72, 16)]:
+    test_paged_attention_cpu([1, 300, 1000], (8, 2), head_size, True,
+                             block_size, torch.bfloat16, "auto")
+# caches written by reshape_and_cache(asm_layout=True) and
+# reshape_and_cache_flash, read in place
+for kv_layout in ["asm", "flash"]:
+    test_paged_attention_cpu([1, 300, 1000], (8, 2), 128, True, 16,
+                             torch.bfloat16, "auto", kv_layout=kv_layout)
+    test_paged_attention_cpu([1, 257, 2000], (8, 1), 128, False, 32,
+                             torch.bfloat16, "fp8", kv_layout=kv_layout)
+# fused output quantization: e4m3fnuz out / fp8_out_scale from the reduce
+for kv_cache_dtype in ["auto", "fp8"]:
+    test_paged_attention_cpu([1, 300, 4097], (8, 2), 128, True, 16,
+                             torch.bfloat16, kv_cache_dtype,
+                             fp8_out_scale=0.05)
+
+
+# skewed batch: one long sequence plus many short ones
+ctx_lens = [16384 if args.long else 4096] + [random.randint(1, 300) for _ in range(63)]
+work_list, partition_size = ater.paged_attention_cpu_plan(
+    torch.tensor(ctx_lens, dtype=torch.int), 1, 16, 0)
+num_items = sum((c + partition_size - 1) // partition_size for c in ctx_lens)
+assert work_list.shape == (num_items, 3), f'{work_list.shape=} {num_items=}'
+assert len(set(map(tuple, work_list.tolist()))) == num_items
+test_paged_attention_cpu(ctx_lens, (8, 1), 128, False, 16,
+                         torch.bfloat16, "auto")
+partition_offsets = ater.paged_attention_cpu_workspace(
+    torch.tensor(ctx_lens, dtype=torch.int), partition_size)
+assert int(partition_offsets[-1]) == num_items
+print(f'[cpu decode] ragged workspace rows: {num_items * 8}, '
+      f'dense: {len(ctx_lens) * 8 * ((max(ctx_lens) + partition_size - 1) // partition_size)}')
+
+
+def test_work_list_cpu(ctx_lens: List[int], num_heads: tuple, head_size: int,
+                       block_size: int, dtype: torch.dtype, seed: int = 0) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, "auto",
+                    seed=seed)
+    num_kv_heads, seq_lens = b.num_kv_heads, b.seq_lens
+    query = torch.empty(b.num_seqs, b.num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+    work_list, partition_size = ater.paged_attention_cpu_plan(
+        seq_lens, num_kv_heads, block_size, 0)
+    partition_offsets = ater.paged_attention_cpu_workspace(seq_lens, partition_size)
+    rows = int(partition_offsets[-1]) * b.num_query_heads
+
+    def run(items):
+        out = torch.empty_like(query)
+        exp_sums = torch.empty(rows, dtype=torch.float)
+        max_logits = torch.empty_like(exp_sums)
+        tmp_out = torch.empty(rows, head_size, dtype=dtype)
+        ater.paged_attention_cpu(
+            out, exp_sums, max_logits, tmp_out, query, b.key_cache, b.value_cache,
+            num_kv_heads, b.scale, b.block_tables, seq_lens, block_size,
+            b.max_seq_len, None, "auto", 1.0, 1.0, None, partition_size, items,
+            partition_offsets, 0, 0, None, None, None, None, None)
+        return out
+
+    out_ref = run_native(query, b.key_ref, b.value_ref, b.block_tables, seq_lens,
+                         b.scale, None, 1.0, 1.0)
+    checkAllclose(out_ref, run(work_list), atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu decode] planned work_list, ctx: {ctx_lens}')
+    # stale lists are rejected before anything is written
+    bad_seq = work_list.clone()
+    bad_seq[0, 0] = b.num_seqs
+    bad_partition = work_list.clone()
+    bad_partition[0, 2] = (ctx_lens[int(work_list[0, 0])] + partition_size - 1) // partition_size
+    for items in [bad_seq, bad_partition, work_list[1:]]:
+        try:
+            run(items)
+        except RuntimeError:
+            continue
+        raise AssertionError(f'invalid work_list accepted: {items.tolist()}')
+
+
+test_work_list_cpu([1, 300, 1000, 33], (8, 2), 128, 16, torch.bfloat16)
+
+
+def test_dense_workspace_cpu(ctx_lens: List[int], num_heads: tuple, head_size: int,
+                             block_size: int, dtype: torch.dtype, seed: int = 0) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, "auto",
+                    seed=seed)
+    query = torch.empty(b.num_seqs, b.num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+    partition_size = 256
+
+    # the [num_seqs, num_heads, max_num_partitions] layout of paged_attention
+    def run(max_context_len, max_num_partitions=None, tables=b.block_tables,
+            lens=b.seq_lens):
+        if max_num_partitions is None:
+            max_num_partitions = (max_context_len + partition_size - 1) // partition_size
+        out = torch.empty_like(query)
+        exp_sums = torch.empty(b.num_seqs, b.num_query_heads, max_num_partitions,
+                               dtype=torch.float)
+        max_logits = torch.empty_like(exp_sums)
+        tmp_out = torch.empty(b.num_seqs, b.num_query_heads, max_num_partitions,
+                              head_size, dtype=dtype)
+        ater.paged_attention_cpu(
+            out, exp_sums, max_logits, tmp_out, query, b.key_cache, b.value_cache,
+            b.num_kv_heads, b.scale, tables, lens, block_size, max_context_len,
+            None, "auto", 1.0, 1.0, None, partition_size, None, None,
+            0, 0, None, None, None, None, None)
+        return out
+
+    out_ref = run_native(query, b.key_ref, b.value_ref, b.block_tables,
+                         b.seq_lens, b.scale, None, 1.0, 1.0)
+    checkAllclose(out_ref, run(b.max_seq_len), atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu decode] dense workspace, ctx: {ctx_lens}')
+    # a stale max_context_len, a workspace of the wrong shape or lengths past
+    # the block tables are rejected before anything is read or written
+    too_long = b.seq_lens.clone()
+    too_long[0] = b.max_num_blocks_per_seq * block_size + 1
+    for kwargs in [dict(max_context_len=1),
+                   dict(max_context_len=b.max_seq_len, max_num_partitions=1),
+                   dict(max_context_len=b.max_seq_len, tables=b.block_tables[1:]),
+                   dict(max_context_len=b.max_seq_len, lens=too_long)]:
+        try:
+            run(**kwargs)
+        except RuntimeError:
+            continue
+        raise AssertionError(f'invalid dense workspace accepted: {kwargs.keys()}')
+
+
+test_dense_workspace_cpu([1, 300, 1000, 33], (8, 2), 128, 16, torch.bfloat16)
+
+if args.long:
+    # beyond the 128K single-pass reduce of the ROCm kernel: tree reduce on CPU
+    test_paged_attention_cpu([200000], (8, 1), 128, False, 16,
+                             torch.bfloat16, "auto")
+
+# sliding window + attention sinks: only the sink and window blocks are read
+test_paged_attention_cpu([131072 if args.long else 16384, 5000, 300], (8, 1),
+                         128, False, 16, torch.bfloat16, "auto", 4096, 4)
+test_paged_attention_cpu([2000, 37], (16, 2), 128, True, 16,
+                         torch.half, "auto", 100, 0)
+
+
+def pertoken_quant_kvcache_cpu(key, value, quant_dtype):
+    # the format of reshape_and_cache_with_pertoken_quant: one scale per
+    # (kv head, slot), scales [num_kv_heads, num_blocks * block_size]
+    num_blocks, num_kv_heads, head_size, block_size = value.shape
+    x = key.shape[-1]
+    k = key.permute(0, 1, 3, 2, 4).reshape(num_blocks, num_kv_heads, block_size, head_size)
+    v = value.permute(0, 1, 3, 2)
+    k_quant, k_scale = ater.pertoken_quant(k, torch.float, quant_dtype=quant_dtype)
+    v_quant, v_scale = ater.pertoken_quant(v, torch.float, quant_dtype=quant_dtype)
+    key_ref = (k_quant.float() * k_scale).view(
+        num_blocks, num_kv_heads, block_size, head_size // x, x).permute(0, 1, 3, 2, 4)
+    value_ref = (v_quant.float() * v_scale).permute(0, 1, 3, 2)
+    key_cache = k_quant.view(
+        num_blocks, num_kv_heads, block_size, head_size // x, x).permute(0, 1, 3, 2, 4).contiguous()
+    value_cache = v_quant.permute(0, 1, 3, 2).contiguous()
+    k_scale = k_scale.permute(1, 0, 2, 3).reshape(num_kv_heads, -1).contiguous()
+    v_scale = v_scale.permute(1, 0, 2, 3).reshape(num_kv_heads, -1).contiguous()
+    if quant_dtype != torch.int8:
+        key_cache, value_cache = key_cache.view(torch.uint8), value_cache.view(torch.uint8)
+    return key_cache, value_cache, k_scale, v_scale, key_ref, value_ref
+
+
+def test_pertoken_quant_cpu(
+    ctx_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    dtype: torch.dtype,
+    kv_cache_dtype: str,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, seed=seed)
+    num_kv_heads, num_blocks = b.num_kv_heads, b.num_blocks
+    query = torch.empty(b.num_seqs, b.num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+    # tokens of very different magnitude, as per-token scales are meant for
+    key = torch.randn(num_blocks, num_kv_heads, head_size // 16, block_size, 16) * \
+        torch.rand(num_blocks, num_kv_heads, 1, block_size, 1) * 4
+    value = torch.randn(num_blocks, num_kv_heads, head_size, block_size) * \
+        torch.rand(num_blocks, num_kv_heads, 1, block_size) * 4
+    quant_dtype = torch.int8 if kv_cache_dtype == "int8" else torch.float8_e4m3fnuz
+    key_cache, value_cache, k_dequant_scales, v_dequant_scales, key_ref, value_ref = \
+        pertoken_quant_kvcache_cpu(key, value, quant_dtype)
+
+    out_ater, time_ater = run_ater(query, key_cache, value_cache,
+                                   b.block_tables, b.seq_lens, b.max_seq_len,
+                                   kv_cache_dtype, num_kv_heads, b.scale, None,
+                                   1.0, 1.0, 0, 0, k_dequant_scales,
+                                   v_dequant_scales)
+    out_ref = run_native(query, key_ref, value_ref, b.block_tables, b.seq_lens,
+                         b.scale, None, 1.0, 1.0)
+    checkAllclose(out_ref, out_ater, atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu decode per-token quant] ctx: {b.max_seq_len}, seqs: {b.num_seqs}, '
+                      f'heads: {num_heads}, {dtype}, kv: {kv_cache_dtype}, {time_ater:.1f} us')
+
+
+# int8 / fp8 cache with [num_kv_heads, max_kv_tokens] dequant scales
+for kv_cache_dtype in ["int8", "fp8"]:
+    test_pertoken_quant_cpu([1, 17, 300, 2000], (32, 8), 128, 16,
+                            torch.bfloat16, kv_cache_dtype)
+test_pertoken_quant_cpu([700, 33], (8, 8), 64, 32, torch.half, "int8")
+
+
+def test_cascade_cpu(
+    prefix_len: int,
+    suffix_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    # parallel sampling: every sequence starts with the same prefix blocks
+    ctx_lens = [prefix_len + s for s in suffix_lens]
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, "auto",
+                    seed=seed)
+    query = torch.empty(b.num_seqs, b.num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+    num_prefix_blocks = prefix_len // block_size
+    blocks = random.sample(range(b.num_blocks), b.num_blocks)
+    prefix, blocks = blocks[:num_prefix_blocks], blocks[num_prefix_blocks:]
+    n = b.max_num_blocks_per_seq - num_prefix_blocks
+    block_tables = torch.tensor([prefix + blocks[i * n:(i + 1) * n]
+                                 for i in range(b.num_seqs)], dtype=torch.int)
+
+    out_ater, time_ater = run_ater(query, b.key_cache, b.value_cache,
+                                   block_tables, b.seq_lens, b.max_seq_len,
+                                   "auto", b.num_kv_heads, b.scale, None, 1.0, 1.0)
+    out_ref = run_native(query, b.key_ref, b.value_ref, block_tables, b.seq_lens,
+                         b.scale, None, 1.0, 1.0)
+    checkAllclose(out_ref, out_ater, atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu cascade] prefix: {prefix_len}, samples: {b.num_seqs}, '
+                      f'{dtype}, {time_ater:.1f} us')
+
+
+test_cascade_cpu(4096, [random.randint(1, 200) for _ in range(64)], (32, 8),
+                 128, 16, torch.bfloat16)
+test_cascade_cpu(1000, [0, 5, 300, 17], (8, 1), 128, 16, torch.half)
+
+
+def test_multi_token_cpu(
+    ctx_lens: List[int],
+    q_len: int,
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, "auto",
+                    seed=seed)
+    scale, num_kv_heads, max_seq_len = b.scale, b.num_kv_heads, b.max_seq_len
+    key_cache, value_cache = b.key_cache, b.value_cache
+    block_tables, seq_lens = b.block_tables, b.seq_lens
+    query = torch.empty(b.num_seqs, q_len, b.num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+
+    @cputest()
+    def run_multi_token():
+        out = torch.empty_like(query)
+        ater.paged_attention_multi_token_cpu(
+            out, query, key_cache, value_cache, num_kv_heads, scale,
+            block_tables, seq_lens, block_size, max_seq_len, None, "auto",
+            1.0, 1.0, 0, 0, None, None)
+        return out
+
+    @cputest()
+    def run_single_token():
+        # k one-token decode steps: the cost multi-token verification replaces
+        for j in range(q_len):
+            run_ater.__wrapped__(query[:, j], key_cache, value_cache,
+                                 block_tables, seq_lens - (q_len - 1 - j),
+                                 max_seq_len, "auto", num_kv_heads, scale,
+                                 None, 1.0, 1.0)
+
+    out_ater, time_ater = run_multi_token()
+    _, time_steps = run_single_token()
+    # draft token j sees the first ctx - q_len + j + 1 cached tokens
+    out_ref = torch.stack([
+        run_native(query[:, j].contiguous(), b.key_ref, b.value_ref, block_tables,
+                   seq_lens - (q_len - 1 - j), scale, None, 1.0, 1.0)
+        for j in range(q_len)], dim=1)
+    checkAllclose(out_ref, out_ater, atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu multi-token decode] q_len: {q_len}, ctx: {max_seq_len}, '
+                      f'{dtype}, {time_ater:.1f} us vs {q_len} steps: {time_steps:.1f} us')
+
+
+for q_len in [2, 4, 8]:
+    test_multi_token_cpu([9, 300, 2049], q_len, (32, 8), 128, 16, torch.bfloat16)
+
+
+def test_varlen_cpu(
+    ctx_lens: List[int],
+    query_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    dtype: torch.dtype,
+    kv_layout: str = "vllm",
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, "auto",
+                    kv_layout, seed)
+    cu_seqlens_q = torch.tensor([0] + query_lens, dtype=torch.int).cumsum(0).int()
+    total_q = int(cu_seqlens_q[-1])
+    query = torch.empty(total_q, b.num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+
+    @cputest()
+    def run_varlen():
+        out = torch.empty_like(query)
+        ater.paged_attention_varlen_cpu(
+            out, query, b.key_cache, b.value_cache, b.num_kv_heads, b.scale,
+            b.block_tables, cu_seqlens_q, b.seq_lens, block_size, b.max_seq_len,
+            None, "auto", 1.0, 1.0, 0, 0, None, None)
+        return out
+
+    out_ater, time_ater = run_varlen()
+    # query token j of sequence s sees the first ctx - q_len + j + 1 tokens
+    seq_ids = torch.repeat_interleave(torch.arange(b.num_seqs), torch.tensor(query_lens))
+    token_ids = torch.arange(total_q) - cu_seqlens_q[seq_ids]
+    visible = (b.seq_lens[seq_ids] - torch.tensor(query_lens)[seq_ids] + token_ids + 1).int()
+    out_ref = run_native(query, b.key_ref, b.value_ref, b.block_tables[seq_ids],
+                         visible, b.scale, None, 1.0, 1.0)
+    checkAllclose(out_ref, out_ater, atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu varlen] q_lens: {query_lens}, ctx: {ctx_lens}, '
+                      f'{dtype}, kv: {kv_layout}, {time_ater:.1f} us')
+
+
+# chunked prefill rows next to decode and multi-token decode rows
+test_varlen_cpu([17, 300, 1000, 2049], [1, 300, 4, 256], (32, 8), 128, 16,
+                torch.bfloat16)
+test_varlen_cpu([700, 33], [70, 1], (8, 8), 64, 32, torch.half)
+for kv_layout in ["asm", "flash"]:
+    test_varlen_cpu([17, 300, 1000, 2049], [1, 300, 4, 256], (32, 8), 128, 16,
+                    torch.bfloat16, kv_layout=kv_layout)
+# wide heads: more K chunks per token group than the 16-bit 128 / 256 shapes
+test_varlen_cpu([300, 5, 700], [120, 1, 70], (4, 2), 512, 16, torch.float)
+
+
+def test_merge_attn_states_cpu(
+    num_tokens: int,
+    num_heads: int,
+    head_size: int,
+    kv_splits: List[int],
+    dtype: torch.dtype,
+    use_lse: bool,
+    seed: int = 0,
+) -> None:
+    # attention over KV split into chunks, merged back by the op
+    torch.manual_seed(seed)
+    q = torch.randn(num_tokens, num_heads, head_size)
+    k = torch.randn(sum(kv_splits), num_heads, head_size)
+    v = torch.randn(sum(kv_splits), num_heads, head_size)
+    logits = torch.einsum("thd,khd->thk", q, k) / head_size**0.5
+    out_ref = torch.einsum("thk,khd->thd", torch.softmax(logits, -1), v).to(dtype)
+
+    partial_out, max_logits, exp_sums = [], [], []
+    for lg, vs in zip(logits.split(kv_splits, -1), v.split(kv_splits, 0)):
+        m = lg.amax(-1)
+        p = torch.exp(lg - m.unsqueeze(-1))
+        s = p.sum(-1)
+        partial_out.append((torch.einsum("thk,khd->thd", p, vs) / s.unsqueeze(-1)).to(dtype))
+        max_logits.append(m + torch.log(s) if use_lse else m)
+        exp_sums.append(s)
+    partial_out = torch.stack(partial_out)
+    max_logits = torch.stack(max_logits)
+    exp_sums = None if use_lse else torch.stack(exp_sums)
+
+    @cputest()
+    def run_merge():
+        out = torch.empty(num_tokens, num_heads, head_size, dtype=dtype)
+        out_lse = torch.empty(num_tokens, num_heads)
+        ater.merge_attn_states_cpu(out, out_lse, partial_out, max_logits, exp_sums)
+        return out, out_lse
+
+    (out_ater, lse_ater), time_ater = run_merge()
+    checkAllclose(out_ref, out_ater, atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu merge_attn_states] partials: {len(kv_splits)}, '
+                      f'{dtype}, lse: {use_lse}, {time_ater:.1f} us')
+    checkAllclose(torch.logsumexp(logits, -1), lse_ater, atol=1e-3, rtol=1e-3,
+                  msg='[cpu merge_attn_states] lse')
+
+
+for dtype in [torch.float, torch.half, torch.bfloat16]:
+    for use_lse in [False, True]:
+        test_merge_attn_states_cpu(64, 16, 128, [300, 17, 1000], dtype, use_lse)
+test_merge_attn_states_cpu(7, 8, 80, [5, 4096], torch.bfloat16, True)
+
+
+def test_mla_decode_cpu(
+    ctx_lens: List[int],
+    num_heads: int,
+    kv_lora_rank: int,
+    qk_nope_head_dim: int,
+    rope_dim: int,
+    v_head_dim: int,
+    block_size: int,
+    kv_cache_dtype: str,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    # one latent vector per token, shared by every head
+    b = paged_batch(ctx_lens, (num_heads, 1), qk_nope_head_dim + rope_dim,
+                    block_size, dtype, seed=seed)
+    num_seqs, num_blocks = b.num_seqs, b.num_blocks
+    block_tables, seq_lens, scale = b.block_tables, b.seq_lens, b.scale
+    k_scale = 0.05 if kv_cache_dtype == "fp8" else 1.0
+    num_tokens = num_blocks * block_size
+    cache_dtype = dtype if kv_cache_dtype == "auto" else torch.uint8
+    kv_cache = torch.zeros(num_blocks, block_size, kv_lora_rank + rope_dim,
+                           dtype=cache_dtype)
+
+    # every slot written once by the op, in shuffled order
+    kv_c = torch.randn(num_tokens, kv_lora_rank, dtype=dtype) * 0.5
+    k_pe = torch.randn(num_tokens, rope_dim, dtype=dtype)
+    slot_mapping = torch.randperm(num_tokens)
+    ops.PagedAttention.write_to_paged_cache_mla(kv_c, k_pe, kv_cache, slot_mapping,
+                                                kv_cache_dtype, k_scale)
+    latent = kv_cache.view(-1, kv_lora_rank + rope_dim)[slot_mapping]
+    if kv_cache_dtype == "fp8":
+        latent = latent.view(torch.float8_e4m3fnuz).float() * k_scale
+    checkAllclose(torch.cat([kv_c, k_pe], -1).float(), latent.float(),
+                  atol=k_scale * 8, rtol=7e-2, msg='[cpu concat_and_cache_mla]')
+
+    q_nope = torch.randn(num_seqs, num_heads, qk_nope_head_dim, dtype=dtype)
+    q_pe = torch.randn(num_seqs, num_heads, rope_dim, dtype=dtype)
+    w_uk = torch.randn(num_heads, qk_nope_head_dim, kv_lora_rank,
+                       dtype=dtype) / kv_lora_rank**0.5
+    w_uv = torch.randn(num_heads, kv_lora_rank, v_head_dim,
+                       dtype=dtype) / kv_lora_rank**0.5
+
+    @cputest()
+    def run_mla():
+        return ops.PagedAttention.forward_decode_mla(
+            q_nope, q_pe, kv_cache, block_tables, seq_lens, kv_cache_dtype,
+            scale, k_scale, w_uk, w_uv)
+
+    out_ater, time_ater = run_mla()
+
+    # reference without absorption: per-head keys and values decompressed
+    # from the cached latent vectors
+    cache_ref = kv_cache.view(torch.float8_e4m3fnuz).float() * k_scale \
+        if kv_cache_dtype == "fp8" else kv_cache.float()
+    out_ref = torch.empty(num_seqs, num_heads, v_head_dim)
+    for i in range(num_seqs):
+        slots = torch.arange(ctx_lens[i])
+        entries = cache_ref[block_tables[i, slots // block_size], slots % block_size]
+        c, pe = entries[:, :kv_lora_rank], entries[:, kv_lora_rank:]
+        k_nope = torch.einsum("tc,hdc->thd", c, w_uk.float())
+        v = torch.einsum("tc,hcv->thv", c, w_uv.float())
+        logits = (torch.einsum("hd,thd->ht", q_nope[i].float(), k_nope) +
+                  q_pe[i].float() @ pe.T) * scale
+        out_ref[i] = torch.einsum("ht,thv->hv", torch.softmax(logits, -1), v)
+    checkAllclose(out_ref, out_ater.float(), atol=3e-2, rtol=3e-2,
+                  msg=f'[cpu mla decode] ctx: {ctx_lens}, {kv_cache_dtype}, '
+                      f'{dtype}, {time_ater:.1f} us')
+
+
+for kv_cache_dtype in ["auto", "fp8"]:
+    test_mla_decode_cpu([1, 17, 300, 2049], 16, 512, 128, 64, 128, 64,
+                        kv_cache_dtype, torch.bfloat16)
+test_mla_decode_cpu([700, 33], 5, 40, 16, 8, 16, 16, "auto", torch.float)
+
+
+def test_block_sparse_cpu(
+    ctx_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    top_blocks: int,
+    kv_cache_dtype: str,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, seed=seed)
+    scale, num_seqs, num_blocks = b.scale, b.num_seqs, b.num_blocks
+    num_query_heads, num_kv_heads = num_heads
+    gqa = num_query_heads // num_kv_heads
+    block_tables, seq_lens = b.block_tables, b.seq_lens
+    k_scale = v_scale = 0.05 if kv_cache_dtype == "fp8" else 1.0
+
+    # every context written by the host writer, which keeps the summaries
+    cache_dtype = dtype if kv_cache_dtype == "auto" else torch.uint8
+    x = 16 // torch.tensor([], dtype=cache_dtype).element_size()
+    key_cache = torch.zeros(num_blocks, num_kv_heads, head_size // x, block_size, x,
+                            dtype=cache_dtype)
+    value_cache = torch.zeros(num_blocks, num_kv_heads, head_size, block_size,
+                              dtype=cache_dtype)
+    key_summaries = torch.empty(ops.PagedAttention.get_key_summaries_shape(
+        num_blocks, num_kv_heads, head_size))
+    keys, values = [], []
+    for i, ctx in enumerate(ctx_lens):
+        # a few blocks of keys aligned with a shared direction stand out
+        key = torch.randn(ctx, num_kv_heads, head_size) * 0.5
+        key[(torch.arange(ctx) // block_size) % 11 == 3] += 1.0
+        keys.append(key.to(dtype))
+        values.append(torch.randn(ctx, num_kv_heads, head_size, dtype=dtype))
+        slots = cache_slots(block_tables[i], torch.arange(ctx), block_size)
+        ops.PagedAttention.write_to_paged_cache(
+            keys[-1], values[-1], key_cache, value_cache, slots,
+            kv_cache_dtype, k_scale, v_scale, key_summaries=key_summaries)
+    query = torch.randn(num_seqs, num_query_heads, head_size, dtype=dtype) + 1.0
+
+    @cputest()
+    def run_sparse():
+        return ops.PagedAttention.forward_decode(
+            query, key_cache, value_cache, block_tables, seq_lens, max(ctx_lens),
+            kv_cache_dtype, num_kv_heads, scale, None, k_scale, v_scale,
+            key_summaries=key_summaries, top_blocks=top_blocks)
+
+    out_ater, time_ater = run_sparse()
+
+    # reference: the same selection from the keys, attention in float over
+    # the dequantized cache contents
+    out_ref = torch.empty(num_seqs, num_query_heads, head_size)
+    for i, ctx in enumerate(ctx_lens):
+        n_blocks = (ctx + block_size - 1) // block_size
+        key = keys[i].float()
+        if kv_cache_dtype == "fp8":
+            k_cached = (key / k_scale).to(torch.float8_e4m3fnuz).float() * k_scale
+            v_cached = (values[i].float() / v_scale).to(torch.float8_e4m3fnuz).float() * v_scale
+        else:
+            k_cached, v_cached = key, values[i].float()
+        pad = n_blocks * block_size - ctx
+        padded = torch.nn.functional.pad(key, (0, 0, 0, 0, 0, pad))
+        blocks = padded.view(n_blocks, block_size, num_kv_heads, head_size)
+        valid = (torch.arange(n_blocks * block_size) < ctx).view(n_blocks, block_size, 1, 1)
+        kmin = blocks.masked_fill(~valid, float("inf")).amin(1)
+        kmax = blocks.masked_fill(~valid, float("-inf")).amax(1)
+        summaries = key_summaries[block_tables[i, :n_blocks].long()]
+        checkAllclose(torch.stack([kmin, kmax], 2), summaries, atol=0, rtol=0,
+                      msg='[cpu block sparse] key summaries')
+        for h in range(num_kv_heads):
+            q = query[i, h * gqa:(h + 1) * gqa].float()
+            if n_blocks <= top_blocks + 1:
+                chosen = torch.arange(n_blocks)
+            else:
+                qq = q.unsqueeze(1)
+                score = torch.maximum(qq * kmin[:-1, h], qq * kmax[:-1, h]).sum((0, 2))
+                chosen = torch.cat([score.topk(top_blocks).indices.sort().values,
+                                    torch.tensor([n_blocks - 1])])
+            tokens = (chosen.unsqueeze(1) * block_size + torch.arange(block_size)).flatten()
+            tokens = tokens[tokens < ctx]
+            logits = q @ k_cached[tokens, h].T * scale
+            out_ref[i, h * gqa:(h + 1) * gqa] = torch.softmax(logits, -1) @ v_cached[tokens, h]
+    checkAllclose(out_ref, out_ater.float(), atol=3e-2, rtol=3e-2,
+                  msg=f'[cpu block sparse] ctx: {ctx_lens}, top {top_blocks}, '
+                      f'{kv_cache_dtype}, {dtype}, {time_ater:.1f} us')
+
+
+for kv_cache_dtype in ["auto", "fp8"]:
+    test_block_sparse_cpu([1, 100, 3000, 32768], (32, 8), 128, 16, 64,
+                          kv_cache_dtype, torch.bfloat16)
+test_block_sparse_cpu([700, 33], (4, 4), 64, 32, 4, "auto", torch.float)
+
+
+def test_h2o_cpu(
+    ctx_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    heavy_blocks: int,
+    recent_tokens: int,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, seed=seed)
+    scale, num_seqs, num_blocks = b.scale, b.num_seqs, b.num_blocks
+    num_query_heads, num_kv_heads = num_heads
+    gqa = num_query_heads // num_kv_heads
+    block_tables, seq_lens = b.block_tables, b.seq_lens
+    x = 16 // torch.tensor([], dtype=dtype).element_size()
+    key_cache = torch.zeros(num_blocks, num_kv_heads, head_size // x, block_size, x,
+                            dtype=dtype)
+    value_cache = torch.zeros(num_blocks, num_kv_heads, head_size, block_size, dtype=dtype)
+    keys, values = [], []
+    for i, ctx in enumerate(ctx_lens):
+        keys.append(torch.randn(ctx, num_kv_heads, head_size, dtype=dtype))
+        values.append(torch.randn(ctx, num_kv_heads, head_size, dtype=dtype))
+        slots = cache_slots(block_tables[i], torch.arange(ctx), block_size)
+        ops.PagedAttention.write_to_paged_cache(
+            keys[-1], values[-1], key_cache, value_cache, slots, "auto", 1.0, 1.0)
+    attn_mass = torch.zeros(ops.PagedAttention.get_attn_mass_shape(
+        num_seqs, num_kv_heads, b.max_num_blocks_per_seq, block_size))
+
+    def decode(query):
+        return ops.PagedAttention.forward_decode(
+            query, key_cache, value_cache, block_tables, seq_lens, int(seq_lens.max()),
+            "auto", num_kv_heads, scale, None, 1.0, 1.0, attn_mass=attn_mass)
+
+    # the mass after a few decode steps is the summed softmax of every step
+    mass_ref = torch.zeros_like(attn_mass)
+    for _ in range(3):
+        query = torch.randn(num_seqs, num_query_heads, head_size, dtype=dtype)
+        decode(query)
+        for i, ctx in enumerate(ctx_lens):
+            for h in range(num_kv_heads):
+                q = query[i, h * gqa:(h + 1) * gqa].float()
+                p = torch.softmax(q @ keys[i][:, h].float().T * scale, -1).sum(0)
+                mass_ref[i, h].view(-1)[:ctx] += p
+    checkAllclose(mass_ref, attn_mass, atol=1e-4, rtol=1e-3,
+                  msg=f'[cpu h2o] attention mass, ctx: {ctx_lens}')
+
+    old_tables = block_tables.clone()
+    mass_before = attn_mass.clone()
+    freed = ops.PagedAttention.compact_h2o(key_cache, value_cache, attn_mass, block_tables,
+                                           seq_lens, heavy_blocks, recent_tokens)
+
+    # afterwards decode attends, per kv head, to the heavy hitters of the
+    # compacted prefix followed by the untouched tail
+    freed_ref = []
+    kept = []
+    for i, ctx in enumerate(ctx_lens):
+        n_cmp = max(0, ctx - recent_tokens) // block_size
+        if n_cmp <= heavy_blocks:
+            assert int(seq_lens[i]) == ctx
+            kept.append([torch.arange(ctx)] * num_kv_heads)
+            continue
+        freed_ref += old_tables[i, heavy_blocks:n_cmp].tolist()
+        prefix = n_cmp * block_size
+        heads = []
+        for h in range(num_kv_heads):
+            top = mass_before[i, h].view(-1)[:prefix].topk(heavy_blocks * block_size).indices
+            heads.append(torch.cat([top.sort().values, torch.arange(prefix, ctx)]))
+        kept.append(heads)
+        assert int(seq_lens[i]) == ctx - (n_cmp - heavy_blocks) * block_size
+    assert sorted(freed.tolist()) == sorted(freed_ref), "[cpu h2o] freed blocks"
+
+    query = torch.randn(num_seqs, num_query_heads, head_size, dtype=dtype)
+    out_ater = decode(query)
+    out_ref = torch.empty(num_seqs, num_query_heads, head_size)
+    for i in range(num_seqs):
+        for h in range(num_kv_heads):
+            tokens = kept[i][h]
+            q = query[i, h * gqa:(h + 1) * gqa].float()
+            logits = q @ keys[i][tokens, h].float().T * scale
+            out_ref[i, h * gqa:(h + 1) * gqa] = \
+                torch.softmax(logits, -1) @ values[i][tokens, h].float()
+    checkAllclose(out_ref, out_ater.float(), atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu h2o] decode after compaction, ctx: {ctx_lens}, '
+                      f'heavy {heavy_blocks}, recent {recent_tokens}, {dtype}')
+
+
+test_h2o_cpu([1, 100, 1000, 4000], (16, 4), 128, 16, 8, 256, torch.bfloat16)
+test_h2o_cpu([700, 33], (4, 4), 64, 32, 2, 64, torch.float)
+
+
+def test_head_scales_cpu(
+    ctx_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, seed=seed)
+    scale, num_seqs, num_blocks = b.scale, b.num_seqs, b.num_blocks
+    num_query_heads, num_kv_heads = num_heads
+    gqa = num_query_heads // num_kv_heads
+    block_tables, seq_lens = b.block_tables, b.seq_lens
+    # kv heads an order of magnitude apart, each quantized with its own scale
+    magnitude = 4.0 ** torch.arange(num_kv_heads).view(1, -1, 1)
+    keys = [(torch.randn(ctx, num_kv_heads, head_size) * magnitude).to(dtype)
+            for ctx in ctx_lens]
+    values = [(torch.randn(ctx, num_kv_heads, head_size) * magnitude).to(dtype)
+              for ctx in ctx_lens]
+    k_head_scales = torch.cat(keys).float().abs().amax((0, 2)) / 224
+    v_head_scales = torch.cat(values).float().abs().amax((0, 2)) / 224
+
+    x = 16
+    key_cache = torch.zeros(num_blocks, num_kv_heads, head_size // x, block_size, x,
+                            dtype=torch.uint8)
+    value_cache = torch.zeros(num_blocks, num_kv_heads, head_size, block_size,
+                              dtype=torch.uint8)
+    for i, ctx in enumerate(ctx_lens):
+        slots = cache_slots(block_tables[i], torch.arange(ctx), block_size)
+        ops.PagedAttention.write_to_paged_cache(
+            keys[i], values[i], key_cache, value_cache, slots, "fp8", 1.0, 1.0,
+            k_head_scales=k_head_scales, v_head_scales=v_head_scales)
+    query = torch.randn(num_seqs, num_query_heads, head_size, dtype=dtype)
+
+    @cputest()
+    def run_head_scales():
+        return ops.PagedAttention.forward_decode(
+            query, key_cache, value_cache, block_tables, seq_lens, max(ctx_lens),
+            "fp8", num_kv_heads, scale, None, 1.0, 1.0,
+            k_head_scales=k_head_scales, v_head_scales=v_head_scales)
+
+    out_ater, time_ater = run_head_scales()
+
+    ks, vs = k_head_scales.view(-1, 1), v_head_scales.view(-1, 1)
+    out_ref = torch.empty(num_seqs, num_query_heads, head_size)
+    for i in range(num_seqs):
+        k_cached = (keys[i].float() / ks).to(torch.float8_e4m3fnuz).float() * ks
+        v_cached = (values[i].float() / vs).to(torch.float8_e4m3fnuz).float() * vs
+        for h in range(num_kv_heads):
+            q = query[i, h * gqa:(h + 1) * gqa].float()
+            p = torch.softmax(q @ k_cached[:, h].T * scale, -1)
+            out_ref[i, h * gqa:(h + 1) * gqa] = p @ v_cached[:, h]
+    checkAllclose(out_ref / magnitude.view(-1, 1).repeat_interleave(gqa, 0),
+                  out_ater.float() / magnitude.view(-1, 1).repeat_interleave(gqa, 0),
+                  atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu head scales] ctx: {ctx_lens}, heads: {num_heads}, '
+                      f'{dtype}, {time_ater:.1f} us')
+
+
+test_head_scales_cpu([1, 300, 2049], (16, 4), 128, 16, torch.bfloat16)
+test_head_scales_cpu([700, 33], (4, 4), 64, 32, torch.half)
+
+
+def test_head_size_v_cpu(
+    ctx_lens: List[int],
+    query_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    head_size_v: int,
+    block_size: int,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype, seed=seed)
+    scale, num_seqs, num_blocks = b.scale, b.num_seqs, b.num_blocks
+    num_query_heads, num_kv_heads = num_heads
+    block_tables, seq_lens, max_seq_len = b.block_tables, b.seq_lens, b.max_seq_len
+
+    # values written at their own head size, in the vLLM and flash layouts
+    x = 16 // torch.tensor([], dtype=dtype).element_size()
+    caches = {
+        "vllm": (torch.zeros(num_blocks, num_kv_heads, head_size // x, block_size, x,
+                             dtype=dtype),
+                 torch.zeros(num_blocks, num_kv_heads, head_size_v, block_size,
+                             dtype=dtype)),
+        "flash": (torch.zeros(num_blocks, block_size, num_kv_heads, head_size,
+                              dtype=dtype),
+                  torch.zeros(num_blocks, block_size, num_kv_heads, head_size_v,
+                              dtype=dtype)),
+    }
+    for i, ctx in enumerate(ctx_lens):
+        slots = cache_slots(block_tables[i], torch.arange(ctx), block_size)
+        key = torch.empty(ctx, num_kv_heads, head_size, dtype=dtype).uniform_(*uniform_range)
+        value = torch.empty(ctx, num_kv_heads, head_size_v,
+                            dtype=dtype).uniform_(*uniform_range)
+        for key_cache, value_cache in caches.values():
+            ops.PagedAttention.write_to_paged_cache(
+                key, value, key_cache, value_cache, slots, "auto", 1.0, 1.0)
+    key_ref, value_ref = (c.float() for c in caches["vllm"])
+
+    query = torch.empty(num_seqs, num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+    out_ref = run_native(query, key_ref, value_ref, block_tables, seq_lens,
+                         scale, None, 1.0, 1.0)
+    for kv_layout, (key_cache, value_cache) in caches.items():
+        out_ater, time_ater = run_ater(query, key_cache, value_cache, block_tables,
+                                       seq_lens, max_seq_len, "auto", num_kv_heads,
+                                       scale, None, 1.0, 1.0)
+        checkAllclose(out_ref, out_ater, atol=2e-2, rtol=2e-2,
+                      msg=f'[cpu head_size_v] {head_size}/{head_size_v} {kv_layout}, '
+                          f'ctx: {ctx_lens}, {dtype}, {time_ater:.1f} us')
+
+    # prefill rows through the varlen entry point
+    cu_seqlens_q = torch.tensor([0] + query_lens, dtype=torch.int).cumsum(0).int()
+    total_q = int(cu_seqlens_q[-1])
+    query = torch.empty(total_q, num_query_heads, head_size, dtype=dtype)
+    query.uniform_(*uniform_range)
+    key_cache, value_cache = caches["vllm"]
+
+    @cputest()
+    def run_varlen():
+        out = torch.empty(total_q, num_query_heads, head_size_v, dtype=dtype)
+        ater.paged_attention_varlen_cpu(
+            out, query, key_cache, value_cache, num_kv_heads, scale,
+            block_tables, cu_seqlens_q, seq_lens, block_size, max_seq_len,
+            None, "auto", 1.0, 1.0, 0, 0, None, None)
+        return out
+
+    out_ater, time_ater = run_varlen()
+    seq_ids = torch.repeat_interleave(torch.arange(num_seqs), torch.tensor(query_lens))
+    token_ids = torch.arange(total_q) - cu_seqlens_q[seq_ids]
+    visible = (seq_lens[seq_ids] - torch.tensor(query_lens)[seq_ids] + token_ids + 1).int()
+    out_ref = run_native(query, key_ref, value_ref, block_tables[seq_ids],
+                         visible, scale, None, 1.0, 1.0)
+    checkAllclose(out_ref, out_ater, atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu head_size_v varlen] {head_size}/{head_size_v}, '
+                      f'q_lens: {query_lens}, ctx: {ctx_lens}, {dtype}, '
+                      f'{time_ater:.1f} us')
+
+
+# DeepSeek-style 192 / 128 (specialized) and a generic pair
+test_head_size_v_cpu([1, 300, 2049], [1, 300, 64], (16, 4), 192, 128, 16,
+                     torch.bfloat16)
+test_head_size_v_cpu([700, 33], [70, 1], (8, 8), 64, 96, 32, torch.half)
+
+
+def test_varlen_attention_cpu(
+    seq_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    head_size_v: int,
+    causal: bool,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    # packed encoder batch, no KV cache
+    torch.manual_seed(seed)
+    scale = float(1.0 / (head_size**0.5))
+    num_query_heads, num_kv_heads = num_heads
+    gqa = num_query_heads // num_kv_heads
+    cu_seqlens = torch.tensor([0] + seq_lens, dtype=torch.int).cumsum(0).int()
+    total = int(cu_seqlens[-1])
+    query = torch.randn(total, num_query_heads, head_size).to(dtype)
+    key = torch.randn(total, num_kv_heads, head_size).to(dtype)
+    value = torch.randn(total, num_kv_heads, head_size_v).to(dtype)
+
+    @cputest()
+    def run_varlen_attention():
+        out = torch.empty(total, num_query_heads, head_size_v, dtype=dtype)
+        ater.varlen_attention_cpu(out, query, key, value, cu_seqlens, scale, causal)
+        return out
+
+    out_ater, time_ater = run_varlen_attention()
+
+    out_ref = torch.empty(total, num_query_heads, head_size_v)
+    for i, n in enumerate(seq_lens):
+        rows = slice(int(cu_seqlens[i]), int(cu_seqlens[i + 1]))
+        k = key[rows].float().repeat_interleave(gqa, 1)
+        v = value[rows].float().repeat_interleave(gqa, 1)
+        logits = torch.einsum("qhd,khd->hqk", query[rows].float(), k) * scale
+        if causal:
+            logits.masked_fill_(torch.ones(n, n, dtype=torch.bool).triu(1), float("-inf"))
+        out_ref[rows] = torch.einsum("hqk,khd->qhd", torch.softmax(logits, -1), v)
+    checkAllclose(out_ref, out_ater.float(), atol=2e-2, rtol=2e-2,
+                  msg=f'[cpu varlen attention] lens: {seq_lens}, heads: {num_heads}, '
+                      f'{head_size}/{head_size_v}, causal: {causal}, {dtype}, '
+                      f'{time_ater:.1f} us')
+
+
+# embedding / reranker batches: bidirectional, plus the causal variant
+for causal in [False, True]:
+    test_varlen_attention_cpu([1, 17, 300, 512, 129], (16, 16), 64, 64, causal,
+                              torch.bfloat16)
+    test_varlen_attention_cpu([700, 33], (8, 2), 128, 128, causal, torch.half)
+test_varlen_attention_cpu([0, 250, 77], (6, 3), 80, 96, False, torch.float)
+
+
+def test_decode_append_cpu(
+    ctx_lens: List[int],
+    num_heads: tuple,
+    head_size: int,
+    block_size: int,
+    kv_cache_dtype: str,
+    kv_layout: str,
+    use_alibi: bool,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    b = paged_batch(ctx_lens, num_heads, head_size, block_size, dtype,
+                    kv_cache_dtype, kv_layout, seed)
+    scale, num_seqs, num_blocks = b.scale, b.num_seqs, b.num_blocks
+    num_query_heads, num_kv_heads = num_heads
+    block_tables, seq_lens = b.block_tables, b.seq_lens
+    key_cache, value_cache = b.key_cache, b.value_cache
+    alibi_slopes = torch.randn(num_query_heads) if use_alibi else None
+    k_scale, v_scale = (0.5, 1.5) if kv_cache_dtype == "fp8" else (1.0, 1.0)
+
+    # the step's new token sits at position ctx - 1; the last sequence
+    # appends nothing (padding slot) and attends over its cache as is
+    query = torch.randn(num_seqs, num_query_heads, head_size, dtype=dtype)
+    key = torch.randn(num_seqs, num_kv_heads, head_size, dtype=dtype)
+    value = torch.randn(num_seqs, num_kv_heads, head_size, dtype=dtype)
+    pos = torch.tensor(ctx_lens) - 1
+    slot_mapping = (block_tables[torch.arange(num_seqs), pos // block_size].long()
+                    * block_size + pos % block_size)
+    slot_mapping[-1] = -1
+
+    key_cache_ref, value_cache_ref = key_cache.clone(), value_cache.clone()
+
+    @cputest()
+    def run_two_ops():
+        ops.PagedAttention.write_to_paged_cache(
+            key, value, key_cache_ref, value_cache_ref, slot_mapping,
+            kv_cache_dtype, k_scale, v_scale)
+        return ops.PagedAttention.forward_decode(
+            query, key_cache_ref, value_cache_ref, block_tables, seq_lens,
+            max(ctx_lens), kv_cache_dtype, num_kv_heads, scale, alibi_slopes,
+            k_scale, v_scale)
+
+    @cputest()
+    def run_fused():
+        return ops.PagedAttention.forward_decode_append(
+            query, key, value, key_cache, value_cache, slot_mapping,
+            block_tables, seq_lens, max(ctx_lens), kv_cache_dtype,
+            num_kv_heads, scale, alibi_slopes, k_scale, v_scale)
+
+    out_ref, time_ref = run_two_ops()
+    out_ater, time_ater = run_fused()
+    assert torch.equal(key_cache, key_cache_ref) and \
+        torch.equal(value_cache, value_cache_ref), "fused append cache mismatch"
+    checkAllclose(out_ref.float(), out_ater.float(), atol=1e-2, rtol=1e-2,
+                  msg=f'[cpu decode append] ctx: {ctx_lens}, heads: {num_heads}, '
+                      f'{kv_cache_dtype}, {kv_layout}, alibi: {use_alibi}, '
+                      f'{dtype}, {time_ater:.1f} us vs two ops {time_ref:.1f} us')
+
+    # a slot that is not position ctx - 1 of its block table, or lies outside
+    # the cache, must be rejected before anything is written
+    wrong_slot, past_cache = slot_mapping.clone(), slot_mapping.clone()
+    wrong_slot[0] = slot_mapping[0] ^ 1
+    past_cache[0] = num_blocks * block_size
+    for slots in [wrong_slot, past_cache]:
+        try:
+            ops.PagedAttention.forward_decode_append(
+                query, key, value, key_cache, value_cache, slots,
+                block_tables, seq_lens, max(ctx_lens), kv_cache_dtype,
+                num_kv_heads, scale, alibi_slopes, k_scale, v_scale)
+        except RuntimeError:
+            continue
+        raise AssertionError(f'invalid slot_mapping accepted: {slots.tolist()}')
+
+
+for kv_layout in ["vllm", "asm", "flash"]:
+    test_decode_append_cpu([1, 17, 257, 2049, 300], (32, 8), 128, 16, "auto",
+                           kv_layout, False, torch.bfloat16)
+test_decode_append_cpu([1, 256, 3000, 65], (16, 4), 128, 16, "fp8", "vllm",
+                       True, torch.bfloat16)
+test_decode_append_cpu([700, 33, 129], (8, 8), 64, 32, "auto", "flash", True,
+                       torch.float)
+
+
+def test_copy_blocks_cpu(
+    num_layers: int,
+    num_blocks: int,
+    num_pairs: int,
+    num_kv_heads: int,
+    head_size: int,
+    head_size_v: int,
+    block_size: int,
+    dtype: torch.dtype,
+    seed: int = 0,
+) -> None:
+    # beam-search fork: shared blocks copied to fresh ones across all layers
+    random.seed(seed)
+    torch.manual_seed(seed)
+    x = 16 // torch.tensor([], dtype=dtype).element_size()
+    key_caches = [torch.randn(num_blocks, num_kv_heads, head_size // x,
+                              block_size, x, dtype=dtype)
+                  for _ in range(num_layers)]
+    value_caches = [torch.randn(num_blocks, num_kv_heads, head_size_v,
+                                block_size, dtype=dtype)
+                    for _ in range(num_layers)]
+    blocks = random.sample(range(num_blocks), 2 * num_pairs)
+    block_mapping = torch.tensor(blocks, dtype=torch.long).view(num_pairs, 2)
+    src, dst = block_mapping[:, 0], block_mapping[:, 1]
+    key_ref = [k.clone() for k in key_caches]
+    value_ref = [v.clone() for v in value_caches]
+    for k, v in zip(key_ref, value_ref):
+        k[dst] = k[src]
+        v[dst] = v[src]
+
+    @cputest()
+    def run_copy():
+        ops.PagedAttention.copy_blocks(list(zip(key_caches, value_caches)),
+                                       block_mapping)
+
+    _, us = run_copy()
+    for i in range(num_layers):
+        assert torch.equal(key_caches[i], key_ref[i]) and \
+            torch.equal(value_caches[i], value_ref[i]), f"layer {i} mismatch"
+    nbytes = num_layers * num_pairs * (key_caches[0][0].numel() +
+                                       value_caches[0][0].numel()) * \
+        key_caches[0].element_size()
+    print(f'[cpu copy_blocks] {num_layers=} {num_pairs=} {dtype}: '
+          f'{us:.1f} us, {nbytes / us / 1e3:.2f} GB/s')
+
+
+test_copy_blocks_cpu(80, 256, 16, 8, 128, 128, 16, torch.bfloat16)
+test_copy_blocks_cpu(4, 64, 7, 4, 192, 128, 32, torch.float)